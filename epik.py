@@ -29,8 +29,9 @@ def epik():
 @epik.command()
 @click.option('-i', '--database',
               required=True,
+              multiple=True,
               type=click.Path(dir_okay=False, file_okay=True, exists=True),
-              help="Input database.")
+              help="Input database. Repeat to place against several databases in one run.")
 @click.option('-s', '--states',
               type=click.Choice(['nucl', 'amino']),
               default='nucl', show_default=True,
@@ -56,8 +57,93 @@ def epik():
              type=str,
              default="", show_default=True,
              help="Approximate RAM limit to use. Database may not be fully loaded")
+@click.option('--engine',
+             type=click.Choice(['per-read', 'join']),
+             default='per-read', show_default=True,
+             help="K-mer search engine. join searches every distinct k-mer of a batch once, "
+                  "which is faster on similar reads (e.g. amplicons).")
+@click.option('--filter-bits',
+             type=int,
+             default=0, show_default=True,
+             help="Bits per key of a filter of the database keys to skip searching absent k-mers (0: no filter).")
+@click.option('--dense-tier',
+             type=float,
+             default=0.0, show_default=True,
+             help="Store the phylo-k-mers scoring at least this fraction of the branches as dense rows "
+                  "of scores (0: no dense tier). Takes more memory.")
+@click.option('--clade-size',
+             type=int,
+             default=0, show_default=True,
+             help="Split the tree into clades of at most this many branches and score every read only "
+                  "in its best clades (0: no clades).")
+@click.option('--candidate-clades',
+             type=int,
+             default=4, show_default=True,
+             help="The number of clades scored for every read with --clade-size.")
+@click.option('--fixed-point',
+             is_flag=True, default=False,
+             help="Sum up the scores as 16-bit fixed-point integers. The placements are ranked the same but for near ties.")
+@click.option('--skip-postings',
+             type=int,
+             default=0, show_default=True,
+             help="Skip the k-mers scoring more than this many branches (0: no limit). Faster, less accurate.")
+@click.option('--skip-ratio',
+             type=float,
+             default=0.0, show_default=True,
+             help="Skip the k-mers whose best score is less than this many times the threshold score (0: none).")
+@click.option('--sampling',
+             type=click.Choice(['none', 'minimizer', 'syncmer']),
+             default='none', show_default=True,
+             help="Query only a subset of k-mers to place faster.")
+@click.option('--sampling-density',
+             type=float,
+             default=0.25, show_default=True,
+             help="The proportion of k-mers queried with --sampling.")
+@click.option('--output-format',
+             type=click.Choice(['jplace', 'mass', 'both']),
+             default='jplace', show_default=True,
+             help="jplace: placements of every read. mass: only the placement mass of every edge, "
+                  "a .mass.tsv table. both: the two of them.")
+@click.option('--mass-counts',
+             is_flag=True, default=False,
+             help="Add the number of reads best placed on every edge to the mass table.")
+@click.option('--metrics',
+             type=click.Path(dir_okay=False, file_okay=True),
+             default=None,
+             help="Write per-stage performance metrics to a .json file.")
+@click.option('--profile-hw',
+             type=click.Path(dir_okay=False, file_okay=True),
+             default=None,
+             help="Write hardware counters (cycles, instructions, cache and TLB misses) of every stage to a .json file.")
+@click.option('--checkpoint-interval',
+             type=int,
+             default=60, show_default=True,
+             help="Save the progress at most every N seconds (0: after every batch).")
+@click.option('--resume',
+             is_flag=True, default=False,
+             help="Continue an interrupted run from its last checkpoint.")
+@click.option('--mates',
+             type=click.Path(exists=True),
+             default=None,
+             help="The second reads of paired-end reads, in the order of the input file. "
+                  "Every pair is placed with the k-mers of both mates.")
+@click.option('--query-parts',
+             type=int,
+             default=1, show_default=True,
+             help="Split the query file into N parts placed by N processes sharing --threads, "
+                  "and merge their outputs.")
+@click.option('--query-part',
+             type=str,
+             default=None,
+             help="Place only the part I/N of the query file, e.g. 0/4 (to place the parts on several nodes).")
+@click.option('--merge-parts',
+             type=int,
+             default=None,
+             help="Merge the outputs of the N parts placed with --query-part.")
 @click.argument('input_file', type=click.Path(exists=True))
-def place(database, states, omega, mu, outputdir, threads, max_ram, input_file):
+def place(database, states, omega, mu, outputdir, threads, max_ram, engine, filter_bits, dense_tier, clade_size,
+          candidate_clades, fixed_point, skip_postings, skip_ratio, sampling, sampling_density, output_format, mass_counts, metrics, profile_hw, checkpoint_interval, resume, mates, query_parts, query_part, merge_parts,
+          input_file):
     """
     Places .fasta files using the input IPK database.
 
@@ -65,12 +151,77 @@ def place(database, states, omega, mu, outputdir, threads, max_ram, input_file):
 
     Examples:
     \tepik.py place -i DB.ipk -o temp --max-ram 4G --threads 8 query.fasta
+    \tepik.py place -i DB1.ipk -i DB2.ipk -o temp --threads 8 query.fasta
+    \tepik.py place -i DB.ipk -o temp --threads 8 --query-parts 4 query.fasta
+    \tepik.py place -i DB.ipk -o temp --threads 8 --mates reads_2.fastq reads_1.fastq
 
     """
-    place_queries(database, states, omega, mu, outputdir, threads, max_ram, input_file)
+    if mates and query_parts > 1:
+        raise click.UsageError("--mates is not supported with --query-parts")
+    if query_parts > 1:
+        place_query_parts(query_parts, database, states, omega, mu, outputdir, threads, max_ram, input_file,
+                          metrics, engine, sampling, sampling_density, filter_bits, checkpoint_interval, resume,
+                          output_format, mass_counts, dense_tier, clade_size, candidate_clades, skip_postings, skip_ratio,
+                          fixed_point)
+    else:
+        place_queries(database, states, omega, mu, outputdir, threads, max_ram, input_file, metrics, engine,
+                      sampling, sampling_density, filter_bits, checkpoint_interval, resume, output_format,
+                      mass_counts, query_part, merge_parts, dense_tier, clade_size, candidate_clades, mates, profile_hw,
+                      skip_postings, skip_ratio, fixed_point)
 
 
-def place_queries(database, states, omega, mu, outputdir, threads, max_ram, input_file):
+def place_queries(database, states, omega, mu, outputdir, threads, max_ram, input_file, metrics=None,
+                  engine="per-read", sampling="none", sampling_density=0.25, filter_bits=0,
+                  checkpoint_interval=60, resume=False, output_format="jplace", mass_counts=False,
+                  query_part=None, merge_parts=None, dense_tier=0.0, clade_size=0, candidate_clades=4, mates=None,
+                  profile_hw=None, skip_postings=0, skip_ratio=0.0, fixed_point=False):
+    command = make_command(database, states, omega, mu, outputdir, threads, max_ram, input_file, metrics,
+                           engine, sampling, sampling_density, filter_bits, checkpoint_interval, resume,
+                           output_format, mass_counts, query_part, merge_parts, dense_tier, clade_size,
+                           candidate_clades, mates, profile_hw, skip_postings, skip_ratio, fixed_point)
+    print(" ".join(s for s in command))
+    return subprocess.call(command)
+
+
+def place_query_parts(num_parts, database, states, omega, mu, outputdir, threads, max_ram, input_file, metrics=None,
+                      engine="per-read", sampling="none", sampling_density=0.25, filter_bits=0,
+                      checkpoint_interval=60, resume=False, output_format="jplace", mass_counts=False,
+                      dense_tier=0.0, clade_size=0, candidate_clades=4, skip_postings=0, skip_ratio=0.0,
+                      fixed_point=False):
+    """
+    Places the parts of the query file by concurrent processes and merges their outputs.
+    Every process loads the database: the memory used is num_parts times larger
+    """
+    processes = []
+    for i in range(num_parts):
+        part_metrics = None
+        if metrics:
+            root, ext = os.path.splitext(str(metrics))
+            part_metrics = f"{root}.part{i}of{num_parts}{ext}"
+        command = make_command(database, states, omega, mu, outputdir, max(1, threads // num_parts), max_ram,
+                               input_file, part_metrics, engine, sampling, sampling_density, filter_bits,
+                               checkpoint_interval, resume, output_format, mass_counts,
+                               query_part=f"{i}/{num_parts}", dense_tier=dense_tier, clade_size=clade_size,
+                               candidate_clades=candidate_clades, skip_postings=skip_postings, skip_ratio=skip_ratio,
+                               fixed_point=fixed_point)
+        print(" ".join(s for s in command))
+        processes.append(subprocess.Popen(command))
+
+    return_codes = [process.wait() for process in processes]
+    for i, code in enumerate(return_codes):
+        if code != 0:
+            print(f"Part {i}/{num_parts} failed with the exit code {code}")
+            return code
+
+    return place_queries(database, states, omega, mu, outputdir, threads, max_ram, input_file,
+                         output_format=output_format, mass_counts=mass_counts, merge_parts=num_parts)
+
+
+def make_command(database, states, omega, mu, outputdir, threads, max_ram, input_file, metrics=None,
+                 engine="per-read", sampling="none", sampling_density=0.25, filter_bits=0,
+                 checkpoint_interval=60, resume=False, output_format="jplace", mass_counts=False,
+                 query_part=None, merge_parts=None, dense_tier=0.0, clade_size=0, candidate_clades=4, mates=None,
+                 profile_hw=None, skip_postings=0, skip_ratio=0.0, fixed_point=False):
     current_dir = os.path.dirname(os.path.realpath(__file__))
     
     # If EPIK is installed, look for the binary in the installed location,
@@ -82,9 +233,13 @@ def place_queries(database, states, omega, mu, outputdir, threads, max_ram, inpu
     else:
         epik_bin = f"{epik_bin_dir}/epik-aa"
 
-    command = [
-        epik_bin, 
-        "-d", str(database),
+    # A single database or a list of databases
+    databases = [database] if isinstance(database, (str, os.PathLike)) else database
+
+    command = [epik_bin]
+    for db in databases:
+        command.extend(["-d", str(db)])
+    command += [
         "-q", str(input_file),
         "-j", str(threads),
         "--omega", str(omega),
@@ -93,9 +248,42 @@ def place_queries(database, states, omega, mu, outputdir, threads, max_ram, inpu
     ]
     if max_ram:
         command.extend(["--max-ram", max_ram])
+    if engine != "per-read":
+        command.extend(["--engine", engine])
+    if filter_bits:
+        command.extend(["--filter-bits", str(filter_bits)])
+    if dense_tier:
+        command.extend(["--dense-tier", str(dense_tier)])
+    if clade_size:
+        command.extend(["--clade-size", str(clade_size), "--candidate-clades", str(candidate_clades)])
+    if fixed_point:
+        command.append("--fixed-point")
+    if skip_postings:
+        command.extend(["--skip-postings", str(skip_postings)])
+    if skip_ratio:
+        command.extend(["--skip-ratio", str(skip_ratio)])
+    if sampling != "none":
+        command.extend(["--sampling", sampling, "--sampling-density", str(sampling_density)])
+    if output_format != "jplace":
+        command.extend(["--output-format", output_format])
+    if mass_counts:
+        command.append("--mass-counts")
+    if metrics:
+        command.extend(["--metrics", str(metrics)])
+    if profile_hw:
+        command.extend(["--profile-hw", str(profile_hw)])
+    if checkpoint_interval != 60:
+        command.extend(["--checkpoint-interval", str(checkpoint_interval)])
+    if resume:
+        command.append("--resume")
+    if mates:
+        command.extend(["--mates", str(mates)])
+    if query_part:
+        command.extend(["--query-part", query_part])
+    if merge_parts:
+        command.extend(["--merge-parts", str(merge_parts)])
     command.append(input_file)
-    print(" ".join(s for s in command))
-    return subprocess.call(command)
+    return command
 
 
 if __name__ == "__main__":
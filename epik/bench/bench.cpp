@@ -0,0 +1,922 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include <limits>
+#include <unordered_map>
+#include <cmath>
+#include <boost/filesystem.hpp>
+#include <cxxopts.hpp>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+#include <i2l/phylo_kmer_db.h>
+#include <i2l/phylo_tree.h>
+#include <i2l/newick.h>
+#include <i2l/seq_record.h>
+#include <i2l/serialization.h>
+#include <epik/place.h>
+#include <epik/jplace.h>
+#include <epik/intrinsic.h>
+#include "synthetic.h"
+
+namespace fs = boost::filesystem;
+using namespace epik::bench;
+
+namespace
+{
+    /// \brief Timings of one benchmark
+    struct bench_result
+    {
+        std::string name;
+
+        /// The number of items (sequences, k-mers, bytes...) processed by one repetition
+        size_t items;
+        std::string unit;
+        std::vector<double> seconds;
+    };
+
+    /// A sink for the results of benchmarked functions to not let the compiler remove them
+    volatile size_t sink = 0;
+
+    /// \brief Runs a benchmark `repeats` times. The setup function is called before
+    /// every repetition and is not measured.
+    bench_result measure(const std::string& name, size_t items, const std::string& unit, size_t repeats,
+                         const std::function<void()>& setup, const std::function<void()>& run)
+    {
+        bench_result result{ name, items, unit, {} };
+        for (size_t i = 0; i < repeats; ++i)
+        {
+            setup();
+            const auto begin = std::chrono::steady_clock::now();
+            run();
+            const auto end = std::chrono::steady_clock::now();
+            result.seconds.push_back(std::chrono::duration<double>(end - begin).count());
+        }
+        std::cerr << "\t" << name << ": " << *std::min_element(result.seconds.begin(), result.seconds.end())
+                  << " s" << std::endl;
+        return result;
+    }
+
+    /// \brief The best branch of a query without placements
+    constexpr size_t unplaced = std::numeric_limits<size_t>::max();
+
+    /// \brief The best branch of every query placed with the selection of the placer
+    std::vector<size_t> best_branches(epik::placer& placer, const std::vector<std::string>& queries, size_t kmer_size)
+    {
+        std::vector<size_t> branches;
+        branches.reserve(queries.size());
+        for (const auto& query : queries)
+        {
+            const auto placed = placer.place_encoded(query, epik::impl::encode_kmers(query, kmer_size));
+            branches.push_back(placed.placements.empty() ? unplaced : placed.placements[0].branch_id);
+        }
+        return branches;
+    }
+
+    /// \brief A configured placer against the default placement
+    struct variant_result
+    {
+        double speedup;
+
+        /// The proportion of queries placed on the same best branch
+        double agreement;
+    };
+
+    /// \brief Runs the place_seq/<name> benchmark of a configured placer. The speedup is relative to
+    /// the default placement that took `reference_seconds`, the agreement is relative to its best branches
+    variant_result measure_variant(std::vector<bench_result>& results, const std::string& name, size_t repeats,
+                                   epik::placer& variant, const std::vector<std::string>& queries, size_t kmer_size,
+                                   const std::vector<size_t>& reference, double reference_seconds)
+    {
+        results.push_back(measure("place_seq/" + name, queries.size(), "seq", repeats, []() {}, [&]() {
+            for (const auto& query : queries)
+            {
+                sink = sink + variant.place_seq(query).placements.size();
+            }
+        }));
+        const auto seconds = *std::min_element(results.back().seconds.begin(), results.back().seconds.end());
+
+        const auto branches = best_branches(variant, queries, kmer_size);
+        size_t num_agreed = 0;
+        for (size_t i = 0; i < queries.size(); ++i)
+        {
+            num_agreed += branches[i] == reference[i] ? 1 : 0;
+        }
+        return { reference_seconds / seconds, (double)num_agreed / (double)std::max(queries.size(), size_t{1}) };
+    }
+
+    void write_config(rapidjson::PrettyWriter<rapidjson::StringBuffer>& writer, const synthetic_config& config)
+    {
+        writer.Key("config");
+        writer.StartObject();
+        writer.Key("leaves");
+        writer.Uint64(config.num_leaves);
+        writer.Key("k");
+        writer.Uint64(config.kmer_size);
+        writer.Key("omega");
+        writer.Double(config.omega);
+        writer.Key("kmers");
+        writer.Uint64(config.num_kmers);
+        writer.Key("posting_dist");
+        writer.String(to_string(config.postings).c_str());
+        writer.Key("posting_mean");
+        writer.Double(config.posting_mean);
+        writer.Key("queries");
+        writer.Uint64(config.num_queries);
+        writer.Key("read_length");
+        writer.Uint64(config.read_length);
+        writer.Key("ambiguity");
+        writer.Double(config.ambiguity_rate);
+        writer.Key("hit_rate");
+        writer.Double(config.hit_rate);
+        writer.Key("redundancy");
+        writer.Double(config.redundancy);
+        writer.Key("seed");
+        writer.Uint64(config.seed);
+        writer.EndObject();
+    }
+
+    void write_result(rapidjson::PrettyWriter<rapidjson::StringBuffer>& writer, const bench_result& result)
+    {
+        auto seconds = result.seconds;
+        std::sort(seconds.begin(), seconds.end());
+        const auto min = seconds.front();
+        const auto median = seconds[seconds.size() / 2];
+
+        writer.StartObject();
+        writer.Key("name");
+        writer.String(result.name.c_str());
+        writer.Key("unit");
+        writer.String(result.unit.c_str());
+        writer.Key("items");
+        writer.Uint64(result.items);
+        writer.Key("repeats");
+        writer.Uint64(result.seconds.size());
+        writer.Key("min_s");
+        writer.Double(min);
+        writer.Key("median_s");
+        writer.Double(median);
+        writer.Key("ns_per_item");
+        writer.Double(result.items > 0 ? 1e9 * min / (double)result.items : 0.0);
+        writer.Key("items_per_s");
+        writer.Double(min > 0 ? (double)result.items / min : 0.0);
+        writer.EndObject();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::ios::sync_with_stdio(false);
+
+    cxxopts::Options options(argv[0], "EPIK microbenchmarks on synthetic databases");
+    options.add_options()
+        ("leaves", "Number of leaves of the synthetic tree", cxxopts::value<size_t>()->default_value("1000"))
+        ("k", "k-mer size", cxxopts::value<size_t>()->default_value("10"))
+        ("omega", "Determines the threshold value", cxxopts::value<float>()->default_value("1.5"))
+        ("kmers", "Number of distinct k-mers in the database", cxxopts::value<size_t>()->default_value("1000000"))
+        ("posting-dist", "Posting list length distribution: fixed, uniform, geometric",
+            cxxopts::value<std::string>()->default_value("geometric"))
+        ("posting-mean", "Mean posting list length", cxxopts::value<double>()->default_value("20"))
+        ("queries", "Number of query sequences", cxxopts::value<size_t>()->default_value("10000"))
+        ("read-length", "Length of query sequences", cxxopts::value<size_t>()->default_value("150"))
+        ("ambiguity", "Probability of a query character to be ambiguous", cxxopts::value<double>()->default_value("0.0"))
+        ("hit-rate", "Proportion of query k-mers present in the database", cxxopts::value<double>()->default_value("0.5"))
+        ("redundancy", "If positive, queries are mutated copies of queries * (1 - redundancy) templates, like amplicons",
+            cxxopts::value<double>()->default_value("0.0"))
+        ("filter-bits", "Bits per key of the key filter of query_kmers/filtered",
+            cxxopts::value<size_t>()->default_value("10"))
+        ("dense-tier", "Fractions of branches of the dense tiers of the place_seq/dense benchmarks",
+            cxxopts::value<std::vector<double>>()->default_value("0.01,0.05,0.1"))
+        ("clade-size", "The size of clades of the place_seq/clades benchmark", cxxopts::value<size_t>()->default_value("64"))
+        ("candidate-clades", "The number of clades scored by the place_seq/clades benchmark",
+            cxxopts::value<size_t>()->default_value("4"))
+        ("skip-postings", "The longest posting list not skipped by the place_seq/skipping benchmark (0: no limit)",
+            cxxopts::value<size_t>()->default_value("100"))
+        ("skip-ratio", "The ratio of the best to the worst score of a k-mer over the branches under which "
+                       "the place_seq/skipping benchmark skips it (0: none)", cxxopts::value<double>()->default_value("2"))
+        ("sampling-density", "The proportion of k-mers queried by the sampled placement benchmarks",
+            cxxopts::value<double>()->default_value("0.25"))
+        ("seed", "Random seed", cxxopts::value<uint64_t>()->default_value("42"))
+        ("repeats", "Number of repetitions of every benchmark", cxxopts::value<size_t>()->default_value("5"))
+        ("keep-at-most", "Number of branches to report", cxxopts::value<size_t>()->default_value("7"))
+        ("keep-factor", "Minimum LWR to report", cxxopts::value<double>()->default_value("0.01"))
+        ("o,output", "Output .json file. Printed to stdout if not given", cxxopts::value<std::string>())
+        ("write-db", "Only generate data: save the synthetic database to a file", cxxopts::value<std::string>())
+        ("write-queries", "Only generate data: save the synthetic queries to a .fasta file",
+            cxxopts::value<std::string>())
+        ("h,help", "Print usage")
+        ;
+
+    const auto parsed_options = options.parse(argc, argv);
+    if (parsed_options.count("help"))
+    {
+        std::cout << options.help() << std::endl;
+        return 0;
+    }
+
+    try
+    {
+        synthetic_config config;
+        config.num_leaves = parsed_options["leaves"].as<size_t>();
+        config.kmer_size = parsed_options["k"].as<size_t>();
+        config.omega = parsed_options["omega"].as<float>();
+        config.num_kmers = parsed_options["kmers"].as<size_t>();
+        config.postings = parse_posting_distribution(parsed_options["posting-dist"].as<std::string>());
+        config.posting_mean = parsed_options["posting-mean"].as<double>();
+        config.num_queries = parsed_options["queries"].as<size_t>();
+        config.read_length = parsed_options["read-length"].as<size_t>();
+        config.ambiguity_rate = parsed_options["ambiguity"].as<double>();
+        config.hit_rate = parsed_options["hit-rate"].as<double>();
+        config.redundancy = parsed_options["redundancy"].as<double>();
+        config.seed = parsed_options["seed"].as<uint64_t>();
+        const auto repeats = std::max(parsed_options["repeats"].as<size_t>(), size_t{ 1 });
+        const auto keep_at_most = parsed_options["keep-at-most"].as<size_t>();
+        const auto keep_factor = parsed_options["keep-factor"].as<double>();
+        const auto sampling_density = parsed_options["sampling-density"].as<double>();
+        const auto filter_bits = parsed_options["filter-bits"].as<size_t>();
+        const auto dense_tier_fractions = parsed_options["dense-tier"].as<std::vector<double>>();
+        const auto clade_size = parsed_options["clade-size"].as<size_t>();
+        const auto candidate_clades = parsed_options["candidate-clades"].as<size_t>();
+        const auto skip_postings = parsed_options["skip-postings"].as<size_t>();
+        const auto skip_ratio = parsed_options["skip-ratio"].as<double>();
+
+        std::cerr << "Generating synthetic data..." << std::endl;
+        const auto queries = make_queries(config);
+        const auto records = make_records(queries);
+        const auto db = make_db(config, queries);
+
+        /// Generation mode: datasets for end-to-end runs of EPIK
+        if (parsed_options.count("write-db") || parsed_options.count("write-queries"))
+        {
+            if (parsed_options.count("write-db"))
+            {
+                i2l::save(db, parsed_options["write-db"].as<std::string>());
+            }
+            if (parsed_options.count("write-queries"))
+            {
+                write_fasta(parsed_options["write-queries"].as<std::string>(), queries);
+            }
+            return 0;
+        }
+        const auto tree = i2l::io::parse_newick(db.tree());
+        const auto num_nodes = tree.get_node_count();
+        auto placer = epik::placer(db, tree, keep_at_most, keep_factor, 1);
+
+        size_t num_kmers = 0;
+        for (const auto& query : queries)
+        {
+            num_kmers += query.size() - config.kmer_size + 1;
+        }
+
+        std::cerr << "Running benchmarks..." << std::endl;
+        std::vector<bench_result> results;
+        const auto nothing = []() {};
+
+        results.push_back(measure("query_kmers", num_kmers, "kmer", repeats, nothing, [&]() {
+            for (const auto& query : queries)
+            {
+                sink = sink + epik::impl::query_kmers(query, db).exact.size();
+            }
+        }));
+
+        /// The k-mer encoding alone: i2l::to_kmers against the table-driven encoder.
+        /// Ambiguous characters (see --ambiguity) are the most expensive for proteins
+        const auto encoder = epik::impl::kmer_encoder::make(config.kmer_size);
+        double encoder_speedup = 0.0;
+        results.push_back(measure("encode_kmers/i2l", num_kmers, "kmer", repeats, nothing, [&]() {
+            for (const auto& query : queries)
+            {
+                sink = sink + epik::impl::encode_kmers(query, config.kmer_size).exact.size();
+            }
+        }));
+        if (encoder)
+        {
+            results.push_back(measure("encode_kmers/table", num_kmers, "kmer", repeats, nothing, [&]() {
+                for (const auto& query : queries)
+                {
+                    sink = sink + epik::impl::encode_kmers(query, config.kmer_size, {}, encoder.get()).exact.size();
+                }
+            }));
+            encoder_speedup = *std::min_element(results[results.size() - 2].seconds.begin(),
+                                                results[results.size() - 2].seconds.end()) /
+                              *std::min_element(results.back().seconds.begin(), results.back().seconds.end());
+            std::cerr << "\tencoder speedup: " << encoder_speedup << std::endl;
+        }
+        else
+        {
+            std::cerr << "\tencoder: the encoding of i2l is not supported by tables" << std::endl;
+        }
+
+        /// The encoding kernels compiled for common k against the generic one, for every such k
+        /// of the alphabet. Only the queries are used, not the database
+        std::vector<std::pair<size_t, double>> specialization_speedups;
+        for (size_t k = 1; k <= 16; ++k)
+        {
+            const auto generic = epik::impl::kmer_encoder::make(k, false);
+            const auto specialized = epik::impl::kmer_encoder::make(k, true);
+            if (!generic || !specialized || !specialized->specialized())
+            {
+                continue;
+            }
+
+            size_t num_k_kmers = 0;
+            for (const auto& query : queries)
+            {
+                num_k_kmers += query.size() >= k ? query.size() - k + 1 : 0;
+            }
+
+            std::vector<double> seconds;
+            for (const auto* kernel_encoder : { generic.get(), specialized.get() })
+            {
+                const auto name = std::string("encode_kmers/k") + std::to_string(k) +
+                                  (kernel_encoder->specialized() ? "/specialized" : "/generic");
+                results.push_back(measure(name, num_k_kmers, "kmer", repeats, nothing, [&]() {
+                    for (const auto& query : queries)
+                    {
+                        sink = sink + epik::impl::encode_kmers(query, k, {}, kernel_encoder).exact.size();
+                    }
+                }));
+                seconds.push_back(*std::min_element(results.back().seconds.begin(), results.back().seconds.end()));
+            }
+            specialization_speedups.emplace_back(k, seconds[0] / seconds[1]);
+            std::cerr << "\tk=" << k << " specialization speedup: " << seconds[0] / seconds[1] << std::endl;
+        }
+
+        /// The same with the key filter: absent k-mers (see --hit-rate) are mostly not searched
+        const auto filter = epik::impl::key_filter(db, filter_bits);
+        results.push_back(measure("query_kmers/filtered", num_kmers, "kmer", repeats, nothing, [&]() {
+            for (const auto& query : queries)
+            {
+                sink = sink + epik::impl::query_kmers(query, db, &filter).exact.size();
+            }
+        }));
+        size_t num_absent = 0;
+        size_t num_false_positives = 0;
+        for (const auto& query : queries)
+        {
+            for (const auto key : epik::impl::encode_kmers(query, config.kmer_size).exact)
+            {
+                if (!db.search(key))
+                {
+                    ++num_absent;
+                    num_false_positives += filter.may_contain(key) ? 1 : 0;
+                }
+            }
+        }
+        const auto filter_false_positive_rate = (double)num_false_positives / (double)std::max(num_absent, size_t{1});
+        std::cerr << "\tkey filter: " << filter.memory_bytes() << " bytes, false positive rate "
+                  << filter_false_positive_rate << std::endl;
+
+        /// The posting lists of all queries are retrieved in advance to measure
+        /// only the accumulation of scores
+        std::vector<epik::impl::kmer_results> search_results;
+        search_results.reserve(queries.size());
+        size_t num_postings = 0;
+        for (const auto& query : queries)
+        {
+            search_results.push_back(epik::impl::query_kmers(query, db));
+            for (const auto& exact : search_results.back().exact)
+            {
+                num_postings += (*exact).size();
+            }
+        }
+
+        std::vector<i2l::phylo_kmer::score_type> scores(num_nodes);
+        std::vector<size_t> counts(num_nodes);
+        std::vector<i2l::phylo_kmer::branch_type> edges;
+
+        using posting_list = std::decay_t<decltype(*std::declval<epik::impl::search_result>())>;
+        using update_function = void (*)(std::vector<i2l::phylo_kmer::score_type>&, std::vector<size_t>&,
+                                          std::vector<i2l::phylo_kmer::branch_type>&, const posting_list&);
+        std::vector<std::pair<std::string, update_function>> variants = {
+            { "scalar", update_vector_scalar<posting_list> }
+        };
+        if (std::string(update_vector_isa) != "scalar")
+        {
+            variants.emplace_back(update_vector_isa, update_vector<posting_list>);
+        }
+
+        for (const auto& [isa, update] : variants)
+        {
+            results.push_back(measure("update_vector/" + isa, num_postings, "posting", repeats, nothing, [&]() {
+                for (const auto& search_result : search_results)
+                {
+                    for (const auto edge : edges)
+                    {
+                        scores[edge] = 0.0f;
+                        counts[edge] = 0;
+                    }
+                    edges.clear();
+
+                    for (const auto& exact : search_result.exact)
+                    {
+                        update(scores, counts, edges, *exact);
+                    }
+                }
+                sink = sink + edges.size();
+            }));
+        }
+
+        /// The vectorized variants must give the same scores, counts and edges as the scalar reference.
+        /// Every branch is scored once per posting list, in the same order: the sums are equal bit for bit
+        for (size_t variant = 1; variant < variants.size(); ++variant)
+        {
+            const auto& [isa, update] = variants[variant];
+            std::vector<i2l::phylo_kmer::score_type> expected_scores(num_nodes);
+            std::vector<size_t> expected_counts(num_nodes);
+            std::vector<i2l::phylo_kmer::branch_type> expected_edges;
+            for (const auto& search_result : search_results)
+            {
+                for (const auto edge : edges)
+                {
+                    scores[edge] = 0.0f;
+                    counts[edge] = 0;
+                }
+                edges.clear();
+                for (const auto edge : expected_edges)
+                {
+                    expected_scores[edge] = 0.0f;
+                    expected_counts[edge] = 0;
+                }
+                expected_edges.clear();
+
+                for (const auto& exact : search_result.exact)
+                {
+                    update_vector_scalar(expected_scores, expected_counts, expected_edges, *exact);
+                    update(scores, counts, edges, *exact);
+                }
+                if (edges != expected_edges || scores != expected_scores || counts != expected_counts)
+                {
+                    throw std::runtime_error("update_vector/" + isa + " differs from update_vector/scalar");
+                }
+            }
+        }
+
+        results.push_back(measure("place_seq", queries.size(), "seq", repeats, nothing, [&]() {
+            for (const auto& query : queries)
+            {
+                sink = sink + placer.place_seq(query).placements.size();
+            }
+        }));
+        const auto sparse_seconds = *std::min_element(results.back().seconds.begin(), results.back().seconds.end());
+        const auto sparse_branches = best_branches(placer, queries, config.kmer_size);
+
+        /// The same with dense tiers of several thresholds: the memory they take against the speedup
+        struct dense_tier_result
+        {
+            double fraction;
+            size_t num_kmers;
+            size_t num_postings;
+            size_t bytes;
+            double speedup;
+            double agreement;
+        };
+        std::vector<dense_tier_result> dense_tier_results;
+        for (const auto fraction : dense_tier_fractions)
+        {
+            auto dense_placer = epik::placer(db, tree, keep_at_most, keep_factor, 1);
+            dense_placer.build_dense_tier(fraction);
+            const auto& tier = *dense_placer.dense_tier();
+            const auto dense = measure_variant(results, "dense_" + std::to_string(fraction), repeats, dense_placer,
+                                               queries, config.kmer_size, sparse_branches, sparse_seconds);
+            dense_tier_results.push_back({ fraction, tier.num_kmers(), tier.num_postings(), tier.memory_bytes(),
+                                           dense.speedup, dense.agreement });
+            std::cerr << "\tdense tier " << fraction << ": " << tier.num_kmers() << " k-mers, "
+                      << tier.memory_bytes() << " bytes, speedup " << dense.speedup
+                      << ", agreement " << dense.agreement << std::endl;
+        }
+
+        /// Coarse-to-fine placement: the speedup and the proportion of queries with the same best branch
+        auto clade_placer = epik::placer(db, tree, keep_at_most, keep_factor, 1);
+        clade_placer.build_clades(clade_size, candidate_clades);
+        const auto clades = measure_variant(results, "clades", repeats, clade_placer, queries, config.kmer_size,
+                                            sparse_branches, sparse_seconds);
+        std::cerr << "\tclades: " << clade_placer.clades()->num_clades() << " clades, speedup " << clades.speedup
+                  << ", agreement " << clades.agreement << std::endl;
+
+        /// Query-time skipping of uninformative k-mers: the proportion of the k-mers found that are skipped,
+        /// the speedup and the proportion of queries with the same best branch
+        auto skip_placer = epik::placer(db, tree, keep_at_most, keep_factor, 1);
+        skip_placer.set_skipping(skip_postings, skip_ratio);
+        size_t num_hits = 0;
+        size_t num_skipped = 0;
+        for (const auto& searched : search_results)
+        {
+            for (const auto key : searched.exact_keys)
+            {
+                ++num_hits;
+                num_skipped += skip_placer.skips(key) ? 1 : 0;
+            }
+        }
+        const auto skipping = measure_variant(results, "skipping", repeats, skip_placer, queries, config.kmer_size,
+                                              sparse_branches, sparse_seconds);
+        const auto skip_rate = (double)num_skipped / (double)std::max(num_hits, size_t{1});
+        std::cerr << "\tskipping: " << skip_rate << " of k-mers found skipped, speedup " << skipping.speedup
+                  << ", agreement " << skipping.agreement << std::endl;
+
+        /// Fixed-point accumulation: integer sums of the fixed-point lists against update_vector,
+        /// the speedup of the placement, and its ranking against the float scores
+        auto fixed_placer = epik::placer(db, tree, keep_at_most, keep_factor, 1);
+        fixed_placer.build_fixed_point();
+        const auto& fixed = *fixed_placer.fixed_point();
+        {
+            std::vector<std::vector<epik::impl::fixed_postings::list>> fixed_lists;
+            fixed_lists.reserve(search_results.size());
+            for (const auto& searched : search_results)
+            {
+                fixed_lists.emplace_back();
+                for (const auto key : searched.exact_keys)
+                {
+                    fixed_lists.back().push_back(*fixed.find(key));
+                }
+            }
+
+            std::vector<uint32_t> sums(num_nodes);
+            std::vector<uint32_t> hits(num_nodes);
+            using fixed_function = void (*)(uint32_t*, uint32_t*, std::vector<i2l::phylo_kmer::branch_type>&,
+                                             const i2l::phylo_kmer::branch_type*, const uint16_t*, size_t);
+            std::vector<std::pair<std::string, fixed_function>> fixed_variants = {
+                { "scalar", update_fixed_scalar }
+            };
+            if (std::string(update_vector_isa) != "scalar" && std::string(update_vector_isa) != "sse")
+            {
+                fixed_variants.emplace_back(update_vector_isa, update_fixed);
+            }
+            for (const auto& [isa, update] : fixed_variants)
+            {
+                results.push_back(measure("update_fixed/" + isa, num_postings, "posting", repeats, nothing, [&]() {
+                    for (const auto& lists : fixed_lists)
+                    {
+                        for (const auto edge : edges)
+                        {
+                            sums[edge] = 0;
+                            hits[edge] = 0;
+                        }
+                        edges.clear();
+
+                        for (const auto& list : lists)
+                        {
+                            update(sums.data(), hits.data(), edges, list.branches, list.scores, list.size);
+                        }
+                    }
+                    sink = sink + edges.size();
+                }));
+            }
+        }
+        const auto fixed_result = measure_variant(results, "fixed", repeats, fixed_placer, queries, config.kmer_size,
+                                                  sparse_branches, sparse_seconds);
+
+        /// The ranking check. Fixed-point placements are compared to the best float placements, both sorted by score
+        /// and branch id, as placer breaks ties. The candidates of the fixed-point path are scored again with float
+        /// scores added in the same order: a placement kept with another branch or another score is a violation
+        size_t num_same_order = 0;
+        size_t num_violations = 0;
+        double max_score_error = 0.0;
+        for (const auto& query : queries)
+        {
+            /// Queries with ambiguous k-mers are placed with float scores, and not selected yet
+            const auto by_score = [](const auto& lhs, const auto& rhs) {
+                return lhs.score > rhs.score || (lhs.score == rhs.score && lhs.branch_id < rhs.branch_id);
+            };
+            auto float_placements = placer.place_seq(query).placements;
+            auto fixed_placements = fixed_placer.place_seq(query).placements;
+            std::sort(float_placements.begin(), float_placements.end(), by_score);
+            std::sort(fixed_placements.begin(), fixed_placements.end(), by_score);
+            float_placements.resize(std::min(float_placements.size(), keep_at_most));
+            fixed_placements.resize(std::min(fixed_placements.size(), keep_at_most));
+
+            bool same_order = fixed_placements.size() == float_placements.size();
+            num_violations += same_order ? 0 : 1;
+            for (size_t i = 0; i < fixed_placements.size() && i < float_placements.size(); ++i)
+            {
+                const auto& placement = fixed_placements[i];
+                max_score_error = std::max(max_score_error, std::abs((double)placement.score - (double)float_placements[i].score));
+                if (placement.branch_id != float_placements[i].branch_id || placement.score != float_placements[i].score)
+                {
+                    same_order = false;
+                    ++num_violations;
+                }
+            }
+            num_same_order += same_order ? 1 : 0;
+        }
+        const auto fixed_same_order = (double)num_same_order / (double)std::max(queries.size(), size_t{1});
+        std::cerr << "\tfixed point: " << fixed.memory_bytes() << " bytes, speedup " << fixed_result.speedup
+                  << ", agreement " << fixed_result.agreement << ", same order " << fixed_same_order
+                  << ", max score error " << max_score_error << ", " << num_violations << " violations" << std::endl;
+        if (num_violations > 0)
+        {
+            throw std::runtime_error("place_seq/fixed keeps " + std::to_string(num_violations) +
+                                     " placements that are not the float ones");
+        }
+
+        /// The whole batch placing with both search engines. Reads of the batch sharing k-mers
+        /// (see --redundancy) make the join engine faster
+        std::vector<epik::impl::seq_view> views;
+        for (const auto& record : records)
+        {
+            views.push_back({ record.header(), record.sequence() });
+        }
+        const auto batch = epik::encoded_batch(views, { config.kmer_size }, 1);
+        const std::vector<epik::placer*> placers = { &placer };
+        for (const auto& [engine_name, search_engine] : { std::make_pair("per_read", epik::engine::per_read),
+                                                          std::make_pair("join", epik::engine::join) })
+        {
+            results.push_back(measure(std::string("place_batch/") + engine_name, queries.size(), "seq", repeats,
+                                      nothing, [&, search_engine = search_engine]() {
+                sink = sink + epik::place(placers, batch, 1, search_engine)[0].placed_seqs.size();
+            }));
+        }
+        const auto join_speedup = *std::min_element(results[results.size() - 2].seconds.begin(),
+                                                    results[results.size() - 2].seconds.end()) /
+                                  *std::min_element(results.back().seconds.begin(), results.back().seconds.end());
+        std::cerr << "\tjoin speedup: " << join_speedup << std::endl;
+
+        /// Consecutive queries as the mates of paired-end reads: placed once per pair with the k-mers
+        /// of both mates, against placing the mates separately. The placements written are counted
+        std::vector<std::string> pairs;
+        std::vector<epik::impl::seq_view> pair_views;
+        pairs.reserve(queries.size() / 2);
+        for (size_t i = 0; i + 1 < queries.size(); i += 2)
+        {
+            pairs.push_back(queries[i] + epik::impl::mate_separator + queries[i + 1]);
+        }
+        for (size_t i = 0; i < pairs.size(); ++i)
+        {
+            pair_views.push_back({ views[2 * i].header, pairs[i] });
+            pair_views.push_back({ views[2 * i + 1].header, pairs[i] });
+        }
+        const auto paired_batch = epik::encoded_batch(pair_views, { config.kmer_size }, 1);
+        const auto count_placements = [](const epik::impl::placed_collection& placed) {
+            size_t num_placements = 0;
+            for (const auto& placed_seq : placed.placed_seqs)
+            {
+                num_placements += placed_seq.placements.size();
+            }
+            return num_placements;
+        };
+        results.push_back(measure("place_batch/paired", pair_views.size(), "seq", repeats, nothing, [&]() {
+            sink = sink + epik::place(placers, paired_batch, 1, epik::engine::per_read)[0].placed_seqs.size();
+        }));
+        const auto paired_speedup = *std::min_element(results[results.size() - 3].seconds.begin(),
+                                                      results[results.size() - 3].seconds.end()) /
+                                    *std::min_element(results.back().seconds.begin(), results.back().seconds.end());
+        const auto separate_placements = count_placements(epik::place(placers, batch, 1, epik::engine::per_read)[0]);
+        const auto paired_placements = count_placements(epik::place(placers, paired_batch, 1, epik::engine::per_read)[0]);
+        std::cerr << "\tpaired speedup: " << paired_speedup << ", placements: " << paired_placements
+                  << " (separately: " << separate_placements << ")" << std::endl;
+
+        /// Placement with subsampled k-mers against the full placement: the speedup and the proportion
+        /// of queries with the same best branch
+        struct sampling_result
+        {
+            std::string scheme;
+            double speedup;
+            double agreement;
+        };
+        std::vector<sampling_result> sampling_results;
+        std::vector<epik::impl::placed_sequence> full_placements;
+        double full_seconds = 0.0;
+        for (const auto& [scheme_name, scheme] : { std::make_pair("none", epik::sampling_scheme::none),
+                                                   std::make_pair("minimizer", epik::sampling_scheme::minimizer),
+                                                   std::make_pair("syncmer", epik::sampling_scheme::syncmer) })
+        {
+            const auto sampling = epik::sampling{ scheme, scheme == epik::sampling_scheme::none ? 1.0 : sampling_density };
+            std::vector<epik::impl::placed_sequence> placements(queries.size());
+            results.push_back(measure(std::string("place_sampled/") + scheme_name, queries.size(), "seq", repeats,
+                                      nothing, [&]() {
+                for (size_t i = 0; i < queries.size(); ++i)
+                {
+                    const auto kmers = epik::impl::encode_kmers(queries[i], config.kmer_size, sampling);
+                    placements[i] = placer.place_encoded(queries[i], kmers);
+                }
+            }));
+            const auto seconds = *std::min_element(results.back().seconds.begin(), results.back().seconds.end());
+
+            if (scheme == epik::sampling_scheme::none)
+            {
+                full_placements = std::move(placements);
+                full_seconds = seconds;
+                continue;
+            }
+
+            size_t num_agreed = 0;
+            for (size_t i = 0; i < queries.size(); ++i)
+            {
+                const auto& full = full_placements[i].placements;
+                const auto& sampled = placements[i].placements;
+                if (!full.empty() && !sampled.empty() && full[0].branch_id == sampled[0].branch_id)
+                {
+                    ++num_agreed;
+                }
+            }
+            sampling_results.push_back({ scheme_name, full_seconds / seconds,
+                                         (double)num_agreed / (double)std::max(queries.size(), size_t{1}) });
+            std::cerr << "\t" << scheme_name << " speedup: " << sampling_results.back().speedup
+                      << ", agreement: " << sampling_results.back().agreement << std::endl;
+        }
+
+        /// Scored placements of every query before and after the selection
+        std::vector<std::vector<epik::impl::placement>> scored;
+        std::vector<std::vector<epik::impl::placement>> selected;
+        for (const auto& query : queries)
+        {
+            scored.push_back(placer.place_seq(query).placements);
+        }
+
+        results.push_back(measure("select_best_placements", queries.size(), "seq", repeats,
+                                  [&]() { selected = scored; },
+                                  [&]() {
+            for (size_t i = 0; i < selected.size(); ++i)
+            {
+                const auto num_query_kmers = queries[i].size() - config.kmer_size + 1;
+                selected[i] = placer.select_best_placements(std::move(selected[i]), num_query_kmers);
+            }
+        }));
+
+        const auto best = selected;
+        results.push_back(measure("lwr", queries.size(), "seq", repeats,
+                                  [&]() { selected = best; },
+                                  [&]() {
+            for (size_t i = 0; i < selected.size(); ++i)
+            {
+                const auto score_sum = placer.sum_scores(scored[i], queries[i]);
+                placer.compute_weight_ratios(selected[i], score_sum);
+            }
+        }));
+
+        const auto placed = placer.place(records, 1);
+        const auto jplace_file = (fs::temp_directory_path() / fs::unique_path("epik-bench-%%%%-%%%%.jplace")).string();
+        const auto tree_as_newick = i2l::io::to_newick(tree, true);
+        results.push_back(measure("jplace_writer", queries.size(), "seq", repeats, nothing, [&]() {
+            auto jplace = epik::io::jplace_writer(jplace_file, "epik-bench", tree_as_newick);
+            jplace.start();
+            jplace << placed;
+            jplace.end();
+        }));
+        const auto jplace_size = fs::file_size(jplace_file);
+        fs::remove(jplace_file);
+
+        rapidjson::StringBuffer buffer;
+        rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+        writer.StartObject();
+        writer.Key("instruction_set");
+        writer.String(update_vector_isa);
+        write_config(writer, config);
+        writer.Key("nodes");
+        writer.Uint64(num_nodes);
+        writer.Key("postings_per_run");
+        writer.Uint64(num_postings);
+        writer.Key("jplace_bytes");
+        writer.Uint64(jplace_size);
+        writer.Key("join_speedup");
+        writer.Double(join_speedup);
+        writer.Key("encoder");
+        writer.StartObject();
+        writer.Key("table");
+        writer.Bool(encoder != nullptr);
+        writer.Key("speedup");
+        writer.Double(encoder_speedup);
+        writer.EndObject();
+        writer.Key("specialization");
+        writer.StartObject();
+        for (const auto& [k, speedup] : specialization_speedups)
+        {
+            writer.Key(std::to_string(k).c_str());
+            writer.Double(speedup);
+        }
+        writer.EndObject();
+        writer.Key("filter");
+        writer.StartObject();
+        writer.Key("bits_per_key");
+        writer.Uint64(filter_bits);
+        writer.Key("bytes");
+        writer.Uint64(filter.memory_bytes());
+        writer.Key("expected_false_positive_rate");
+        writer.Double(filter.expected_false_positive_rate());
+        writer.Key("false_positive_rate");
+        writer.Double(filter_false_positive_rate);
+        writer.EndObject();
+        writer.Key("dense_tier");
+        writer.StartArray();
+        for (const auto& result : dense_tier_results)
+        {
+            writer.StartObject();
+            writer.Key("fraction");
+            writer.Double(result.fraction);
+            writer.Key("kmers");
+            writer.Uint64(result.num_kmers);
+            writer.Key("postings");
+            writer.Uint64(result.num_postings);
+            writer.Key("bytes");
+            writer.Uint64(result.bytes);
+            writer.Key("speedup");
+            writer.Double(result.speedup);
+            writer.Key("agreement");
+            writer.Double(result.agreement);
+            writer.EndObject();
+        }
+        writer.EndArray();
+        writer.Key("clades");
+        writer.StartObject();
+        writer.Key("size");
+        writer.Uint64(clade_size);
+        writer.Key("candidates");
+        writer.Uint64(candidate_clades);
+        writer.Key("clades");
+        writer.Uint64(clade_placer.clades()->num_clades());
+        writer.Key("bytes");
+        writer.Uint64(clade_placer.clades()->memory_bytes());
+        writer.Key("speedup");
+        writer.Double(clades.speedup);
+        writer.Key("agreement");
+        writer.Double(clades.agreement);
+        writer.EndObject();
+        writer.Key("skipping");
+        writer.StartObject();
+        writer.Key("max_postings");
+        writer.Uint64(skip_postings);
+        writer.Key("min_ratio");
+        writer.Double(skip_ratio);
+        writer.Key("kmers");
+        writer.Uint64(skip_placer.num_skipped_kmers());
+        writer.Key("postings");
+        writer.Uint64(skip_placer.num_skipped_postings());
+        writer.Key("skip_rate");
+        writer.Double(skip_rate);
+        writer.Key("speedup");
+        writer.Double(skipping.speedup);
+        writer.Key("agreement");
+        writer.Double(skipping.agreement);
+        writer.EndObject();
+        writer.Key("fixed_point");
+        writer.StartObject();
+        writer.Key("scale");
+        writer.Double(fixed.scale());
+        writer.Key("bytes");
+        writer.Uint64(fixed.memory_bytes());
+        writer.Key("speedup");
+        writer.Double(fixed_result.speedup);
+        writer.Key("agreement");
+        writer.Double(fixed_result.agreement);
+        writer.Key("same_order");
+        writer.Double(fixed_same_order);
+        writer.Key("violations");
+        writer.Uint64(num_violations);
+        writer.Key("max_score_error");
+        writer.Double(max_score_error);
+        writer.EndObject();
+        writer.Key("paired");
+        writer.StartObject();
+        writer.Key("pairs");
+        writer.Uint64(pairs.size());
+        writer.Key("speedup");
+        writer.Double(paired_speedup);
+        writer.Key("placements");
+        writer.Uint64(paired_placements);
+        writer.Key("separate_placements");
+        writer.Uint64(separate_placements);
+        writer.EndObject();
+        writer.Key("sampling");
+        writer.StartObject();
+        writer.Key("density");
+        writer.Double(sampling_density);
+        for (const auto& result : sampling_results)
+        {
+            writer.Key(result.scheme.c_str());
+            writer.StartObject();
+            writer.Key("speedup");
+            writer.Double(result.speedup);
+            writer.Key("agreement");
+            writer.Double(result.agreement);
+            writer.EndObject();
+        }
+        writer.EndObject();
+        writer.Key("results");
+        writer.StartArray();
+        for (const auto& result : results)
+        {
+            write_result(writer, result);
+        }
+        writer.EndArray();
+        writer.EndObject();
+
+        if (parsed_options.count("output"))
+        {
+            std::ofstream out(parsed_options["output"].as<std::string>());
+            out << buffer.GetString() << std::endl;
+        }
+        else
+        {
+            std::cout << buffer.GetString() << std::endl;
+        }
+    }
+    catch (const std::runtime_error& error)
+    {
+        std::cerr << "Error: " << error.what() << std::endl;
+        return -1;
+    }
+    return 0;
+}
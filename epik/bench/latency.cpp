@@ -0,0 +1,221 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <algorithm>
+#include <cxxopts.hpp>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+#include <i2l/phylo_kmer_db.h>
+#include <i2l/phylo_tree.h>
+#include <i2l/newick.h>
+#include <epik/place.h>
+#include <epik/stream.h>
+#include "synthetic.h"
+
+using namespace epik::bench;
+
+namespace
+{
+    /// \brief The value below which a proportion q of the sorted values fall
+    double percentile(const std::vector<double>& sorted, double q)
+    {
+        if (sorted.empty())
+        {
+            return 0.0;
+        }
+        const auto index = static_cast<size_t>(q * (double)(sorted.size() - 1) + 0.5);
+        return sorted[std::min(index, sorted.size() - 1)];
+    }
+
+    void write_distribution(rapidjson::PrettyWriter<rapidjson::StringBuffer>& writer, const char* name,
+                            std::vector<double> microseconds)
+    {
+        std::sort(microseconds.begin(), microseconds.end());
+        double sum = 0.0;
+        for (const auto value : microseconds)
+        {
+            sum += value;
+        }
+
+        writer.Key(name);
+        writer.StartObject();
+        writer.Key("mean_us");
+        writer.Double(microseconds.empty() ? 0.0 : sum / (double)microseconds.size());
+        writer.Key("p50_us");
+        writer.Double(percentile(microseconds, 0.5));
+        writer.Key("p90_us");
+        writer.Double(percentile(microseconds, 0.9));
+        writer.Key("p99_us");
+        writer.Double(percentile(microseconds, 0.99));
+        writer.Key("p999_us");
+        writer.Double(percentile(microseconds, 0.999));
+        writer.Key("max_us");
+        writer.Double(microseconds.empty() ? 0.0 : microseconds.back());
+        writer.EndObject();
+    }
+}
+
+int main(int argc, char** argv)
+{
+    std::ios::sync_with_stdio(false);
+
+    cxxopts::Options options(argv[0], "EPIK latency of single-read placement (epik::stream_placer) "
+                                      "on a synthetic database");
+    options.add_options()
+        ("leaves", "Number of leaves of the synthetic tree", cxxopts::value<size_t>()->default_value("1000"))
+        ("k", "k-mer size", cxxopts::value<size_t>()->default_value("10"))
+        ("omega", "Determines the threshold value", cxxopts::value<float>()->default_value("1.5"))
+        ("kmers", "Number of distinct k-mers in the database", cxxopts::value<size_t>()->default_value("1000000"))
+        ("posting-mean", "Mean posting list length", cxxopts::value<double>()->default_value("20"))
+        ("queries", "Number of reads submitted", cxxopts::value<size_t>()->default_value("10000"))
+        ("read-length", "Length of reads", cxxopts::value<size_t>()->default_value("150"))
+        ("hit-rate", "Proportion of read k-mers present in the database", cxxopts::value<double>()->default_value("0.5"))
+        ("seed", "Random seed", cxxopts::value<uint64_t>()->default_value("42"))
+        ("workers", "Number of placement threads", cxxopts::value<size_t>()->default_value("1"))
+        ("queue", "Capacity of the queue of reads", cxxopts::value<size_t>()->default_value("64"))
+        ("rate", "Reads submitted per second, rejected if the queue is full. "
+                 "0: every read is submitted as soon as there is room in the queue",
+            cxxopts::value<double>()->default_value("1000"))
+        ("warm-up", "Number of reads placed by every worker before the measure",
+            cxxopts::value<size_t>()->default_value("100"))
+        ("keep-at-most", "Number of branches to report", cxxopts::value<size_t>()->default_value("7"))
+        ("keep-factor", "Minimum LWR to report", cxxopts::value<double>()->default_value("0.01"))
+        ("o,output", "Output .json file. Printed to stdout if not given", cxxopts::value<std::string>())
+        ("h,help", "Print usage")
+        ;
+
+    const auto parsed_options = options.parse(argc, argv);
+    if (parsed_options.count("help"))
+    {
+        std::cout << options.help() << std::endl;
+        return 0;
+    }
+
+    try
+    {
+        synthetic_config config;
+        config.num_leaves = parsed_options["leaves"].as<size_t>();
+        config.kmer_size = parsed_options["k"].as<size_t>();
+        config.omega = parsed_options["omega"].as<float>();
+        config.num_kmers = parsed_options["kmers"].as<size_t>();
+        config.posting_mean = parsed_options["posting-mean"].as<double>();
+        config.read_length = parsed_options["read-length"].as<size_t>();
+        config.hit_rate = parsed_options["hit-rate"].as<double>();
+        config.seed = parsed_options["seed"].as<uint64_t>();
+        const auto num_workers = std::max(parsed_options["workers"].as<size_t>(), size_t{1});
+        const auto queue_capacity = parsed_options["queue"].as<size_t>();
+        const auto rate = parsed_options["rate"].as<double>();
+        const auto num_warm_up = parsed_options["warm-up"].as<size_t>();
+        const auto num_reads = parsed_options["queries"].as<size_t>();
+        config.num_queries = num_reads + num_warm_up;
+
+        std::cerr << "Generating synthetic data..." << std::endl;
+        auto queries = make_queries(config);
+        const auto db = make_db(config, queries);
+        const auto tree = i2l::io::parse_newick(db.tree());
+        auto placer = epik::placer(db, tree, parsed_options["keep-at-most"].as<size_t>(),
+                                   parsed_options["keep-factor"].as<double>(), num_workers);
+
+        /// The warm-up reads are different from the measured ones
+        const auto warm_up = std::vector<std::string>(queries.begin() + (long)num_reads, queries.end());
+        queries.resize(num_reads);
+
+        std::mutex mutex;
+        std::vector<double> latencies;
+        std::vector<double> queued;
+        latencies.reserve(num_reads);
+        queued.reserve(num_reads);
+
+        std::cerr << "Placing " << num_reads << " reads..." << std::endl;
+        auto stream = epik::stream_placer(placer, num_workers, queue_capacity, [&](epik::placed_read&& read) {
+            std::lock_guard<std::mutex> lock(mutex);
+            latencies.push_back(std::chrono::duration<double, std::micro>(read.latency).count());
+            queued.push_back(std::chrono::duration<double, std::micro>(read.queued).count());
+        }, warm_up);
+
+        /// Reads arrive at a fixed rate, like from a sequencer, or as fast as they are placed
+        const auto begin = std::chrono::steady_clock::now();
+        for (size_t i = 0; i < queries.size(); ++i)
+        {
+            if (rate > 0.0)
+            {
+                std::this_thread::sleep_until(begin + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                    std::chrono::duration<double>((double)i / rate)));
+                stream.try_submit("read_" + std::to_string(i), queries[i]);
+            }
+            else
+            {
+                stream.submit("read_" + std::to_string(i), queries[i]);
+            }
+        }
+        stream.wait();
+        const auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+
+        const auto num_rejected = stream.num_rejected();
+        std::cerr << "\tplaced: " << latencies.size() << ", rejected: " << num_rejected << std::endl;
+        {
+            auto sorted = latencies;
+            std::sort(sorted.begin(), sorted.end());
+            std::cerr << "\tlatency p50: " << percentile(sorted, 0.5) << " us, p99: "
+                      << percentile(sorted, 0.99) << " us" << std::endl;
+        }
+
+        rapidjson::StringBuffer buffer;
+        rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+        writer.StartObject();
+        writer.Key("config");
+        writer.StartObject();
+        writer.Key("leaves");
+        writer.Uint64(config.num_leaves);
+        writer.Key("k");
+        writer.Uint64(config.kmer_size);
+        writer.Key("kmers");
+        writer.Uint64(config.num_kmers);
+        writer.Key("posting_mean");
+        writer.Double(config.posting_mean);
+        writer.Key("read_length");
+        writer.Uint64(config.read_length);
+        writer.Key("hit_rate");
+        writer.Double(config.hit_rate);
+        writer.Key("seed");
+        writer.Uint64(config.seed);
+        writer.EndObject();
+        writer.Key("workers");
+        writer.Uint64(num_workers);
+        writer.Key("queue");
+        writer.Uint64(queue_capacity);
+        writer.Key("rate");
+        writer.Double(rate);
+        writer.Key("submitted");
+        writer.Uint64(num_reads);
+        writer.Key("placed");
+        writer.Uint64(latencies.size());
+        writer.Key("rejected");
+        writer.Uint64(num_rejected);
+        writer.Key("reads_per_s");
+        writer.Double(seconds > 0 ? (double)latencies.size() / seconds : 0.0);
+        write_distribution(writer, "latency", latencies);
+        write_distribution(writer, "queued", queued);
+        writer.EndObject();
+
+        if (parsed_options.count("output"))
+        {
+            std::ofstream out(parsed_options["output"].as<std::string>());
+            out << buffer.GetString() << std::endl;
+        }
+        else
+        {
+            std::cout << buffer.GetString() << std::endl;
+        }
+    }
+    catch (const std::runtime_error& error)
+    {
+        std::cerr << "Error: " << error.what() << std::endl;
+        return -1;
+    }
+    return 0;
+}
@@ -0,0 +1,331 @@
+#include <cmath>
+#include <fstream>
+#include <algorithm>
+#include <functional>
+#include <numeric>
+#include <stdexcept>
+#include <unordered_set>
+#include <sstream>
+#include <iomanip>
+#include <type_traits>
+#include <i2l/phylo_kmer.h>
+#include <i2l/kmer_iterator.h>
+#include <i2l/seq_record.h>
+#include "synthetic.h"
+
+using namespace epik::bench;
+
+namespace
+{
+#if defined(SEQ_TYPE_AA)
+    constexpr std::string_view alphabet = "ARNDCQEGHILKMFPSTWYV";
+    constexpr char ambiguous_char = 'X';
+    constexpr const char* sequence_type = "amino";
+#else
+    constexpr std::string_view alphabet = "ACGT";
+    constexpr char ambiguous_char = 'N';
+    constexpr const char* sequence_type = "nucl";
+#endif
+
+    using tree_index_t = std::decay_t<decltype(std::declval<const i2l::phylo_kmer_db&>().tree_index())>;
+
+    /// A random tree together with the subtree information of every node,
+    /// indexed by post-order ids the same way the database does
+    struct random_tree
+    {
+        std::string newick;
+        tree_index_t index;
+    };
+
+    struct tree_node
+    {
+        std::vector<size_t> children;
+        double branch_length;
+    };
+
+    random_tree generate_tree(size_t num_leaves, std::mt19937_64& rng)
+    {
+        if (num_leaves < 2)
+        {
+            throw std::runtime_error("A synthetic tree must have at least two leaves");
+        }
+
+        std::exponential_distribution<double> length_distribution(10.0);
+        std::vector<tree_node> nodes;
+        nodes.reserve(2 * num_leaves - 1);
+
+        /// Join random pairs of subtrees until one is left
+        std::vector<size_t> roots;
+        for (size_t i = 0; i < num_leaves; ++i)
+        {
+            nodes.push_back({ {}, length_distribution(rng) });
+            roots.push_back(i);
+        }
+
+        while (roots.size() > 1)
+        {
+            std::uniform_int_distribution<size_t> pick(0, roots.size() - 1);
+            const auto i = pick(rng);
+            std::swap(roots[i], roots.back());
+            const auto left = roots.back();
+            roots.pop_back();
+
+            const auto j = std::uniform_int_distribution<size_t>(0, roots.size() - 1)(rng);
+            const auto right = roots[j];
+
+            nodes.push_back({ { left, right }, length_distribution(rng) });
+            roots[j] = nodes.size() - 1;
+        }
+
+        random_tree tree;
+        tree.index.resize(nodes.size());
+
+        std::ostringstream newick;
+        newick << std::setprecision(6);
+        size_t postorder_id = 0;
+
+        /// Returns the number of nodes and the total branch length of a subtree
+        std::function<std::pair<size_t, double>(size_t, bool)> visit = [&](size_t id, bool is_root) {
+            const auto& node = nodes[id];
+            size_t num_nodes = 1;
+            double total_length = 0.0;
+
+            if (!node.children.empty())
+            {
+                newick << "(";
+                for (size_t c = 0; c < node.children.size(); ++c)
+                {
+                    if (c > 0)
+                    {
+                        newick << ",";
+                    }
+                    const auto [child_nodes, child_length] = visit(node.children[c], false);
+                    num_nodes += child_nodes;
+                    total_length += child_length + nodes[node.children[c]].branch_length;
+                }
+                newick << ")";
+            }
+            else
+            {
+                newick << "L" << id;
+            }
+
+            if (!is_root)
+            {
+                newick << ":" << node.branch_length;
+            }
+
+            tree.index[postorder_id].subtree_num_nodes = num_nodes;
+            tree.index[postorder_id].subtree_total_length = total_length;
+            ++postorder_id;
+            return std::make_pair(num_nodes, total_length);
+        };
+        visit(roots[0], true);
+        newick << ";";
+
+        tree.newick = newick.str();
+        return tree;
+    }
+
+    std::string random_sequence(size_t length, double ambiguity_rate, std::mt19937_64& rng)
+    {
+        std::uniform_int_distribution<size_t> char_distribution(0, alphabet.size() - 1);
+        std::bernoulli_distribution is_ambiguous(ambiguity_rate);
+
+        std::string sequence(length, alphabet[0]);
+        for (auto& c : sequence)
+        {
+            c = is_ambiguous(rng) ? ambiguous_char : alphabet[char_distribution(rng)];
+        }
+        return sequence;
+    }
+
+    size_t posting_length(const synthetic_config& config, size_t num_branches, std::mt19937_64& rng)
+    {
+        const auto mean = std::max(config.posting_mean, 1.0);
+        size_t length = 1;
+        switch (config.postings)
+        {
+            case posting_distribution::fixed:
+                length = static_cast<size_t>(mean);
+                break;
+            case posting_distribution::uniform:
+                length = std::uniform_int_distribution<size_t>(1, static_cast<size_t>(2 * mean - 1))(rng);
+                break;
+            case posting_distribution::geometric:
+                length = 1 + std::geometric_distribution<size_t>(1.0 / mean)(rng);
+                break;
+        }
+        return std::clamp(length, size_t{ 1 }, num_branches);
+    }
+}
+
+posting_distribution epik::bench::parse_posting_distribution(const std::string& name)
+{
+    if (name == "fixed")
+    {
+        return posting_distribution::fixed;
+    }
+    else if (name == "uniform")
+    {
+        return posting_distribution::uniform;
+    }
+    else if (name == "geometric")
+    {
+        return posting_distribution::geometric;
+    }
+    throw std::runtime_error("Unknown posting list distribution: " + name);
+}
+
+std::string epik::bench::to_string(posting_distribution distribution)
+{
+    switch (distribution)
+    {
+        case posting_distribution::fixed:
+            return "fixed";
+        case posting_distribution::uniform:
+            return "uniform";
+        case posting_distribution::geometric:
+            return "geometric";
+    }
+    return "";
+}
+
+std::string epik::bench::make_random_tree(size_t num_leaves, std::mt19937_64& rng)
+{
+    return generate_tree(num_leaves, rng).newick;
+}
+
+std::vector<std::string> epik::bench::make_queries(const synthetic_config& config)
+{
+    if (config.read_length < config.kmer_size)
+    {
+        throw std::runtime_error("Synthetic reads must be at least k characters long");
+    }
+
+    std::mt19937_64 rng(config.seed);
+    std::vector<std::string> queries;
+    queries.reserve(config.num_queries);
+    if (config.redundancy <= 0.0)
+    {
+        for (size_t i = 0; i < config.num_queries; ++i)
+        {
+            queries.push_back(random_sequence(config.read_length, config.ambiguity_rate, rng));
+        }
+        return queries;
+    }
+
+    /// Amplicon-like reads: copies of a few templates with substitutions,
+    /// so that most reads are different but share most of their k-mers
+    const auto num_templates = std::max(size_t{ 1 }, static_cast<size_t>(
+        std::round((double)config.num_queries * (1.0 - std::min(config.redundancy, 1.0)))));
+    std::vector<std::string> templates;
+    for (size_t i = 0; i < num_templates; ++i)
+    {
+        templates.push_back(random_sequence(config.read_length, config.ambiguity_rate, rng));
+    }
+
+    std::uniform_int_distribution<size_t> template_distribution(0, num_templates - 1);
+    std::uniform_int_distribution<size_t> char_distribution(0, alphabet.size() - 1);
+    std::bernoulli_distribution is_substituted(config.substitution_rate);
+    for (size_t i = 0; i < config.num_queries; ++i)
+    {
+        auto query = templates[template_distribution(rng)];
+        for (auto& c : query)
+        {
+            if (is_substituted(rng))
+            {
+                c = alphabet[char_distribution(rng)];
+            }
+        }
+        queries.push_back(std::move(query));
+    }
+    return queries;
+}
+
+i2l::phylo_kmer_db epik::bench::make_db(const synthetic_config& config, const std::vector<std::string>& queries)
+{
+    std::mt19937_64 rng(config.seed + 1);
+    const auto tree = generate_tree(config.num_leaves, rng);
+    const auto num_branches = tree.index.size();
+
+    /// Collect the keys: a part of the query k-mers and random ones
+    std::unordered_set<i2l::phylo_kmer::key_type> keys;
+    std::bernoulli_distribution is_hit(config.hit_rate);
+    for (const auto& query : queries)
+    {
+        for (const auto& [kmer, kmer_keys] : i2l::to_kmers<i2l::one_ambiguity_policy>(query, config.kmer_size))
+        {
+            (void)kmer;
+            if (kmer_keys.size() == 1 && is_hit(rng))
+            {
+                keys.insert(kmer_keys[0]);
+            }
+        }
+    }
+
+    /// The key space can be smaller than requested for small k. Give up after a while
+    const size_t chunk_size = 1000;
+    size_t attempts = 4 * config.num_kmers / chunk_size + 1;
+    while (keys.size() < config.num_kmers && attempts-- > 0)
+    {
+        const auto chunk = random_sequence(chunk_size + config.kmer_size - 1, 0.0, rng);
+        for (const auto& [kmer, kmer_keys] : i2l::to_kmers<i2l::one_ambiguity_policy>(chunk, config.kmer_size))
+        {
+            (void)kmer;
+            keys.insert(kmer_keys[0]);
+            if (keys.size() == config.num_kmers)
+            {
+                break;
+            }
+        }
+    }
+
+    i2l::phylo_kmer_db db(config.kmer_size, config.omega, sequence_type, tree.newick);
+    db.tree_index() = tree.index;
+
+    /// Scores are uniform between the threshold and zero
+    const auto log_threshold = std::log10(i2l::score_threshold(config.omega, config.kmer_size));
+    std::uniform_real_distribution<i2l::phylo_kmer::score_type> score_distribution(log_threshold, 0.0f);
+
+    /// Branches are sampled without replacement with a partial Fisher-Yates shuffle
+    std::vector<i2l::phylo_kmer::branch_type> branches(num_branches);
+    std::iota(branches.begin(), branches.end(), 0);
+
+    for (const auto key : keys)
+    {
+        const auto length = posting_length(config, num_branches, rng);
+        for (size_t i = 0; i < length; ++i)
+        {
+            const auto j = std::uniform_int_distribution<size_t>(i, num_branches - 1)(rng);
+            std::swap(branches[i], branches[j]);
+            db.unsafe_insert(key, { branches[i], score_distribution(rng) });
+        }
+    }
+    return db;
+}
+
+std::vector<i2l::seq_record> epik::bench::make_records(const std::vector<std::string>& queries)
+{
+    std::vector<i2l::seq_record> records;
+    records.reserve(queries.size());
+    for (size_t i = 0; i < queries.size(); ++i)
+    {
+        records.emplace_back("q" + std::to_string(i), queries[i]);
+    }
+    return records;
+}
+
+void epik::bench::write_fasta(const std::string& filename, const std::vector<std::string>& queries)
+{
+    std::ofstream out(filename);
+    if (!out)
+    {
+        throw std::runtime_error("Could not create file " + filename);
+    }
+
+    for (size_t i = 0; i < queries.size(); ++i)
+    {
+        out << ">q" << i << '\n' << queries[i] << '\n';
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef EPIK_BENCH_SYNTHETIC_H
+#define EPIK_BENCH_SYNTHETIC_H
+
+#include <string>
+#include <vector>
+#include <random>
+#include <i2l/phylo_kmer_db.h>
+
+namespace i2l
+{
+    class seq_record;
+}
+
+namespace epik::bench
+{
+    /// The distribution of posting list lengths, i.e. the number of
+    /// branches a phylo-k-mer of the synthetic database is stored for
+    enum class posting_distribution
+    {
+        fixed,
+        uniform,
+        geometric
+    };
+
+    posting_distribution parse_posting_distribution(const std::string& name);
+    std::string to_string(posting_distribution distribution);
+
+    /// \brief Parameters of a synthetic database and query set
+    struct synthetic_config
+    {
+        /// The number of leaves of the random binary tree. The tree has 2n-1 nodes
+        size_t num_leaves = 1000;
+
+        size_t kmer_size = 10;
+        float omega = 1.5;
+
+        /// The number of distinct k-mers stored in the database
+        size_t num_kmers = 1000000;
+
+        posting_distribution postings = posting_distribution::geometric;
+        double posting_mean = 20.0;
+
+        size_t num_queries = 10000;
+        size_t read_length = 150;
+
+        /// The probability of a query character to be ambiguous
+        double ambiguity_rate = 0.0;
+
+        /// The proportion of query k-mers that are present in the database
+        double hit_rate = 0.5;
+
+        /// If positive, queries are copies of num_queries * (1 - redundancy) random templates
+        /// with substitutions, like amplicon reads. Otherwise every query is random
+        double redundancy = 0.0;
+
+        /// The probability of a character of a redundant query to be substituted
+        double substitution_rate = 0.01;
+
+        uint64_t seed = 42;
+    };
+
+    /// \brief Generates a random rooted binary tree in the newick format
+    std::string make_random_tree(size_t num_leaves, std::mt19937_64& rng);
+
+    /// \brief Generates random query sequences, see synthetic_config::redundancy
+    std::vector<std::string> make_queries(const synthetic_config& config);
+
+    /// \brief Builds a database over a random tree. A config.hit_rate proportion of the
+    /// k-mers of the queries is stored; the rest of the keys are random.
+    i2l::phylo_kmer_db make_db(const synthetic_config& config, const std::vector<std::string>& queries);
+
+    /// \brief Wraps the query sequences into fasta records with generated headers
+    std::vector<i2l::seq_record> make_records(const std::vector<std::string>& queries);
+
+    /// \brief Writes the query sequences to a .fasta file with the same headers as make_records
+    void write_fasta(const std::string& filename, const std::vector<std::string>& queries);
+}
+
+#endif
@@ -0,0 +1,194 @@
+#ifndef EPIK_ACCUMULATOR_H
+#define EPIK_ACCUMULATOR_H
+
+#include <vector>
+#include <utility>
+#include <iterator>
+#include <i2l/phylo_kmer.h>
+#include <epik/intrinsic.h>
+#include <epik/tier.h>
+
+namespace epik::impl
+{
+    /// \brief The scores of the branches for one query: the arrays S[], C[] and L[]
+    /// in terms of the RAPPAS' supplement, plus their counterparts for ambiguous k-mers.
+    /// \details A query touches a small part of a large tree, so the scores are first stored
+    /// in an open-addressing hash table that grows with the number of branches scored.
+    /// Once a query scores more than 1/dense_fraction of the branches, the accumulator
+    /// switches to dense arrays of the size of the tree and keeps them for the next queries.
+    /// After sparse_after queries in a row that would have fit in the hash table, the dense
+    /// arrays are released and the accumulator is sparse again: its memory follows the queries,
+    /// not the tree. Trees of no more than min_sparse_branches branches use dense arrays only.
+    /// The hash table of a query scoring the whole tree would be larger than the dense arrays,
+    /// so the memory of an accumulator is bounded by max_bytes(). Both forms give the same scores
+    /// and the same order of branches.
+    class score_accumulator
+    {
+    public:
+        using score_type = i2l::phylo_kmer::score_type;
+        using branch_type = i2l::phylo_kmer::branch_type;
+
+        static constexpr size_t dense_fraction = 16;
+        static constexpr size_t min_sparse_branches = 4096;
+        static constexpr size_t sparse_after = 64;
+
+        explicit score_accumulator(size_t num_branches);
+
+        /// \brief The memory taken by the dense form for a tree, with the hits of dense tier rows
+        static size_t dense_bytes(size_t num_branches) noexcept;
+
+        /// \brief The most memory an accumulator takes for a tree: the dense form, the branches scored,
+        /// and the hash table the dense form is made from while both are allocated
+        static size_t max_bytes(size_t num_branches) noexcept;
+
+        /// \brief Forgets the scores of the previous query
+        void clear();
+
+        /// \brief Adds the scores of a posting list and counts one hit for every branch.
+        /// The vectorized update_vector is used in the dense form
+        template<class PostingList>
+        void add_postings(const PostingList& postings);
+
+        /// \brief Adds a score and a number of hits to a branch
+        void add(branch_type branch, score_type score, size_t count);
+
+        /// \brief Adds a row of the dense tier if the accumulator is dense. Rows are applied together
+        /// by apply_rows(). Returns false if it is sparse: the postings of the k-mer must be added instead,
+        /// and make it dense if they score enough branches
+        bool add_row(const dense_tier::row& row);
+
+        /// \brief Applies the rows added since the last call. The branches scored only by rows
+        /// follow the other ones in edges(), in the order of their ids
+        void apply_rows();
+
+        /// \brief Adds the probability of an ambiguous k-mer key to a branch.
+        /// Returns true if it is the first ambiguous key of the query that scores the branch
+        bool add_ambiguous(branch_type branch, score_type probability);
+
+        /// \brief The sum of probabilities and the number of ambiguous keys scoring a branch
+        std::pair<score_type, size_t> ambiguous(branch_type branch) const;
+
+        /// \brief Calls f(branch, score, count) for every branch scored, in the order of edges()
+        template<class Function>
+        void for_each(Function f) const;
+
+        /// \brief Branches in the order they were first scored
+        const std::vector<branch_type>& edges() const noexcept;
+
+        bool is_dense() const noexcept;
+
+    private:
+        struct entry
+        {
+            branch_type branch;
+            uint32_t count;
+            uint32_t count_amb;
+            score_type score;
+            score_type score_amb;
+        };
+
+        static constexpr branch_type empty_branch = static_cast<branch_type>(-1);
+
+        const entry* _find(branch_type branch) const;
+        entry& _find_or_insert(branch_type branch);
+        void _rehash(size_t capacity);
+
+        /// \brief Moves the scores from the hash table to dense arrays
+        void _make_dense();
+
+        /// \brief Releases the dense arrays of an accumulator with no scores and goes back to the hash table
+        void _make_sparse();
+
+        /// \brief Switches to the dense form if the query scores too many branches
+        void _check_density()
+        {
+            if (_slots.size() > _dense_threshold)
+            {
+                _make_dense();
+            }
+        }
+
+        size_t _num_branches;
+        size_t _dense_threshold;
+        bool _dense;
+
+        /// The number of the last queries in a row that were placed dense and would have fit in the hash table
+        size_t _num_small_queries;
+
+        /// The sparse form: a hash table of power of two size and the indices of its used slots
+        std::vector<entry> _table;
+        std::vector<size_t> _slots;
+        size_t _shift;
+
+        /// The dense form, allocated by the first query that needs it
+        std::vector<score_type> _scores;
+        std::vector<score_type> _scores_amb;
+        std::vector<size_t> _counts;
+        std::vector<size_t> _counts_amb;
+
+        /// The rows of the dense tier added and not applied yet, and the hits of the rows applied
+        std::vector<dense_tier::row> _rows;
+        std::vector<uint32_t> _row_hits;
+
+        std::vector<branch_type> _edges;
+    };
+
+    template<class PostingList>
+    void score_accumulator::add_postings(const PostingList& postings)
+    {
+        if (_dense)
+        {
+            update_vector(_scores, _counts, _edges, postings);
+            return;
+        }
+
+        auto it = std::begin(postings);
+        const auto end = std::end(postings);
+        for (; it != end && !_dense; ++it)
+        {
+            const auto& [branch, score] = *it;
+            auto& e = _find_or_insert(branch);
+            if (e.count == 0)
+            {
+                _edges.push_back(branch);
+            }
+            ++e.count;
+            e.score += score;
+            _check_density();
+        }
+
+        /// The rest of the list if the accumulator has just become dense
+        for (; it != end; ++it)
+        {
+            const auto& [branch, score] = *it;
+            if (_counts[branch] == 0)
+            {
+                _edges.push_back(branch);
+            }
+            ++_counts[branch];
+            _scores[branch] += score;
+        }
+    }
+
+    template<class Function>
+    void score_accumulator::for_each(Function f) const
+    {
+        if (_dense)
+        {
+            for (const auto branch : _edges)
+            {
+                f(branch, _scores[branch], _counts[branch]);
+            }
+        }
+        else
+        {
+            for (const auto branch : _edges)
+            {
+                const auto* e = _find(branch);
+                f(branch, e->score, static_cast<size_t>(e->count));
+            }
+        }
+    }
+}
+
+#endif
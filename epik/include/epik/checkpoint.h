@@ -0,0 +1,53 @@
+#ifndef EPIK_CHECKPOINT_H
+#define EPIK_CHECKPOINT_H
+
+#include <string>
+#include <vector>
+#include <optional>
+
+namespace epik
+{
+    /// \brief The state of a placement run after a completed batch, to resume it after an interruption
+    struct checkpoint
+    {
+        /// An output .jplace file written up to position, with num_placements placements
+        /// starting at placements_begin, and the mass table at the checkpoint if the mass
+        /// is written (empty otherwise)
+        struct output
+        {
+            std::string filename;
+            size_t position;
+            size_t num_placements;
+            std::string mass_snapshot;
+            size_t placements_begin;
+        };
+
+        std::string query_file;
+
+        /// The batch size of the run. A resumed run uses the same batches
+        size_t batch_size;
+
+        /// The number of query sequences placed and the input read, bytes. A resumed run
+        /// reads the input from input_offset, which must be where a record starts
+        size_t num_sequences;
+        size_t input_offset;
+
+        /// The file of mates read, bytes, for paired-end reads (0 otherwise)
+        size_t mates_offset;
+
+        std::vector<output> outputs;
+    };
+
+    /// \brief Writes a checkpoint to a temporary file renamed to filename, so that
+    /// filename always contains a complete checkpoint. The file and the rename are flushed
+    /// to the disk: the outputs it refers to must be flushed before (see sync_file)
+    void save_checkpoint(const std::string& filename, const checkpoint& state);
+
+    /// \brief Reads a checkpoint. Returns nothing if the file does not exist
+    std::optional<checkpoint> load_checkpoint(const std::string& filename);
+
+    /// \brief Flushes a closed file, or the entries of a directory, to the disk
+    void sync_file(const std::string& filename);
+}
+
+#endif
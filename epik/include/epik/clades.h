@@ -0,0 +1,91 @@
+#ifndef EPIK_CLADES_H
+#define EPIK_CLADES_H
+
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include <i2l/phylo_kmer.h>
+#include <epik/ordinal.h>
+
+namespace i2l
+{
+    class phylo_kmer_db;
+}
+
+namespace epik::impl
+{
+    /// \brief The tree split into clades, and the best score of every k-mer in every clade.
+    /// \details Clades are ranges of post-order ids made of whole subtrees of at most max_size nodes
+    /// (found with phylo_kmer_db::tree_index) and of the nodes above them, packed in post-order.
+    /// For every k-mer, the summary keeps the largest score of its postings in every clade it scores.
+    /// The sum of these scores over the k-mers of a query, with the threshold score for the k-mers
+    /// that do not score a clade, is an upper bound of the score of every branch of the clade:
+    /// the coarse stage of placer ranks clades by it. Like impl::dense_tier, the summary of a k-mer
+    /// is found by its key: k-mers are numbered by an impl::ordinal_index
+    class clade_index
+    {
+    public:
+        using score_type = i2l::phylo_kmer::score_type;
+        using branch_type = i2l::phylo_kmer::branch_type;
+
+        /// \brief The best score of a k-mer in a clade
+        struct entry
+        {
+            uint32_t clade;
+            score_type score;
+        };
+
+        /// \brief Splits the tree of db into clades of at most max_size nodes and summarizes
+        /// the k-mers. Scores lower than log_threshold are raised to it
+        clade_index(const i2l::phylo_kmer_db& db, size_t num_branches, size_t max_size, score_type log_threshold);
+
+        /// \brief The entries of a k-mer of the database, [first, last). None for a k-mer not in the database
+        /// or with an empty posting list
+        std::pair<const entry*, const entry*> find(i2l::phylo_kmer::key_type key) const noexcept
+        {
+            const auto ordinal = _summaries.find(key);
+            if (ordinal == ordinal_index::none)
+            {
+                return { nullptr, nullptr };
+            }
+            return { _entries.data() + _offsets[ordinal], _entries.data() + _offsets[ordinal + 1] };
+        }
+
+        /// \brief The clade of a branch
+        uint32_t clade_of(branch_type branch) const noexcept
+        {
+            return _clade_of[branch];
+        }
+
+        /// \brief The number of branches of a clade
+        uint32_t clade_size(uint32_t clade) const noexcept
+        {
+            return _clade_sizes[clade];
+        }
+
+        size_t num_clades() const noexcept;
+
+        /// \brief The largest clade, in branches
+        size_t max_size() const noexcept;
+
+        /// \brief The number of entries of all k-mers
+        size_t num_entries() const noexcept;
+
+        size_t memory_bytes() const noexcept;
+
+    private:
+        size_t _num_clades;
+        size_t _max_size;
+        std::vector<uint32_t> _clade_of;
+        std::vector<uint32_t> _clade_sizes;
+
+        /// The entries of the k-mer number i are _entries[_offsets[i], _offsets[i + 1])
+        std::vector<entry> _entries;
+        std::vector<size_t> _offsets;
+
+        /// The key of a k-mer -> its number
+        ordinal_index _summaries;
+    };
+}
+
+#endif
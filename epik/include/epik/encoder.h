@@ -0,0 +1,283 @@
+#ifndef EPIK_ENCODER_H
+#define EPIK_ENCODER_H
+
+#include <array>
+#include <vector>
+#include <memory>
+#include <string_view>
+#include <cstdint>
+#include <i2l/phylo_kmer.h>
+
+namespace epik::impl
+{
+    /// \brief A table-driven equivalent of i2l::to_kmers with one_ambiguity_policy.
+    /// \details The codes of the characters and the way i2l combines them into keys are learned
+    /// from i2l and checked against it, so the keys are the same. Every character is looked up
+    /// in a table once, a key is updated in O(1) per position and an ambiguous character is
+    /// resolved by a precomputed table instead of enumerating k-mers. It matters most for proteins:
+    /// ambiguous residues (B, Z, J, X) resolve to up to 20 keys each
+    class kmer_encoder
+    {
+    public:
+        using key_type = i2l::phylo_kmer::key_type;
+
+        /// \brief Learns the encoding of k-mers of size kmer_size. Returns nullptr if it can not be
+        /// reproduced with tables; i2l::to_kmers must be used then.
+        /// \details If specialize is set and k is a common one for the alphabet (see specialized()),
+        /// k-mers are encoded by a kernel compiled for this k
+        static std::unique_ptr<kmer_encoder> make(size_t kmer_size, bool specialize = true);
+
+        kmer_encoder(const kmer_encoder&) = delete;
+        kmer_encoder& operator=(const kmer_encoder&) = delete;
+        ~kmer_encoder() noexcept = default;
+
+        /// \brief Calls on_exact(kmer, key) for every k-mer without ambiguous characters and
+        /// on_ambiguous(keys) for every k-mer with one ambiguous character, in the order of i2l::to_kmers.
+        /// \details Returns false without calling anything if the sequence has characters whose
+        /// handling by i2l the tables do not reproduce: it must be encoded with i2l::to_kmers then
+        template<typename OnExact, typename OnAmbiguous>
+        bool encode(std::string_view seq, OnExact&& on_exact, OnAmbiguous&& on_ambiguous) const;
+
+        size_t kmer_size() const noexcept;
+
+        /// \brief True if the kernel compiled for k is used: 2 bits per character (DNA) and k from 8 to 12,
+        /// or 5 bits per character (proteins) and k from 3 to 7. Other k are encoded by the generic kernel
+        bool specialized() const noexcept;
+
+    private:
+        enum class char_class : uint8_t
+        {
+            /// Resolves to one code
+            exact,
+
+            /// Resolves to several codes
+            ambiguous,
+
+            /// Is not a part of any k-mer
+            separator,
+
+            /// Handled by i2l in some other way
+            unsupported
+        };
+
+        explicit kmer_encoder(size_t kmer_size) noexcept;
+
+        /// \brief Updates of the key by the next character for any k and base: they are read from the encoder
+        template<bool MostSignificantFirst, bool PowerOfTwo>
+        struct runtime_rolling
+        {
+            const kmer_encoder& encoder;
+
+            size_t kmer_size() const noexcept
+            {
+                return encoder._kmer_size;
+            }
+
+            uint64_t roll(uint64_t key, uint64_t code) const noexcept
+            {
+                if constexpr (MostSignificantFirst && PowerOfTwo)
+                {
+                    return ((key << encoder._shift) | code) & (encoder._range - 1);
+                }
+                else if constexpr (MostSignificantFirst)
+                {
+                    return (key * encoder._base + code) % encoder._range;
+                }
+                else if constexpr (PowerOfTwo)
+                {
+                    return (key >> encoder._shift) | (code << (encoder._shift * (encoder._kmer_size - 1)));
+                }
+                else
+                {
+                    return key / encoder._base + code * encoder._weights.back();
+                }
+            }
+
+            uint64_t weight(size_t position) const noexcept
+            {
+                return encoder._weights[position];
+            }
+        };
+
+        /// \brief Updates of the key for k and bits per character known at compile time:
+        /// shifts and masks are constants and the loops over k are unrolled
+        template<size_t KmerSize, size_t Shift>
+        struct fixed_rolling
+        {
+            static constexpr uint64_t mask = (uint64_t{ 1 } << (KmerSize * Shift)) - 1;
+
+            static constexpr size_t kmer_size() noexcept
+            {
+                return KmerSize;
+            }
+
+            static constexpr uint64_t roll(uint64_t key, uint64_t code) noexcept
+            {
+                return ((key << Shift) | code) & mask;
+            }
+
+            static constexpr uint64_t weight(size_t position) noexcept
+            {
+                return uint64_t{ 1 } << (Shift * (KmerSize - 1 - position));
+            }
+        };
+
+        /// \brief Encodes with the kernel compiled for k if k is one of KmerSizes. Returns false otherwise
+        template<size_t Shift, size_t... KmerSizes, typename OnExact, typename OnAmbiguous>
+        bool _encode_fixed(std::string_view seq, OnExact& on_exact, OnAmbiguous& on_ambiguous) const
+        {
+            return ((_kmer_size == KmerSizes &&
+                     (_encode(seq, on_exact, on_ambiguous, fixed_rolling<KmerSizes, Shift>{}), true)) || ...);
+        }
+
+        template<typename OnExact, typename OnAmbiguous>
+        bool _encode_specialized(std::string_view seq, OnExact& on_exact, OnAmbiguous& on_ambiguous) const
+        {
+            if (_shift == 2)
+            {
+                return _encode_fixed<2, 8, 9, 10, 11, 12>(seq, on_exact, on_ambiguous);
+            }
+            else if (_shift == 5)
+            {
+                return _encode_fixed<5, 3, 4, 5, 6, 7>(seq, on_exact, on_ambiguous);
+            }
+            return false;
+        }
+
+        template<typename OnExact, typename OnAmbiguous, typename Rolling>
+        void _encode(std::string_view seq, OnExact& on_exact, OnAmbiguous& on_ambiguous, const Rolling& rolling) const;
+
+        /// \brief Checks if a sequence is encoded the same way as by i2l
+        bool _agrees(std::string_view seq) const;
+
+        size_t _kmer_size;
+
+        /// A key is the sum of code * weight of its characters. The weights are powers of the base,
+        /// decreasing if the first character is the most significant one
+        uint64_t _base;
+        bool _most_significant_first;
+        bool _specialized;
+
+        /// log2 of the base if it is a power of two, 0 otherwise
+        uint64_t _shift;
+
+        /// base ^ k
+        uint64_t _range;
+        std::vector<uint64_t> _weights;
+
+        std::array<char_class, 256> _classes;
+        std::array<uint64_t, 256> _codes;
+
+        /// The codes of an ambiguous character c are _resolutions[_first_resolution[c].._first_resolution[c + 1])
+        std::vector<uint64_t> _resolutions;
+        std::array<uint32_t, 257> _first_resolution;
+    };
+
+    template<typename OnExact, typename OnAmbiguous>
+    bool kmer_encoder::encode(std::string_view seq, OnExact&& on_exact, OnAmbiguous&& on_ambiguous) const
+    {
+        for (const auto c : seq)
+        {
+            if (_classes[static_cast<unsigned char>(c)] == char_class::unsupported)
+            {
+                return false;
+            }
+        }
+
+        if (_specialized && _encode_specialized(seq, on_exact, on_ambiguous))
+        {
+            return true;
+        }
+
+        if (_most_significant_first)
+        {
+            if (_shift > 0)
+            {
+                _encode(seq, on_exact, on_ambiguous, runtime_rolling<true, true>{ *this });
+            }
+            else
+            {
+                _encode(seq, on_exact, on_ambiguous, runtime_rolling<true, false>{ *this });
+            }
+        }
+        else
+        {
+            if (_shift > 0)
+            {
+                _encode(seq, on_exact, on_ambiguous, runtime_rolling<false, true>{ *this });
+            }
+            else
+            {
+                _encode(seq, on_exact, on_ambiguous, runtime_rolling<false, false>{ *this });
+            }
+        }
+        return true;
+    }
+
+    template<typename OnExact, typename OnAmbiguous, typename Rolling>
+    void kmer_encoder::_encode(std::string_view seq, OnExact& on_exact, OnAmbiguous& on_ambiguous,
+                               const Rolling& rolling) const
+    {
+        const auto kmer_size = rolling.kmer_size();
+        std::vector<key_type> keys;
+        uint64_t key = 0;
+
+        /// Positions (starting from 1) of the last separator and of the last two ambiguous characters.
+        /// Ambiguous characters take code 0 in the key
+        size_t last_separator = 0;
+        size_t last_ambiguous = 0;
+        size_t previous_ambiguous = 0;
+
+        for (size_t i = 0; i < seq.size(); ++i)
+        {
+            const auto c = static_cast<unsigned char>(seq[i]);
+            switch (_classes[c])
+            {
+                case char_class::exact:
+                    key = rolling.roll(key, _codes[c]);
+                    break;
+                case char_class::ambiguous:
+                    key = rolling.roll(key, 0);
+                    previous_ambiguous = last_ambiguous;
+                    last_ambiguous = i + 1;
+                    break;
+                default:
+                    key = rolling.roll(key, 0);
+                    last_separator = i + 1;
+                    break;
+            }
+
+            if (i + 1 < kmer_size)
+            {
+                continue;
+            }
+
+            /// The k-mer is seq[start..i]
+            const auto start = i + 1 - kmer_size;
+            if (last_separator > start)
+            {
+                continue;
+            }
+
+            if (last_ambiguous <= start)
+            {
+                on_exact(seq.substr(start, kmer_size), static_cast<key_type>(key));
+            }
+            else if (previous_ambiguous <= start)
+            {
+                const auto position = last_ambiguous - 1;
+                const auto weight = rolling.weight(position - start);
+                const auto ambiguous = static_cast<unsigned char>(seq[position]);
+
+                keys.clear();
+                for (auto r = _first_resolution[ambiguous]; r < _first_resolution[ambiguous + 1]; ++r)
+                {
+                    keys.push_back(static_cast<key_type>(key + _resolutions[r] * weight));
+                }
+                on_ambiguous(keys);
+            }
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef EPIK_EPIK_H
+#define EPIK_EPIK_H
+
+/// The public API of libepik: in-process phylogenetic placement.
+/// This header does not depend on i2l or other third-party headers, and the
+/// implementation is hidden behind a pointer, so that it stays stable between releases.
+
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#define EPIK_API_VERSION 1
+
+namespace epik
+{
+    /// \brief Parameters of a placement session. The defaults are those of epik-dna and epik-aa
+    struct options
+    {
+        /// Proportion of the database to load, see --mu
+        float mu = 1.0f;
+
+        /// Determines the score threshold, see --omega
+        float omega = 1.5f;
+
+        /// Maximum number of phylo-k-mers to load, see --max-ram
+        size_t max_entries = std::numeric_limits<size_t>::max();
+
+        /// Number of branches to report, see --keep-at-most
+        size_t keep_at_most = 7;
+
+        /// Minimum LWR to report, see --keep-factor
+        double keep_factor = 0.01;
+
+        /// Number of placement threads, see --jobs
+        size_t num_threads = 1;
+    };
+
+    /// \brief One placement of a query: the same fields as reported in .jplace
+    struct branch_placement
+    {
+        uint32_t edge_num;
+        float likelihood;
+        double like_weight_ratio;
+        double distal_length;
+        double pendant_length;
+    };
+
+    /// \brief A query sequence. Memory is owned by the caller
+    struct query
+    {
+        std::string_view header;
+        std::string_view sequence;
+    };
+
+    /// \brief Receives the placements of one query. Called once for every query of a batch,
+    /// from the thread that called session::place. The views are valid only during the call.
+    using placement_callback = std::function<void(std::string_view header,
+                                                  const std::vector<branch_placement>& placements)>;
+
+    /// \brief A loaded database ready to place queries
+    class session
+    {
+    public:
+        /// \brief Loads a database. Throws std::runtime_error on failure
+        explicit session(const std::string& db_filename, const options& opts = options{});
+        session(const session&) = delete;
+        session(session&&) noexcept;
+        session& operator=(const session&) = delete;
+        session& operator=(session&&) noexcept;
+        ~session() noexcept;
+
+        /// \brief Places a batch of queries and reports the placements through the callback.
+        /// Identical sequences of the batch are placed once.
+        void place(const std::vector<query>& batch, const placement_callback& callback);
+
+        /// \brief Places a batch of queries. Returns the placements in the order of the batch
+        std::vector<std::vector<branch_placement>> place(const std::vector<query>& batch);
+
+        /// \brief The reference tree in the newick format with the edge numbers used in placements
+        const std::string& newick() const noexcept;
+
+        size_t kmer_size() const noexcept;
+        float omega() const noexcept;
+        const std::string& sequence_type() const noexcept;
+
+        /// \brief Number of phylo-k-mers loaded and stored in the database
+        size_t num_entries_loaded() const noexcept;
+        size_t num_entries_total() const noexcept;
+
+    private:
+        struct context;
+        std::unique_ptr<context> _context;
+    };
+}
+
+#endif
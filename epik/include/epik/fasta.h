@@ -0,0 +1,101 @@
+#ifndef EPIK_FASTA_H
+#define EPIK_FASTA_H
+
+#include <string>
+#include <vector>
+#include <epik/place.h>
+#include <epik/split.h>
+
+namespace epik::io
+{
+    /// \brief Reads the records of a fasta file (or of a range of it) in batches, parsed by several threads.
+    /// \details Fastq files are also read, if the range starts with '@': their records are four lines,
+    /// and qualities are ignored. The file is mapped to memory. The records of a window of the file are found by all threads,
+    /// each scanning a part of the window, and then the records of a batch are parsed in parallel.
+    /// Headers and sequences written on one line, which includes all fastq records, are views of the mapping,
+    /// without copies. Fasta sequences written on several lines are copied: they are joined into strings owned
+    /// by the reader, one per record of the batch. The views of a batch are valid until the next batch is read
+    class mapped_fasta
+    {
+    public:
+        mapped_fasta(const std::string& filename, size_t batch_size, size_t num_threads);
+        mapped_fasta(const std::string& filename, split::byte_range range, size_t batch_size, size_t num_threads);
+        mapped_fasta(const mapped_fasta&) = delete;
+        mapped_fasta(mapped_fasta&&) = delete;
+        mapped_fasta& operator=(const mapped_fasta&) = delete;
+        mapped_fasta& operator=(mapped_fasta&&) = delete;
+        ~mapped_fasta() noexcept;
+
+        /// \brief The next batch_size records, or less at the end of the range
+        std::vector<impl::seq_view> next_batch();
+
+        /// \brief The number of bytes of the range read so far: up to the first record not read
+        size_t bytes_read() const noexcept;
+
+        /// \brief If a record of the file starts at the beginning of the range, or the range is empty.
+        /// The record starts like the first one of the file. A fastq record is the line of '@' followed
+        /// by a line of sequence and a line of '+'
+        bool at_record_start() const noexcept;
+
+    private:
+        /// \brief Finds the records starting in the next window of the range
+        void _scan_window();
+
+        const char* _data;
+        size_t _file_size;
+        split::byte_range _range;
+        size_t _batch_size;
+        size_t _num_threads;
+
+        /// The positions of the records found and not read yet, from _records[_next_record]
+        std::vector<size_t> _records;
+        size_t _next_record;
+
+        /// The range is scanned for records up to this position
+        size_t _scanned;
+
+        /// Where the first record not read starts
+        size_t _position;
+
+        /// The sequences of the last batch written on several lines, joined
+        std::vector<std::string> _joined;
+
+        /// If the file is fastq
+        bool _fastq;
+    };
+
+    /// \brief Reads paired-end reads from two files of mates, in the same order, in batches.
+    /// \details The mates of a pair are joined into one sequence, separated by impl::mate_separator,
+    /// and placed together: the k-mers of both mates score the same branches. Every batch has two views
+    /// per pair, one for the header of each mate, of the same joined sequence, so that the pair is placed
+    /// once and reported under both headers. Mates are taken as they are written, without reverse-complementing
+    /// the second one, like every query of EPIK. The views of a batch are valid until the next batch is read
+    class paired_fasta
+    {
+    public:
+        /// \brief Reads the files from the given offsets, where the records of a pair start
+        paired_fasta(const std::string& first_filename, const std::string& second_filename,
+                     size_t batch_size, size_t num_threads, size_t first_offset = 0, size_t second_offset = 0);
+
+        /// \brief The views of the next batch_size pairs, or less at the end of the files
+        std::vector<impl::seq_view> next_batch();
+
+        /// \brief The number of bytes of the first file read so far, from its offset
+        size_t bytes_read() const noexcept;
+
+        /// \brief The number of bytes of the second file read so far, from its offset
+        size_t mates_bytes_read() const noexcept;
+
+        /// \brief If records start at the offsets of both files (see mapped_fasta::at_record_start)
+        bool at_record_start() const noexcept;
+
+    private:
+        mapped_fasta _first;
+        mapped_fasta _second;
+
+        /// The joined mates of the last batch
+        std::vector<std::string> _pairs;
+    };
+}
+
+#endif
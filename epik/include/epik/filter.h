@@ -0,0 +1,86 @@
+#ifndef EPIK_FILTER_H
+#define EPIK_FILTER_H
+
+#include <vector>
+#include <cstdint>
+#include <i2l/phylo_kmer.h>
+
+namespace i2l
+{
+    class phylo_kmer_db;
+}
+
+namespace epik::impl
+{
+    /// \brief A 64-bit mixing function (the finalizer of SplitMix64)
+    inline uint64_t mix_hash(uint64_t value)
+    {
+        value ^= value >> 30;
+        value *= 0xbf58476d1ce4e5b9ull;
+        value ^= value >> 27;
+        value *= 0x94d049bb133111ebull;
+        value ^= value >> 31;
+        return value;
+    }
+
+    /// \brief A blocked Bloom filter of the keys of a database, checked before searching a key.
+    /// \details Most k-mers of a metagenomic query are not in the database, and every miss
+    /// costs a probe of its hash table. All bits of a key are in one cache line, so a check
+    /// costs one cache miss at most. False positives are searched as usual, there are no false negatives
+    class key_filter
+    {
+    public:
+        /// \brief Builds the filter of the keys of a database with about bits_per_key bits per key
+        key_filter(const i2l::phylo_kmer_db& db, size_t bits_per_key);
+
+        /// \brief Returns false if the key is not in the database
+        bool may_contain(i2l::phylo_kmer::key_type key) const noexcept
+        {
+            const auto hash = mix_hash(key);
+            const auto& block = _blocks[_block_of(hash)];
+
+            auto bits = hash * 0x9e3779b97f4a7c15ull;
+            for (size_t i = 0; i < _num_probes; ++i, bits >>= 9)
+            {
+                const auto bit = bits & 511u;
+                if ((block.words[bit >> 6] & (uint64_t{1} << (bit & 63u))) == 0)
+                {
+                    return false;
+                }
+            }
+            return true;
+        }
+
+        size_t num_keys() const noexcept;
+
+        size_t memory_bytes() const noexcept;
+
+        /// \brief The memory taken by a filter of num_keys keys
+        static size_t memory_bytes(size_t num_keys, size_t bits_per_key) noexcept;
+
+        /// \brief The false positive rate expected for a Bloom filter of this size
+        double expected_false_positive_rate() const noexcept;
+
+    private:
+        struct alignas(64) block
+        {
+            uint64_t words[8];
+        };
+
+        /// \brief Maps the high half of a hash to [0, number of blocks) without a division
+        size_t _block_of(uint64_t hash) const noexcept
+        {
+            return static_cast<size_t>(((hash >> 32) * static_cast<uint64_t>(_blocks.size())) >> 32);
+        }
+
+        void _insert(i2l::phylo_kmer::key_type key) noexcept;
+
+        std::vector<block> _blocks;
+        size_t _num_keys;
+
+        /// The number of bits set per key. At most 7: the bits are taken from one hash
+        size_t _num_probes;
+    };
+}
+
+#endif
@@ -0,0 +1,155 @@
+#ifndef EPIK_FIXED_H
+#define EPIK_FIXED_H
+
+#include <vector>
+#include <optional>
+#include <limits>
+#include <cstdint>
+#include <i2l/phylo_kmer.h>
+#include <epik/ordinal.h>
+
+namespace i2l
+{
+    class phylo_kmer_db;
+}
+
+namespace epik::impl
+{
+    /// \brief The posting lists of the database with scores in fixed point, summed up as integers.
+    /// \details A score s of the database is stored as q = round((s - L) * scale), where L is the threshold
+    /// score: phylo-k-mers are stored only above the threshold, so q is not negative, and scale makes
+    /// the largest q fill 16 bits. The corrected score of a branch scored by c of the n k-mers of a query,
+    /// (sum(s) + (n - c) * L) / k, equals (sum(s - L) + n * L) / k: the same increasing function of
+    /// sum(s - L) for all branches. The integer Q = sum(q) is exact and does not depend on the order
+    /// of the additions. Every q is rounded by half a unit at most, so Q differs from sum(s - L) * scale
+    /// by at most error_bound(n) units, which also covers the rounding of the float sums. A branch whose
+    /// Q is more than twice that below the Q of keep_at_most others can not be among the best float
+    /// placements: placer ranks only the other ones again, with float scores, and keeps the same
+    /// placements as the float path. The sums of up to max_kmers() k-mers fit in 32 bits.
+    /// Like impl::dense_tier, a list is found by the key of its k-mer
+    class fixed_postings
+    {
+    public:
+        using score_type = i2l::phylo_kmer::score_type;
+        using branch_type = i2l::phylo_kmer::branch_type;
+        using fixed_type = uint16_t;
+        using sum_type = uint32_t;
+
+        /// \brief The branches and the fixed-point scores of a posting list
+        struct list
+        {
+            const branch_type* branches;
+            const fixed_type* scores;
+            size_t size;
+        };
+
+        /// \brief Converts the scores of db. Scores lower than log_threshold are raised to it
+        fixed_postings(const i2l::phylo_kmer_db& db, size_t num_branches, score_type log_threshold);
+
+        /// \brief The fixed-point list of a k-mer of the database, nothing if the k-mer is not
+        /// in the database or has an empty posting list
+        std::optional<list> find(i2l::phylo_kmer::key_type key) const noexcept
+        {
+            const auto ordinal = _lists.find(key);
+            if (ordinal == ordinal_index::none)
+            {
+                return std::nullopt;
+            }
+            const auto begin = _offsets[ordinal];
+            return list{ _branches.data() + begin, _scores.data() + begin, _offsets[ordinal + 1] - begin };
+        }
+
+        /// \brief The sum of (s - L) of the sum of fixed-point scores
+        score_type to_score(sum_type sum) const noexcept
+        {
+            return static_cast<score_type>((double)sum / _scale);
+        }
+
+        /// \brief The number of fixed-point units per unit of log10 score
+        double scale() const noexcept;
+
+        /// \brief The largest number of k-mers of a query whose sums can not overflow
+        size_t max_kmers() const noexcept;
+
+        /// \brief The most the sum Q of a branch for a query of num_kmers k-mers differs from
+        /// sum(s - L) * scale, where sum(s) is computed in float in any order
+        sum_type error_bound(size_t num_kmers) const noexcept;
+
+        size_t num_postings() const noexcept;
+
+        size_t memory_bytes() const noexcept;
+
+    private:
+        double _scale;
+
+        /// The largest rounding of a score, in units, and the largest absolute score or threshold
+        double _max_rounding;
+        double _max_abs_score;
+
+        std::vector<branch_type> _branches;
+        std::vector<fixed_type> _scores;
+
+        /// The postings of the k-mer number i are [_offsets[i], _offsets[i + 1])
+        std::vector<size_t> _offsets;
+
+        /// The key of a k-mer -> its number
+        ordinal_index _lists;
+    };
+
+    /// \brief The fixed-point sums and the hits of every branch for one query, in dense arrays
+    class fixed_accumulator
+    {
+    public:
+        using branch_type = i2l::phylo_kmer::branch_type;
+        using sum_type = fixed_postings::sum_type;
+
+        /// \brief The slot of a branch not marked
+        static constexpr uint32_t no_slot = std::numeric_limits<uint32_t>::max();
+
+        explicit fixed_accumulator(size_t num_branches);
+
+        /// \brief The memory taken by an accumulator for a tree. It is dense: the sums take
+        /// less than the float scores of a branch, and are allocated once
+        static size_t memory_bytes(size_t num_branches) noexcept;
+
+        /// \brief Forgets the sums of the previous query
+        void clear();
+
+        /// \brief Adds a list to the sums with the vectorized update_fixed
+        void add(const fixed_postings::list& list);
+
+        sum_type sum(branch_type branch) const noexcept
+        {
+            return _sums[branch];
+        }
+
+        uint32_t count(branch_type branch) const noexcept
+        {
+            return _counts[branch];
+        }
+
+        /// \brief Marks a branch of edges() with a slot, e.g. its index among the branches ranked again.
+        /// Marks are forgotten by clear()
+        void mark(branch_type branch, uint32_t slot) noexcept
+        {
+            _slots[branch] = slot;
+        }
+
+        /// \brief The slot of a branch, no_slot if it is not marked
+        uint32_t slot(branch_type branch) const noexcept
+        {
+            return _slots[branch];
+        }
+
+        /// \brief Branches in the order they were first scored
+        const std::vector<branch_type>& edges() const noexcept;
+
+    private:
+        std::vector<sum_type> _sums;
+        std::vector<uint32_t> _counts;
+        std::vector<uint32_t> _slots;
+        std::vector<branch_type> _edges;
+    };
+}
+
+#endif
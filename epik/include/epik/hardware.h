@@ -0,0 +1,60 @@
+#ifndef EPIK_HARDWARE_H
+#define EPIK_HARDWARE_H
+
+#include <array>
+#include <cstdint>
+#include <string>
+
+namespace epik::metrics
+{
+    /// Hardware events counted for every stage with enable_hw_counters
+    enum class hw_event : size_t
+    {
+        cycles,
+        instructions,
+        llc_misses,
+        dtlb_misses,
+        num_events
+    };
+
+    constexpr size_t num_hw_events = static_cast<size_t>(hw_event::num_events);
+
+    const char* to_string(hw_event e);
+
+    /// \brief Values of the hardware counters of a thread, and the nanoseconds they were enabled and counting.
+    /// If the counters were multiplexed with other events, running is less than enabled
+    struct hw_sample
+    {
+        std::array<uint64_t, num_hw_events> values{};
+        uint64_t enabled = 0;
+        uint64_t running = 0;
+    };
+
+    /// \brief Adds the events between two samples to total
+    inline void accumulate(hw_sample& total, const hw_sample& begin, const hw_sample& end) noexcept
+    {
+        for (size_t i = 0; i < num_hw_events; ++i)
+        {
+            total.values[i] += end.values[i] - begin.values[i];
+        }
+        total.enabled += end.enabled - begin.enabled;
+        total.running += end.running - begin.running;
+    }
+
+    /// \brief Starts counting hardware events (Linux perf_event_open) in every thread that times a stage,
+    /// see scoped_timer. Opens the counters of the calling thread and returns false if none of the events
+    /// can be counted, e.g. in a container or with a restrictive kernel.perf_event_paranoid.
+    /// Stages are timed anyway, and the events that can not be counted are left out
+    bool enable_hw_counters();
+
+    bool hw_counters_enabled() noexcept;
+
+    /// \brief Reads the counters of the calling thread, opened on the first call.
+    /// Returns false if the thread has none
+    bool read_hw_counters(hw_sample& sample) noexcept;
+
+    /// \brief Why an event could not be counted, empty if it could
+    std::string hw_event_error(hw_event e);
+}
+
+#endif
@@ -1,27 +1,49 @@
 #ifndef EPIK_INTRINSIC_H
 #define EPIK_INTRINSIC_H
 
-#ifdef EPIK_SSE
 #include <vector>
-#include <xmmintrin.h>
+#include <cstdint>
 #include <i2l/phylo_kmer.h>
 
+/// \brief Adds the scores of a posting list to the score vector, counts the hits
+/// of every branch and collects the branches scored for the first time.
+/// This is the reference implementation; the vectorized variants below must give the same result.
+template <class T>
+void update_vector_scalar(std::vector<i2l::phylo_kmer::score_type>& vec,
+                          std::vector<size_t>& counts,
+                          std::vector<i2l::phylo_kmer::branch_type>& edges,
+                          const T& updates) {
+    for (const auto& [postorder_node_id, score] : updates)
+    {
+        if (counts[postorder_node_id] == 0)
+        {
+            edges.push_back(postorder_node_id);
+        }
+
+        ++counts[postorder_node_id];
+        vec[postorder_node_id] += score;
+    }
+}
+
+#ifdef EPIK_SSE
+#include <xmmintrin.h>
+
 template <class T>
-void update_vector(std::vector<i2l::phylo_kmer::score_type>& vec,
-                   std::vector<size_t>& counts,
-                   std::vector<i2l::phylo_kmer::branch_type>& edges,
-                   const T& updates) {
+void update_vector_sse(std::vector<i2l::phylo_kmer::score_type>& vec,
+                       std::vector<size_t>& counts,
+                       std::vector<i2l::phylo_kmer::branch_type>& edges,
+                       const T& updates) {
     int i = 0;
 
     // Process updates in blocks of 4 as long as possible
     for (; i <= (int)updates.size() - 4; i += 4) {
-        // Load score updates
-        __m128 simdValues = _mm_set_ps(updates[i].score, updates[i+1].score,
+        // Load score updates. _mm_setr_ps keeps the memory order: lane j is updates[i+j]
+        __m128 simdValues = _mm_setr_ps(updates[i].score, updates[i+1].score,
                                         updates[i+2].score, updates[i+3].score);
 
         // Load the current scores
-        __m128 currentValues = _mm_set_ps(vec[updates[i].branch], vec[updates[i+1].branch],
-                                          vec[updates[i+2].branch], vec[updates[i+3].branch]);
+        __m128 currentValues = _mm_setr_ps(vec[updates[i].branch], vec[updates[i+1].branch],
+                                           vec[updates[i+2].branch], vec[updates[i+3].branch]);
 
         // SIMD Add
         __m128 newValues = _mm_add_ps(currentValues, simdValues);
@@ -40,6 +62,10 @@ void update_vector(std::vector<i2l::phylo_kmer::score_type>& vec,
     // Process the remaining updates
     for (; i < (int)updates.size(); i++) {
         vec[updates[i].branch] += updates[i].score;
+        if (counts[updates[i].branch] == 0)
+        {
+            edges.push_back(updates[i].branch);
+        }
         counts[updates[i].branch]++;
     }
 }
@@ -48,15 +74,13 @@ void update_vector(std::vector<i2l::phylo_kmer::score_type>& vec,
 //#define EPIK_AVX2
 #ifdef EPIK_AVX2
 
-#include <vector>
 #include <immintrin.h>
-#include <i2l/phylo_kmer.h>
 
 template <class T>
-void update_vector(std::vector<i2l::phylo_kmer::score_type>& vec,
-                   std::vector<size_t>& counts,
-                   std::vector<i2l::phylo_kmer::branch_type>& edges,
-                   const T& updates) {
+void update_vector_avx2(std::vector<i2l::phylo_kmer::score_type>& vec,
+                        std::vector<size_t>& counts,
+                        std::vector<i2l::phylo_kmer::branch_type>& edges,
+                        const T& updates) {
 
     int i = 0;
 
@@ -71,10 +95,11 @@ void update_vector(std::vector<i2l::phylo_kmer::score_type>& vec,
             indices[j] = updates[i + j].branch;
         }
 
-        // Load score updates
-        __m256 simdValues = _mm256_set_ps(updates[i].score, updates[i+1].score, updates[i+2].score,
-                                          updates[i+3].score, updates[i+4].score, updates[i+5].score,
-                                          updates[i+6].score, updates[i+7].score);
+        // Load score updates. _mm256_setr_ps keeps the memory order: lane j is updates[i+j],
+        // like the indices gathered
+        __m256 simdValues = _mm256_setr_ps(updates[i].score, updates[i+1].score, updates[i+2].score,
+                                           updates[i+3].score, updates[i+4].score, updates[i+5].score,
+                                           updates[i+6].score, updates[i+7].score);
 
         // Load indices and gather the current scores
         __m256i simdIndices = _mm256_loadu_si256((const __m256i*)indices);
@@ -112,15 +137,13 @@ void update_vector(std::vector<i2l::phylo_kmer::score_type>& vec,
 
 
 #ifdef EPIK_AVX512
-#include <vector>
 #include <immintrin.h>
-#include <i2l/phylo_kmer.h>
 
 template <class T>
-void update_vector(std::vector<i2l::phylo_kmer::score_type>& vec,
-                   std::vector<size_t>& counts,
-                   std::vector<i2l::phylo_kmer::branch_type>& edges,
-                   const T& updates) {
+void update_vector_avx512(std::vector<i2l::phylo_kmer::score_type>& vec,
+                          std::vector<size_t>& counts,
+                          std::vector<i2l::phylo_kmer::branch_type>& edges,
+                          const T& updates) {
 
     int i = 0;
     constexpr int simdWidth = 16;  // 512 bits / 32-bit float = 16 floats
@@ -133,13 +156,14 @@ void update_vector(std::vector<i2l::phylo_kmer::score_type>& vec,
             indices[j] = updates[i + j].branch;
         }
 
-        // Load score updates
-        __m512 simdValues = _mm512_set_ps(updates[i].score, updates[i+1].score, updates[i+2].score,
-                                          updates[i+3].score, updates[i+4].score, updates[i+5].score,
-                                          updates[i+6].score, updates[i+7].score, updates[i+8].score,
-                                          updates[i+9].score, updates[i+10].score, updates[i+11].score,
-                                          updates[i+12].score, updates[i+13].score, updates[i+14].score,
-                                          updates[i+15].score);
+        // Load score updates. _mm512_setr_ps keeps the memory order: lane j is updates[i+j],
+        // like the indices gathered
+        __m512 simdValues = _mm512_setr_ps(updates[i].score, updates[i+1].score, updates[i+2].score,
+                                           updates[i+3].score, updates[i+4].score, updates[i+5].score,
+                                           updates[i+6].score, updates[i+7].score, updates[i+8].score,
+                                           updates[i+9].score, updates[i+10].score, updates[i+11].score,
+                                           updates[i+12].score, updates[i+13].score, updates[i+14].score,
+                                           updates[i+15].score);
 
         // Load indices and gather the current scores
         __m512i simdIndices = _mm512_loadu_si512((__m512i const*)indices);
@@ -176,4 +200,211 @@ void update_vector(std::vector<i2l::phylo_kmer::score_type>& vec,
 
 #endif
 
+/// \brief Adds a dense row of scores to the score vector and its hits (0 or 1 per branch)
+/// to the hit counts, for all branches. Unlike update_vector, all memory accesses are contiguous.
+/// This is the reference implementation; the vectorized variants below must give the same result.
+inline void add_row_scalar(i2l::phylo_kmer::score_type* scores, uint32_t* hits,
+                           const i2l::phylo_kmer::score_type* row_scores, const uint8_t* row_hits,
+                           size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        scores[i] += row_scores[i];
+        hits[i] += row_hits[i];
+    }
+}
+
+#ifdef EPIK_SSE
+inline void add_row_sse(i2l::phylo_kmer::score_type* scores, uint32_t* hits,
+                        const i2l::phylo_kmer::score_type* row_scores, const uint8_t* row_hits,
+                        size_t size) {
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4) {
+        _mm_storeu_ps(scores + i, _mm_add_ps(_mm_loadu_ps(scores + i), _mm_loadu_ps(row_scores + i)));
+        for (size_t j = 0; j < 4; j++) {
+            hits[i + j] += row_hits[i + j];
+        }
+    }
+    add_row_scalar(scores + i, hits + i, row_scores + i, row_hits + i, size - i);
+}
+#endif
+
+#ifdef EPIK_AVX2
+inline void add_row_avx2(i2l::phylo_kmer::score_type* scores, uint32_t* hits,
+                         const i2l::phylo_kmer::score_type* row_scores, const uint8_t* row_hits,
+                         size_t size) {
+    constexpr size_t simdWidth = 8;
+    size_t i = 0;
+    for (; i + simdWidth <= size; i += simdWidth) {
+        _mm256_storeu_ps(scores + i, _mm256_add_ps(_mm256_loadu_ps(scores + i), _mm256_loadu_ps(row_scores + i)));
+
+        // Widen 8 hits of one byte to 32 bits
+        const __m256i rowHits = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i*)(row_hits + i)));
+        const __m256i currentHits = _mm256_loadu_si256((const __m256i*)(hits + i));
+        _mm256_storeu_si256((__m256i*)(hits + i), _mm256_add_epi32(currentHits, rowHits));
+    }
+    add_row_scalar(scores + i, hits + i, row_scores + i, row_hits + i, size - i);
+}
+#endif
+
+#ifdef EPIK_AVX512
+inline void add_row_avx512(i2l::phylo_kmer::score_type* scores, uint32_t* hits,
+                           const i2l::phylo_kmer::score_type* row_scores, const uint8_t* row_hits,
+                           size_t size) {
+    constexpr size_t simdWidth = 16;
+    size_t i = 0;
+    for (; i + simdWidth <= size; i += simdWidth) {
+        _mm512_storeu_ps(scores + i, _mm512_add_ps(_mm512_loadu_ps(scores + i), _mm512_loadu_ps(row_scores + i)));
+
+        // Widen 16 hits of one byte to 32 bits
+        const __m512i rowHits = _mm512_cvtepu8_epi32(_mm_loadu_si128((const __m128i*)(row_hits + i)));
+        const __m512i currentHits = _mm512_loadu_si512((const void*)(hits + i));
+        _mm512_storeu_si512((void*)(hits + i), _mm512_add_epi32(currentHits, rowHits));
+    }
+    add_row_scalar(scores + i, hits + i, row_scores + i, row_hits + i, size - i);
+}
+#endif
+
+/// \brief Adds the fixed-point scores of a posting list to the integer sums, counts the hits of every branch
+/// and collects the branches scored for the first time, like update_vector_scalar.
+/// This is the reference implementation; the vectorized variants below must give the same result.
+inline void update_fixed_scalar(uint32_t* sums, uint32_t* counts, std::vector<i2l::phylo_kmer::branch_type>& edges,
+                                const i2l::phylo_kmer::branch_type* branches, const uint16_t* scores,
+                                size_t size) {
+    for (size_t i = 0; i < size; i++) {
+        const auto branch = branches[i];
+        if (counts[branch] == 0)
+        {
+            edges.push_back(branch);
+        }
+        ++counts[branch];
+        sums[branch] += scores[i];
+    }
+}
+
+/// The branches of a posting list are distinct: the lanes of a gather never
+/// alias, and the sums can be scattered back in one store.
+#ifdef EPIK_AVX2
+inline void update_fixed_avx2(uint32_t* sums, uint32_t* counts, std::vector<i2l::phylo_kmer::branch_type>& edges,
+                              const i2l::phylo_kmer::branch_type* branches, const uint16_t* scores,
+                              size_t size) {
+    static_assert(sizeof(i2l::phylo_kmer::branch_type) == 4, "Branches are gathered as 32-bit indices");
+    constexpr size_t simdWidth = 8;
+    const __m256i one = _mm256_set1_epi32(1);
+    alignas(32) uint32_t newSums[simdWidth];
+    alignas(32) uint32_t newCounts[simdWidth];
+
+    size_t i = 0;
+    for (; i + simdWidth <= size; i += simdWidth) {
+        const __m256i indices = _mm256_loadu_si256((const __m256i*)(branches + i));
+
+        // Widen 8 scores of 16 bits to 32 bits
+        const __m256i values = _mm256_cvtepu16_epi32(_mm_loadu_si128((const __m128i*)(scores + i)));
+        const __m256i currentSums = _mm256_i32gather_epi32((const int*)sums, indices, 4);
+        const __m256i currentCounts = _mm256_i32gather_epi32((const int*)counts, indices, 4);
+        _mm256_store_si256((__m256i*)newSums, _mm256_add_epi32(currentSums, values));
+        _mm256_store_si256((__m256i*)newCounts, _mm256_add_epi32(currentCounts, one));
+
+        // AVX2 has no scatter: the lanes are stored one by one
+        for (size_t j = 0; j < simdWidth; j++) {
+            sums[branches[i + j]] = newSums[j];
+            counts[branches[i + j]] = newCounts[j];
+        }
+
+        // Branches scored for the first time, in the order of the list
+        auto first = (unsigned)_mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(currentCounts, _mm256_setzero_si256())));
+        while (first != 0) {
+            const auto j = (size_t)__builtin_ctz(first);
+            edges.push_back(branches[i + j]);
+            first &= first - 1;
+        }
+    }
+    update_fixed_scalar(sums, counts, edges, branches + i, scores + i, size - i);
+}
+#endif
+
+#ifdef EPIK_AVX512
+inline void update_fixed_avx512(uint32_t* sums, uint32_t* counts, std::vector<i2l::phylo_kmer::branch_type>& edges,
+                                const i2l::phylo_kmer::branch_type* branches, const uint16_t* scores,
+                                size_t size) {
+    static_assert(sizeof(i2l::phylo_kmer::branch_type) == 4, "Branches are gathered as 32-bit indices");
+    constexpr size_t simdWidth = 16;
+    const __m512i one = _mm512_set1_epi32(1);
+
+    size_t i = 0;
+    for (; i + simdWidth <= size; i += simdWidth) {
+        const __m512i indices = _mm512_loadu_si512((const void*)(branches + i));
+
+        // Widen 16 scores of 16 bits to 32 bits
+        const __m512i values = _mm512_cvtepu16_epi32(_mm256_loadu_si256((const __m256i*)(scores + i)));
+        const __m512i currentSums = _mm512_i32gather_epi32(indices, (const void*)sums, 4);
+        const __m512i currentCounts = _mm512_i32gather_epi32(indices, (const void*)counts, 4);
+        _mm512_i32scatter_epi32((void*)sums, indices, _mm512_add_epi32(currentSums, values), 4);
+        _mm512_i32scatter_epi32((void*)counts, indices, _mm512_add_epi32(currentCounts, one), 4);
+
+        // Branches scored for the first time, packed in the order of the list
+        const __mmask16 first = _mm512_cmpeq_epi32_mask(currentCounts, _mm512_setzero_si512());
+        if (first != 0) {
+            const auto old_size = edges.size();
+            edges.resize(old_size + (size_t)__builtin_popcount(first));
+            _mm512_mask_compressstoreu_epi32((void*)(edges.data() + old_size), first, indices);
+        }
+    }
+    update_fixed_scalar(sums, counts, edges, branches + i, scores + i, size - i);
+}
+#endif
+
+/// The name of the instruction set update_vector is compiled for
+#if defined(EPIK_SSE)
+constexpr const char* update_vector_isa = "sse";
+#elif defined(EPIK_AVX2)
+constexpr const char* update_vector_isa = "avx2";
+#elif defined(EPIK_AVX512)
+constexpr const char* update_vector_isa = "avx512";
+#else
+constexpr const char* update_vector_isa = "scalar";
+#endif
+
+/// \brief Updates the score vector with the variant selected at compile time
+template <class T>
+inline void update_vector(std::vector<i2l::phylo_kmer::score_type>& vec,
+                          std::vector<size_t>& counts,
+                          std::vector<i2l::phylo_kmer::branch_type>& edges,
+                          const T& updates) {
+#if defined(EPIK_SSE)
+    update_vector_sse(vec, counts, edges, updates);
+#elif defined(EPIK_AVX2)
+    update_vector_avx2(vec, counts, edges, updates);
+#elif defined(EPIK_AVX512)
+    update_vector_avx512(vec, counts, edges, updates);
+#else
+    update_vector_scalar(vec, counts, edges, updates);
+#endif
+}
+
+/// \brief Adds a dense row with the variant selected at compile time
+inline void add_row(i2l::phylo_kmer::score_type* scores, uint32_t* hits,
+                    const i2l::phylo_kmer::score_type* row_scores, const uint8_t* row_hits, size_t size) {
+#if defined(EPIK_SSE)
+    add_row_sse(scores, hits, row_scores, row_hits, size);
+#elif defined(EPIK_AVX2)
+    add_row_avx2(scores, hits, row_scores, row_hits, size);
+#elif defined(EPIK_AVX512)
+    add_row_avx512(scores, hits, row_scores, row_hits, size);
+#else
+    add_row_scalar(scores, hits, row_scores, row_hits, size);
+#endif
+}
+
+/// \brief Adds fixed-point scores with the variant selected at compile time.
+/// SSE has no gather: it uses the scalar variant
+inline void update_fixed(uint32_t* sums, uint32_t* counts, std::vector<i2l::phylo_kmer::branch_type>& edges,
+                         const i2l::phylo_kmer::branch_type* branches, const uint16_t* scores, size_t size) {
+#if defined(EPIK_AVX2)
+    update_fixed_avx2(sums, counts, edges, branches, scores, size);
+#elif defined(EPIK_AVX512)
+    update_fixed_avx512(sums, counts, edges, branches, scores, size);
+#else
+    update_fixed_scalar(sums, counts, edges, branches, scores, size);
+#endif
+}
+
 #endif
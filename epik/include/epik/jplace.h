@@ -31,7 +31,23 @@ namespace epik
             void start();
             void end();
 
+            /// \brief Continues a file written up to the given position with num_placements placements,
+            /// instead of start(). The rest of the file is discarded. The placements of the file start
+            /// at placements_begin; 0 if unknown, then the header is assumed to be the same as written now
+            void resume(size_t position, size_t num_placements, size_t placements_begin = 0);
+
+            /// \brief The size of the file written so far
+            size_t position() const noexcept;
+
+            /// \brief The number of placements written so far
+            size_t num_placements() const noexcept;
+
+            /// \brief The size of everything before the placements, i.e. where the first placement starts
+            size_t placements_begin() const noexcept;
+
         private:
+            /// \brief Writes everything before the placements to the buffer
+            void _write_header();
             void _write_metadata(const std::string& invocation);
             void _write_tree(std::string_view newick_tree);
             void _write_version();
@@ -50,6 +66,10 @@ namespace epik
 
             std::string _invocation;
             std::string_view _tree;
+
+            size_t _position;
+            size_t _num_placements;
+            size_t _placements_begin;
         };
 
     }
@@ -0,0 +1,69 @@
+#ifndef EPIK_MASS_H
+#define EPIK_MASS_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+namespace epik
+{
+    namespace impl
+    {
+        struct placed_collection;
+    }
+
+    namespace io
+    {
+        /// \brief Accumulates the placement mass of every edge over all batches and writes it
+        /// as a table, instead of or along with a .jplace file.
+        /// \details Every read has the mass of 1 (times its multiplicity) spread over its placements
+        /// proportionally to their weight ratios. Optionally, the reads whose best placement is on
+        /// an edge are counted. Every thread accumulates its own table; they are summed up on writing
+        class mass_writer
+        {
+        public:
+            mass_writer(const std::string& filename, size_t num_branches, bool with_counts, size_t num_threads);
+            mass_writer(const mass_writer&) = delete;
+            mass_writer(mass_writer&&) = delete;
+            mass_writer& operator=(const mass_writer&) = delete;
+            mass_writer& operator=(mass_writer&&) = delete;
+            ~mass_writer() noexcept = default;
+
+            /// \brief Adds the placements of a batch
+            mass_writer& operator<<(const impl::placed_collection& placed);
+
+            /// \brief Writes the table of everything added so far. Can be called several times
+            void write();
+
+            /// \brief Writes the table to another file, e.g. a snapshot for a checkpoint
+            void write(const std::string& filename);
+
+            /// \brief Continues the accumulation from a table written before
+            void resume(const std::string& filename);
+
+            const std::string& filename() const noexcept;
+
+            /// \brief The memory taken by the table of one thread
+            size_t thread_bytes() const noexcept;
+
+            /// \brief Lowers the number of threads that add placements at once. Must be called
+            /// before placements are added
+            void set_num_threads(size_t num_threads);
+
+        private:
+            /// \brief Sums up the tables of all threads into the first one
+            void _merge();
+
+            std::string _filename;
+            size_t _num_branches;
+            bool _with_counts;
+            size_t _num_threads;
+
+            /// The mass and the number of best placements of every edge for every thread
+            std::vector<std::vector<double>> _mass;
+            std::vector<std::vector<uint64_t>> _counts;
+        };
+    }
+}
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef EPIK_MEMORY_H
+#define EPIK_MEMORY_H
+
+#include <string>
+#include <iosfwd>
+
+/// Planning of --max-ram: the memory limit is shared between the phylo-k-mers
+/// of the databases and the buffers used while placing
+namespace epik::memory
+{
+    /// 1/scratch_share of the budget is reserved for the scratch of the threads. It depends on the trees:
+    /// once they are loaded, fewer threads place if the scratch of all of them does not fit
+    constexpr size_t scratch_share = 8;
+
+    /// At most 1/buffer_share of the budget is used by the batch and output buffers.
+    /// The batch size is reduced to stay under it
+    constexpr size_t buffer_share = 4;
+
+    /// At most 1/dense_tier_share of the budget is used by the dense tiers of the databases
+    constexpr size_t dense_tier_share = 8;
+
+    /// The batch size is never reduced below this
+    constexpr size_t min_batch_size = 100;
+
+    /// \brief What is about to be run, to estimate its memory use
+    struct workload
+    {
+        size_t num_databases;
+        size_t num_threads;
+        size_t batch_size;
+
+        /// The average size of a query record: header and sequence, bytes
+        size_t record_size;
+
+        size_t keep_at_most;
+
+        /// The search results of the whole batch are kept (see epik::engine::join)
+        bool batch_search;
+
+        /// The structures built over the phylo-k-mers of every database (see epik::placer):
+        /// bits per key of the key filter (0 if there is none), the dense tier, the clades,
+        /// fixed-point scores and skipped k-mers
+        size_t filter_bits;
+        bool dense_tier;
+        bool clades;
+        bool fixed_point;
+        bool skipping;
+    };
+
+    /// \brief How a memory budget is shared, bytes
+    struct plan
+    {
+        size_t budget;
+
+        size_t entries_per_database;
+        size_t entries_bytes;
+
+        /// The structures built over the phylo-k-mers loaded, but the dense tier. Planned for
+        /// the worst case of one phylo-k-mer per k-mer
+        size_t index_bytes;
+
+        /// The limit of the dense tier of one database
+        size_t tier_per_database;
+        size_t tier_bytes;
+
+        /// The limit of the scratch of the threads for all databases: their score accumulators,
+        /// clade bounds and mass tables (see epik::placer::thread_scratch_bytes)
+        size_t scratch_bytes;
+
+        size_t batch_size;
+        size_t batch_bytes;
+        size_t output_bytes;
+
+        /// The batch size requested, if it was reduced to fit the budget
+        size_t requested_batch_size;
+    };
+
+    /// \brief Estimates the average size of a record of a fasta or fastq file by its beginning
+    size_t estimate_record_size(const std::string& filename);
+
+    /// \brief The memory taken by a batch of queries while it is placed: the records,
+    /// their grouping by content, encoded k-mers and placements
+    size_t batch_bytes(const workload& work);
+
+    /// \brief The memory taken by the .jplace output of a batch
+    size_t output_bytes(const workload& work);
+
+    /// \brief Shares the budget between database entries and the structures built over them,
+    /// scratch and buffers. Reduces the batch size if the buffers take too much of it
+    plan make_plan(size_t budget, const workload& work);
+
+    /// \brief Prints the planned breakdown
+    void print_plan(std::ostream& out, const plan& plan, const workload& work);
+
+    /// \brief Formats a number of bytes, e.g. 1.5G
+    std::string format_bytes(size_t bytes);
+}
+
+#endif
@@ -0,0 +1,157 @@
+#ifndef EPIK_METRICS_H
+#define EPIK_METRICS_H
+
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <epik/hardware.h>
+
+namespace epik::metrics
+{
+    /// Stages of the placement pipeline that are timed
+    enum class stage : size_t
+    {
+        load,
+        parse,
+        dedup,
+        place,
+        encode,
+        lookup,
+        accumulate,
+        select,
+        lwr,
+        write,
+        num_stages
+    };
+
+    /// Event counters of the placement pipeline
+    enum class counter : size_t
+    {
+        reads,
+        unique_reads,
+        duplicates_collapsed,
+        kmers_queried,
+        kmers_hit,
+        keys_searched,
+        postings_applied,
+        edges_touched,
+        filter_rejected,
+        filter_false_positives,
+        dense_promotions,
+        dense_releases,
+        dense_rows_applied,
+        clades_pruned,
+        clade_expansions,
+        kmers_skipped,
+        fixed_candidates,
+        bytes_written,
+        num_counters
+    };
+
+    constexpr size_t num_stages = static_cast<size_t>(stage::num_stages);
+    constexpr size_t num_counters = static_cast<size_t>(counter::num_counters);
+
+    const char* to_string(stage s);
+    const char* to_string(counter c);
+
+    /// \brief Counters and timers of one thread. Every thread writes only to its own
+    /// instance, aligned to a cache line to avoid false sharing
+    struct alignas(64) thread_metrics
+    {
+        std::array<uint64_t, num_counters> counters{};
+        std::array<uint64_t, num_stages> nanoseconds{};
+        std::array<uint64_t, num_stages> calls{};
+
+        /// Hardware events of every stage, if enable_hw_counters was called
+        std::array<hw_sample, num_stages> events{};
+    };
+
+    /// \brief Owns the metrics of all threads that have reported something
+    class registry
+    {
+    public:
+        static registry& instance();
+
+        /// \brief Returns the metrics of the calling thread. Registers the thread on first call
+        thread_metrics& local();
+
+        /// \brief Writes the metrics of all threads and their totals as JSON.
+        /// Must not be called while other threads are reporting.
+        void write_json(const std::string& filename) const;
+
+        /// \brief Writes the hardware events of every stage of all threads and their totals as JSON.
+        /// Must not be called while other threads are reporting.
+        void write_hw_json(const std::string& filename) const;
+
+        /// \brief The sum of a counter over all threads.
+        /// Must not be called while other threads are reporting.
+        uint64_t total(counter c) const;
+
+    private:
+        registry() = default;
+
+        mutable std::mutex _mutex;
+
+        /// std::deque does not move its elements on growth
+        std::deque<thread_metrics> _threads;
+    };
+
+    inline void add(counter c, uint64_t value)
+    {
+        registry::instance().local().counters[static_cast<size_t>(c)] += value;
+    }
+
+    /// \brief Adds the time elapsed between its construction and destruction to a stage,
+    /// and the hardware events of the thread if they are counted
+    class scoped_timer
+    {
+    public:
+        explicit scoped_timer(stage s) noexcept
+            : _stage{ static_cast<size_t>(s) }
+            , _hardware{ hw_counters_enabled() && read_hw_counters(_begin_events) }
+            , _begin{ std::chrono::steady_clock::now() }
+        {}
+
+        scoped_timer(const scoped_timer&) = delete;
+        scoped_timer& operator=(const scoped_timer&) = delete;
+
+        ~scoped_timer() noexcept
+        {
+            const auto end = std::chrono::steady_clock::now();
+            auto& local = registry::instance().local();
+            local.nanoseconds[_stage] += static_cast<uint64_t>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(end - _begin).count());
+            ++local.calls[_stage];
+
+            hw_sample end_events;
+            if (_hardware && read_hw_counters(end_events))
+            {
+                accumulate(local.events[_stage], _begin_events, end_events);
+            }
+        }
+
+    private:
+        size_t _stage;
+        hw_sample _begin_events;
+        bool _hardware;
+        std::chrono::steady_clock::time_point _begin;
+    };
+}
+
+/// The instrumentation compiles to nothing if EPIK is built without EPIK_METRICS
+#define EPIK_METRICS_CONCAT_IMPL(a, b) a##b
+#define EPIK_METRICS_CONCAT(a, b) EPIK_METRICS_CONCAT_IMPL(a, b)
+
+#ifdef EPIK_METRICS
+#define EPIK_COUNT(name, value) ::epik::metrics::add(::epik::metrics::counter::name, (value))
+#define EPIK_TIME_SCOPE(name) \
+    ::epik::metrics::scoped_timer EPIK_METRICS_CONCAT(epik_timer_, __LINE__)(::epik::metrics::stage::name)
+#else
+#define EPIK_COUNT(name, value) ((void)0)
+#define EPIK_TIME_SCOPE(name) ((void)0)
+#endif
+
+#endif
@@ -0,0 +1,67 @@
+#ifndef EPIK_ORDINAL_H
+#define EPIK_ORDINAL_H
+
+#include <vector>
+#include <limits>
+#include <cstdint>
+#include <i2l/phylo_kmer.h>
+#include <epik/filter.h>
+
+namespace epik::impl
+{
+    /// \brief Maps the keys of a set of k-mers to their ordinals 0, 1, ... n - 1.
+    /// \details The structures built over the database (e.g. impl::dense_tier) store what they know
+    /// of a k-mer in dense arrays indexed by its ordinal. An open-addressing table of keys and ordinals,
+    /// at most half full: a lookup is one probe of a cache line in most cases, and the memory
+    /// is two flat arrays without a node per key
+    class ordinal_index
+    {
+    public:
+        using key_type = i2l::phylo_kmer::key_type;
+
+        /// \brief The ordinal of a key not in the index
+        static constexpr uint32_t none = std::numeric_limits<uint32_t>::max();
+
+        /// \brief An index takes at most this per key, plus memory_bytes(0): there are fewer
+        /// than four slots per key
+        static constexpr size_t max_bytes_per_key = 4 * (sizeof(key_type) + sizeof(uint32_t));
+
+        ordinal_index() = default;
+
+        /// \brief Indexes distinct keys: the ordinal of keys[i] is i
+        explicit ordinal_index(const std::vector<key_type>& keys);
+
+        /// \brief The ordinal of a key, none if it is not indexed
+        uint32_t find(key_type key) const noexcept
+        {
+            if (_size == 0)
+            {
+                return none;
+            }
+            for (auto slot = static_cast<size_t>(mix_hash(key)) & _mask; ; slot = (slot + 1) & _mask)
+            {
+                const auto ordinal = _ordinals[slot];
+                if (ordinal == none || _keys[slot] == key)
+                {
+                    return ordinal;
+                }
+            }
+        }
+
+        /// \brief The number of keys
+        size_t size() const noexcept;
+
+        size_t memory_bytes() const noexcept;
+
+        /// \brief The memory taken by an index of num_keys keys
+        static size_t memory_bytes(size_t num_keys) noexcept;
+
+    private:
+        size_t _size = 0;
+        size_t _mask = 0;
+        std::vector<key_type> _keys;
+        std::vector<uint32_t> _ordinals;
+    };
+}
+
+#endif
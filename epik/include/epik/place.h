@@ -2,10 +2,21 @@
 #define EPIK_PLACE_H
 
 #include <vector>
+#include <memory>
+#include <limits>
+#include <optional>
 #include <unordered_map>
+#include <utility>
 #include <i2l/phylo_kmer.h>
 #include <i2l/phylo_kmer_db.h>
 #include <i2l/phylo_tree.h>
+#include <epik/accumulator.h>
+#include <epik/clades.h>
+#include <epik/encoder.h>
+#include <epik/filter.h>
+#include <epik/fixed.h>
+#include <epik/ordinal.h>
+#include <epik/tier.h>
 
 #ifdef __clang__
 /// Clang still does not fully support boost::multiprecion.
@@ -36,11 +47,56 @@ namespace i2l
     class seq_record;
 }
 
+namespace epik
+{
+    /// \brief How the k-mers of a sequence are subsampled
+    enum class sampling_scheme
+    {
+        /// Every k-mer is queried
+        none,
+
+        /// Minimizers: the k-mer of the smallest hash in every window of w consecutive k-mers.
+        /// About 2 / (w + 1) of k-mers are kept
+        minimizer,
+
+        /// Open syncmers: the k-mers whose smallest s-mer (by hash) is their prefix.
+        /// About 1 / (k - s + 1) of k-mers are kept
+        syncmer
+    };
+
+    /// \brief Subsampling of k-mers: only a deterministic subset of the k-mers of a sequence is
+    /// queried. Window and s-mer sizes are chosen for the density.
+    /// Ambiguous k-mers are rare and always kept
+    struct sampling
+    {
+        sampling_scheme scheme = sampling_scheme::none;
+
+        /// The expected proportion of k-mers kept, in (0, 1]
+        double density = 1.0;
+    };
+
+    sampling_scheme parse_sampling_scheme(const std::string& name);
+}
+
 namespace epik::impl
 {
     /// A mapping "sequence content -> list of headers" to group identical reads
     using sequence_map_t = std::unordered_map<std::string_view, std::vector<std::string_view>>;
 
+    /// A non-owning view of a query sequence and its header
+    struct seq_view
+    {
+        std::string_view header;
+        std::string_view sequence;
+    };
+
+    /// Separates the mates of a paired read in the sequence placed for the pair (see io::paired_fasta).
+    /// The k-mers of both mates are scored together; no k-mer spans the two mates
+    constexpr char mate_separator = '\x1f';
+
+    /// \brief The number of k-mers of a sequence, or of both mates of a paired read
+    size_t count_kmers(std::string_view seq, size_t kmer_size) noexcept;
+
     /// A placement of one sequence
     struct placement {
     public:
@@ -60,6 +116,14 @@ namespace epik::impl
         std::string_view sequence;
         std::vector<placement> placements;
 
+        /// The sum of 10^score over all branches if it was computed along with the scores (see
+        /// placer::build_fixed_point), before the best placements were selected
+        std::optional<placement::weight_ratio_type> score_sum = std::nullopt;
+
+        /// The weight the branches of the pruned clades may have above the threshold score, at the upper
+        /// bounds of their clades (see placer::build_clades). Added to the sum of 10^score for the LWR
+        placement::weight_ratio_type pruned_weight = 0.0;
+
         placed_sequence() = default;
         placed_sequence(const placed_sequence&) = delete;
         placed_sequence(placed_sequence&&) noexcept = default;
@@ -73,18 +137,107 @@ namespace epik::impl
         impl::sequence_map_t sequence_map;
         std::vector<placed_sequence> placed_seqs;
     };
+
+    /// The result of a database search for one key
+    using search_result = decltype(std::declval<i2l::phylo_kmer_db>().search(0));
+
+    /// Results of DB search for exact k-mers and
+    /// pairs (k-mer, results of search) for ambiguous k-mers
+    struct kmer_results
+    {
+        std::vector<search_result> exact;
+
+        /// The keys of the exact k-mers found: exact_keys[i] is the key of exact[i]
+        std::vector<i2l::phylo_kmer::key_type> exact_keys;
+        std::vector<std::vector<search_result>> ambiguous;
+
+        /// The number of k-mers queried if they were sampled, 0 if all k-mers were
+        size_t num_sampled = 0;
+    };
+
+    /// The keys of the k-mers of a sequence, computed once to query several databases
+    /// with the same k. Every ambiguous k-mer is stored as the list of keys it resolves to
+    struct encoded_sequence
+    {
+        std::vector<i2l::phylo_kmer::key_type> exact;
+        std::vector<std::vector<i2l::phylo_kmer::key_type>> ambiguous;
+
+        /// True if the k-mers were sampled (see epik::sampling)
+        bool sampled = false;
+    };
+
+    /// \brief Computes the keys of every k-mer of a sequence that has no more than one ambiguous character.
+    /// If sampling is given, only the sampled exact k-mers are kept. If an encoder for kmer_size is given,
+    /// it is used instead of i2l::to_kmers
+    encoded_sequence encode_kmers(std::string_view seq, size_t kmer_size, const sampling& sampling = {},
+                                  const kmer_encoder* encoder = nullptr);
+
+    /// \brief Queries every k-mer of a sequence that has no more than one ambiguous character.
+    /// If a filter is given, the keys it rejects are not searched
+    kmer_results query_kmers(std::string_view seq, const i2l::phylo_kmer_db& db,
+                             const key_filter* filter = nullptr);
+
+    /// \brief Queries the keys of an encoded sequence
+    kmer_results query_kmers(const encoded_sequence& kmers, const i2l::phylo_kmer_db& db,
+                             const key_filter* filter = nullptr);
+
+    /// \brief Queries the keys of a batch of encoded sequences with a sort-merge join.
+    /// \details The exact keys of all sequences are sorted together with their positions,
+    /// every distinct key is searched once and its result is copied to all its occurrences.
+    /// The result of every sequence is the same as the one of query_kmers
+    std::vector<kmer_results> join_kmers(const std::vector<encoded_sequence>& kmers,
+                                         const i2l::phylo_kmer_db& db, size_t num_threads,
+                                         const key_filter* filter = nullptr);
+
+    /// \brief The contribution of the k-mers of one database shard to the scores of a sequence
+    struct partial_scores
+    {
+        /// A posting of an ambiguous k-mer key. Keys are numbered in the order of
+        /// encoded_sequence::ambiguous
+        struct ambiguous_posting
+        {
+            uint32_t key_index;
+            i2l::phylo_kmer::branch_type branch;
+            i2l::phylo_kmer::score_type score;
+        };
+
+        /// Sums of the scores of exact k-mers and their counts for every branch scored
+        std::vector<i2l::phylo_kmer::branch_type> branches;
+        std::vector<i2l::phylo_kmer::score_type> scores;
+        std::vector<uint32_t> counts;
+
+        /// Ambiguous k-mers are averaged over all their keys and can not be summed up
+        /// over shards. Their postings are returned as they are
+        std::vector<ambiguous_posting> ambiguous;
+    };
+
+    /// \brief Groups fasta sequences by their sequence content.
+    sequence_map_t group_by_sequence_content(const std::vector<seq_view>& seqs);
+
+    /// \brief Copies the keys of an input map to a vector
+    std::vector<std::string_view> copy_keys(const sequence_map_t& map);
 }
 
 namespace epik
 {
+    /// \brief How the k-mers of a batch are searched in the database
+    enum class engine
+    {
+        /// Every sequence searches its k-mers independently
+        per_read,
+
+        /// The k-mers of the whole batch are searched at once, every distinct k-mer once
+        /// (see impl::join_kmers). Faster on batches of similar reads, e.g. amplicons
+        join
+    };
+
+    engine parse_engine(const std::string& name);
+
     /// \brief Places a collection of fasta sequences
     class placer
     {
         using placed_collection = impl::placed_collection;
         using placed_sequence = impl::placed_sequence;
-        using score_vector = std::vector<i2l::phylo_kmer::score_type>;
-        using count_vector = std::vector<size_t>;
-        using branch_list = std::vector<i2l::phylo_kmer::branch_type>;
 
     public:
         /// \brief Constructor.
@@ -102,42 +255,249 @@ namespace epik
         /// \brief Places a collection of fasta sequences
         placed_collection place(const std::vector<i2l::seq_record>& seq_records, size_t num_threads);
 
-    private:
+        /// \brief Places a collection of sequences without copying them.
+        /// \details The result refers to the memory of the input views
+        placed_collection place(const std::vector<impl::seq_view>& seqs, size_t num_threads);
+
+        /// The stages of place() are public to be measured in isolation by epik-bench.
+
+        /// \brief Places a sequence, computes the weight ratios and keeps the best placements
+        placed_sequence place_encoded(std::string_view seq, const impl::encoded_sequence& kmers);
+
+        /// \brief Places a sequence by the results of DB search, computes the weight ratios
+        /// and keeps the best placements
+        placed_sequence place_searched(std::string_view seq, const impl::kmer_results& search_results);
 
         /// \brief Places a fasta sequence
         placed_sequence place_seq(std::string_view seq);
+        placed_sequence place_seq(std::string_view seq, const impl::encoded_sequence& kmers);
+
+        /// \brief Places one sequence with the scratch number thread_id (less than max_threads), computes
+        /// the weight ratios and keeps the best placements. Can be called from threads not managed by OpenMP,
+        /// concurrently with different thread ids (see stream_placer)
+        placed_sequence place_one(std::string_view seq, size_t thread_id);
 
         epik::impl::placement::weight_ratio_type sum_scores(const std::vector<epik::impl::placement>& placements,
                                                             std::string_view seq);
 
         std::vector<impl::placement> select_best_placements(std::vector<impl::placement> placements, size_t num_kmers);
 
+        /// \brief Computes the likelihood weight ratios of the selected placements and
+        /// removes those that have a low weight ratio
+        void compute_weight_ratios(std::vector<impl::placement>& placements,
+                                   impl::placement::weight_ratio_type score_sum) const;
+
+        /// \brief Scores a sequence by the keys in [first_key, last_key] only. Used by the
+        /// workers of a sharded database
+        impl::partial_scores place_partial(const impl::encoded_sequence& kmers,
+                                           i2l::phylo_kmer::key_type first_key, i2l::phylo_kmer::key_type last_key);
+
+        /// \brief Sums up partial scores of the same sequence into one
+        impl::partial_scores merge_partials(const std::vector<const impl::partial_scores*>& partials);
+
+        /// \brief Places a sequence by the partial scores of all shards of a database, computes
+        /// the weight ratios and keeps the best placements
+        placed_sequence place_merged(std::string_view seq, const std::vector<const impl::partial_scores*>& partials);
+
+        /// \brief The most memory a thread takes to place queries: its score accumulator
+        /// and the scratch of the structures built (see build_clades, build_fixed_point)
+        size_t thread_scratch_bytes() const noexcept;
+
+        /// \brief Lowers the number of threads that can place at once and releases the scratch
+        /// of the others. Must not be called while placing
+        void set_max_threads(size_t num_threads);
+
+        /// \brief Builds a filter of the database keys with about bits_per_key bits per key.
+        /// Keys rejected by the filter are not searched. Must not be called while placing
+        void build_filter(size_t bits_per_key);
+
+        /// \brief The filter of the database keys, nullptr if there is none
+        const impl::key_filter* filter() const noexcept;
+
+        /// \brief Builds the dense tier of the k-mers scoring at least min_fraction of the branches.
+        /// Their scores are added as rows by the exact k-mer search once the score accumulator of the query
+        /// is dense (see impl::score_accumulator), their postings before. The tier takes at most max_bytes
+        /// (see impl::dense_tier). Must not be called while placing
+        void build_dense_tier(double min_fraction, size_t max_bytes = std::numeric_limits<size_t>::max());
+
+        /// \brief The dense tier of the database, nullptr if there is none
+        const impl::dense_tier* dense_tier() const noexcept;
+
+        /// \brief Splits the tree into clades of at most max_size branches and places coarse-to-fine:
+        /// the exact k-mers of a query are scored only in the num_candidates clades of the best
+        /// upper bounds (see impl::clade_index), and in the other clades whose bound is higher than
+        /// the score of the last placement kept. The placements kept are then the same as without clades.
+        /// The branches of the pruned clades count at the upper bound of their clade in the sum of the LWR:
+        /// with S this sum and P the weight of the bounds above the threshold score, the LWR is never higher
+        /// than without clades and at most S / (S - P) times lower, up to rounding. The keep_factor compares
+        /// the LWR to the best one and keeps the same placements. Queries with ambiguous k-mers are placed
+        /// on the whole tree. Must not be called while placing
+        void build_clades(size_t max_size, size_t num_candidates);
+
+        /// \brief The clades of the tree, nullptr if there are none
+        const impl::clade_index* clades() const noexcept;
+
+        /// \brief Converts the scores of the database to 16-bit fixed point (see impl::fixed_postings).
+        /// The exact k-mers of a query are then summed up as integers to find the branches that may be
+        /// among the best placements, within the error bound of impl::fixed_postings. They are scored
+        /// again with float scores and the best are kept: the placements and their scores are those of
+        /// the float path. The LWR is computed with the float scores of these branches and the
+        /// fixed-point scores of the other ones. Queries with ambiguous k-mers are placed with
+        /// float scores. The dense tier and the clades are not used. Must not be called while placing
+        void build_fixed_point();
+
+        /// \brief The fixed-point scores of the database, nullptr if there are none
+        const impl::fixed_postings* fixed_point() const noexcept;
+
+        /// \brief Skips the exact k-mers of uninformative posting lists at query time: those of more than
+        /// max_postings entries (0: no limit), and those whose scores spread over the branches less than
+        /// min_ratio (0: none), which score all branches about the same.
+        /// \details A k-mer scores the branches of its posting list, and the threshold score the other ones.
+        /// Its spread is the ratio of the best of these scores to the worst one. A skipped k-mer is not added
+        /// to the scores, so the threshold correction scores it with the threshold on every branch, like
+        /// a k-mer not found. The k-mers skipped are found once here. The policy changes the placement,
+        /// not the database: it can be set for every run without reloading. Ambiguous k-mers are not skipped.
+        /// Must not be called while placing
+        void set_skipping(size_t max_postings, double min_ratio);
+
+        /// \brief If a k-mer of the database is skipped (see set_skipping)
+        bool skips(i2l::phylo_kmer::key_type key) const noexcept
+        {
+            return _skipped.size() > 0 && _skipped.find(key) != impl::ordinal_index::none;
+        }
+
+        /// \brief The number of k-mers of the database skipped, and of their postings
+        size_t num_skipped_kmers() const noexcept;
+        size_t num_skipped_postings() const noexcept;
+
+        size_t kmer_size() const noexcept;
+        const i2l::phylo_kmer_db& db() const noexcept;
+
+        /// \brief The number of threads that can place at once, each with its own scratch
+        size_t max_threads() const noexcept;
+
+    private:
+        /// \brief The scratch number of the calling OpenMP thread
+        static size_t _current_thread() noexcept;
+
+        /// \brief Clears the score vectors of the calling thread. Returns the thread id
+        size_t _reset_thread_scores();
+        void _reset_thread_scores(size_t thread_id);
+
+        /// \brief Adds the average score of an ambiguous k-mer key to the scores of the thread
+        template<typename PostingList>
+        void _add_ambiguous_kmer(size_t thread_id, const PostingList& postings);
+
+        /// \brief Adds partial scores of exact k-mers to the scores of the thread
+        void _add_partial(size_t thread_id, const impl::partial_scores& partial);
+
+        /// \brief Copies the scores of exact k-mers of the thread to partial
+        void _get_partial(size_t thread_id, impl::partial_scores& partial) const;
+
+        /// \brief Applies the threshold score to the k-mers not found for the scored branches.
+        /// If num_sampled k-mers were sampled, the scores are scaled to all k-mers of the sequence
+        placed_sequence _correct_scores(std::string_view seq, size_t thread_id, size_t num_sampled = 0);
+
+        /// \brief Scores the branches of a sequence according to the results of DB search
+        placed_sequence _place_seq(std::string_view seq, const impl::kmer_results& search_results, size_t thread_id);
+
+        /// \brief Scores the branches of a sequence by the fixed-point scores of its exact k-mers.
+        /// Returns the best placements with the sum of 10^score over all branches
+        placed_sequence _place_fixed(std::string_view seq, const impl::kmer_results& search_results, size_t thread_id);
+
+        /// \brief A placement on the branch of the post-order id edge
+        impl::placement _make_placement(i2l::phylo_kmer::branch_type edge, i2l::phylo_kmer::score_type score,
+                                        size_t count) const;
+
+        /// \brief Keeps the best placements of a sequence and computes their weight ratios
+        void _select_and_weight(placed_sequence& placed_seq);
+
+        /// \brief Adds the scores of exact k-mers to the branches of the candidate clades of the query
+        /// (see build_clades). Returns the number of postings applied and the weight the branches of the
+        /// pruned clades may have above the threshold score (see placed_sequence::pruned_weight)
+        std::pair<size_t, impl::placement::weight_ratio_type> _add_by_clades(
+            std::string_view seq, size_t thread_id, const impl::kmer_results& search_results);
+
+
         const i2l::phylo_kmer_db& _db;
         const i2l::phylo_tree& _original_tree;
         const i2l::phylo_kmer::score_type _threshold;
         const i2l::phylo_kmer::score_type _log_threshold;
         const size_t _keep_at_most;
         const double _keep_factor;
-        const size_t _max_threads;
+        size_t _max_threads;
+
+        /// The scores of the query processed by every concurrent thread
+        std::vector<impl::score_accumulator> _accumulators;
+
+        std::unique_ptr<impl::key_filter> _filter;
+
+        std::unique_ptr<impl::dense_tier> _dense_tier;
 
-        // A vector of vectors of scores. Every vector corresponds to an array S[]
-        // (in terms of the RAPPAS' supplement) for a concurrent thread and its query.
-        // S[] is the array storing the scores S[i] of branch i for the processed query.
-        std::vector<score_vector> _scores;
-        std::vector<score_vector> _scores_amb;
+        /// The bounds of the clades for the query processed by every concurrent thread
+        struct clade_scratch
+        {
+            /// The upper bound of the score of a clade, minus the threshold score of all k-mers
+            std::vector<i2l::phylo_kmer::score_type> bounds;
 
-        // A vector of vectors of branch counts. Every vector corresponds to C[],
-        // the array counting the number of k-mers of the query mapped to branch C[i]
-        std::vector<count_vector> _counts;
-        std::vector<count_vector> _counts_amb;
+            /// 0: not scored by the query, 1: pruned, 2: candidate, 3: pruned, then scored
+            std::vector<uint8_t> states;
+            std::vector<uint32_t> scored;
+            std::vector<i2l::phylo_kmer::score_type> branch_scores;
+        };
 
-        /// A vector of vector of branch ids. Every vector corresponds to L[],
-        /// the list of branches mapped to some k-mer in the query, i.e.
-        /// branches i such that C[i] > 0
-        std::vector<branch_list> _edges;
+        std::unique_ptr<impl::fixed_postings> _fixed;
+        std::vector<impl::fixed_accumulator> _fixed_accumulators;
+
+        std::unique_ptr<impl::clade_index> _clades;
+        size_t _num_candidates;
+        std::vector<clade_scratch> _clade_scratch;
+
+        /// The keys of the k-mers skipped (see set_skipping)
+        impl::ordinal_index _skipped;
+        size_t _num_skipped_postings;
+
+        /// The table-driven k-mer encoder, nullptr if i2l::to_kmers is used
+        std::unique_ptr<impl::kmer_encoder> _encoder;
 
         std::vector<double> _pendant_lengths;
     };
+
+    /// \brief A batch of sequences grouped by content and encoded once, to be placed
+    /// against several databases
+    class encoded_batch
+    {
+    public:
+        /// \brief Deduplicates the sequences and encodes them for every k of kmer_sizes.
+        /// \details The batch refers to the memory of the input views
+        encoded_batch(const std::vector<impl::seq_view>& seqs, const std::vector<size_t>& kmer_sizes,
+                      size_t num_threads, const sampling& sampling = {});
+        encoded_batch(const encoded_batch&) = delete;
+        encoded_batch(encoded_batch&&) = default;
+        encoded_batch& operator=(const encoded_batch&) = delete;
+        encoded_batch& operator=(encoded_batch&&) = default;
+        ~encoded_batch() noexcept = default;
+
+        size_t num_reads() const noexcept;
+        const impl::sequence_map_t& sequence_map() const noexcept;
+        const std::vector<std::string_view>& unique_sequences() const noexcept;
+
+        /// \brief The encoded unique sequences for k-mers of size k
+        const std::vector<impl::encoded_sequence>& kmers(size_t k) const;
+
+    private:
+        size_t _num_reads;
+        impl::sequence_map_t _sequence_map;
+        std::vector<std::string_view> _unique_sequences;
+        std::unordered_map<size_t, std::vector<impl::encoded_sequence>> _kmers;
+    };
+
+    /// \brief Places a batch against several databases in one parallel loop.
+    /// Returns a collection of placed sequences for every placer, in the same order.
+    /// \details The placers must be created with at least num_threads threads
+    std::vector<impl::placed_collection> place(const std::vector<placer*>& placers,
+                                               const encoded_batch& batch, size_t num_threads,
+                                               engine search_engine = engine::per_read);
 }
 
 #endif
@@ -0,0 +1,127 @@
+#ifndef EPIK_SHARD_H
+#define EPIK_SHARD_H
+
+#include <memory>
+#include <string>
+#include <vector>
+#include <sys/types.h>
+#include <i2l/phylo_kmer.h>
+#include <epik/place.h>
+
+namespace i2l
+{
+    class phylo_kmer_db;
+    class phylo_tree;
+}
+
+/// Sharded databases: the key space of a database is split into ranges stored
+/// in separate files, every range is served by its own worker process.
+/// Workers return partial scores that a coordinator merges and places.
+namespace epik::shard
+{
+    /// \brief A shard file storing all phylo-k-mers with keys in [first_key, last_key]
+    struct shard_info
+    {
+        std::string filename;
+        i2l::phylo_kmer::key_type first_key;
+        i2l::phylo_kmer::key_type last_key;
+        size_t num_entries;
+    };
+
+    /// \brief The description of a sharded database, stored in a .json file next to the shards
+    struct manifest
+    {
+        /// The original database
+        std::string database;
+
+        /// A database with the tree of the original one and no phylo-k-mers,
+        /// loaded by the coordinator
+        std::string skeleton;
+
+        std::vector<shard_info> shards;
+
+        /// The proportion of the database kept when it was split (--mu). The shards store the
+        /// phylo-k-mers kept and are loaded whole
+        float mu = 1.0f;
+    };
+
+    /// \brief Reads a manifest. The filenames of the result are resolved relative to the manifest
+    manifest read_manifest(const std::string& filename);
+
+    /// \brief Splits a database into num_shards key ranges of about the same number of entries.
+    /// Writes the shards, the skeleton and the manifest <name>.shards.json to output_dir.
+    /// The database must be loaded whole, filtered with mu. Returns the filename of the manifest.
+    std::string make_shards(const i2l::phylo_kmer_db& db, const std::string& db_filename,
+                            size_t num_shards, const std::string& output_dir, float mu);
+
+    /// \brief The number of phylo-k-mers of the largest shard
+    size_t max_shard_entries(const manifest& manifest);
+
+    /// \brief Serves the requests of a coordinator: reads batches of sequences from in_fd
+    /// and writes their partial scores to out_fd until the end of input
+    void run_worker(placer& placer, const shard_info& shard, size_t num_threads, int in_fd, int out_fd);
+
+    /// \brief A worker process connected to the coordinator by its standard input and output
+    class worker_process
+    {
+    public:
+        /// \brief Runs args[0] with the arguments args
+        explicit worker_process(const std::vector<std::string>& args);
+        worker_process(const worker_process&) = delete;
+        worker_process(worker_process&&) = delete;
+        worker_process& operator=(const worker_process&) = delete;
+        worker_process& operator=(worker_process&&) = delete;
+
+        /// \brief Closes the input of the worker and waits for it to finish
+        ~worker_process() noexcept;
+
+        void send(const std::vector<std::string_view>& sequences);
+        std::vector<impl::partial_scores> receive(size_t num_sequences);
+
+    private:
+        pid_t _pid;
+        int _to_worker;
+        int _from_worker;
+    };
+
+    /// \brief Places batches against a sharded database. Every shard is served by a worker
+    /// process; the placer of the skeleton database merges their partial scores
+    class coordinator
+    {
+    public:
+        /// \brief Starts a worker for every shard of the manifest. worker_args are the command
+        /// to run a worker, the shard index is appended to them
+        coordinator(placer& placer, const manifest& manifest, const std::vector<std::string>& worker_args);
+
+        impl::placed_collection place(const std::vector<impl::seq_view>& seqs, size_t num_threads);
+
+    private:
+        placer& _placer;
+        std::vector<std::unique_ptr<worker_process>> _workers;
+    };
+
+    /// \brief Places batches against a sharded database in one process, loading the shards one
+    /// at a time. The partial scores of the batch are kept between shards, so the memory is bounded
+    /// by the largest shard plus the batch. Every batch loads all the shards: make batches large
+    class out_of_core_placer
+    {
+    public:
+        /// \brief The shards are loaded whole with omega (--mu was applied when they were made).
+        /// Throws if the largest shard has more than max_entries phylo-k-mers
+        out_of_core_placer(placer& placer, const i2l::phylo_tree& tree, const manifest& manifest,
+                           float omega, size_t max_entries);
+
+        impl::placed_collection place(const std::vector<impl::seq_view>& seqs, size_t num_threads);
+
+    private:
+        placer& _placer;
+        const i2l::phylo_tree& _tree;
+        const manifest& _manifest;
+        float _omega;
+
+        /// Made once: the encoder validates itself against i2l. nullptr if i2l::to_kmers is used
+        std::unique_ptr<impl::kmer_encoder> _encoder;
+    };
+}
+
+#endif
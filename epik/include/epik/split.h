@@ -0,0 +1,61 @@
+#ifndef EPIK_SPLIT_H
+#define EPIK_SPLIT_H
+
+#include <string>
+#include <vector>
+
+/// Splitting a query file into parts placed by independent processes (e.g. on several nodes),
+/// and merging their outputs
+namespace epik::split
+{
+    /// \brief One of count parts of a query file, numbered from 0
+    struct part
+    {
+        size_t index;
+        size_t count;
+    };
+
+    /// \brief Parses a part given as "index/count", e.g. "0/4"
+    part parse_part(const std::string& value);
+
+    /// \brief The name of the output of a part: ".partIofN" inserted before the extension of filename
+    std::string part_filename(const std::string& filename, const part& part);
+
+    /// \brief A range of bytes of a file, [begin, end)
+    struct byte_range
+    {
+        size_t begin;
+        size_t end;
+    };
+
+    /// \brief The bytes of a part of a fasta or fastq file, read by io::mapped_fasta. The file is split into parts
+    /// of about equal size at record boundaries: every record belongs to the part where its header starts
+    byte_range find_range(const std::string& filename, const part& part);
+
+    /// \brief Where the placements are in a .jplace file written for a part, to merge it
+    /// without parsing. Saved to filename + ".index"
+    struct fragment
+    {
+        std::string filename;
+
+        /// The placements are the bytes [placements_begin, placements_end): a list of objects
+        /// without brackets. The rest of the file is the header and the footer
+        size_t placements_begin;
+        size_t placements_end;
+        size_t num_placements;
+    };
+
+    void save_fragment_index(const fragment& fragment);
+
+    fragment load_fragment_index(const std::string& filename);
+
+    /// \brief Merges the .jplace files of all parts into one: the header and the footer of the first
+    /// part (tree, fields and metadata), and the placements of every part in order. The headers of all parts
+    /// must be the same but for the metadata, or the merge fails. Returns the number of placements
+    size_t merge_jplace(const std::vector<std::string>& fragments, const std::string& output);
+
+    /// \brief Sums up the mass tables of all parts (see io::mass_writer)
+    void merge_mass(const std::vector<std::string>& tables, const std::string& output);
+}
+
+#endif
@@ -0,0 +1,98 @@
+#ifndef EPIK_STREAM_H
+#define EPIK_STREAM_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <epik/place.h>
+
+namespace epik
+{
+    /// \brief The placement of a read submitted to stream_placer
+    struct placed_read
+    {
+        std::string header;
+        std::vector<impl::placement> placements;
+
+        /// The time from the submission of the read to the end of its placement,
+        /// and the part of it the read waited in the queue
+        std::chrono::nanoseconds latency;
+        std::chrono::nanoseconds queued;
+    };
+
+    /// \brief Places reads one by one as they arrive, e.g. for the decisions of adaptive sampling.
+    /// \details Reads wait in a queue of bounded capacity and are placed by worker threads as soon as
+    /// one of them is free, without batches and barriers. Every worker uses its own scratch of the placer
+    /// (see placer::place_one), which is warmed up by placing some reads before the first submission.
+    /// When the queue is full, try_submit rejects the read instead of making the queue and the latency grow
+    class stream_placer
+    {
+    public:
+        /// Receives every placed read. Called by the worker that placed it
+        using callback = std::function<void(placed_read&&)>;
+
+        /// \brief Starts num_workers workers (no more than the max_threads of the placer). warm_up reads
+        /// are placed by every worker before the constructor returns, and not reported
+        stream_placer(placer& placer, size_t num_workers, size_t queue_capacity, callback on_placed,
+                      const std::vector<std::string>& warm_up = {});
+        stream_placer(const stream_placer&) = delete;
+        stream_placer(stream_placer&&) = delete;
+        stream_placer& operator=(const stream_placer&) = delete;
+        stream_placer& operator=(stream_placer&&) = delete;
+
+        /// \brief Places the reads left in the queue and stops the workers
+        ~stream_placer() noexcept;
+
+        /// \brief Queues a read. Returns false without queueing it if the queue is full
+        bool try_submit(std::string header, std::string sequence);
+
+        /// \brief Queues a read, waits while the queue is full
+        void submit(std::string header, std::string sequence);
+
+        /// \brief Waits until every read submitted is placed. Rethrows the first error of the workers
+        void wait();
+
+        /// \brief The number of reads rejected by try_submit
+        size_t num_rejected() const;
+
+    private:
+        using clock = std::chrono::steady_clock;
+
+        struct request
+        {
+            std::string header;
+            std::string sequence;
+            clock::time_point submitted;
+        };
+
+        void _push(std::string header, std::string sequence);
+        void _work(size_t thread_id);
+
+        placer& _placer;
+        callback _on_placed;
+
+        /// A ring buffer of _queue.size() requests, _size of them from _head are queued
+        std::vector<request> _queue;
+        size_t _head;
+        size_t _size;
+
+        size_t _num_busy;
+        size_t _num_rejected;
+        bool _stopping;
+        std::exception_ptr _error;
+
+        mutable std::mutex _mutex;
+        std::condition_variable _not_empty;
+        std::condition_variable _not_full;
+        std::condition_variable _idle;
+
+        std::vector<std::thread> _workers;
+    };
+}
+
+#endif
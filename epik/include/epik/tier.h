@@ -0,0 +1,88 @@
+#ifndef EPIK_TIER_H
+#define EPIK_TIER_H
+
+#include <vector>
+#include <optional>
+#include <limits>
+#include <cstdint>
+#include <i2l/phylo_kmer.h>
+#include <epik/ordinal.h>
+
+namespace i2l
+{
+    class phylo_kmer_db;
+}
+
+namespace epik::impl
+{
+    /// \brief The phylo-k-mers that score a large part of the tree, stored as dense rows of scores.
+    /// \details A k-mer of a conserved region has a posting list covering many branches, which
+    /// update_vector applies with scattered reads and writes over the whole score array.
+    /// Its row of scores in branch order is applied with contiguous SIMD adds instead (see add_row).
+    /// The database keeps all posting lists: the row of a k-mer is found by its key
+    /// (see impl::ordinal_index), only for lists long enough to be in the tier
+    class dense_tier
+    {
+    public:
+        using score_type = i2l::phylo_kmer::score_type;
+
+        /// \brief The scores of every branch (0 if the k-mer does not score it)
+        /// and the number of its postings (usually 0 or 1) of every branch
+        struct row
+        {
+            const score_type* scores;
+            const uint8_t* hits;
+        };
+
+        /// \brief Stores the k-mers of db whose posting lists cover at least min_fraction
+        /// of num_branches branches. If they take more than max_bytes, the longest lists are stored
+        dense_tier(const i2l::phylo_kmer_db& db, size_t num_branches, double min_fraction,
+                   size_t max_bytes = std::numeric_limits<size_t>::max());
+
+        /// \brief The row of a k-mer of the database and its posting list, nothing if the k-mer
+        /// is not in the tier. Shorter lists than min_postings(), empty ones too, are not looked up
+        template<class PostingList>
+        std::optional<row> find(i2l::phylo_kmer::key_type key, const PostingList& postings) const noexcept
+        {
+            if ((size_t)postings.size() < _min_postings)
+            {
+                return std::nullopt;
+            }
+            const auto ordinal = _rows.find(key);
+            if (ordinal == ordinal_index::none)
+            {
+                return std::nullopt;
+            }
+            return row{ _scores.data() + (size_t)ordinal * _stride, _hits.data() + (size_t)ordinal * _stride };
+        }
+
+        size_t num_branches() const noexcept;
+
+        /// \brief The number of k-mers in the tier
+        size_t num_kmers() const noexcept;
+
+        /// \brief The number of postings of the k-mers in the tier
+        size_t num_postings() const noexcept;
+
+        /// \brief The shortest posting list in the tier
+        size_t min_postings() const noexcept;
+
+        size_t memory_bytes() const noexcept;
+
+    private:
+        size_t _num_branches;
+
+        /// The size of a row, rounded up to a multiple of 64 elements
+        size_t _stride;
+        size_t _min_postings;
+        size_t _num_postings;
+
+        std::vector<score_type> _scores;
+        std::vector<uint8_t> _hits;
+
+        /// The key of a k-mer -> its row
+        ordinal_index _rows;
+    };
+}
+
+#endif
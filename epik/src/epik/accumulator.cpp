@@ -0,0 +1,319 @@
+#include <epik/accumulator.h>
+#include <epik/metrics.h>
+
+using namespace epik::impl;
+
+namespace
+{
+    /// The initial size of the hash table
+    constexpr size_t min_capacity_log = 6;
+
+    /// Fibonacci hashing: the high bits of the product
+    inline size_t slot_of(score_accumulator::branch_type branch, size_t shift)
+    {
+        return static_cast<size_t>((static_cast<uint64_t>(branch) * 11400714819323198485ull) >> shift);
+    }
+}
+
+score_accumulator::score_accumulator(size_t num_branches)
+    : _num_branches{ num_branches }
+    , _dense_threshold{ num_branches / dense_fraction }
+    , _dense{ false }
+    , _num_small_queries{ 0 }
+    , _shift{ 64 }
+{
+    if (num_branches <= min_sparse_branches)
+    {
+        _make_dense();
+    }
+    else
+    {
+        _rehash(size_t{1} << min_capacity_log);
+    }
+}
+
+size_t score_accumulator::dense_bytes(size_t num_branches) noexcept
+{
+    return num_branches * (2 * sizeof(score_type) + 2 * sizeof(size_t) + sizeof(uint32_t));
+}
+
+size_t score_accumulator::max_bytes(size_t num_branches) noexcept
+{
+    /// Every branch can be scored. The branches and slots are pushed back: a vector takes up to twice its size
+    const auto edges_bytes = 2 * num_branches * sizeof(branch_type);
+    if (num_branches <= min_sparse_branches)
+    {
+        return dense_bytes(num_branches) + edges_bytes;
+    }
+
+    /// The table holds at most _dense_threshold + 1 branches at a load factor under 1/2
+    const auto max_slots = num_branches / dense_fraction + 1;
+    size_t capacity = size_t{1} << min_capacity_log;
+    while (2 * max_slots > capacity)
+    {
+        capacity *= 2;
+    }
+    return dense_bytes(num_branches) + edges_bytes + capacity * sizeof(entry) + 2 * max_slots * sizeof(size_t);
+}
+
+void score_accumulator::clear()
+{
+    if (_dense)
+    {
+        for (const auto branch : _edges)
+        {
+            _counts[branch] = 0;
+            _scores[branch] = 0.0f;
+            _counts_amb[branch] = 0;
+            _scores_amb[branch] = 0.0f;
+        }
+
+        /// A high-fanout query should not keep the arrays of a large tree for all the next ones
+        if (_num_branches > min_sparse_branches)
+        {
+            _num_small_queries = _edges.size() <= _dense_threshold ? _num_small_queries + 1 : 0;
+            if (_num_small_queries >= sparse_after)
+            {
+                _make_sparse();
+            }
+        }
+    }
+    else
+    {
+        for (const auto slot : _slots)
+        {
+            _table[slot] = { empty_branch, 0, 0, 0.0f, 0.0f };
+        }
+        _slots.clear();
+    }
+    _rows.clear();
+    _edges.clear();
+}
+
+void score_accumulator::add(branch_type branch, score_type score, size_t count)
+{
+    if (_dense)
+    {
+        if (_counts[branch] == 0)
+        {
+            _edges.push_back(branch);
+        }
+        _counts[branch] += count;
+        _scores[branch] += score;
+    }
+    else
+    {
+        auto& e = _find_or_insert(branch);
+        if (e.count == 0)
+        {
+            _edges.push_back(branch);
+        }
+        e.count += static_cast<uint32_t>(count);
+        e.score += score;
+        _check_density();
+    }
+}
+
+bool score_accumulator::add_row(const dense_tier::row& row)
+{
+    if (!_dense)
+    {
+        return false;
+    }
+    _rows.push_back(row);
+    return true;
+}
+
+void score_accumulator::apply_rows()
+{
+    if (_rows.empty())
+    {
+        return;
+    }
+    EPIK_COUNT(dense_rows_applied, _rows.size());
+
+    if (_row_hits.empty())
+    {
+        _row_hits.resize(_num_branches, 0);
+    }
+    for (const auto& row : _rows)
+    {
+        ::add_row(_scores.data(), _row_hits.data(), row.scores, row.hits, _num_branches);
+    }
+    _rows.clear();
+
+    /// Branches scored by rows are found in one pass, not by every row
+    for (size_t branch = 0; branch < _num_branches; ++branch)
+    {
+        if (_row_hits[branch] > 0)
+        {
+            if (_counts[branch] == 0)
+            {
+                _edges.push_back(static_cast<branch_type>(branch));
+            }
+            _counts[branch] += _row_hits[branch];
+            _row_hits[branch] = 0;
+        }
+    }
+}
+
+bool score_accumulator::add_ambiguous(branch_type branch, score_type probability)
+{
+    if (_dense)
+    {
+        const bool first = _counts_amb[branch] == 0;
+        _counts_amb[branch] += 1;
+        _scores_amb[branch] += probability;
+        return first;
+    }
+    else
+    {
+        auto& e = _find_or_insert(branch);
+        const bool first = e.count_amb == 0;
+        e.count_amb += 1;
+        e.score_amb += probability;
+        _check_density();
+        return first;
+    }
+}
+
+std::pair<score_accumulator::score_type, size_t> score_accumulator::ambiguous(branch_type branch) const
+{
+    if (_dense)
+    {
+        return { _scores_amb[branch], _counts_amb[branch] };
+    }
+
+    if (const auto* e = _find(branch))
+    {
+        return { e->score_amb, e->count_amb };
+    }
+    return { 0.0f, 0 };
+}
+
+const std::vector<score_accumulator::branch_type>& score_accumulator::edges() const noexcept
+{
+    return _edges;
+}
+
+bool score_accumulator::is_dense() const noexcept
+{
+    return _dense;
+}
+
+const score_accumulator::entry* score_accumulator::_find(branch_type branch) const
+{
+    const size_t mask = _table.size() - 1;
+    for (size_t slot = slot_of(branch, _shift); ; slot = (slot + 1) & mask)
+    {
+        const auto& e = _table[slot];
+        if (e.branch == branch)
+        {
+            return &e;
+        }
+        if (e.branch == empty_branch)
+        {
+            return nullptr;
+        }
+    }
+}
+
+score_accumulator::entry& score_accumulator::_find_or_insert(branch_type branch)
+{
+    /// Keep the load factor under 1/2
+    if (2 * (_slots.size() + 1) > _table.size())
+    {
+        _rehash(2 * _table.size());
+    }
+
+    const size_t mask = _table.size() - 1;
+    for (size_t slot = slot_of(branch, _shift); ; slot = (slot + 1) & mask)
+    {
+        auto& e = _table[slot];
+        if (e.branch == branch)
+        {
+            return e;
+        }
+        if (e.branch == empty_branch)
+        {
+            e.branch = branch;
+            _slots.push_back(slot);
+            return e;
+        }
+    }
+}
+
+void score_accumulator::_rehash(size_t capacity)
+{
+    std::vector<entry> old_table(capacity, { empty_branch, 0, 0, 0.0f, 0.0f });
+    std::swap(old_table, _table);
+
+    size_t capacity_log = 0;
+    while ((size_t{1} << capacity_log) < capacity)
+    {
+        ++capacity_log;
+    }
+    _shift = 64 - capacity_log;
+
+    const size_t mask = _table.size() - 1;
+    std::vector<size_t> old_slots;
+    std::swap(old_slots, _slots);
+    for (const auto old_slot : old_slots)
+    {
+        const auto& old_entry = old_table[old_slot];
+        size_t slot = slot_of(old_entry.branch, _shift);
+        while (_table[slot].branch != empty_branch)
+        {
+            slot = (slot + 1) & mask;
+        }
+        _table[slot] = old_entry;
+        _slots.push_back(slot);
+    }
+}
+
+void score_accumulator::_make_dense()
+{
+    /// Accumulators of small trees are dense from the start and not counted
+    if (!_slots.empty())
+    {
+        EPIK_COUNT(dense_promotions, 1);
+    }
+
+    if (_scores.empty())
+    {
+        _scores.resize(_num_branches, 0.0f);
+        _scores_amb.resize(_num_branches, 0.0f);
+        _counts.resize(_num_branches, 0);
+        _counts_amb.resize(_num_branches, 0);
+    }
+
+    for (const auto slot : _slots)
+    {
+        const auto& e = _table[slot];
+        _scores[e.branch] = e.score;
+        _scores_amb[e.branch] = e.score_amb;
+        _counts[e.branch] = e.count;
+        _counts_amb[e.branch] = e.count_amb;
+    }
+
+    /// The hash table is not needed anymore
+    _table = {};
+    _slots = {};
+    _dense = true;
+    _num_small_queries = 0;
+}
+
+void score_accumulator::_make_sparse()
+{
+    EPIK_COUNT(dense_releases, 1);
+
+    _scores = {};
+    _scores_amb = {};
+    _counts = {};
+    _counts_amb = {};
+    _row_hits = {};
+    _edges = {};
+    _dense = false;
+    _num_small_queries = 0;
+    _rehash(size_t{1} << min_capacity_log);
+}
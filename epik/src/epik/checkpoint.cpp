@@ -0,0 +1,136 @@
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <boost/filesystem.hpp>
+#include <rapidjson/document.h>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+#include <epik/checkpoint.h>
+
+namespace fs = boost::filesystem;
+
+void epik::save_checkpoint(const std::string& filename, const checkpoint& state)
+{
+    rapidjson::StringBuffer buffer;
+    rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("query");
+    writer.String(state.query_file.c_str());
+    writer.Key("batch_size");
+    writer.Uint64(state.batch_size);
+    writer.Key("sequences");
+    writer.Uint64(state.num_sequences);
+    writer.Key("input_offset");
+    writer.Uint64(state.input_offset);
+    writer.Key("mates_offset");
+    writer.Uint64(state.mates_offset);
+    writer.Key("outputs");
+    writer.StartArray();
+    for (const auto& output : state.outputs)
+    {
+        writer.StartObject();
+        writer.Key("file");
+        writer.String(output.filename.c_str());
+        writer.Key("position");
+        writer.Uint64(output.position);
+        writer.Key("placements");
+        writer.Uint64(output.num_placements);
+        writer.Key("placements_begin");
+        writer.Uint64(output.placements_begin);
+        if (!output.mass_snapshot.empty())
+        {
+            writer.Key("mass");
+            writer.String(output.mass_snapshot.c_str());
+        }
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+
+    /// A rename is atomic: an interruption leaves the previous checkpoint. The content is on the disk
+    /// before the rename, and the rename before the previous mass tables are removed
+    const auto temp_filename = filename + ".tmp";
+    {
+        std::ofstream out(temp_filename);
+        if (!out)
+        {
+            throw std::runtime_error("Could not create file " + temp_filename);
+        }
+        out << buffer.GetString() << std::endl;
+        if (!out)
+        {
+            throw std::runtime_error("Could not write file " + temp_filename);
+        }
+    }
+    sync_file(temp_filename);
+    fs::rename(temp_filename, filename);
+    const auto directory = fs::absolute(filename).parent_path();
+    sync_file(directory.string());
+}
+
+std::optional<epik::checkpoint> epik::load_checkpoint(const std::string& filename)
+{
+    if (!fs::exists(filename))
+    {
+        return std::nullopt;
+    }
+
+    std::ifstream in(filename);
+    if (!in)
+    {
+        throw std::runtime_error("Could not open file " + filename);
+    }
+    std::stringstream content;
+    content << in.rdbuf();
+
+    rapidjson::Document document;
+    document.Parse(content.str().c_str());
+    if (document.HasParseError() || !document.IsObject() ||
+        !document.HasMember("query") || !document.HasMember("batch_size") || !document.HasMember("sequences") ||
+        !document.HasMember("input_offset") || !document.HasMember("outputs") || !document["outputs"].IsArray())
+    {
+        throw std::runtime_error("Wrong checkpoint: " + filename);
+    }
+
+    checkpoint result;
+    result.query_file = document["query"].GetString();
+    result.batch_size = static_cast<size_t>(document["batch_size"].GetUint64());
+    result.num_sequences = static_cast<size_t>(document["sequences"].GetUint64());
+    result.input_offset = static_cast<size_t>(document["input_offset"].GetUint64());
+    result.mates_offset = document.HasMember("mates_offset")
+        ? static_cast<size_t>(document["mates_offset"].GetUint64()) : 0;
+
+    const auto& outputs = document["outputs"];
+    for (rapidjson::SizeType i = 0; i < outputs.Size(); ++i)
+    {
+        const auto& output = outputs[i];
+        result.outputs.push_back({
+            output["file"].GetString(),
+            static_cast<size_t>(output["position"].GetUint64()),
+            static_cast<size_t>(output["placements"].GetUint64()),
+            output.HasMember("mass") ? output["mass"].GetString() : "",
+            output.HasMember("placements_begin") ? static_cast<size_t>(output["placements_begin"].GetUint64()) : 0
+        });
+    }
+    return result;
+}
+
+void epik::sync_file(const std::string& filename)
+{
+    const auto fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Could not open file " + filename + ": " + std::strerror(errno));
+    }
+    if (fsync(fd) != 0)
+    {
+        const auto error = errno;
+        close(fd);
+        throw std::runtime_error("Could not flush file " + filename + ": " + std::strerror(error));
+    }
+    close(fd);
+}
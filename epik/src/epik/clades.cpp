@@ -0,0 +1,156 @@
+#include <algorithm>
+#include <stdexcept>
+#include <i2l/phylo_kmer_db.h>
+#include <epik/clades.h>
+
+using namespace epik::impl;
+
+namespace
+{
+    /// \brief A range of post-order ids [begin, end)
+    struct id_range
+    {
+        size_t begin;
+        size_t end;
+    };
+
+    /// \brief Splits the tree into ranges of post-order ids: the subtrees of at most max_size nodes
+    /// that are not in a larger such subtree, and the nodes above them one by one. The ranges cover
+    /// all ids, since a subtree takes the ids [root - size + 1, root] in post-order
+    std::vector<id_range> find_subtrees(const i2l::phylo_kmer_db& db, size_t num_branches, size_t max_size)
+    {
+        const auto& index = db.tree_index();
+        const auto subtree_size = [&index](size_t id) { return std::max(index[id].subtree_num_nodes, size_t{1}); };
+
+        std::vector<id_range> ranges;
+        std::vector<size_t> stack = { num_branches - 1 };
+        while (!stack.empty())
+        {
+            const auto root = stack.back();
+            stack.pop_back();
+
+            const auto size = std::min(subtree_size(root), root + 1);
+            if (size <= max_size)
+            {
+                ranges.push_back({ root + 1 - size, root + 1 });
+                continue;
+            }
+
+            /// The root goes alone, its children are visited: the last child is root - 1,
+            /// every other one ends where the next one starts
+            ranges.push_back({ root, root + 1 });
+            const auto first = root + 1 - size;
+            for (auto child = root; child > first; )
+            {
+                --child;
+                stack.push_back(child);
+                child = child + 1 - std::min(subtree_size(child), child + 1 - first);
+            }
+        }
+
+        std::sort(ranges.begin(), ranges.end(), [](const auto& lhs, const auto& rhs) { return lhs.begin < rhs.begin; });
+        return ranges;
+    }
+}
+
+clade_index::clade_index(const i2l::phylo_kmer_db& db, size_t num_branches, size_t max_size, score_type log_threshold)
+    : _num_clades{ 0 }
+    , _max_size{ 0 }
+    , _clade_of(num_branches, 0)
+{
+    if (max_size == 0)
+    {
+        throw std::runtime_error("The size of clades has to be positive");
+    }
+    if (num_branches == 0 || db.tree_index().size() < num_branches)
+    {
+        throw std::runtime_error("The database has no subtree information for all branches of the tree");
+    }
+
+    /// Neighbouring subtrees are packed into clades of up to max_size nodes
+    size_t clade_size = 0;
+    for (const auto& range : find_subtrees(db, num_branches, max_size))
+    {
+        const auto size = range.end - range.begin;
+        if (_num_clades == 0 || clade_size + size > max_size)
+        {
+            ++_num_clades;
+            clade_size = 0;
+        }
+        clade_size += size;
+        _max_size = std::max(_max_size, clade_size);
+        std::fill(_clade_of.begin() + (long)range.begin, _clade_of.begin() + (long)range.end,
+                  static_cast<uint32_t>(_num_clades - 1));
+    }
+
+    _clade_sizes.resize(_num_clades, 0);
+    for (const auto clade : _clade_of)
+    {
+        ++_clade_sizes[clade];
+    }
+
+    /// The best score of every k-mer in the clades it scores
+    std::vector<score_type> best(_num_clades, log_threshold);
+    std::vector<uint8_t> is_scored(_num_clades, 0);
+    std::vector<uint32_t> scored;
+    std::vector<i2l::phylo_kmer::key_type> keys;
+    keys.reserve(db.size());
+    _offsets.reserve(db.size() + 1);
+    _offsets.push_back(0);
+    for (const auto& [key, entries] : db)
+    {
+        if (entries.size() == 0)
+        {
+            continue;
+        }
+
+        for (const auto& [branch, score] : entries)
+        {
+            if (branch >= num_branches)
+            {
+                throw std::runtime_error("Wrong branch in the database: " + std::to_string(branch));
+            }
+
+            const auto clade = _clade_of[branch];
+            if (!is_scored[clade])
+            {
+                is_scored[clade] = 1;
+                scored.push_back(clade);
+            }
+            best[clade] = std::max(best[clade], score);
+        }
+
+        for (const auto clade : scored)
+        {
+            _entries.push_back({ clade, best[clade] });
+            best[clade] = log_threshold;
+            is_scored[clade] = 0;
+        }
+        scored.clear();
+
+        keys.push_back(key);
+        _offsets.push_back(_entries.size());
+    }
+    _summaries = ordinal_index(keys);
+}
+
+size_t clade_index::num_clades() const noexcept
+{
+    return _num_clades;
+}
+
+size_t clade_index::max_size() const noexcept
+{
+    return _max_size;
+}
+
+size_t clade_index::num_entries() const noexcept
+{
+    return _entries.size();
+}
+
+size_t clade_index::memory_bytes() const noexcept
+{
+    return (_clade_of.size() + _clade_sizes.size()) * sizeof(uint32_t) + _entries.size() * sizeof(entry) +
+           _offsets.size() * sizeof(size_t) + _summaries.memory_bytes();
+}
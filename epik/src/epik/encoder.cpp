@@ -0,0 +1,284 @@
+#include <string>
+#include <optional>
+#include <algorithm>
+#include <stdexcept>
+#include <tuple>
+#include <i2l/kmer_iterator.h>
+#include <epik/encoder.h>
+
+using namespace epik::impl;
+
+namespace
+{
+    /// A k-mer and its keys: one key for an exact k-mer
+    using encoded_kmer = std::pair<std::string, std::vector<kmer_encoder::key_type>>;
+
+    /// \brief Encodes a sequence with i2l. Returns nothing if i2l does not accept it
+    std::optional<std::vector<encoded_kmer>> reference_kmers(std::string_view seq, size_t kmer_size)
+    {
+        std::vector<encoded_kmer> result;
+        try
+        {
+            for (const auto& [kmer, keys] : i2l::to_kmers<i2l::one_ambiguity_policy>(seq, kmer_size))
+            {
+                result.emplace_back(std::string(kmer), std::vector<kmer_encoder::key_type>(std::begin(keys), std::end(keys)));
+            }
+        }
+        catch (const std::exception&)
+        {
+            return std::nullopt;
+        }
+        return result;
+    }
+
+    /// \brief A deterministic pseudo-random sequence of the given characters
+    std::string random_sequence(const std::vector<char>& chars, size_t length, uint64_t& state)
+    {
+        std::string seq;
+        seq.reserve(length);
+        for (size_t i = 0; i < length; ++i)
+        {
+            state = state * 6364136223846793005ull + 1442695040888963407ull;
+            seq.push_back(chars[(state >> 33) % chars.size()]);
+        }
+        return seq;
+    }
+}
+
+kmer_encoder::kmer_encoder(size_t kmer_size) noexcept
+    : _kmer_size{ kmer_size }
+    , _base{ 0 }
+    , _most_significant_first{ true }
+    , _specialized{ false }
+    , _shift{ 0 }
+    , _range{ 0 }
+    , _classes{}
+    , _codes{}
+    , _first_resolution{}
+{}
+
+std::unique_ptr<kmer_encoder> kmer_encoder::make(size_t kmer_size, bool specialize)
+{
+    if (kmer_size == 0)
+    {
+        return nullptr;
+    }
+    auto encoder = std::unique_ptr<kmer_encoder>(new kmer_encoder(kmer_size));
+
+    /// The codes of a character are the keys of its 1-mer
+    std::vector<char> exact_chars;
+    std::vector<char> ambiguous_chars;
+    std::vector<char> separators;
+    uint64_t max_code = 0;
+    for (size_t c = 0; c < 256; ++c)
+    {
+        const auto ch = static_cast<char>(c);
+        encoder->_first_resolution[c] = static_cast<uint32_t>(encoder->_resolutions.size());
+
+        const auto kmers = reference_kmers(std::string_view(&ch, 1), 1);
+        if (!kmers || kmers->size() > 1)
+        {
+            encoder->_classes[c] = char_class::unsupported;
+        }
+        else if (kmers->empty())
+        {
+            encoder->_classes[c] = char_class::separator;
+            separators.push_back(ch);
+        }
+        else if (kmers->front().second.size() == 1)
+        {
+            encoder->_classes[c] = char_class::exact;
+            encoder->_codes[c] = kmers->front().second[0];
+            max_code = std::max(max_code, encoder->_codes[c]);
+            exact_chars.push_back(ch);
+        }
+        else
+        {
+            encoder->_classes[c] = char_class::ambiguous;
+            for (const auto key : kmers->front().second)
+            {
+                encoder->_resolutions.push_back(key);
+                max_code = std::max(max_code, uint64_t{ key });
+            }
+            ambiguous_chars.push_back(ch);
+        }
+    }
+    encoder->_first_resolution[256] = static_cast<uint32_t>(encoder->_resolutions.size());
+
+    /// Learn how two codes are combined from a few characters of different codes
+    std::vector<char> sample;
+    for (const auto ch : exact_chars)
+    {
+        const auto code = encoder->_codes[static_cast<unsigned char>(ch)];
+        const auto same_code = [&encoder, code](char other) {
+            return encoder->_codes[static_cast<unsigned char>(other)] == code;
+        };
+        if (sample.size() < 8 && std::none_of(sample.begin(), sample.end(), same_code))
+        {
+            sample.push_back(ch);
+        }
+    }
+    if (sample.size() < 2)
+    {
+        return nullptr;
+    }
+
+    std::vector<std::tuple<uint64_t, uint64_t, uint64_t>> pairs;
+    for (const auto first : sample)
+    {
+        for (const auto second : sample)
+        {
+            const char pair[] = { first, second };
+            const auto kmers = reference_kmers(std::string_view(pair, 2), 2);
+            if (!kmers || kmers->size() != 1 || kmers->front().second.size() != 1)
+            {
+                return nullptr;
+            }
+            pairs.emplace_back(encoder->_codes[static_cast<unsigned char>(first)],
+                               encoder->_codes[static_cast<unsigned char>(second)],
+                               kmers->front().second[0]);
+        }
+    }
+
+    bool found = false;
+    for (uint64_t base = max_code + 1; base <= 256 && !found; ++base)
+    {
+        for (const auto most_significant_first : { true, false })
+        {
+            const auto matches = [base, most_significant_first](const auto& pair) {
+                const auto& [first, second, key] = pair;
+                return key == (most_significant_first ? first * base + second : second * base + first);
+            };
+            if (std::all_of(pairs.begin(), pairs.end(), matches))
+            {
+                encoder->_base = base;
+                encoder->_most_significant_first = most_significant_first;
+                found = true;
+                break;
+            }
+        }
+    }
+    if (!found)
+    {
+        return nullptr;
+    }
+
+    const auto base = encoder->_base;
+    std::vector<uint64_t> powers = { 1 };
+    for (size_t i = 0; i < kmer_size; ++i)
+    {
+        if (powers.back() > (uint64_t{ 1 } << 62) / base)
+        {
+            return nullptr;
+        }
+        powers.push_back(powers.back() * base);
+    }
+    encoder->_range = powers.back();
+    powers.pop_back();
+    if (encoder->_most_significant_first)
+    {
+        std::reverse(powers.begin(), powers.end());
+    }
+    encoder->_weights = powers;
+
+    if ((base & (base - 1)) == 0)
+    {
+        while ((uint64_t{ 1 } << encoder->_shift) < base)
+        {
+            ++encoder->_shift;
+        }
+    }
+
+    if (specialize && encoder->_most_significant_first)
+    {
+        encoder->_specialized = (encoder->_shift == 2 && kmer_size >= 8 && kmer_size <= 12) ||
+                                (encoder->_shift == 5 && kmer_size >= 3 && kmer_size <= 7);
+    }
+
+    /// Check the tables against i2l: random sequences, every ambiguous character at every position
+    /// of a k-mer, and pairs of ambiguous characters closer than k
+    uint64_t state = kmer_size;
+    if (!encoder->_agrees(random_sequence(exact_chars, 4 * kmer_size + 64, state)))
+    {
+        return nullptr;
+    }
+    for (const auto ch : ambiguous_chars)
+    {
+        const auto seq = random_sequence(exact_chars, kmer_size + 1, state) + ch +
+                         random_sequence(exact_chars, kmer_size + 1, state);
+        if (!encoder->_agrees(seq))
+        {
+            return nullptr;
+        }
+    }
+    if (!ambiguous_chars.empty())
+    {
+        const auto first = ambiguous_chars.front();
+        const auto second = ambiguous_chars.back();
+        for (size_t distance = 1; distance <= kmer_size; ++distance)
+        {
+            const auto seq = random_sequence(exact_chars, kmer_size, state) + first +
+                             random_sequence(exact_chars, distance - 1, state) + second +
+                             random_sequence(exact_chars, kmer_size, state);
+            if (!encoder->_agrees(seq))
+            {
+                return nullptr;
+            }
+        }
+    }
+
+    /// Characters without k-mers may be skipped by i2l rather than separate k-mers.
+    /// Sequences with such characters are encoded by i2l
+    for (const auto ch : separators)
+    {
+        const auto seq = random_sequence(exact_chars, kmer_size + 1, state) + ch +
+                         random_sequence(exact_chars, kmer_size + 1, state);
+        if (!encoder->_agrees(seq))
+        {
+            encoder->_classes[static_cast<unsigned char>(ch)] = char_class::unsupported;
+        }
+    }
+    return encoder;
+}
+
+size_t kmer_encoder::kmer_size() const noexcept
+{
+    return _kmer_size;
+}
+
+bool kmer_encoder::specialized() const noexcept
+{
+    return _specialized;
+}
+
+bool kmer_encoder::_agrees(std::string_view seq) const
+{
+    const auto expected = reference_kmers(seq, _kmer_size);
+    if (!expected)
+    {
+        return false;
+    }
+
+    std::vector<encoded_kmer> encoded;
+    const auto on_exact = [&encoded](std::string_view kmer, key_type key) {
+        encoded.emplace_back(std::string(kmer), std::vector<key_type>{ key });
+    };
+    const auto on_ambiguous = [&encoded](const std::vector<key_type>& keys) {
+        encoded.emplace_back(std::string(), keys);
+    };
+    if (!encode(seq, on_exact, on_ambiguous) || encoded.size() != expected->size())
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < encoded.size(); ++i)
+    {
+        const auto& [kmer, keys] = encoded[i];
+        const auto& [expected_kmer, expected_keys] = (*expected)[i];
+        if (keys != expected_keys || (keys.size() == 1 && kmer != expected_kmer))
+        {
+            return false;
+        }
+    }
+    return true;
+}
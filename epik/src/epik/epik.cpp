@@ -0,0 +1,146 @@
+#include <stdexcept>
+#include <unordered_map>
+#include <i2l/phylo_kmer_db.h>
+#include <i2l/serialization.h>
+#include <i2l/phylo_tree.h>
+#include <i2l/newick.h>
+#include <epik/epik.h>
+#include <epik/place.h>
+
+using namespace epik;
+
+namespace
+{
+    i2l::phylo_kmer_db load_database(const std::string& db_filename, const options& opts)
+    {
+        if ((opts.mu < 0.0) || (opts.mu > 1.0))
+        {
+            throw std::runtime_error("Mu has to a value in [0, 1]");
+        }
+
+        auto db = i2l::load(db_filename, opts.mu, opts.omega, opts.max_entries);
+        if (db.version() < i2l::protocol::EARLIEST_INDEX)
+        {
+            throw std::runtime_error("The serialization protocol version is too old (v" +
+                                     std::to_string(db.version()) + "). "
+                                     "Can not use databases built by xpas older than v0.3.2");
+        }
+        return db;
+    }
+}
+
+/// \brief Everything a session owns. The placer refers to the database and the tree,
+/// so the context is never moved once created
+struct session::context
+{
+    context(const std::string& db_filename, const options& opts)
+        : db{ load_database(db_filename, opts) }
+        , tree{ i2l::io::parse_newick(db.tree()) }
+        , newick{ i2l::io::to_newick(tree, true) }
+        , sequence_type{ db.sequence_type() }
+        , placer{ db, tree, opts.keep_at_most, opts.keep_factor, opts.num_threads }
+        , num_threads{ std::max(opts.num_threads, size_t{ 1 }) }
+    {}
+
+    const i2l::phylo_kmer_db db;
+    const i2l::phylo_tree tree;
+    const std::string newick;
+    const std::string sequence_type;
+    epik::placer placer;
+    const size_t num_threads;
+};
+
+namespace
+{
+    std::vector<branch_placement> to_branch_placements(const std::vector<impl::placement>& placements)
+    {
+        std::vector<branch_placement> result;
+        result.reserve(placements.size());
+        for (const auto& p : placements)
+        {
+            result.push_back({ p.branch_id, p.score, (double)p.weight_ratio, p.distal_length, p.pendant_length });
+        }
+        return result;
+    }
+
+    std::vector<impl::seq_view> to_views(const std::vector<query>& batch)
+    {
+        std::vector<impl::seq_view> views;
+        views.reserve(batch.size());
+        for (const auto& q : batch)
+        {
+            views.push_back({ q.header, q.sequence });
+        }
+        return views;
+    }
+}
+
+session::session(const std::string& db_filename, const options& opts)
+    : _context{ std::make_unique<context>(db_filename, opts) }
+{}
+
+session::session(session&&) noexcept = default;
+session& session::operator=(session&&) noexcept = default;
+session::~session() noexcept = default;
+
+void session::place(const std::vector<query>& batch, const placement_callback& callback)
+{
+    const auto placed = _context->placer.place(to_views(batch), _context->num_threads);
+    for (const auto& placed_seq : placed.placed_seqs)
+    {
+        const auto placements = to_branch_placements(placed_seq.placements);
+        for (const auto header : placed.sequence_map.at(placed_seq.sequence))
+        {
+            callback(header, placements);
+        }
+    }
+}
+
+std::vector<std::vector<branch_placement>> session::place(const std::vector<query>& batch)
+{
+    const auto placed = _context->placer.place(to_views(batch), _context->num_threads);
+
+    std::unordered_map<std::string_view, const impl::placed_sequence*> by_sequence;
+    for (const auto& placed_seq : placed.placed_seqs)
+    {
+        by_sequence[placed_seq.sequence] = &placed_seq;
+    }
+
+    std::vector<std::vector<branch_placement>> result;
+    result.reserve(batch.size());
+    for (const auto& q : batch)
+    {
+        result.push_back(to_branch_placements(by_sequence.at(q.sequence)->placements));
+    }
+    return result;
+}
+
+const std::string& session::newick() const noexcept
+{
+    return _context->newick;
+}
+
+size_t session::kmer_size() const noexcept
+{
+    return _context->db.kmer_size();
+}
+
+float session::omega() const noexcept
+{
+    return _context->db.omega();
+}
+
+const std::string& session::sequence_type() const noexcept
+{
+    return _context->sequence_type;
+}
+
+size_t session::num_entries_loaded() const noexcept
+{
+    return _context->db.get_num_entries_loaded();
+}
+
+size_t session::num_entries_total() const noexcept
+{
+    return _context->db.get_num_entries_total();
+}
@@ -0,0 +1,351 @@
+#include <cstring>
+#include <limits>
+#include <algorithm>
+#include <cerrno>
+#include <stdexcept>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <epik/fasta.h>
+
+using namespace epik::io;
+
+namespace
+{
+    /// The number of bytes scanned for records by every thread at once
+    constexpr size_t window_size = 8 * 1024 * 1024;
+
+    bool is_line_end(char c)
+    {
+        return c == '\n' || c == '\r';
+    }
+
+    /// \brief The start of the line after the one at position, or end if there is none
+    size_t next_line(const char* data, size_t position, size_t end)
+    {
+        const auto* next = static_cast<const char*>(std::memchr(data + position, '\n', end - position));
+        return next ? static_cast<size_t>(next - data) + 1 : end;
+    }
+
+    /// \brief If a fastq record starts at the line at position, found by its line structure: a line of '@'
+    /// and, two lines later, a line of '+'. A line of qualities may start with '@' too, but the line
+    /// two lines later is a sequence
+    bool is_fastq_record(const char* data, size_t position, size_t end)
+    {
+        if (position >= end || data[position] != '@')
+        {
+            return false;
+        }
+        position = next_line(data, next_line(data, position, end), end);
+        return position < end && data[position] == '+';
+    }
+
+    /// \brief Parses the record in data[begin, end). Returns views of the mapping,
+    /// or of joined if the sequence has several lines
+    epik::impl::seq_view parse_record(const char* data, size_t begin, size_t end, std::string& joined)
+    {
+        const auto record = std::string_view(data + begin, end - begin);
+
+        /// The header is the first line without '>'
+        const auto header_end = std::min(record.find('\n'), record.size());
+        auto header = record.substr(1, header_end - 1);
+        if (!header.empty() && header.back() == '\r')
+        {
+            header.remove_suffix(1);
+        }
+
+        auto sequence = header_end < record.size() ? record.substr(header_end + 1) : std::string_view{};
+        while (!sequence.empty() && is_line_end(sequence.back()))
+        {
+            sequence.remove_suffix(1);
+        }
+
+        /// Lines of a sequence are joined without their ends
+        if (std::memchr(sequence.data(), '\n', sequence.size()) || std::memchr(sequence.data(), '\r', sequence.size()))
+        {
+            joined.reserve(sequence.size());
+            for (const auto c : sequence)
+            {
+                if (!is_line_end(c))
+                {
+                    joined.push_back(c);
+                }
+            }
+            return { header, joined };
+        }
+        return { header, sequence };
+    }
+
+    /// \brief Parses the fastq record in data[begin, end): the header line without '@' and the sequence line.
+    /// Qualities are not used
+    epik::impl::seq_view parse_fastq_record(const char* data, size_t begin, size_t end)
+    {
+        const auto record = std::string_view(data + begin, end - begin);
+        const auto trim = [](std::string_view line) {
+            while (!line.empty() && is_line_end(line.back()))
+            {
+                line.remove_suffix(1);
+            }
+            return line;
+        };
+
+        const auto header_end = std::min(record.find('\n'), record.size());
+        const auto header = trim(record.substr(1, header_end - 1));
+        if (header_end == record.size())
+        {
+            return { header, std::string_view{} };
+        }
+        const auto sequence = record.substr(header_end + 1);
+        return { header, trim(sequence.substr(0, std::min(sequence.find('\n'), sequence.size()))) };
+    }
+}
+
+mapped_fasta::mapped_fasta(const std::string& filename, size_t batch_size, size_t num_threads)
+    : mapped_fasta(filename, { 0, std::numeric_limits<size_t>::max() }, batch_size, num_threads)
+{}
+
+mapped_fasta::mapped_fasta(const std::string& filename, split::byte_range range, size_t batch_size, size_t num_threads)
+    : _data{ nullptr }
+    , _file_size{ 0 }
+    , _range{ range }
+    , _batch_size{ std::max(batch_size, size_t{1}) }
+    , _num_threads{ std::max(num_threads, size_t{1}) }
+    , _next_record{ 0 }
+    , _scanned{ range.begin }
+    , _position{ range.begin }
+    , _fastq{ false }
+{
+    const auto fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0)
+    {
+        throw std::runtime_error("Could not open file " + filename + ": " + std::strerror(errno));
+    }
+
+    struct stat status{};
+    if (fstat(fd, &status) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("Could not read file " + filename + ": " + std::strerror(errno));
+    }
+    _file_size = static_cast<size_t>(status.st_size);
+
+    /// The whole file is mapped, so that positions are the same as in the file
+    if (_file_size > 0)
+    {
+        auto* mapping = mmap(nullptr, _file_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (mapping == MAP_FAILED)
+        {
+            close(fd);
+            throw std::runtime_error("Could not map file " + filename + ": " + std::strerror(errno));
+        }
+        madvise(mapping, _file_size, MADV_SEQUENTIAL);
+        _data = static_cast<const char*>(mapping);
+    }
+    close(fd);
+
+    _range.end = std::min(_range.end, _file_size);
+    if (_range.begin > _range.end)
+    {
+        throw std::runtime_error("Wrong range of file " + filename);
+    }
+    _fastq = _range.begin < _range.end && _data[_range.begin] == '@';
+}
+
+mapped_fasta::~mapped_fasta() noexcept
+{
+    if (_data)
+    {
+        munmap(const_cast<char*>(_data), _file_size);
+    }
+}
+
+std::vector<epik::impl::seq_view> mapped_fasta::next_batch()
+{
+    /// The last record found ends where the next one starts: it is not complete until then
+    while (_records.size() - _next_record <= _batch_size && _scanned < _range.end)
+    {
+        _scan_window();
+    }
+
+    const auto first = _next_record;
+    const auto num_records = std::min(_batch_size, _records.size() - _next_record);
+    std::vector<impl::seq_view> batch(num_records);
+    _joined.assign(num_records, std::string{});
+
+    const auto* data = _data;
+    const auto& records = _records;
+    const auto range_end = _range.end;
+    auto& joined = _joined;
+    const auto num_threads = _num_threads;
+    const auto fastq = _fastq;
+
+#ifdef EPIK_OMP
+    #if __clang__
+    #pragma omp parallel for schedule(static) num_threads(num_threads) \
+        default(none) shared(data, records, range_end, first, batch, joined, fastq)
+    #elif defined (__GNUC__) && (__GNUC__ < 9)
+#pragma omp parallel for schedule(static) num_threads(num_threads) default(none) \
+    shared(data, batch, joined)
+    #else
+#pragma omp parallel for schedule(static) num_threads(num_threads) \
+    default(none) shared(data, records, range_end, first, batch, joined, fastq)
+    #endif
+#endif
+    for (size_t i = 0; i < batch.size(); ++i)
+    {
+        const auto begin = records[first + i];
+        const auto end = first + i + 1 < records.size() ? records[first + i + 1] : range_end;
+        batch[i] = fastq ? parse_fastq_record(data, begin, end) : parse_record(data, begin, end, joined[i]);
+    }
+
+    _next_record += num_records;
+    _position = _next_record < _records.size() ? _records[_next_record] : _range.end;
+    return batch;
+}
+
+size_t mapped_fasta::bytes_read() const noexcept
+{
+    return _position - _range.begin;
+}
+
+bool mapped_fasta::at_record_start() const noexcept
+{
+    if (_range.begin == _range.end)
+    {
+        return true;
+    }
+
+    /// The file is of the same format from its first record
+    if (_range.begin > 0 && (_data[_range.begin - 1] != '\n' || _data[0] != _data[_range.begin]))
+    {
+        return false;
+    }
+    return _fastq ? is_fastq_record(_data, _range.begin, _file_size) : _data[_range.begin] == '>';
+}
+
+void mapped_fasta::_scan_window()
+{
+    /// A fasta record starts with '>' at the beginning of a line. A fastq record takes four lines
+    /// and is found by its line structure (see is_fastq_record) in every part, from which the records
+    /// are counted by four lines. Every thread scans a part of the window
+    const auto num_threads = _num_threads;
+    const auto window_begin = _scanned;
+    const auto window_end = std::min(_range.end, window_begin + window_size * num_threads);
+    const auto part_size = (window_end - window_begin + num_threads - 1) / num_threads;
+    const auto range_begin = _range.begin;
+    const auto range_end = _range.end;
+    const auto fastq = _fastq;
+    const auto* data = _data;
+    std::vector<std::vector<size_t>> found(num_threads);
+
+#ifdef EPIK_OMP
+    #if __clang__
+    #pragma omp parallel for schedule(static) num_threads(num_threads) default(none) \
+        shared(data, found, window_begin, window_end, part_size, range_begin, range_end, fastq)
+    #elif defined (__GNUC__) && (__GNUC__ < 9)
+#pragma omp parallel for schedule(static) num_threads(num_threads) default(none) \
+    shared(data, found)
+    #else
+#pragma omp parallel for schedule(static) num_threads(num_threads) default(none) \
+    shared(data, found, window_begin, window_end, part_size, range_begin, range_end, fastq)
+    #endif
+#endif
+    for (size_t part = 0; part < found.size(); ++part)
+    {
+        const auto begin = std::min(window_end, window_begin + part * part_size);
+        const auto end = std::min(window_end, begin + part_size);
+        auto position = begin;
+        if (fastq)
+        {
+            if (position != range_begin && position < end && data[position - 1] != '\n')
+            {
+                position = next_line(data, position, range_end);
+            }
+            while (position < end && !is_fastq_record(data, position, range_end))
+            {
+                position = next_line(data, position, range_end);
+            }
+            while (position < end)
+            {
+                found[part].push_back(position);
+                for (size_t line = 0; line < 4; ++line)
+                {
+                    position = next_line(data, position, range_end);
+                }
+            }
+            continue;
+        }
+
+        while (position < end)
+        {
+            const auto* next = static_cast<const char*>(std::memchr(data + position, '>', end - position));
+            if (!next)
+            {
+                break;
+            }
+            position = static_cast<size_t>(next - data);
+            if (position == range_begin || data[position - 1] == '\n')
+            {
+                found[part].push_back(position);
+            }
+            ++position;
+        }
+    }
+
+    _records.erase(_records.begin(), _records.begin() + static_cast<std::ptrdiff_t>(_next_record));
+    _next_record = 0;
+    for (const auto& positions : found)
+    {
+        _records.insert(_records.end(), positions.begin(), positions.end());
+    }
+    _scanned = window_end;
+}
+
+paired_fasta::paired_fasta(const std::string& first_filename, const std::string& second_filename,
+                           size_t batch_size, size_t num_threads, size_t first_offset, size_t second_offset)
+    : _first(first_filename, { first_offset, std::numeric_limits<size_t>::max() }, batch_size, num_threads)
+    , _second(second_filename, { second_offset, std::numeric_limits<size_t>::max() }, batch_size, num_threads)
+{}
+
+std::vector<epik::impl::seq_view> paired_fasta::next_batch()
+{
+    const auto first = _first.next_batch();
+    const auto second = _second.next_batch();
+    if (first.size() != second.size())
+    {
+        throw std::runtime_error("The files of mates have different numbers of reads");
+    }
+
+    _pairs.resize(first.size());
+    std::vector<impl::seq_view> batch;
+    batch.reserve(2 * first.size());
+    for (size_t i = 0; i < first.size(); ++i)
+    {
+        auto& pair = _pairs[i];
+        pair.clear();
+        pair.reserve(first[i].sequence.size() + 1 + second[i].sequence.size());
+        pair.append(first[i].sequence);
+        pair.push_back(impl::mate_separator);
+        pair.append(second[i].sequence);
+
+        batch.push_back({ first[i].header, pair });
+        batch.push_back({ second[i].header, pair });
+    }
+    return batch;
+}
+
+size_t paired_fasta::bytes_read() const noexcept
+{
+    return _first.bytes_read();
+}
+
+size_t paired_fasta::mates_bytes_read() const noexcept
+{
+    return _second.bytes_read();
+}
+
+bool paired_fasta::at_record_start() const noexcept
+{
+    return _first.at_record_start() && _second.at_record_start();
+}
@@ -0,0 +1,68 @@
+#include <cmath>
+#include <algorithm>
+#include <i2l/phylo_kmer_db.h>
+#include <epik/filter.h>
+
+using namespace epik::impl;
+
+namespace
+{
+    /// The filter has about bits_per_key bits per key in blocks of 512 bits, at least one
+    size_t num_blocks_for(size_t num_keys, size_t bits_per_key) noexcept
+    {
+        const auto num_bits = std::max(num_keys * std::max(bits_per_key, size_t{1}), size_t{512});
+        return (num_bits + 511) / 512;
+    }
+}
+
+key_filter::key_filter(const i2l::phylo_kmer_db& db, size_t bits_per_key)
+    : _num_keys{ db.size() }
+{
+    bits_per_key = std::max(bits_per_key, size_t{1});
+    _blocks.resize(num_blocks_for(_num_keys, bits_per_key), block{});
+
+    /// The optimal number of bits per key of a Bloom filter is ln(2) * m / n
+    const auto optimal_probes = std::lround(std::log(2.0) * static_cast<double>(bits_per_key));
+    _num_probes = std::clamp(static_cast<size_t>(std::max(optimal_probes, 1l)), size_t{1}, size_t{7});
+
+    for (const auto& [key, entries] : db)
+    {
+        (void)entries;
+        _insert(key);
+    }
+}
+
+size_t key_filter::num_keys() const noexcept
+{
+    return _num_keys;
+}
+
+size_t key_filter::memory_bytes() const noexcept
+{
+    return _blocks.size() * sizeof(block);
+}
+
+size_t key_filter::memory_bytes(size_t num_keys, size_t bits_per_key) noexcept
+{
+    return num_blocks_for(num_keys, bits_per_key) * sizeof(block);
+}
+
+double key_filter::expected_false_positive_rate() const noexcept
+{
+    const auto num_bits = static_cast<double>(_blocks.size() * 512);
+    const auto num_probes = static_cast<double>(_num_probes);
+    return std::pow(1.0 - std::exp(-num_probes * static_cast<double>(_num_keys) / num_bits), num_probes);
+}
+
+void key_filter::_insert(i2l::phylo_kmer::key_type key) noexcept
+{
+    const auto hash = mix_hash(key);
+    auto& block = _blocks[_block_of(hash)];
+
+    auto bits = hash * 0x9e3779b97f4a7c15ull;
+    for (size_t i = 0; i < _num_probes; ++i, bits >>= 9)
+    {
+        const auto bit = bits & 511u;
+        block.words[bit >> 6] |= uint64_t{1} << (bit & 63u);
+    }
+}
@@ -0,0 +1,136 @@
+#include <cmath>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <i2l/phylo_kmer_db.h>
+#include <epik/fixed.h>
+#include <epik/intrinsic.h>
+
+using namespace epik::impl;
+
+namespace
+{
+    constexpr auto max_fixed = std::numeric_limits<fixed_postings::fixed_type>::max();
+}
+
+fixed_postings::fixed_postings(const i2l::phylo_kmer_db& db, size_t num_branches, score_type log_threshold)
+    : _scale{ 1.0 }
+    , _max_rounding{ 0.0 }
+    , _max_abs_score{ std::abs((double)log_threshold) }
+{
+    /// The largest score above the threshold is max_fixed
+    size_t num_postings = 0;
+    double max_delta = 0.0;
+    for (const auto& [key, entries] : db)
+    {
+        (void)key;
+        for (const auto& [branch, score] : entries)
+        {
+            if (branch >= num_branches)
+            {
+                throw std::runtime_error("Wrong branch in the database: " + std::to_string(branch));
+            }
+            max_delta = std::max(max_delta, (double)score - (double)log_threshold);
+            _max_abs_score = std::max(_max_abs_score, std::abs((double)score));
+        }
+        num_postings += entries.size();
+    }
+    if (max_delta > 0.0)
+    {
+        _scale = (double)max_fixed / max_delta;
+    }
+
+    std::vector<i2l::phylo_kmer::key_type> keys;
+    keys.reserve(db.size());
+    _branches.reserve(num_postings);
+    _scores.reserve(num_postings);
+    _offsets.reserve(db.size() + 1);
+    _offsets.push_back(0);
+    for (const auto& [key, entries] : db)
+    {
+        if (entries.size() == 0)
+        {
+            continue;
+        }
+
+        for (const auto& [branch, score] : entries)
+        {
+            /// Scores under the threshold are raised to it: their rounding is larger than half a unit
+            const auto delta = ((double)score - (double)log_threshold) * _scale;
+            const auto fixed = static_cast<fixed_type>(std::clamp(std::round(delta), 0.0, (double)max_fixed));
+            _max_rounding = std::max(_max_rounding, std::abs((double)fixed - delta));
+            _branches.push_back(branch);
+            _scores.push_back(fixed);
+        }
+        keys.push_back(key);
+        _offsets.push_back(_branches.size());
+    }
+    _lists = ordinal_index(keys);
+}
+
+double fixed_postings::scale() const noexcept
+{
+    return _scale;
+}
+
+size_t fixed_postings::max_kmers() const noexcept
+{
+    return std::numeric_limits<sum_type>::max() / max_fixed;
+}
+
+fixed_postings::sum_type fixed_postings::error_bound(size_t num_kmers) const noexcept
+{
+    /// Every posting of a branch is rounded by _max_rounding units at most. The float sum of n scores
+    /// and its correction are rounded by less than (n + 5) * n * u * max|s|, u the unit roundoff of float:
+    /// twice that is kept, and one unit more for the rounding of the bound itself
+    const auto n = (double)num_kmers;
+    const auto unit_roundoff = (double)std::numeric_limits<score_type>::epsilon() / 2.0;
+    const auto float_error = 2.0 * (n + 5.0) * n * unit_roundoff * _max_abs_score * _scale;
+    const auto bound = std::ceil(n * _max_rounding + float_error) + 1.0;
+    return static_cast<sum_type>(std::min(bound, (double)std::numeric_limits<sum_type>::max()));
+}
+
+size_t fixed_postings::num_postings() const noexcept
+{
+    return _branches.size();
+}
+
+size_t fixed_postings::memory_bytes() const noexcept
+{
+    return _branches.size() * sizeof(branch_type) + _scores.size() * sizeof(fixed_type) +
+           _offsets.size() * sizeof(size_t) + _lists.memory_bytes();
+}
+
+fixed_accumulator::fixed_accumulator(size_t num_branches)
+    : _sums(num_branches, 0)
+    , _counts(num_branches, 0)
+    , _slots(num_branches, no_slot)
+{
+    _edges.reserve(num_branches);
+}
+
+size_t fixed_accumulator::memory_bytes(size_t num_branches) noexcept
+{
+    return num_branches * (sizeof(sum_type) + 2 * sizeof(uint32_t) + sizeof(branch_type));
+}
+
+void fixed_accumulator::clear()
+{
+    for (const auto branch : _edges)
+    {
+        _sums[branch] = 0;
+        _counts[branch] = 0;
+        _slots[branch] = no_slot;
+    }
+    _edges.clear();
+}
+
+void fixed_accumulator::add(const fixed_postings::list& list)
+{
+    update_fixed(_sums.data(), _counts.data(), _edges, list.branches, list.scores, list.size);
+}
+
+const std::vector<fixed_accumulator::branch_type>& fixed_accumulator::edges() const noexcept
+{
+    return _edges;
+}
@@ -0,0 +1,189 @@
+#include <atomic>
+#include <mutex>
+#include <cstring>
+#include <cerrno>
+#include <epik/hardware.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+using namespace epik::metrics;
+
+namespace
+{
+    std::atomic<bool> hw_enabled{ false };
+
+    /// The first error of every event, over all threads
+    std::mutex errors_mutex;
+    std::array<std::string, num_hw_events> errors;
+
+    void set_error(size_t event, const char* error) noexcept
+    {
+        try
+        {
+            std::lock_guard<std::mutex> lock(errors_mutex);
+            if (errors[event].empty())
+            {
+                errors[event] = error;
+            }
+        }
+        catch (...)
+        {
+        }
+    }
+
+#ifdef __linux__
+    /// \brief The events of one thread, read at once as a group of its leader
+    class counter_group
+    {
+    public:
+        counter_group() noexcept = default;
+        counter_group(const counter_group&) = delete;
+        counter_group& operator=(const counter_group&) = delete;
+
+        ~counter_group() noexcept
+        {
+            for (size_t i = 0; i < _num_open; ++i)
+            {
+                close(_fds[i]);
+            }
+        }
+
+        bool read(hw_sample& sample) noexcept
+        {
+            if (!_opened)
+            {
+                _open();
+            }
+            if (_num_open == 0)
+            {
+                return false;
+            }
+
+            /// PERF_FORMAT_GROUP: the number of events, the times, then the values in the order of opening
+            std::array<uint64_t, 3 + num_hw_events> buffer{};
+            const auto size = static_cast<ssize_t>((3 + _num_open) * sizeof(uint64_t));
+            if (::read(_fds[0], buffer.data(), (size_t)size) != size)
+            {
+                return false;
+            }
+            sample.enabled = buffer[1];
+            sample.running = buffer[2];
+            for (size_t i = 0; i < _num_open; ++i)
+            {
+                sample.values[_events[i]] = buffer[3 + i];
+            }
+            return true;
+        }
+
+    private:
+        void _open() noexcept
+        {
+            _opened = true;
+            for (size_t event = 0; event < num_hw_events; ++event)
+            {
+                perf_event_attr attr{};
+                attr.size = sizeof(attr);
+                attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+                /// Only user space is counted: allowed with kernel.perf_event_paranoid up to 2
+                attr.exclude_kernel = 1;
+                attr.exclude_hv = 1;
+                switch (static_cast<hw_event>(event))
+                {
+                    case hw_event::cycles:
+                        attr.type = PERF_TYPE_HARDWARE;
+                        attr.config = PERF_COUNT_HW_CPU_CYCLES;
+                        break;
+                    case hw_event::instructions:
+                        attr.type = PERF_TYPE_HARDWARE;
+                        attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+                        break;
+                    case hw_event::llc_misses:
+                        attr.type = PERF_TYPE_HW_CACHE;
+                        attr.config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+                        break;
+                    default:
+                        attr.type = PERF_TYPE_HW_CACHE;
+                        attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                      (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+                        break;
+                }
+
+                /// The calling thread on any CPU. The first event opened leads the group
+                const auto group = _num_open > 0 ? _fds[0] : -1;
+                const auto fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, group, PERF_FLAG_FD_CLOEXEC));
+                if (fd < 0)
+                {
+                    set_error(event, std::strerror(errno));
+                    continue;
+                }
+                _fds[_num_open] = fd;
+                _events[_num_open] = event;
+                ++_num_open;
+            }
+        }
+
+        bool _opened = false;
+        size_t _num_open = 0;
+        std::array<int, num_hw_events> _fds{};
+        std::array<size_t, num_hw_events> _events{};
+    };
+#endif
+}
+
+const char* epik::metrics::to_string(hw_event e)
+{
+    switch (e)
+    {
+        case hw_event::cycles:
+            return "cycles";
+        case hw_event::instructions:
+            return "instructions";
+        case hw_event::llc_misses:
+            return "llc_misses";
+        case hw_event::dtlb_misses:
+            return "dtlb_misses";
+        default:
+            return "unknown";
+    }
+}
+
+bool epik::metrics::enable_hw_counters()
+{
+#ifndef __linux__
+    for (size_t event = 0; event < num_hw_events; ++event)
+    {
+        set_error(event, "not supported on this system");
+    }
+#endif
+    hw_enabled = true;
+    hw_sample sample;
+    return read_hw_counters(sample);
+}
+
+bool epik::metrics::hw_counters_enabled() noexcept
+{
+    return hw_enabled.load(std::memory_order_relaxed);
+}
+
+bool epik::metrics::read_hw_counters(hw_sample& sample) noexcept
+{
+#ifdef __linux__
+    thread_local counter_group group;
+    return group.read(sample);
+#else
+    (void)sample;
+    return false;
+#endif
+}
+
+std::string epik::metrics::hw_event_error(hw_event e)
+{
+    std::lock_guard<std::mutex> lock(errors_mutex);
+    return errors[static_cast<size_t>(e)];
+}
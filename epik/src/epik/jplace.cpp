@@ -1,16 +1,19 @@
 #include <fstream>
 #include <utility>
 #include <stdexcept>
+#include <boost/filesystem.hpp>
 #include <epik/jplace.h>
 #include <epik/place.h>
+#include <epik/metrics.h>
 
 using namespace epik::io;
 
 jplace_writer::jplace_writer(const std::string& filename,
                              const std::string& invocation,
                              std::string_view newick_tree)
-    : _filename(filename), _out(filename), _buffer(),
-    _writer(_buffer), _invocation(invocation), _tree(newick_tree)
+    : _filename(filename), _out(filename, std::ios_base::app), _buffer(),
+    _writer(_buffer), _invocation(invocation), _tree(newick_tree), _position(0), _num_placements(0),
+    _placements_begin(0)
 {
     if (_out.bad())
     {
@@ -20,6 +23,8 @@ jplace_writer::jplace_writer(const std::string& filename,
 
 jplace_writer& jplace_writer::operator<<(const impl::placed_collection& placed)
 {
+    EPIK_TIME_SCOPE(write);
+
     for (const auto& placed_seq : placed.placed_seqs)
     {
         _writer.StartObject();
@@ -29,15 +34,73 @@ jplace_writer& jplace_writer::operator<<(const impl::placed_collection& placed)
         _write_named_multiplicity(seq_headers);
         _writer.EndObject();
     }
+    _num_placements += placed.placed_seqs.size();
 
     _out.open(_filename, std::ios_base::app);
     _out << _buffer.GetString();
+    EPIK_COUNT(bytes_written, _buffer.GetSize());
+    _position += _buffer.GetSize();
     _buffer.Clear();
     _out.close();
     return *this;
 }
 
 void jplace_writer::start()
+{
+    EPIK_TIME_SCOPE(write);
+
+    _write_header();
+
+    _out.close();
+    _out.open(_filename, std::ios_base::trunc);
+    _out << _buffer.GetString();
+    EPIK_COUNT(bytes_written, _buffer.GetSize());
+    _position = _buffer.GetSize();
+    _placements_begin = _position;
+    _buffer.Clear();
+    _out.close();
+}
+
+void jplace_writer::resume(size_t position, size_t num_placements, size_t placements_begin)
+{
+    /// The writer has to be in the same state as after writing the file: inside the
+    /// array of placements, which has elements or not. The beginning of the file is
+    /// written to the buffer and discarded
+    _write_header();
+    _placements_begin = placements_begin > 0 ? placements_begin : _buffer.GetSize();
+    if (num_placements > 0)
+    {
+        _writer.StartObject();
+        _writer.EndObject();
+    }
+    _buffer.Clear();
+
+    _out.close();
+    if (!boost::filesystem::exists(_filename) || boost::filesystem::file_size(_filename) < position)
+    {
+        throw std::runtime_error("Can not resume " + _filename + ": the file is shorter than the checkpoint");
+    }
+    boost::filesystem::resize_file(_filename, position);
+    _position = position;
+    _num_placements = num_placements;
+}
+
+size_t jplace_writer::position() const noexcept
+{
+    return _position;
+}
+
+size_t jplace_writer::num_placements() const noexcept
+{
+    return _num_placements;
+}
+
+size_t jplace_writer::placements_begin() const noexcept
+{
+    return _placements_begin;
+}
+
+void jplace_writer::_write_header()
 {
     /// We use SetFormatOptions to control where to put newlines in the output file.
     /// Possible options are: kFormatSingleLineArray, kFormatDefault
@@ -52,19 +115,19 @@ void jplace_writer::start()
     _writer.SetFormatOptions(rapidjson::PrettyFormatOptions::kFormatDefault);
     _writer.Key("placements");
     _writer.StartArray();
-
-    _out << _buffer.GetString();
-    _buffer.Clear();
-    _out.close();
 }
 
 void jplace_writer::end()
 {
+    EPIK_TIME_SCOPE(write);
+
     _writer.EndArray();
     _writer.EndObject();
 
     _out.open(_filename, std::ios_base::app);
     _out << _buffer.GetString();
+    EPIK_COUNT(bytes_written, _buffer.GetSize());
+    _position += _buffer.GetSize();
     _buffer.Clear();
 }
 
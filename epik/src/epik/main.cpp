@@ -7,6 +7,8 @@
 #include <cctype>
 #include <cmath>
 #include <stdexcept>
+#include <memory>
+#include <optional>
 #include <boost/filesystem.hpp>
 #include <cxxopts.hpp>
 #include <indicators/cursor_control.hpp>
@@ -17,7 +19,15 @@
 #include <i2l/newick.h>
 #include <i2l/fasta.h>
 #include <epik/place.h>
+#include <epik/checkpoint.h>
+#include <epik/fasta.h>
 #include <epik/jplace.h>
+#include <epik/mass.h>
+#include <epik/memory.h>
+#include <epik/metrics.h>
+#include <epik/shard.h>
+#include <epik/split.h>
+#include <unistd.h>
 
 /// \brief Creates a string with wich the program was executed
 std::string make_invocation(int argc, char** argv)
@@ -36,6 +46,33 @@ fs::path make_output_filename(const std::string& input_file, const std::string&
     return fs::path(output_dir) / fs::path{ "placements_" + fs::path(input_file).filename().string() + ".jplace" };
 }
 
+/// \brief The output filename of one of several databases. Includes the name of the database
+fs::path make_output_filename(const std::string& input_file, const std::string& output_dir, const std::string& db_file)
+{
+    return fs::path(output_dir) / fs::path{ "placements_" + fs::path(db_file).stem().string() + "_" +
+                                            fs::path(input_file).filename().string() + ".jplace" };
+}
+
+/// \brief The output filename of every database. With a query part, the outputs of the part
+std::vector<std::string> make_output_filenames(const std::vector<std::string>& db_files, const std::string& query_file,
+                                               const std::string& output_dir,
+                                               const std::optional<epik::split::part>& query_part)
+{
+    std::vector<std::string> filenames;
+    for (const auto& db_file : db_files)
+    {
+        auto filename = db_files.size() == 1
+            ? make_output_filename(query_file, output_dir).string()
+            : make_output_filename(query_file, output_dir, db_file).string();
+        if (query_part)
+        {
+            filename = epik::split::part_filename(filename, *query_part);
+        }
+        filenames.push_back(filename);
+    }
+    return filenames;
+}
+
 template<typename R>
 bool is_busy(const std::future<R>& f)
 {
@@ -201,6 +238,187 @@ void check_mu(float mu)
     }
 }
 
+i2l::phylo_kmer_db load_database(const std::string& db_file, float mu, float omega, size_t max_entries)
+{
+    std::cout << "Loading " << db_file << " with mu=" << mu << " and omega="
+              << omega << "..." << std::endl;
+    auto db = [&]() {
+        EPIK_TIME_SCOPE(load);
+        return i2l::load(db_file, mu, omega, max_entries);
+    }();
+    if (db.version() < i2l::protocol::EARLIEST_INDEX)
+    {
+        throw std::runtime_error("The serialization protocol version is too old (v" +
+                                 std::to_string(db.version()) + ").\n"
+                                 "Can not use databases built by xpas older than v0.3.2");
+    }
+
+    std::cout << "Database parameters:" << std::endl
+              << "\tSequence type: " << db.sequence_type() << std::endl
+              << "\tk: " << db.kmer_size() << std::endl
+              << "\tomega: " << db.omega() << std::endl
+              << "\tPositions loaded: " << (db.positions_loaded() ? "true" : "false") << std::endl << std::endl;
+    std::cout << "Loaded " << to_human_readable(db.get_num_entries_loaded())
+              << " of " << to_human_readable(db.get_num_entries_total())
+              << " phylo-k-mers. " << std::endl << std::endl;
+    return db;
+}
+
+/// \brief Serves one shard of a sharded database to the coordinator (see --shards).
+/// Reads requests from the standard input and answers to the standard output
+int run_shard_worker(const cxxopts::ParseResult& parsed_options)
+{
+    /// The standard output is reserved for the answers. Everything else printed goes to stderr
+    const auto out_fd = dup(STDOUT_FILENO);
+    dup2(STDERR_FILENO, STDOUT_FILENO);
+
+    const auto manifest = epik::shard::read_manifest(parsed_options["shards"].as<std::string>());
+    const auto shard_index = parsed_options["shard-worker"].as<size_t>();
+    if (shard_index >= manifest.shards.size())
+    {
+        throw std::runtime_error("Wrong shard index: " + std::to_string(shard_index));
+    }
+    const auto& shard = manifest.shards[shard_index];
+
+    /// The shard is loaded whole: --mu was applied when the database was split (see manifest::mu),
+    /// and the coordinator checked that the shards fit in --max-ram
+    const auto num_threads = parsed_options["jobs"].as<size_t>();
+    const auto db = i2l::load(shard.filename, 1.0f, parsed_options["omega"].as<float>(),
+                              std::numeric_limits<size_t>::max());
+    const auto tree = i2l::io::parse_newick(db.tree());
+    /// Workers only score k-mers, the placements are selected by the coordinator
+    auto placer = epik::placer(db, tree, 1, 0.0, num_threads);
+    std::cerr << "Shard " << shard_index << ": loaded " << to_human_readable(db.get_num_entries_loaded())
+              << " phylo-k-mers from " << shard.filename << std::endl;
+
+    epik::shard::run_worker(placer, shard, num_threads, STDIN_FILENO, out_fd);
+    close(out_fd);
+    return 0;
+}
+
+/// \brief The outputs of placement (see --output-format)
+struct output_format
+{
+    /// Placements of every read to a .jplace file
+    bool jplace = true;
+
+    /// The placement mass of every edge to a .mass.tsv file
+    bool mass = false;
+
+    /// The number of reads best placed on every edge in the mass table
+    bool mass_counts = false;
+};
+
+output_format parse_output_format(const std::string& name, bool mass_counts)
+{
+    if (name == "jplace")
+    {
+        return { true, false, false };
+    }
+    else if (name == "mass")
+    {
+        return { false, true, mass_counts };
+    }
+    else if (name == "both")
+    {
+        return { true, true, mass_counts };
+    }
+    throw std::runtime_error("Unknown output format: " + name);
+}
+
+/// \brief Removes the mass tables saved for a checkpoint
+void remove_mass_snapshots(const std::optional<epik::checkpoint>& state)
+{
+    if (!state)
+    {
+        return;
+    }
+    for (const auto& output : state->outputs)
+    {
+        if (!output.mass_snapshot.empty())
+        {
+            fs::remove(output.mass_snapshot);
+        }
+    }
+}
+
+/// \brief Merges the outputs of all parts of the query file placed with --query-part (see --merge-parts)
+int merge_parts(const std::vector<std::string>& db_files, const std::string& query_file,
+                const std::string& output_dir, size_t num_parts, const output_format& format)
+{
+    if (num_parts == 0)
+    {
+        throw std::runtime_error("--merge-parts has to be positive");
+    }
+
+    const auto filenames = make_output_filenames(db_files, query_file, output_dir, std::nullopt);
+    for (const auto& filename : filenames)
+    {
+        std::vector<std::string> part_filenames;
+        for (size_t i = 0; i < num_parts; ++i)
+        {
+            part_filenames.push_back(epik::split::part_filename(filename, { i, num_parts }));
+        }
+
+        if (format.jplace)
+        {
+            const auto num_placements = epik::split::merge_jplace(part_filenames, filename);
+            std::cout << "Merged " << num_placements << " placements of " << num_parts << " parts: "
+                      << filename << std::endl;
+        }
+        if (format.mass)
+        {
+            const auto to_mass_filename = [](const std::string& jplace_filename) {
+                return fs::path(jplace_filename).replace_extension(".mass.tsv").string();
+            };
+            std::vector<std::string> tables;
+            for (const auto& part_filename : part_filenames)
+            {
+                tables.push_back(to_mass_filename(part_filename));
+            }
+            epik::split::merge_mass(tables, to_mass_filename(filename));
+            std::cout << "Merged the mass tables of " << num_parts << " parts: "
+                      << to_mass_filename(filename) << std::endl;
+        }
+    }
+    return 0;
+}
+
+/// \brief A database to place queries against, with its own tree, placer and outputs
+struct placement_target
+{
+    placement_target(const std::string& db_file, float mu, float omega, size_t max_entries,
+                     size_t keep_at_most, double keep_factor, size_t num_threads,
+                     const std::string& jplace_filename, const std::string& invocation,
+                     const output_format& format)
+        : db{ load_database(db_file, mu, omega, max_entries) }
+        , tree{ i2l::io::parse_newick(db.tree()) }
+        /// Here we transform the tree to .newick by our own to make sure the output format is always the same
+        , newick{ i2l::io::to_newick(tree, true) }
+        , placer{ db, tree, keep_at_most, keep_factor, num_threads }
+        , jplace_filename{ jplace_filename }
+    {
+        if (format.jplace)
+        {
+            jplace = std::make_unique<epik::io::jplace_writer>(jplace_filename, invocation, newick);
+        }
+        if (format.mass)
+        {
+            const auto mass_filename = fs::path(jplace_filename).replace_extension(".mass.tsv").string();
+            mass = std::make_unique<epik::io::mass_writer>(mass_filename, tree.get_node_count(),
+                                                           format.mass_counts, num_threads);
+        }
+    }
+
+    const i2l::phylo_kmer_db db;
+    const i2l::phylo_tree tree;
+    const std::string newick;
+    epik::placer placer;
+    const std::string jplace_filename;
+    std::unique_ptr<epik::io::jplace_writer> jplace;
+    std::unique_ptr<epik::io::mass_writer> mass;
+};
+
 
 int main(int argc, char** argv)
 {
@@ -208,8 +426,11 @@ int main(int argc, char** argv)
 
     cxxopts::Options options(argv[0], "Evolutionary Placement with Informative K-mers");
     options.add_options()
-        ("d,database", "IPK database", cxxopts::value<std::string>())
-        ("q,query", "Input query file (.fasta)", cxxopts::value<std::string>())
+        ("d,database", "IPK database. Repeat to place against several databases at once",
+            cxxopts::value<std::vector<std::string>>())
+        ("q,query", "Input query file (.fasta or .fastq)", cxxopts::value<std::string>())
+        ("mates", "The second reads of paired-end reads, in the order of the query file. Every pair is placed "
+                  "once, with the k-mers of both mates, and reported under both headers", cxxopts::value<std::string>())
         ("j,jobs", "Num threads", cxxopts::value<size_t>()->default_value("1"))
         ("batch-size", "Batch size", cxxopts::value<size_t>()->default_value("2000"))
         ("omega", "Determines the threshold value", cxxopts::value<float>()->default_value("1.5"))
@@ -218,6 +439,52 @@ int main(int argc, char** argv)
         ("o,output-dir", "Output directory", cxxopts::value<std::string>())
         ("keep-at-most", "Number of branches to report", cxxopts::value<size_t>()->default_value("7"))
         ("keep-factor", "Minimum LWR to report", cxxopts::value<double>()->default_value("0.01"))
+        ("output-format", "jplace: placements of every read, mass: the placement mass of every edge "
+                          "(a .mass.tsv table), or both", cxxopts::value<std::string>()->default_value("jplace"))
+        ("mass-counts", "Add the number of reads best placed on every edge to the mass table")
+        ("engine", "K-mer search: per-read, or join to search every distinct k-mer of a batch once "
+                   "(faster on similar reads, e.g. amplicons)", cxxopts::value<std::string>()->default_value("per-read"))
+        ("sampling", "Query only a subset of k-mers to place faster: none, minimizer or syncmer",
+            cxxopts::value<std::string>()->default_value("none"))
+        ("sampling-density", "The proportion of k-mers queried with --sampling",
+            cxxopts::value<double>()->default_value("0.25"))
+        ("filter-bits", "Build a Bloom filter of the database keys with this many bits per key to skip "
+                        "searching absent k-mers (0: no filter). Useful if most k-mers are not in the database",
+            cxxopts::value<size_t>()->default_value("0"))
+        ("dense-tier", "Store the phylo-k-mers scoring at least this fraction of the branches as dense rows "
+                       "of scores, added with vector instructions (0: no dense tier). Takes more memory",
+            cxxopts::value<double>()->default_value("0"))
+        ("clade-size", "Split the tree into clades of at most this many branches and score every read only in "
+                       "its best clades (0: no clades). Useful for very large trees",
+            cxxopts::value<size_t>()->default_value("0"))
+        ("candidate-clades", "The number of clades scored for every read with --clade-size",
+            cxxopts::value<size_t>()->default_value("4"))
+        ("fixed-point", "Convert the scores of the database to 16-bit integers and sum them up with integer "
+                        "vector instructions. The branches close to the best ones are scored again with float "
+                        "scores: the placements are the same as without it")
+        ("skip-postings", "Skip the k-mers scoring more than this many branches, as if they were not found "
+                          "(0: no limit). Faster, less accurate", cxxopts::value<size_t>()->default_value("0"))
+        ("skip-ratio", "Skip the k-mers whose best score over the branches is less than this many times their "
+                       "worst one, the threshold score for the branches not scored (0: none). Faster, less accurate", cxxopts::value<double>()->default_value("0"))
+        ("metrics", "Write per-stage counters and timers to a .json file", cxxopts::value<std::string>())
+        ("profile-hw", "Count CPU cycles, instructions, LLC and dTLB misses of every stage per thread "
+                       "and write them to a .json file", cxxopts::value<std::string>())
+        ("checkpoint-interval", "Save the progress to a .ckpt file in the output directory at most every N seconds, "
+                                "after a completed batch (0: after every batch)",
+            cxxopts::value<size_t>()->default_value("60"))
+        ("resume", "Continue an interrupted run from its last checkpoint")
+        ("query-part", "Place only the part I of N of the query file, e.g. 0/4. The parts are split at record "
+                       "boundaries and can be placed by separate processes or nodes", cxxopts::value<std::string>())
+        ("merge-parts", "Merge the outputs of the N parts placed with --query-part into the outputs of "
+                        "the whole query file and exit", cxxopts::value<size_t>())
+        ("make-shards", "Split the database into N shards for --shards, write them to the output directory and exit",
+            cxxopts::value<size_t>())
+        ("shards", "Place against a sharded database: the .shards.json file made by --make-shards. "
+                   "Every shard is served by a worker process", cxxopts::value<std::string>())
+        ("shard-worker", "Internal: serve the shard with this index of --shards", cxxopts::value<size_t>())
+        ("out-of-core", "With --shards: load the shards one by one in this process instead of running workers")
+        ("chunk-size", "Batch size of --out-of-core. Every batch loads all the shards",
+            cxxopts::value<size_t>()->default_value("500000"))
         ("h,help", "Print usage")
         ;
 
@@ -236,32 +503,143 @@ int main(int argc, char** argv)
 
     try
     {
-        const auto db_file = parsed_options["database"].as<std::string>();
-        const auto query_file = parsed_options["query"].as<std::string>();
-        const auto num_threads = parsed_options["jobs"].as<size_t>();
-        const auto batch_size = parsed_options["batch-size"].as<size_t>();
+        if (parsed_options.count("shard-worker"))
+        {
+            return run_shard_worker(parsed_options);
+        }
+
+        /// In the sharded mode, the coordinator loads the skeleton database: the tree without phylo-k-mers
+        const auto sharded = parsed_options.count("shards") > 0;
+        const auto manifest = sharded
+            ? epik::shard::read_manifest(parsed_options["shards"].as<std::string>())
+            : epik::shard::manifest{};
+        const auto db_files = sharded
+            ? std::vector<std::string>{ manifest.skeleton }
+            : parsed_options["database"].as<std::vector<std::string>>();
+        auto num_threads = parsed_options["jobs"].as<size_t>();
+        const auto out_of_core = parsed_options.count("out-of-core") > 0;
+        auto batch_size = out_of_core
+            ? parsed_options["chunk-size"].as<size_t>()
+            : parsed_options["batch-size"].as<size_t>();
+        if (out_of_core && !sharded)
+        {
+            throw std::runtime_error("--out-of-core requires --shards");
+        }
+        const auto search_engine = epik::parse_engine(parsed_options["engine"].as<std::string>());
+        if (search_engine == epik::engine::join && sharded)
+        {
+            throw std::runtime_error("--engine join is not supported with --shards");
+        }
+        const auto filter_bits = parsed_options["filter-bits"].as<size_t>();
+        if (filter_bits > 0 && sharded)
+        {
+            throw std::runtime_error("--filter-bits is not supported with --shards");
+        }
+        const auto dense_tier_fraction = parsed_options["dense-tier"].as<double>();
+        if (dense_tier_fraction < 0.0 || dense_tier_fraction > 1.0)
+        {
+            throw std::runtime_error("--dense-tier has to be a value in [0, 1]");
+        }
+        if (dense_tier_fraction > 0.0 && sharded)
+        {
+            throw std::runtime_error("--dense-tier is not supported with --shards");
+        }
+        const auto clade_size = parsed_options["clade-size"].as<size_t>();
+        const auto candidate_clades = parsed_options["candidate-clades"].as<size_t>();
+        if (clade_size > 0 && candidate_clades == 0)
+        {
+            throw std::runtime_error("--candidate-clades has to be positive");
+        }
+        if (clade_size > 0 && sharded)
+        {
+            throw std::runtime_error("--clade-size is not supported with --shards");
+        }
+        const auto fixed_point = parsed_options.count("fixed-point") > 0;
+        if (fixed_point && (dense_tier_fraction > 0.0 || clade_size > 0))
+        {
+            throw std::runtime_error("--fixed-point can not be used with --dense-tier or --clade-size");
+        }
+        if (fixed_point && sharded)
+        {
+            throw std::runtime_error("--fixed-point is not supported with --shards");
+        }
+        const auto skip_postings = parsed_options["skip-postings"].as<size_t>();
+        const auto skip_ratio = parsed_options["skip-ratio"].as<double>();
+        if (skip_ratio != 0.0 && skip_ratio < 1.0)
+        {
+            throw std::runtime_error("--skip-ratio has to be 0 or at least 1");
+        }
+        if ((skip_postings > 0 || skip_ratio > 0.0) && sharded)
+        {
+            throw std::runtime_error("--skip-postings and --skip-ratio are not supported with --shards");
+        }
+        const auto sampling = epik::sampling{
+            epik::parse_sampling_scheme(parsed_options["sampling"].as<std::string>()),
+            parsed_options["sampling-density"].as<double>()
+        };
+        if (sampling.density <= 0.0 || sampling.density > 1.0)
+        {
+            throw std::runtime_error("--sampling-density has to be a value in (0, 1]");
+        }
+        if (sampling.scheme != epik::sampling_scheme::none && sharded)
+        {
+            throw std::runtime_error("--sampling is not supported with --shards");
+        }
         const auto user_omega = parsed_options["omega"].as<float>();
         const auto user_mu = parsed_options["mu"].as<float>();
 
         const auto keep_at_most = parsed_options["keep-at-most"].as<size_t>();
         const auto keep_factor = parsed_options["keep-factor"].as<double>();
         const auto output_dir = parsed_options["output-dir"].as<std::string>();
+        const auto format = parse_output_format(parsed_options["output-format"].as<std::string>(),
+                                                parsed_options.count("mass-counts") > 0);
 
         check_mu(user_mu);
+        if (sharded && parsed_options.count("mu") && user_mu != manifest.mu)
+        {
+            throw std::runtime_error("--mu is applied when the database is split: the shards of " +
+                                     parsed_options["shards"].as<std::string>() + " were made with --mu " +
+                                     std::to_string(manifest.mu));
+        }
 
         size_t max_entries = std::numeric_limits<size_t>::max();
-        if (parsed_options.count("max-ram"))
+        size_t scratch_budget = std::numeric_limits<size_t>::max();
+        size_t tier_limit = std::numeric_limits<size_t>::max();
+        if (parsed_options.count("max-ram") && parsed_options.count("query") && !parsed_options.count("make-shards"))
         {
+            /// The limit is shared between the phylo-k-mers, the scratch of the threads and the buffers
+            const auto max_ram = parse_human_readable(parsed_options["max-ram"].as<std::string>());
+            const auto work = epik::memory::workload{
+                db_files.size(), num_threads, batch_size,
+                epik::memory::estimate_record_size(parsed_options["query"].as<std::string>()),
+                keep_at_most, search_engine == epik::engine::join,
+                filter_bits, dense_tier_fraction > 0.0, clade_size > 0, fixed_point,
+                skip_postings > 0 || skip_ratio > 0.0
+            };
+            const auto plan = epik::memory::make_plan(max_ram, work);
+            epik::memory::print_plan(std::cout, plan, work);
+
+            max_entries = plan.entries_per_database;
+            scratch_budget = plan.scratch_bytes;
+            tier_limit = plan.tier_per_database;
+            batch_size = plan.batch_size;
+        }
+        else if (parsed_options.count("max-ram"))
+        {
+            /// Only the database is loaded
             const auto max_ram_string = parsed_options["max-ram"].as<std::string>();
             const auto max_ram = parse_human_readable(max_ram_string);
             max_entries = static_cast<size_t>(max_ram / sizeof(i2l::pkdb_value));
 
+            /// The memory limit is shared between the databases
+            max_entries /= db_files.size();
             if (max_entries == 0)
             {
                 throw std::runtime_error("Memory limit is too low");
             }
             std::cout << "Max-RAM provided: will be loaded not more than "
-                      << to_human_readable(max_entries) << " phylo-k-mers." << std::endl;
+                      << to_human_readable(max_entries) << " phylo-k-mers"
+                      << (db_files.size() > 1 ? " per database." : ".") << std::endl;
         }
 
 #ifndef EPIK_OMP
@@ -272,35 +650,303 @@ int main(int argc, char** argv)
             return -2;
         }
 #endif
-        std::cout << "Loading database with mu=" << user_mu << " and omega="
-                  << user_omega << "..." << std::endl;
-        const auto db = i2l::load(db_file, user_mu, user_omega, max_entries);
-        if (db.version() < i2l::protocol::EARLIEST_INDEX)
-        {
-            std::cerr << "The serialization protocol version is too old (v" << db.version() << ").\n"
-                      << "Can not use databases built by xpas older than v0.3.2" << std::endl;
-            return -1;
-        }
-
-        std::cout << "Database parameters:" << std::endl
-                  << "\tSequence type: " << db.sequence_type() << std::endl
-                  << "\tk: " << db.kmer_size() << std::endl
-                  << "\tomega: " << db.omega() << std::endl
-                  << "\tPositions loaded: " << (db.positions_loaded() ? "true" : "false") << std::endl << std::endl;
-        std::cout << "Loaded " << to_human_readable(db.get_num_entries_loaded())
-                  << " of " << to_human_readable(db.get_num_entries_total())
-                  << " phylo-k-mers. " << std::endl << std::endl;
-
-        const auto tree = i2l::io::parse_newick(db.tree());
-        auto placer = epik::placer(db, tree, keep_at_most, keep_factor, num_threads);
-        /// Here we transform the tree to .newick by our own to make sure the output format is always the same
-        const auto tree_as_newick = i2l::io::to_newick(tree, true);
-        const auto jplace_filename = make_output_filename(query_file, output_dir).string();
+#ifndef EPIK_METRICS
+        if (parsed_options.count("metrics") || parsed_options.count("profile-hw"))
+        {
+            std::cerr << "EPIK was complied without metrics support (EPIK_METRICS) and "
+                         "can not report them." << std::endl;
+            return -2;
+        }
+#endif
+        if (parsed_options.count("profile-hw") && !epik::metrics::enable_hw_counters())
+        {
+            /// Containers often have no access to the counters: the stages are still timed
+            std::cout << "Note: hardware counters are not available ("
+                      << epik::metrics::hw_event_error(epik::metrics::hw_event::cycles)
+                      << "), --profile-hw reports only the time of the stages." << std::endl;
+        }
+        if (parsed_options.count("make-shards"))
+        {
+            if (db_files.size() != 1)
+            {
+                throw std::runtime_error("--make-shards requires exactly one database");
+            }
+            if (parsed_options.count("max-ram"))
+            {
+                throw std::runtime_error("--make-shards can not be used with --max-ram: the shards must store "
+                                         "all phylo-k-mers of the database");
+            }
+            const auto db = load_database(db_files[0], user_mu, user_omega, max_entries);
+            if (db.get_num_entries_loaded() < db.get_num_entries_total() && user_mu == 1.0f)
+            {
+                throw std::runtime_error("Could not load all phylo-k-mers of " + db_files[0] + " to split it");
+            }
+            const auto manifest_file = epik::shard::make_shards(db, db_files[0],
+                                                                parsed_options["make-shards"].as<size_t>(), output_dir,
+                                                                user_mu);
+            for (const auto& shard : epik::shard::read_manifest(manifest_file).shards)
+            {
+                std::cout << "Shard " << shard.filename << ": " << to_human_readable(shard.num_entries)
+                          << " phylo-k-mers, keys " << shard.first_key << ".." << shard.last_key << std::endl;
+            }
+            std::cout << "Manifest: " << manifest_file << std::endl;
+            return 0;
+        }
+
+        const auto query_file = parsed_options["query"].as<std::string>();
+        if (parsed_options.count("merge-parts"))
+        {
+            return merge_parts(db_files, query_file, output_dir, parsed_options["merge-parts"].as<size_t>(), format);
+        }
+
+        /// A part of the query file is placed like a whole file of its records. Its outputs
+        /// are named after the part and indexed to be merged
+        const auto query_part = parsed_options.count("query-part")
+            ? std::make_optional(epik::split::parse_part(parsed_options["query-part"].as<std::string>()))
+            : std::nullopt;
+        const auto mates_file = parsed_options.count("mates")
+            ? std::make_optional(parsed_options["mates"].as<std::string>())
+            : std::nullopt;
+        if (mates_file && (query_part || sharded))
+        {
+            throw std::runtime_error("--mates is not supported with --query-part and --shards");
+        }
+        const auto query_range = query_part
+            ? epik::split::find_range(query_file, *query_part)
+            : epik::split::byte_range{ 0, static_cast<size_t>(fs::file_size(query_file)) };
         const auto invocation = make_invocation(argc, argv);
-        const auto total_fasta_size = fs::file_size(query_file);
+        const auto total_fasta_size = query_range.end - query_range.begin;
+        const auto output_filenames = make_output_filenames(db_files, query_file, output_dir, query_part);
 
-        auto jplace = epik::io::jplace_writer(jplace_filename, invocation, tree_as_newick);
-        jplace.start();
+        /// The progress of the run is saved after completed batches. A resumed run skips the batches
+        /// placed and continues the .jplace files from their size at the checkpoint
+        const auto checkpoint_filename = fs::path(query_part
+                ? epik::split::part_filename(make_output_filename(query_file, output_dir).string(), *query_part)
+                : make_output_filename(query_file, output_dir).string())
+            .replace_extension(".ckpt").string();
+        const auto checkpoint_interval = std::chrono::seconds(parsed_options["checkpoint-interval"].as<size_t>());
+        std::optional<epik::checkpoint> resumed;
+        if (parsed_options.count("resume"))
+        {
+            resumed = epik::load_checkpoint(checkpoint_filename);
+            if (!resumed)
+            {
+                std::cout << "No checkpoint found in " << checkpoint_filename
+                          << ", starting from the beginning." << std::endl;
+            }
+            else if (fs::path(resumed->query_file).filename() != fs::path(query_file).filename())
+            {
+                throw std::runtime_error("The checkpoint " + checkpoint_filename + " is for another query file: " +
+                                         resumed->query_file);
+            }
+            else
+            {
+                batch_size = resumed->batch_size;
+            }
+        }
+
+        /// Every database has its own tree, placer and output. The queries are read
+        /// and encoded once and placed against all of them
+        std::vector<std::unique_ptr<placement_target>> targets;
+        std::vector<epik::placer*> placers;
+        std::vector<size_t> kmer_sizes;
+        for (size_t db_index = 0; db_index < db_files.size(); ++db_index)
+        {
+            const auto& db_file = db_files[db_index];
+            const auto& jplace_filename = output_filenames[db_index];
+            for (const auto& target : targets)
+            {
+                if (target->jplace_filename == jplace_filename)
+                {
+                    throw std::runtime_error("Databases must have different file names: " + db_file);
+                }
+            }
+
+            targets.push_back(std::make_unique<placement_target>(db_file, user_mu, user_omega, max_entries,
+                                                                 keep_at_most, keep_factor, num_threads,
+                                                                 jplace_filename, invocation, format));
+            if (targets.front()->db.sequence_type() != targets.back()->db.sequence_type())
+            {
+                throw std::runtime_error("Databases must have the same sequence type: " + db_file);
+            }
+            const auto& db = targets.back()->db;
+            if (parsed_options.count("max-ram") && !sharded && db.get_num_entries_loaded() < db.get_num_entries_total())
+            {
+                std::cout << "Note: --max-ram dropped " << to_human_readable(db.get_num_entries_total() -
+                                                                            db.get_num_entries_loaded())
+                          << " phylo-k-mers. To place with all of them, split the database with --make-shards "
+                             "and use --shards with --out-of-core." << std::endl << std::endl;
+            }
+            if (filter_bits > 0)
+            {
+                auto& placer = targets.back()->placer;
+                placer.build_filter(filter_bits);
+                std::cout << "Key filter of " << db_file << ": " << epik::memory::format_bytes(placer.filter()->memory_bytes())
+                          << " for " << to_human_readable(placer.filter()->num_keys()) << " keys, expected false positive rate "
+                          << placer.filter()->expected_false_positive_rate() << std::endl;
+            }
+            if (dense_tier_fraction > 0.0)
+            {
+                auto& placer = targets.back()->placer;
+                placer.build_dense_tier(dense_tier_fraction, tier_limit);
+                const auto& tier = *placer.dense_tier();
+                const auto num_entries = targets.back()->db.get_num_entries_loaded();
+                if (tier.num_kmers() == 0)
+                {
+                    std::cout << "Dense tier of " << db_file << ": no k-mers" << std::endl;
+                }
+                else
+                {
+                    std::cout << "Dense tier of " << db_file << ": " << to_human_readable(tier.num_kmers())
+                              << " k-mers of at least " << tier.min_postings() << " branches ("
+                              << (num_entries > 0 ? 100.0 * (double)tier.num_postings() / (double)num_entries : 0.0)
+                              << "% of the phylo-k-mers), " << epik::memory::format_bytes(tier.memory_bytes()) << std::endl;
+                }
+            }
+            if (clade_size > 0)
+            {
+                auto& placer = targets.back()->placer;
+                placer.build_clades(clade_size, candidate_clades);
+                const auto& clades = *placer.clades();
+                std::cout << "Clades of " << db_file << ": " << to_human_readable(clades.num_clades())
+                          << " clades of at most " << clades.max_size() << " branches, "
+                          << epik::memory::format_bytes(clades.memory_bytes()) << std::endl;
+            }
+            if (fixed_point)
+            {
+                auto& placer = targets.back()->placer;
+                placer.build_fixed_point();
+                const auto& fixed = *placer.fixed_point();
+                std::cout << "Fixed-point scores of " << db_file << ": " << to_human_readable(fixed.num_postings())
+                          << " phylo-k-mers, " << fixed.scale() << " units per log10, "
+                          << epik::memory::format_bytes(fixed.memory_bytes()) << std::endl;
+            }
+            if (skip_postings > 0 || skip_ratio > 0.0)
+            {
+                auto& placer = targets.back()->placer;
+                placer.set_skipping(skip_postings, skip_ratio);
+                const auto num_entries = targets.back()->db.get_num_entries_loaded();
+                std::cout << "Skipped k-mers of " << db_file << ": " << to_human_readable(placer.num_skipped_kmers())
+                          << " (" << (num_entries > 0 ? 100.0 * (double)placer.num_skipped_postings() / (double)num_entries : 0.0)
+                          << "% of the phylo-k-mers)" << std::endl;
+            }
+            placers.push_back(&targets.back()->placer);
+            kmer_sizes.push_back(targets.back()->db.kmer_size());
+        }
+
+        /// The scratch of a thread is known once the trees are loaded: fewer threads place if it does not fit
+        if (scratch_budget != std::numeric_limits<size_t>::max())
+        {
+            size_t thread_scratch = 0;
+            for (const auto& target : targets)
+            {
+                thread_scratch += target->placer.thread_scratch_bytes() + (target->mass ? target->mass->thread_bytes() : 0);
+            }
+            const auto fitting_threads = std::min(std::max(num_threads, size_t{1}), scratch_budget / thread_scratch);
+            if (fitting_threads == 0)
+            {
+                throw std::runtime_error("Memory limit is too low: the thread scratch of the trees takes " +
+                                         epik::memory::format_bytes(thread_scratch) + " for one thread, " +
+                                         epik::memory::format_bytes(scratch_budget) + " are planned. Raise --max-ram");
+            }
+
+            std::cout << "Thread scratch of the trees: " << epik::memory::format_bytes(thread_scratch)
+                      << " per thread, " << fitting_threads << (fitting_threads > 1 ? " threads" : " thread");
+            if (fitting_threads < num_threads)
+            {
+                std::cout << " (reduced from " << num_threads << " to fit in "
+                          << epik::memory::format_bytes(scratch_budget) << ")";
+                num_threads = fitting_threads;
+                for (auto& target : targets)
+                {
+                    target->placer.set_max_threads(num_threads);
+                    if (target->mass)
+                    {
+                        target->mass->set_num_threads(num_threads);
+                    }
+                }
+            }
+            std::cout << std::endl << std::endl;
+        }
+
+        /// Workers are started by the same command with the same parameters
+        std::unique_ptr<epik::shard::coordinator> coordinator;
+        std::unique_ptr<epik::shard::out_of_core_placer> out_of_core_placer;
+        if (out_of_core)
+        {
+            std::cout << "Out-of-core placement: " << manifest.shards.size()
+                      << " shards are loaded for every " << batch_size << " queries." << std::endl;
+            out_of_core_placer = std::make_unique<epik::shard::out_of_core_placer>(
+                targets[0]->placer, targets[0]->tree, manifest, user_omega, max_entries);
+        }
+        else if (sharded)
+        {
+            const auto to_arg = [](float value) {
+                std::ostringstream oss;
+                oss << std::setprecision(9) << value;
+                return oss.str();
+            };
+            std::vector<std::string> worker_args = {
+                argv[0], "--shards", parsed_options["shards"].as<std::string>(),
+                "-j", std::to_string(num_threads),
+                "--omega", to_arg(user_omega),
+            };
+            worker_args.push_back("--shard-worker");
+
+            /// Every worker loads its whole shard: one that does not fit in --max-ram is an error, not a truncation
+            if (parsed_options.count("max-ram"))
+            {
+                const auto max_ram = parse_human_readable(parsed_options["max-ram"].as<std::string>());
+                const auto max_shard = epik::shard::max_shard_entries(manifest);
+                if (max_shard * sizeof(i2l::pkdb_value) > max_ram)
+                {
+                    throw std::runtime_error("The largest shard has " + to_human_readable(max_shard) +
+                                             " phylo-k-mers and does not fit in --max-ram for a worker. "
+                                             "Split the database into more shards");
+                }
+            }
+
+            std::cout << "Starting " << manifest.shards.size() << " shard workers..." << std::endl;
+            coordinator = std::make_unique<epik::shard::coordinator>(targets[0]->placer, manifest, worker_args);
+        }
+
+        if (resumed)
+        {
+            if (resumed->outputs.size() != targets.size())
+            {
+                throw std::runtime_error("The checkpoint " + checkpoint_filename + " is for other databases");
+            }
+            for (size_t i = 0; i < targets.size(); ++i)
+            {
+                if (fs::path(resumed->outputs[i].filename).filename() != fs::path(targets[i]->jplace_filename).filename())
+                {
+                    throw std::runtime_error("The checkpoint " + checkpoint_filename + " is for other databases");
+                }
+                if (targets[i]->jplace)
+                {
+                    targets[i]->jplace->resume(resumed->outputs[i].position, resumed->outputs[i].num_placements,
+                                               resumed->outputs[i].placements_begin);
+                }
+                if (targets[i]->mass)
+                {
+                    if (resumed->outputs[i].mass_snapshot.empty())
+                    {
+                        throw std::runtime_error("The checkpoint " + checkpoint_filename + " has no mass table");
+                    }
+                    targets[i]->mass->resume(resumed->outputs[i].mass_snapshot);
+                }
+            }
+        }
+        else
+        {
+            for (auto& target : targets)
+            {
+                if (target->jplace)
+                {
+                    target->jplace->start();
+                }
+            }
+        }
 
         print_intruction_set();
         std::cout << "Placing " << query_file << "..." << std::endl;
@@ -328,20 +974,77 @@ int main(int argc, char** argv)
         double average_speed = 0.0;
         size_t num_iterations = 0;
 
-        /// Batch query reading
-        auto reader = i2l::io::batch_fasta(query_file, batch_size);
+        /// Batch query reading. The query file (or its part) is mapped to memory and parsed by all threads.
+        /// Paired-end reads are read from both files of mates, and every pair is two views of a batch.
+        /// A resumed run reads from the input offsets of the checkpoint, where the next records must start
+        const auto input_offset = resumed ? resumed->input_offset : 0;
+        const auto mates_offset = resumed ? resumed->mates_offset : 0;
+        if (input_offset > total_fasta_size || (mates_file && mates_offset > fs::file_size(*mates_file)))
+        {
+            throw std::runtime_error("The query file has changed since the checkpoint " + checkpoint_filename);
+        }
+        std::optional<epik::io::mapped_fasta> single_reader;
+        std::optional<epik::io::paired_fasta> paired_reader;
+        if (mates_file)
+        {
+            paired_reader.emplace(query_file, *mates_file, batch_size, num_threads, input_offset, mates_offset);
+        }
+        else
+        {
+            single_reader.emplace(query_file, epik::split::byte_range{ query_range.begin + input_offset,
+                                                                       query_range.end },
+                                  batch_size, num_threads);
+        }
+        const auto next_batch = [&single_reader, &paired_reader]() {
+            return paired_reader ? paired_reader->next_batch() : single_reader->next_batch();
+        };
+        const auto bytes_read = [&single_reader, &paired_reader, input_offset]() {
+            return input_offset + (paired_reader ? paired_reader->bytes_read() : single_reader->bytes_read());
+        };
+        const auto mates_bytes_read = [&paired_reader, mates_offset]() {
+            return paired_reader ? mates_offset + paired_reader->mates_bytes_read() : 0;
+        };
+
+        if (resumed)
+        {
+            /// The batches placed are not read again: only the record boundaries at the offsets are checked
+            if (!(paired_reader ? paired_reader->at_record_start() : single_reader->at_record_start()))
+            {
+                throw std::runtime_error("The query file has changed since the checkpoint " + checkpoint_filename);
+            }
+            num_seq_placed = resumed->num_sequences;
+            std::cout << "Resuming after " << num_seq_placed << " sequences." << std::endl;
+        }
+
+        auto last_checkpoint = std::chrono::steady_clock::now();
         while (true)
         {
             // Synchronous reading of the next batch to place
-            const auto batch = reader.next_batch();
-            if (batch.empty())
+            const auto views = [&next_batch]() {
+                EPIK_TIME_SCOPE(parse);
+                return next_batch();
+            }();
+            if (views.empty())
             {
                 break;
             }
 
             // Place in parallel
             const auto begin_batch = std::chrono::steady_clock::now();
-            const auto placed_batch = placer.place(batch, num_threads);
+            std::vector<epik::impl::placed_collection> placed_batches;
+            if (coordinator)
+            {
+                placed_batches.push_back(coordinator->place(views, num_threads));
+            }
+            else if (out_of_core_placer)
+            {
+                placed_batches.push_back(out_of_core_placer->place(views, num_threads));
+            }
+            else
+            {
+                const auto encoded_batch = epik::encoded_batch(views, kmer_sizes, num_threads, sampling);
+                placed_batches = epik::place(placers, encoded_batch, num_threads, search_engine);
+            }
             const auto end_batch = std::chrono::steady_clock::now();
 
             // Compute placement speed, sequences per second
@@ -355,30 +1058,141 @@ int main(int argc, char** argv)
             // Update progress bar
             bar.set_option(option::PrefixText{to_human_readable(seq_per_second) + " seq/s "});
             bar.set_option(option::PostfixText{std::to_string(num_seq_placed) + " / ?"});
-            bar.set_progress(reader.bytes_read());
+            bar.set_progress(bytes_read());
 
-            // Synchronous output to the .jplace file
-            jplace << placed_batch;
+            // Synchronous output to the .jplace files. The mass is only accumulated
+            for (size_t i = 0; i < targets.size(); ++i)
+            {
+                if (targets[i]->jplace)
+                {
+                    *targets[i]->jplace << placed_batches[i];
+                }
+                if (targets[i]->mass)
+                {
+                    *targets[i]->mass << placed_batches[i];
+                }
+            }
 
-            num_seq_placed += batch.size();
+            num_seq_placed += views.size();
             ++num_iterations;
+
+            if (std::chrono::steady_clock::now() - last_checkpoint >= checkpoint_interval)
+            {
+                auto state = epik::checkpoint{ query_file, batch_size, num_seq_placed, bytes_read(),
+                                               mates_bytes_read(), {} };
+                for (const auto& target : targets)
+                {
+                    /// The mass table at the checkpoint is a separate file, read back on resuming.
+                    /// The previous one is removed only after the new checkpoint is saved. The outputs
+                    /// are on the disk before the checkpoint that refers to them
+                    std::string mass_snapshot;
+                    if (target->mass)
+                    {
+                        mass_snapshot = target->mass->filename() + ".ckpt-" + std::to_string(num_seq_placed);
+                        target->mass->write(mass_snapshot);
+                        epik::sync_file(mass_snapshot);
+                        epik::sync_file(fs::absolute(mass_snapshot).parent_path().string());
+                    }
+                    if (target->jplace)
+                    {
+                        epik::sync_file(target->jplace_filename);
+                    }
+                    state.outputs.push_back({ target->jplace_filename,
+                                              target->jplace ? target->jplace->position() : 0,
+                                              target->jplace ? target->jplace->num_placements() : 0,
+                                              mass_snapshot,
+                                              target->jplace ? target->jplace->placements_begin() : 0 });
+                }
+                const auto previous = epik::load_checkpoint(checkpoint_filename);
+                epik::save_checkpoint(checkpoint_filename, state);
+                remove_mass_snapshots(previous);
+                last_checkpoint = std::chrono::steady_clock::now();
+            }
         }
-        jplace.end();
+        for (auto& target : targets)
+        {
+            if (target->jplace)
+            {
+                /// The placements of a part end where the footer starts
+                const auto placements_end = target->jplace->position();
+                target->jplace->end();
+                if (query_part)
+                {
+                    epik::split::save_fragment_index({ target->jplace_filename, target->jplace->placements_begin(),
+                                                       placements_end, target->jplace->num_placements() });
+                }
+            }
+            if (target->mass)
+            {
+                target->mass->write();
+            }
+        }
+        remove_mass_snapshots(epik::load_checkpoint(checkpoint_filename));
+        fs::remove(checkpoint_filename);
 
-        average_speed /= (double)num_iterations;
+        average_speed /= (double)std::max(num_iterations, size_t{1});
         bar.set_option(option::PrefixText{"Done. "});
         bar.set_option(option::PostfixText{to_human_readable(num_seq_placed)});
-        bar.set_progress(reader.bytes_read());
+        bar.set_progress(bytes_read());
 
         std::cout << std::endl << termcolor::bold << termcolor::white
                   << "Placed " << num_seq_placed << " sequences.\nAverage speed: "
                   << to_human_readable(average_speed) << " seq/s.\n";
-        std::cout << "Output: " << jplace_filename << std::endl;
+        for (const auto& target : targets)
+        {
+            if (target->jplace)
+            {
+                std::cout << "Output: " << target->jplace_filename << std::endl;
+            }
+            if (target->mass)
+            {
+                std::cout << "Output: " << target->mass->filename() << std::endl;
+            }
+        }
 
         const auto placement_time = std::chrono::duration_cast<std::chrono::milliseconds>(
             std::chrono::steady_clock::now() - begin).count();
         std::cout << "Placement time: " << humanize_time(placement_time)
             << " (" << placement_time << " ms)" << termcolor::reset << std::endl;
+
+#ifdef EPIK_METRICS
+        if (filter_bits > 0)
+        {
+            const auto& metrics = epik::metrics::registry::instance();
+            const auto rejected = metrics.total(epik::metrics::counter::filter_rejected);
+            const auto false_positives = metrics.total(epik::metrics::counter::filter_false_positives);
+            const auto absent = rejected + false_positives;
+            std::cout << "Key filter: " << to_human_readable(rejected) << " searches avoided, false positive rate "
+                      << (absent > 0 ? (double)false_positives / (double)absent : 0.0) << std::endl;
+        }
+        if (clade_size > 0)
+        {
+            const auto& metrics = epik::metrics::registry::instance();
+            std::cout << "Clades: " << to_human_readable(metrics.total(epik::metrics::counter::clades_pruned))
+                      << " clades pruned, " << to_human_readable(metrics.total(epik::metrics::counter::clade_expansions))
+                      << " placements scored in more than " << candidate_clades << " clades" << std::endl;
+        }
+        if (skip_postings > 0 || skip_ratio > 0.0)
+        {
+            const auto& metrics = epik::metrics::registry::instance();
+            const auto skipped = metrics.total(epik::metrics::counter::kmers_skipped);
+            const auto hit = metrics.total(epik::metrics::counter::kmers_hit);
+            std::cout << "Skipped: " << to_human_readable(skipped) << " k-mers found ("
+                      << (hit > 0 ? 100.0 * (double)skipped / (double)hit : 0.0) << "%)" << std::endl;
+        }
+#endif
+        if (parsed_options.count("metrics"))
+        {
+            const auto metrics_filename = parsed_options["metrics"].as<std::string>();
+            epik::metrics::registry::instance().write_json(metrics_filename);
+            std::cout << "Metrics: " << metrics_filename << std::endl;
+        }
+        if (parsed_options.count("profile-hw"))
+        {
+            const auto profile_filename = parsed_options["profile-hw"].as<std::string>();
+            epik::metrics::registry::instance().write_hw_json(profile_filename);
+            std::cout << "Hardware profile: " << profile_filename << std::endl;
+        }
         std::cout << "Done." << '\n' << std::flush;
     }
     catch (const std::runtime_error& error)
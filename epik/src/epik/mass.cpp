@@ -0,0 +1,218 @@
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <limits>
+#include <algorithm>
+#include <stdexcept>
+#include <boost/filesystem.hpp>
+#include <epik/mass.h>
+#include <epik/place.h>
+#include <epik/metrics.h>
+
+#if defined(EPIK_OMP)
+#include <omp.h>
+#endif
+
+using namespace epik::io;
+
+mass_writer::mass_writer(const std::string& filename, size_t num_branches, bool with_counts, size_t num_threads)
+    : _filename{ filename }
+    , _num_branches{ num_branches }
+    , _with_counts{ with_counts }
+    , _num_threads{ std::max(num_threads, size_t{1}) }
+    , _mass(_num_threads, std::vector<double>(num_branches, 0.0))
+    , _counts(with_counts ? _num_threads : 0, std::vector<uint64_t>(num_branches, 0))
+{}
+
+mass_writer& mass_writer::operator<<(const impl::placed_collection& placed)
+{
+    EPIK_TIME_SCOPE(write);
+
+    const auto& placed_seqs = placed.placed_seqs;
+    const auto& sequence_map = placed.sequence_map;
+    auto& mass = _mass;
+    auto& counts = _counts;
+    const auto num_branches = _num_branches;
+    const auto with_counts = _with_counts;
+    const auto num_threads = _num_threads;
+
+#ifdef EPIK_OMP
+    #if __clang__
+    #pragma omp parallel for schedule(static) num_threads(num_threads) \
+        default(none) shared(placed_seqs, sequence_map, mass, counts, num_branches, with_counts)
+    #elif defined (__GNUC__) && (__GNUC__ < 9)
+#pragma omp parallel for schedule(static) num_threads(num_threads) default(none) \
+    shared(mass, counts)
+    #else
+#pragma omp parallel for schedule(static) num_threads(num_threads) \
+    default(none) shared(placed_seqs, sequence_map, mass, counts, num_branches, with_counts)
+    #endif
+#endif
+    for (size_t i = 0; i < placed_seqs.size(); ++i)
+    {
+#if defined(EPIK_OMP)
+        const size_t thread_id = omp_get_thread_num();
+#else
+        const size_t thread_id = 0;
+#endif
+        const auto& placements = placed_seqs[i].placements;
+        if (placements.empty())
+        {
+            continue;
+        }
+        const auto multiplicity = static_cast<double>(sequence_map.at(placed_seqs[i].sequence).size());
+
+        /// The weight ratios of the placements kept do not sum up to 1. If they are all zero,
+        /// the mass is spread evenly
+        double sum = 0.0;
+        for (const auto& placement : placements)
+        {
+            sum += static_cast<double>(placement.weight_ratio);
+        }
+
+        auto& thread_mass = mass[thread_id];
+        for (const auto& placement : placements)
+        {
+            if (placement.branch_id >= num_branches)
+            {
+                continue;
+            }
+            const auto share = sum > 0.0
+                ? static_cast<double>(placement.weight_ratio) / sum
+                : 1.0 / static_cast<double>(placements.size());
+            thread_mass[placement.branch_id] += multiplicity * share;
+        }
+
+        /// Placements are sorted by score, the first one is the best
+        if (with_counts && placements[0].branch_id < num_branches)
+        {
+            counts[thread_id][placements[0].branch_id] += static_cast<uint64_t>(multiplicity);
+        }
+    }
+    return *this;
+}
+
+void mass_writer::write()
+{
+    write(_filename);
+}
+
+void mass_writer::write(const std::string& filename)
+{
+    EPIK_TIME_SCOPE(write);
+
+    _merge();
+
+    std::ostringstream out;
+    out << std::setprecision(std::numeric_limits<double>::max_digits10);
+    out << "edge_num\tmass" << (_with_counts ? "\treads" : "") << '\n';
+    for (size_t branch = 0; branch < _num_branches; ++branch)
+    {
+        out << branch << '\t' << _mass[0][branch];
+        if (_with_counts)
+        {
+            out << '\t' << _counts[0][branch];
+        }
+        out << '\n';
+    }
+
+    /// A rename is atomic: the file is either the previous table or the new one
+    const auto content = out.str();
+    const auto temp_filename = filename + ".tmp";
+    {
+        std::ofstream file(temp_filename);
+        if (!file)
+        {
+            throw std::runtime_error("Could not create file " + temp_filename);
+        }
+        file << content;
+        if (!file)
+        {
+            throw std::runtime_error("Could not write file " + temp_filename);
+        }
+    }
+    boost::filesystem::rename(temp_filename, filename);
+    EPIK_COUNT(bytes_written, content.size());
+}
+
+void mass_writer::resume(const std::string& filename)
+{
+    std::ifstream in(filename);
+    if (!in)
+    {
+        throw std::runtime_error("Can not resume from " + filename + ": the file does not exist");
+    }
+
+    std::string line;
+    std::getline(in, line);
+    for (auto& thread_mass : _mass)
+    {
+        std::fill(thread_mass.begin(), thread_mass.end(), 0.0);
+    }
+    for (auto& thread_counts : _counts)
+    {
+        std::fill(thread_counts.begin(), thread_counts.end(), 0);
+    }
+
+    while (std::getline(in, line))
+    {
+        std::istringstream fields(line);
+        size_t branch;
+        double mass;
+        uint64_t count = 0;
+        fields >> branch >> mass;
+        if (_with_counts)
+        {
+            fields >> count;
+        }
+        if (fields.fail() || branch >= _num_branches)
+        {
+            throw std::runtime_error("Can not resume from " + filename + ": wrong line \"" + line + "\"");
+        }
+        _mass[0][branch] = mass;
+        if (_with_counts)
+        {
+            _counts[0][branch] = count;
+        }
+    }
+}
+
+const std::string& mass_writer::filename() const noexcept
+{
+    return _filename;
+}
+
+size_t mass_writer::thread_bytes() const noexcept
+{
+    return _num_branches * (sizeof(double) + (_with_counts ? sizeof(uint64_t) : 0));
+}
+
+void mass_writer::set_num_threads(size_t num_threads)
+{
+    _num_threads = std::clamp(num_threads, size_t{1}, _num_threads);
+    _mass.resize(_num_threads);
+    if (_with_counts)
+    {
+        _counts.resize(_num_threads);
+    }
+}
+
+void mass_writer::_merge()
+{
+    for (size_t thread = 1; thread < _mass.size(); ++thread)
+    {
+        for (size_t branch = 0; branch < _num_branches; ++branch)
+        {
+            _mass[0][branch] += _mass[thread][branch];
+            _mass[thread][branch] = 0.0;
+        }
+    }
+    for (size_t thread = 1; thread < _counts.size(); ++thread)
+    {
+        for (size_t branch = 0; branch < _num_branches; ++branch)
+        {
+            _counts[0][branch] += _counts[thread][branch];
+            _counts[thread][branch] = 0;
+        }
+    }
+}
@@ -0,0 +1,230 @@
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+#include <i2l/phylo_kmer_db.h>
+#include <epik/clades.h>
+#include <epik/filter.h>
+#include <epik/fixed.h>
+#include <epik/memory.h>
+#include <epik/ordinal.h>
+#include <epik/place.h>
+
+using namespace epik::memory;
+
+namespace
+{
+    /// The amount of the query file read to estimate the record size
+    constexpr size_t sample_size = 4 * 1024 * 1024;
+
+    /// The approximate size of a placement in the .jplace output
+    constexpr size_t jplace_placement_size = 160;
+
+    /// The approximate size of the rest of a placed query in the .jplace output: the name, brackets etc.
+    constexpr size_t jplace_query_size = 64;
+
+    /// \brief The memory of the structures built over the phylo-k-mers of a database, but the dense tier:
+    /// bytes per phylo-k-mer loaded and bytes per database
+    struct index_cost
+    {
+        size_t per_entry;
+        size_t per_database;
+    };
+
+    /// \brief The most memory the structures of a workload take. The structures indexed by k-mer
+    /// (see impl::ordinal_index) are planned for one phylo-k-mer per k-mer, the most k-mers there can be
+    index_cost index_cost_of(const workload& work)
+    {
+        using epik::impl::ordinal_index;
+        const size_t per_kmer = sizeof(size_t) + ordinal_index::max_bytes_per_key;
+        const size_t per_index = sizeof(size_t) + ordinal_index::memory_bytes(0);
+
+        index_cost cost{ 0, 0 };
+        if (work.filter_bits > 0)
+        {
+            cost.per_entry += (work.filter_bits + 7) / 8;
+            cost.per_database += epik::impl::key_filter::memory_bytes(1, work.filter_bits);
+        }
+        if (work.clades)
+        {
+            cost.per_entry += sizeof(epik::impl::clade_index::entry) + per_kmer;
+            cost.per_database += per_index;
+        }
+        if (work.fixed_point)
+        {
+            cost.per_entry += sizeof(i2l::phylo_kmer::branch_type) + sizeof(epik::impl::fixed_postings::fixed_type) + per_kmer;
+            cost.per_database += per_index;
+        }
+        if (work.skipping)
+        {
+            cost.per_entry += ordinal_index::max_bytes_per_key;
+            cost.per_database += ordinal_index::memory_bytes(0);
+        }
+        return cost;
+    }
+}
+
+size_t epik::memory::estimate_record_size(const std::string& filename)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in)
+    {
+        throw std::runtime_error("Could not open file: " + filename);
+    }
+
+    std::vector<char> sample(sample_size);
+    in.read(sample.data(), static_cast<std::streamsize>(sample.size()));
+    const auto size_read = static_cast<size_t>(in.gcount());
+
+    /// A fastq record takes four lines: a line of qualities may start with '>' or '@'
+    const bool fastq = size_read > 0 && sample[0] == '@';
+    size_t num_records = 0;
+    size_t num_lines = 0;
+    for (size_t i = 0; i < size_read; ++i)
+    {
+        if (fastq)
+        {
+            if (i == 0 || sample[i - 1] == '\n')
+            {
+                num_records += num_lines % 4 == 0 ? 1 : 0;
+                ++num_lines;
+            }
+        }
+        else if (sample[i] == '>' && (i == 0 || sample[i - 1] == '\n'))
+        {
+            ++num_records;
+        }
+    }
+
+    /// A sample without a full record: the record is at least as large as the sample
+    if (num_records <= 1)
+    {
+        return std::max(size_read, size_t{1});
+    }
+
+    /// The last record of the sample can be incomplete
+    return size_read / (num_records - 1);
+}
+
+size_t epik::memory::batch_bytes(const workload& work)
+{
+    /// The records as read, their views and the grouping by content
+    const size_t record = work.record_size + 2 * sizeof(std::string);
+    const size_t views = sizeof(impl::seq_view) + 2 * sizeof(std::string_view);
+    const size_t sequence_map = sizeof(std::string_view) + sizeof(std::vector<std::string_view>)
+                                + sizeof(std::string_view) + 2 * sizeof(void*);
+
+    /// Every sequence is encoded and placed for every database
+    const size_t encoded = work.record_size * sizeof(i2l::phylo_kmer::key_type);
+    const size_t searched = work.batch_search ? work.record_size * sizeof(impl::search_result) : 0;
+    const size_t placed = sizeof(impl::placed_sequence) + work.keep_at_most * sizeof(impl::placement);
+
+    const size_t per_read = record + views + sequence_map + work.num_databases * (encoded + searched + placed);
+    return work.batch_size * per_read;
+}
+
+size_t epik::memory::output_bytes(const workload& work)
+{
+    /// Every database has its own .jplace writer and buffer
+    const size_t per_read = jplace_query_size + work.keep_at_most * jplace_placement_size;
+    return work.num_databases * work.batch_size * per_read;
+}
+
+plan epik::memory::make_plan(size_t budget, const workload& work)
+{
+    plan result{};
+    result.budget = budget;
+    result.requested_batch_size = work.batch_size;
+
+    /// Smaller batches take less memory and are placed at about the same speed
+    auto planned = work;
+    const size_t max_buffers = budget / buffer_share;
+    while (planned.batch_size > min_batch_size && batch_bytes(planned) + output_bytes(planned) > max_buffers)
+    {
+        planned.batch_size = std::max(planned.batch_size / 2, min_batch_size);
+    }
+    result.batch_size = planned.batch_size;
+    result.batch_bytes = batch_bytes(planned);
+    result.output_bytes = output_bytes(planned);
+
+    /// The scratch of a thread is not known before the trees are loaded (see scratch_share)
+    result.scratch_bytes = budget / scratch_share;
+
+    /// The dense tier keeps the longest posting lists that fit in its share (see impl::dense_tier)
+    if (work.dense_tier)
+    {
+        result.tier_bytes = budget / dense_tier_share;
+        result.tier_per_database = result.tier_bytes / work.num_databases;
+    }
+
+    const auto cost = index_cost_of(work);
+    const size_t runtime_bytes = result.scratch_bytes + result.batch_bytes + result.output_bytes +
+                                 result.tier_bytes + cost.per_database * work.num_databases;
+    if (runtime_bytes >= budget)
+    {
+        throw std::runtime_error("Memory limit is too low: " + format_bytes(runtime_bytes) +
+                                 " are needed to place batches of " + std::to_string(result.batch_size) + " queries");
+    }
+
+    /// Every phylo-k-mer loaded takes its entry and its part of the structures built
+    result.entries_per_database = (budget - runtime_bytes) / (sizeof(i2l::pkdb_value) + cost.per_entry) / work.num_databases;
+    if (result.entries_per_database == 0)
+    {
+        throw std::runtime_error("Memory limit is too low");
+    }
+    result.entries_bytes = result.entries_per_database * sizeof(i2l::pkdb_value) * work.num_databases;
+    result.index_bytes = (result.entries_per_database * cost.per_entry + cost.per_database) * work.num_databases;
+    return result;
+}
+
+void epik::memory::print_plan(std::ostream& out, const plan& plan, const workload& work)
+{
+    out << "Memory plan for --max-ram " << format_bytes(plan.budget) << ":" << std::endl
+        << "\tphylo-k-mers:   " << std::setw(8) << format_bytes(plan.entries_bytes) << " ("
+        << plan.entries_per_database << (work.num_databases > 1 ? " per database)" : ")") << std::endl
+        << "\tthread scratch: " << std::setw(8) << format_bytes(plan.scratch_bytes) << " ("
+        << work.num_threads << " threads)" << std::endl;
+    if (plan.index_bytes > 0)
+    {
+        out << "\tk-mer indexes:  " << std::setw(8) << format_bytes(plan.index_bytes) << std::endl;
+    }
+    if (plan.tier_bytes > 0)
+    {
+        out << "\tdense tier:     " << std::setw(8) << format_bytes(plan.tier_bytes) << std::endl;
+    }
+    out
+        << "\tbatch buffers:  " << std::setw(8) << format_bytes(plan.batch_bytes) << " (batch size "
+        << plan.batch_size;
+    if (plan.batch_size != plan.requested_batch_size)
+    {
+        out << ", reduced from " << plan.requested_batch_size;
+    }
+    out << ")" << std::endl
+        << "\toutput buffers: " << std::setw(8) << format_bytes(plan.output_bytes) << std::endl;
+}
+
+std::string epik::memory::format_bytes(size_t bytes)
+{
+    const char* units[] = { "B", "K", "M", "G", "T" };
+    auto value = static_cast<double>(bytes);
+    size_t unit = 0;
+    while (value >= 1024.0 && unit + 1 < sizeof(units) / sizeof(units[0]))
+    {
+        value /= 1024.0;
+        ++unit;
+    }
+
+    std::ostringstream oss;
+    if (unit == 0)
+    {
+        oss << bytes << units[unit];
+    }
+    else
+    {
+        oss << std::fixed << std::setprecision(1) << value << units[unit];
+    }
+    return oss.str();
+}
@@ -0,0 +1,309 @@
+#include <fstream>
+#include <stdexcept>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+#include <epik/metrics.h>
+
+using namespace epik::metrics;
+
+const char* epik::metrics::to_string(stage s)
+{
+    switch (s)
+    {
+        case stage::load:
+            return "load";
+        case stage::parse:
+            return "parse";
+        case stage::dedup:
+            return "dedup";
+        case stage::place:
+            return "place";
+        case stage::encode:
+            return "encode";
+        case stage::lookup:
+            return "lookup";
+        case stage::accumulate:
+            return "accumulate";
+        case stage::select:
+            return "select";
+        case stage::lwr:
+            return "lwr";
+        case stage::write:
+            return "write";
+        default:
+            return "unknown";
+    }
+}
+
+const char* epik::metrics::to_string(counter c)
+{
+    switch (c)
+    {
+        case counter::reads:
+            return "reads";
+        case counter::unique_reads:
+            return "unique_reads";
+        case counter::duplicates_collapsed:
+            return "duplicates_collapsed";
+        case counter::kmers_queried:
+            return "kmers_queried";
+        case counter::kmers_hit:
+            return "kmers_hit";
+        case counter::keys_searched:
+            return "keys_searched";
+        case counter::postings_applied:
+            return "postings_applied";
+        case counter::edges_touched:
+            return "edges_touched";
+        case counter::filter_rejected:
+            return "filter_rejected";
+        case counter::filter_false_positives:
+            return "filter_false_positives";
+        case counter::dense_promotions:
+            return "dense_promotions";
+        case counter::dense_releases:
+            return "dense_releases";
+        case counter::dense_rows_applied:
+            return "dense_rows_applied";
+        case counter::clades_pruned:
+            return "clades_pruned";
+        case counter::clade_expansions:
+            return "clade_expansions";
+        case counter::kmers_skipped:
+            return "kmers_skipped";
+        case counter::fixed_candidates:
+            return "fixed_candidates";
+        case counter::bytes_written:
+            return "bytes_written";
+        default:
+            return "unknown";
+    }
+}
+
+registry& registry::instance()
+{
+    static registry metrics_registry;
+    return metrics_registry;
+}
+
+thread_metrics& registry::local()
+{
+    thread_local thread_metrics* metrics = nullptr;
+    if (!metrics)
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        metrics = &_threads.emplace_back();
+    }
+    return *metrics;
+}
+
+namespace
+{
+    using json_writer = rapidjson::PrettyWriter<rapidjson::StringBuffer>;
+
+    void write_metrics(json_writer& writer, const thread_metrics& metrics)
+    {
+        writer.StartObject();
+        writer.Key("counters");
+        writer.StartObject();
+        for (size_t i = 0; i < num_counters; ++i)
+        {
+            writer.Key(to_string(static_cast<counter>(i)));
+            writer.Uint64(metrics.counters[i]);
+        }
+        writer.EndObject();
+
+        writer.Key("stages");
+        writer.StartObject();
+        for (size_t i = 0; i < num_stages; ++i)
+        {
+            writer.Key(to_string(static_cast<stage>(i)));
+            writer.StartObject();
+            writer.Key("seconds");
+            writer.Double((double)metrics.nanoseconds[i] / 1e9);
+            writer.Key("calls");
+            writer.Uint64(metrics.calls[i]);
+            writer.EndObject();
+        }
+        writer.EndObject();
+        writer.EndObject();
+    }
+
+    /// \brief Writes the events of the stages that were counted. Events are scaled to the time
+    /// the counters were enabled, if they were multiplexed with other events
+    void write_events(json_writer& writer, const thread_metrics& metrics)
+    {
+        writer.StartObject();
+        for (size_t i = 0; i < num_stages; ++i)
+        {
+            const auto& events = metrics.events[i];
+            if (metrics.calls[i] == 0)
+            {
+                continue;
+            }
+
+            writer.Key(to_string(static_cast<stage>(i)));
+            writer.StartObject();
+            writer.Key("seconds");
+            writer.Double((double)metrics.nanoseconds[i] / 1e9);
+            writer.Key("calls");
+            writer.Uint64(metrics.calls[i]);
+            if (events.running == 0)
+            {
+                writer.EndObject();
+                continue;
+            }
+
+            const auto scale = (double)events.enabled / (double)events.running;
+            std::array<double, num_hw_events> scaled{};
+            for (size_t event = 0; event < num_hw_events; ++event)
+            {
+                scaled[event] = (double)events.values[event] * scale;
+            }
+            const auto cycles = scaled[static_cast<size_t>(hw_event::cycles)];
+            const auto instructions = scaled[static_cast<size_t>(hw_event::instructions)];
+
+            /// The proportion of the time the counters were counting
+            writer.Key("counted");
+            writer.Double(1.0 / scale);
+            for (size_t event = 0; event < num_hw_events; ++event)
+            {
+                if (hw_event_error(static_cast<hw_event>(event)).empty())
+                {
+                    writer.Key(to_string(static_cast<hw_event>(event)));
+                    writer.Double(scaled[event]);
+                }
+            }
+
+            /// Instructions per cycle, and misses per thousand instructions
+            if (cycles > 0 && instructions > 0)
+            {
+                writer.Key("ipc");
+                writer.Double(instructions / cycles);
+            }
+            if (instructions > 0)
+            {
+                for (const auto event : { hw_event::llc_misses, hw_event::dtlb_misses })
+                {
+                    if (hw_event_error(event).empty())
+                    {
+                        writer.Key((std::string(to_string(event)) + "_per_kilo_instruction").c_str());
+                        writer.Double(1000.0 * scaled[static_cast<size_t>(event)] / instructions);
+                    }
+                }
+            }
+            writer.EndObject();
+        }
+        writer.EndObject();
+    }
+}
+
+uint64_t registry::total(counter c) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    uint64_t result = 0;
+    for (const auto& metrics : _threads)
+    {
+        result += metrics.counters[static_cast<size_t>(c)];
+    }
+    return result;
+}
+
+void registry::write_json(const std::string& filename) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    /// Stage times of different threads are summed up, so the total
+    /// of a parallel stage is CPU time, not wall-clock time
+    thread_metrics total;
+    for (const auto& metrics : _threads)
+    {
+        for (size_t i = 0; i < num_counters; ++i)
+        {
+            total.counters[i] += metrics.counters[i];
+        }
+        for (size_t i = 0; i < num_stages; ++i)
+        {
+            total.nanoseconds[i] += metrics.nanoseconds[i];
+            total.calls[i] += metrics.calls[i];
+        }
+    }
+
+    rapidjson::StringBuffer buffer;
+    json_writer writer(buffer);
+    writer.StartObject();
+    writer.Key("total");
+    write_metrics(writer, total);
+    writer.Key("threads");
+    writer.StartArray();
+    for (const auto& metrics : _threads)
+    {
+        write_metrics(writer, metrics);
+    }
+    writer.EndArray();
+    writer.EndObject();
+
+    std::ofstream out(filename);
+    if (!out)
+    {
+        throw std::runtime_error("Could not create file " + filename);
+    }
+    out << buffer.GetString() << std::endl;
+}
+
+void registry::write_hw_json(const std::string& filename) const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+
+    thread_metrics total;
+    for (const auto& metrics : _threads)
+    {
+        for (size_t i = 0; i < num_stages; ++i)
+        {
+            total.nanoseconds[i] += metrics.nanoseconds[i];
+            total.calls[i] += metrics.calls[i];
+            accumulate(total.events[i], hw_sample{}, metrics.events[i]);
+        }
+    }
+
+    rapidjson::StringBuffer buffer;
+    json_writer writer(buffer);
+    writer.StartObject();
+
+    /// The events that could not be counted, and why
+    bool available = false;
+    writer.Key("unavailable");
+    writer.StartObject();
+    for (size_t event = 0; event < num_hw_events; ++event)
+    {
+        const auto error = hw_event_error(static_cast<hw_event>(event));
+        if (!error.empty())
+        {
+            writer.Key(to_string(static_cast<hw_event>(event)));
+            writer.String(error.c_str());
+        }
+        available = available || error.empty();
+    }
+    writer.EndObject();
+    writer.Key("available");
+    writer.Bool(available);
+
+    writer.Key("total");
+    write_events(writer, total);
+    writer.Key("threads");
+    writer.StartArray();
+    for (const auto& metrics : _threads)
+    {
+        write_events(writer, metrics);
+    }
+    writer.EndArray();
+    writer.EndObject();
+
+    std::ofstream out(filename);
+    if (!out)
+    {
+        throw std::runtime_error("Could not create file " + filename);
+    }
+    out << buffer.GetString() << std::endl;
+}
@@ -0,0 +1,62 @@
+#include <stdexcept>
+#include <epik/ordinal.h>
+
+using namespace epik::impl;
+
+namespace
+{
+    /// A power of two of at least twice the keys
+    size_t num_slots_for(size_t num_keys) noexcept
+    {
+        size_t num_slots = 16;
+        while (num_slots < 2 * num_keys)
+        {
+            num_slots *= 2;
+        }
+        return num_slots;
+    }
+}
+
+ordinal_index::ordinal_index(const std::vector<key_type>& keys)
+    : _size{ keys.size() }
+{
+    if (keys.size() >= none)
+    {
+        throw std::runtime_error("Too many k-mers to index: " + std::to_string(keys.size()));
+    }
+
+    const auto num_slots = num_slots_for(keys.size());
+    _mask = num_slots - 1;
+    _keys.resize(num_slots, 0);
+    _ordinals.resize(num_slots, none);
+
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        auto slot = static_cast<size_t>(mix_hash(keys[i])) & _mask;
+        while (_ordinals[slot] != none)
+        {
+            if (_keys[slot] == keys[i])
+            {
+                throw std::runtime_error("The key is indexed twice: " + std::to_string(keys[i]));
+            }
+            slot = (slot + 1) & _mask;
+        }
+        _keys[slot] = keys[i];
+        _ordinals[slot] = static_cast<uint32_t>(i);
+    }
+}
+
+size_t ordinal_index::size() const noexcept
+{
+    return _size;
+}
+
+size_t ordinal_index::memory_bytes() const noexcept
+{
+    return _keys.size() * sizeof(key_type) + _ordinals.size() * sizeof(uint32_t);
+}
+
+size_t ordinal_index::memory_bytes(size_t num_keys) noexcept
+{
+    return num_slots_for(num_keys) * (sizeof(key_type) + sizeof(uint32_t));
+}
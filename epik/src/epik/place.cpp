@@ -1,8 +1,14 @@
 #include <vector>
+#include <algorithm>
+#include <functional>
 #include <unordered_map>
 #include <unordered_set>
 #include <cmath>
+#include <cctype>
 #include <iostream>
+#include <iterator>
+#include <limits>
+#include <tuple>
 #include <i2l/seq.h>
 #include <i2l/phylo_kmer_db.h>
 #include <i2l/phylo_tree.h>
@@ -10,6 +16,7 @@
 #include <i2l/seq_record.h>
 #include <i2l/fasta.h>
 #include <epik/place.h>
+#include <epik/metrics.h>
 
 #include <chrono>
 
@@ -17,13 +24,6 @@
 #include <omp.h>
 #endif
 
-#if defined(EPIK_SSE) or \
-    defined(EPIK_AVX) or \
-    defined(EPIK_AVX2) or \
-    defined(EPIK_AVX512)
-#include <epik/intrinsic.h>
-#endif
-
 
 using namespace epik::impl;
 using namespace epik;
@@ -49,7 +49,7 @@ namespace epik::impl
 
 
 /// \brief Copies the keys of an input map to a vector
-std::vector<std::string_view> copy_keys(const sequence_map_t& map)
+std::vector<std::string_view> epik::impl::copy_keys(const sequence_map_t& map)
 {
     std::vector<std::string_view> values;
     values.reserve(map.size());
@@ -62,6 +62,17 @@ std::vector<std::string_view> copy_keys(const sequence_map_t& map)
     return values;
 }
 
+/// \brief The number of k-mers of a sequence, or of both mates of a paired read
+size_t epik::impl::count_kmers(std::string_view seq, size_t kmer_size) noexcept
+{
+    const auto separator = seq.find(mate_separator);
+    if (separator != std::string_view::npos)
+    {
+        return count_kmers(seq.substr(0, separator), kmer_size) + count_kmers(seq.substr(separator + 1), kmer_size);
+    }
+    return seq.size() >= kmer_size ? seq.size() - kmer_size + 1 : 0;
+}
+
 /// \brief Groups fasta sequences by their sequence content.
 /// \details Returns a map
 ///     {
@@ -70,12 +81,14 @@ std::vector<std::string_view> copy_keys(const sequence_map_t& map)
 ///       ...
 ///     }
 /// to store identical reads together
-sequence_map_t group_by_sequence_content(const std::vector<seq_record>& seq_records)
+sequence_map_t epik::impl::group_by_sequence_content(const std::vector<seq_view>& seqs)
 {
+    EPIK_TIME_SCOPE(dedup);
+
     sequence_map_t sequence_map;
-    for (const auto& seq_record : seq_records)
+    for (const auto& seq : seqs)
     {
-        sequence_map[seq_record.sequence()].push_back(seq_record.header());
+        sequence_map[seq.sequence].push_back(seq.header);
     }
     return sequence_map;
 }
@@ -89,11 +102,10 @@ placer::placer(const i2l::phylo_kmer_db& db, const i2l::phylo_tree& original_tre
     , _keep_at_most{ keep_at_most }
     , _keep_factor{ keep_factor }
     , _max_threads{ std::max(num_threads, 1ul) }
-    , _scores(_max_threads, score_vector(original_tree.get_node_count()))
-    , _scores_amb(_max_threads, score_vector(original_tree.get_node_count()))
-    , _counts(_max_threads, count_vector(original_tree.get_node_count()))
-    , _counts_amb(_max_threads, count_vector(original_tree.get_node_count()))
-    , _edges(_max_threads)
+    , _accumulators(_max_threads, score_accumulator(original_tree.get_node_count()))
+    , _num_candidates{ 0 }
+    , _num_skipped_postings{ 0 }
+    , _encoder{ kmer_encoder::make(db.kmer_size()) }
 {
     /// precompute pendant lengths
     for (i2l::phylo_kmer::branch_type i = 0; i < original_tree.get_node_count(); ++i)
@@ -133,6 +145,8 @@ bool compare_placed_branches(const placement& lhs, const placement& rhs)
 /// \brief Selects keep_at_most most placed branches among these that have count > 0
 std::vector<placement> placer::select_best_placements(std::vector<placement> placements, size_t num_kmers)
 {
+    EPIK_TIME_SCOPE(select);
+
     /// Partially select best keep_at_most placements
     size_t return_size = std::min(_keep_at_most, placements.size());
 
@@ -163,9 +177,11 @@ std::vector<placement> placer::select_best_placements(std::vector<placement> pla
 /// We use a longer float type, not phylo_kmer::score_type here, because 10 ** score can be a small number.
 placement::weight_ratio_type placer::sum_scores(const std::vector<placement>& placements, std::string_view seq)
 {
+    EPIK_TIME_SCOPE(lwr);
+
     const auto num_branches = static_cast<i2l::phylo_kmer::score_type>(_original_tree.get_node_count());
     const auto num_placements = static_cast<i2l::phylo_kmer::score_type>(placements.size());
-    const auto num_kmers = static_cast<i2l::phylo_kmer::score_type>(seq.size() - _db.kmer_size() + 1);
+    const auto num_kmers = static_cast<i2l::phylo_kmer::score_type>(count_kmers(seq, _db.kmer_size()));
     const auto kmer_size = static_cast<i2l::phylo_kmer::score_type>(_db.kmer_size());
 
     /// There are n branches where we placed the sequence, and N-n where we did not.
@@ -198,19 +214,69 @@ std::vector<placement> filter_by_ratio(const std::vector<placement>& placements,
     return result;
 }
 
+void placer::compute_weight_ratios(std::vector<placement>& placements, placement::weight_ratio_type score_sum) const
+{
+    EPIK_TIME_SCOPE(lwr);
+
+    auto keep_factor = _keep_factor;
+    for (auto& placement : placements)
+    {
+        /// If the scores are that small that taking 10 to these powers is still zero
+        /// according to boost::multiprecision::pow, then score_sum is zero.
+        /// Assign all weight_ration to zeros and keep_factor to zero as well to
+        /// not filter them out.
+        if (score_sum == 0)
+        {
+            placement.weight_ratio = 0.0f;
+            keep_factor = 0.0f;
+        }
+        else
+        {
+            const auto power = epik::impl::pow(10.0f, placement::weight_ratio_type(placement.score));
+            if (power == 0.0)
+            {
+                placement.weight_ratio = 0.0;
+            }
+            else
+            {
+                placement.weight_ratio = power / score_sum;
+            }
+        }
+    }
+
+    /// Remove placements with low weight ratio
+    placements = filter_by_ratio(placements, keep_factor);
+}
+
 placed_collection placer::place(const std::vector<seq_record>& seq_records, size_t num_threads)
+{
+    std::vector<seq_view> seqs;
+    seqs.reserve(seq_records.size());
+    for (const auto& seq_record : seq_records)
+    {
+        seqs.push_back({ seq_record.header(), seq_record.sequence() });
+    }
+    return place(seqs, num_threads);
+}
+
+placed_collection placer::place(const std::vector<seq_view>& seqs, size_t num_threads)
 {
     (void)num_threads;
+    EPIK_TIME_SCOPE(place);
 
     /// There may be identical sequences with different headers. We group them
     /// by the sequence content to not to place the same sequences more than once
-    const auto sequence_map = group_by_sequence_content(seq_records);
+    const auto sequence_map = group_by_sequence_content(seqs);
 
     /// To support OpenMP, we need to iterate over unique sequences in the old-style fashion.
     /// To do this, we copy all the unique keys from a map to a vector.
     /// Keys are std::string_view's, so copying is cheap enough
     const auto unique_sequences = copy_keys(sequence_map);
 
+    EPIK_COUNT(reads, seqs.size());
+    EPIK_COUNT(unique_reads, unique_sequences.size());
+    EPIK_COUNT(duplicates_collapsed, seqs.size() - unique_sequences.size());
+
     /// Place only unique sequences
     std::vector<placed_sequence> placed_seqs(unique_sequences.size());
 
@@ -229,212 +295,1379 @@ placed_collection placer::place(const std::vector<seq_record>& seq_records, size
 #endif
     for (size_t i = 0; i < unique_sequences.size(); ++i)
     {
-        auto keep_factor = _keep_factor;
-        const auto sequence = unique_sequences[i];
-
-        placed_seqs[i] = place_seq(sequence);
-
-        /// compute weight ratio
-        const auto score_sum = sum_scores(placed_seqs[i].placements, sequence);
-        const auto num_kmers = sequence.size() - _db.kmer_size() + 1;
-        placed_seqs[i].placements = select_best_placements(std::move(placed_seqs[i].placements), num_kmers);
-        for (auto& placement : placed_seqs[i].placements)
-        {
-            /// If the scores are that small that taking 10 to these powers is still zero
-            /// according to boost::multiprecision::pow, then score_sum is zero.
-            /// Assign all weight_ration to zeros and keep_factor to zero as well to
-            /// not filter them out.
-            if (score_sum == 0)
-            {
-                placement.weight_ratio = 0.0f;
-                keep_factor = 0.0f;
-            }
-            else
-            {
-                const auto power = epik::impl::pow(10.0f, placement::weight_ratio_type(placement.score));
-                if (power == 0.0)
-                {
-                    placement.weight_ratio = 0.0;
-                }
-                else
-                {
-                    placement.weight_ratio = power / score_sum;
-                }
-            }
-        }
-
-        /// Remove placements with low weight ratio
-        placed_seqs[i].placements = filter_by_ratio(placed_seqs[i].placements, keep_factor);
+        placed_seqs[i] = place_seq(unique_sequences[i]);
+        _select_and_weight(placed_seqs[i]);
     }
     //const auto end_omp = std::chrono::steady_clock::now();
     //const float seconds = (float)std::chrono::duration_cast<std::chrono::milliseconds>(
     //    end_omp - begin_omp).count() / 1000.0f;
-    //float speed = seq_records.size() / seconds / num_threads;
+    //float speed = seqs.size() / seconds / num_threads;
     //std::cout << "Query/sec (per thread): " << speed << std::endl << std::endl;
     return { sequence_map, std::move(placed_seqs) };
 }
 
 
-auto query_kmers(std::string_view seq, const i2l::phylo_kmer_db& db)
+placed_sequence placer::place_encoded(std::string_view seq, const encoded_sequence& kmers)
+{
+    auto placed_seq = place_seq(seq, kmers);
+    _select_and_weight(placed_seq);
+    return placed_seq;
+}
+
+void placer::_select_and_weight(placed_sequence& placed_seq)
+{
+    /// compute weight ratio. The fixed-point path sums the scores of all branches before it selects them
+    const auto score_sum = placed_seq.score_sum ? *placed_seq.score_sum
+                                                : sum_scores(placed_seq.placements, placed_seq.sequence)
+                                                  + placed_seq.pruned_weight;
+    const auto num_kmers = count_kmers(placed_seq.sequence, _db.kmer_size());
+    placed_seq.placements = select_best_placements(std::move(placed_seq.placements), num_kmers);
+    compute_weight_ratios(placed_seq.placements, score_sum);
+}
+
+placed_sequence placer::place_searched(std::string_view seq, const kmer_results& search_results)
+{
+    auto placed_seq = _place_seq(seq, search_results, _current_thread());
+    _select_and_weight(placed_seq);
+    return placed_seq;
+}
+
+void placer::build_filter(size_t bits_per_key)
+{
+    _filter = std::make_unique<key_filter>(_db, bits_per_key);
+}
+
+const key_filter* placer::filter() const noexcept
+{
+    return _filter.get();
+}
+
+void placer::build_dense_tier(double min_fraction, size_t max_bytes)
+{
+    _dense_tier = std::make_unique<impl::dense_tier>(_db, _original_tree.get_node_count(), min_fraction, max_bytes);
+}
+
+const dense_tier* placer::dense_tier() const noexcept
 {
-    using search_result = std::vector<decltype(db.search(0))>;
+    return _dense_tier.get();
+}
 
-    /// Results of DB search for exact k-mers and
-    /// pairs (k-mer, results of search) for ambiguous k-mers
-    struct kmer_results
+void placer::build_fixed_point()
+{
+    const auto num_branches = _original_tree.get_node_count();
+    _fixed = std::make_unique<fixed_postings>(_db, num_branches, _log_threshold);
+    /// Constructed in place: a copy would not keep the branches reserved
+    _fixed_accumulators.clear();
+    _fixed_accumulators.reserve(_max_threads);
+    for (size_t thread = 0; thread < _max_threads; ++thread)
     {
-        search_result exact;
-        std::vector<search_result> ambiguous;
-    };
-    kmer_results result;
+        _fixed_accumulators.emplace_back(num_branches);
+    }
+}
 
-    result.exact.reserve(seq.size() - db.kmer_size() + 1);
+const fixed_postings* placer::fixed_point() const noexcept
+{
+    return _fixed.get();
+}
 
-    /// Query every k-mer that has no more than one ambiguous character
-    for (const auto& [kmer, keys] : i2l::to_kmers<i2l::one_ambiguity_policy>(seq, db.kmer_size()))
+void placer::build_clades(size_t max_size, size_t num_candidates)
+{
+    _clades = std::make_unique<clade_index>(_db, _original_tree.get_node_count(), max_size, _log_threshold);
+    _num_candidates = std::max(num_candidates, size_t{1});
+
+    clade_scratch scratch;
+    scratch.bounds.resize(_clades->num_clades(), 0.0f);
+    scratch.states.resize(_clades->num_clades(), 0);
+    _clade_scratch.assign(_max_threads, scratch);
+
+    /// Allocated once, to the most a query can take (see scratch_bytes)
+    for (auto& thread_scratch : _clade_scratch)
     {
-        (void) kmer;
-        if (keys.size() == 1)
+        thread_scratch.scored.reserve(_clades->num_clades());
+        thread_scratch.branch_scores.reserve(_original_tree.get_node_count());
+    }
+}
+
+const clade_index* placer::clades() const noexcept
+{
+    return _clades.get();
+}
+
+void placer::set_skipping(size_t max_postings, double min_ratio)
+{
+    _num_skipped_postings = 0;
+
+    /// Scores are log10: the spread is the best score minus the worst one, compared to log10(min_ratio)
+    const auto min_spread = min_ratio > 0.0
+        ? static_cast<i2l::phylo_kmer::score_type>(std::log10(min_ratio))
+        : -std::numeric_limits<i2l::phylo_kmer::score_type>::infinity();
+    const auto num_branches = _original_tree.get_node_count();
+    std::vector<i2l::phylo_kmer::key_type> skipped;
+    for (const auto& [key, entries] : _db)
+    {
+        if (entries.size() == 0)
         {
-            const auto key = keys[0];
-            auto key_result = db.search(key);
-            if (key_result)
-            {
-                result.exact.push_back(key_result);
-            }
+            continue;
         }
-        else
+
+        auto best_score = -std::numeric_limits<i2l::phylo_kmer::score_type>::infinity();
+        auto worst_score = std::numeric_limits<i2l::phylo_kmer::score_type>::infinity();
+        for (const auto& [branch, score] : entries)
         {
-            for (const auto& key : keys)
-            {
-                result.ambiguous.emplace_back();
-                result.ambiguous.back().push_back(db.search(key));
-            }
+            (void)branch;
+            best_score = std::max(best_score, score);
+            worst_score = std::min(worst_score, score);
+        }
+
+        /// The branches not in the list have the threshold score
+        if ((size_t)entries.size() < num_branches)
+        {
+            worst_score = std::min(worst_score, _log_threshold);
+        }
+
+        const auto too_long = max_postings > 0 && (size_t)entries.size() > max_postings;
+        if (too_long || best_score - worst_score < min_spread)
+        {
+            skipped.push_back(key);
+            _num_skipped_postings += entries.size();
         }
     }
-    return result;
+    _skipped = ordinal_index(skipped);
 }
 
+size_t placer::num_skipped_kmers() const noexcept
+{
+    return _skipped.size();
+}
 
-/// \brief Places a fasta sequence
-placed_sequence placer::place_seq(std::string_view seq)
+size_t placer::num_skipped_postings() const noexcept
 {
-    const auto num_of_kmers = seq.size() - _db.kmer_size() + 1;
+    return _num_skipped_postings;
+}
 
-#if defined(EPIK_OMP)
-    const auto thread_id = omp_get_thread_num();
-#else
-    const size_t thread_id = 0;
-#endif
-    auto& thread_counts = _counts[thread_id];
-    auto& thread_scores = _scores[thread_id];
-    auto& thread_counts_amb = _counts_amb[thread_id];
-    auto& thread_scores_amb = _scores_amb[thread_id];
-    auto& thread_edges = _edges[thread_id];
+size_t placer::thread_scratch_bytes() const noexcept
+{
+    const auto num_branches = _original_tree.get_node_count();
+    size_t bytes = score_accumulator::max_bytes(num_branches);
+    if (_clades)
+    {
+        /// The bounds and states of the clades, the branches scored and their scores
+        const auto num_clades = _clades->num_clades();
+        bytes += num_clades * (sizeof(i2l::phylo_kmer::score_type) + sizeof(uint8_t) + sizeof(uint32_t)) +
+                 num_branches * sizeof(i2l::phylo_kmer::score_type);
+    }
+    if (_fixed)
+    {
+        /// Queries that can not be summed up in fixed point are placed with the score accumulator.
+        /// The others rank the branches scored in a copy of them, with the float scores of the candidates
+        bytes += fixed_accumulator::memory_bytes(num_branches) +
+                 num_branches * (sizeof(i2l::phylo_kmer::branch_type) + sizeof(i2l::phylo_kmer::score_type));
+    }
+    return bytes;
+}
+
+void placer::set_max_threads(size_t num_threads)
+{
+    _max_threads = std::clamp(num_threads, size_t{1}, _max_threads);
+    if (_accumulators.size() > _max_threads)
+    {
+        _accumulators.erase(_accumulators.begin() + (long)_max_threads, _accumulators.end());
+    }
+    if (_fixed_accumulators.size() > _max_threads)
+    {
+        _fixed_accumulators.erase(_fixed_accumulators.begin() + (long)_max_threads, _fixed_accumulators.end());
+    }
+    if (_clade_scratch.size() > _max_threads)
+    {
+        _clade_scratch.erase(_clade_scratch.begin() + (long)_max_threads, _clade_scratch.end());
+    }
+}
+
+size_t placer::kmer_size() const noexcept
+{
+    return _db.kmer_size();
+}
+
+const i2l::phylo_kmer_db& placer::db() const noexcept
+{
+    return _db;
+}
+
+size_t placer::max_threads() const noexcept
+{
+    return _max_threads;
+}
 
-    for (const auto& edge : thread_edges)
+epik::engine epik::parse_engine(const std::string& name)
+{
+    if (name == "per-read")
+    {
+        return engine::per_read;
+    }
+    else if (name == "join")
     {
-        thread_counts[edge] = 0;
-        thread_scores[edge] = 0.0f;
-        thread_counts_amb[edge] = 0;
-        thread_scores_amb[edge] = 0.0f;
+        return engine::join;
     }
-    thread_edges.clear();
+    throw std::runtime_error("Unknown engine: " + name);
+}
 
-    /// Let's query every k-mer in advance. We'll apply the scores later
-    const auto search_results = query_kmers(seq, _db);
-    const auto exact_phylo_kmers = search_results.exact;
+epik::sampling_scheme epik::parse_sampling_scheme(const std::string& name)
+{
+    if (name == "none")
+    {
+        return sampling_scheme::none;
+    }
+    else if (name == "minimizer")
+    {
+        return sampling_scheme::minimizer;
+    }
+    else if (name == "syncmer")
+    {
+        return sampling_scheme::syncmer;
+    }
+    throw std::runtime_error("Unknown sampling scheme: " + name);
+}
 
-    /// Now let's update the score vectors according to retrieved values
-    for (auto exact_result : exact_phylo_kmers)
+namespace
+{
+    /// \brief Marks the minimizers of a list of keys: the smallest hash in every window
+    /// of window_size consecutive keys, the leftmost one in case of ties
+    std::vector<bool> find_minimizers(const std::vector<i2l::phylo_kmer::key_type>& keys, size_t window_size)
     {
-        if (exact_result)
+        std::vector<bool> selected(keys.size(), false);
+        if (keys.empty())
         {
+            return selected;
+        }
 
-#if defined(EPIK_SSE) or defined(EPIK_AVX) or defined(EPIK_AVX2) or defined(EPIK_AVX512)
-            update_vector(thread_scores, thread_counts, thread_edges, *exact_result);
-#else
+        std::vector<uint64_t> hashes(keys.size());
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            hashes[i] = mix_hash(keys[i]);
+        }
 
-            for (const auto& [postorder_node_id, score] : *exact_result)
+        /// A monotone queue of candidates: their hashes increase from front to back
+        std::vector<size_t> queue;
+        size_t front = 0;
+        for (size_t i = 0; i < keys.size(); ++i)
+        {
+            while (queue.size() > front && hashes[queue.back()] > hashes[i])
             {
-                if (thread_counts[postorder_node_id] == 0)
-                {
-                    thread_edges.push_back(postorder_node_id);
-                }
+                queue.pop_back();
+            }
+            queue.push_back(i);
+            if (queue[front] + window_size <= i)
+            {
+                ++front;
+            }
 
-                ++thread_counts[postorder_node_id];
-                thread_scores[postorder_node_id] += score;
+            /// Every full window, and the only window of a short sequence
+            if (i + 1 >= window_size || i + 1 == keys.size())
+            {
+                selected[queue[front]] = true;
             }
-#endif
         }
+        return selected;
+    }
 
+    /// \brief Checks if a k-mer is an open syncmer: its s-mer of the smallest hash
+    /// is the first one, the leftmost one in case of ties
+    bool is_open_syncmer(std::string_view kmer, size_t smer_size)
+    {
+        const auto smer_hash = [kmer, smer_size](size_t position) {
+            uint64_t hash = 0;
+            for (size_t i = position; i < position + smer_size; ++i)
+            {
+                hash = hash * 131 + static_cast<unsigned char>(std::toupper(kmer[i]));
+            }
+            return mix_hash(hash);
+        };
+
+        const auto first = smer_hash(0);
+        for (size_t position = 1; position + smer_size <= kmer.size(); ++position)
+        {
+            if (smer_hash(position) < first)
+            {
+                return false;
+            }
+        }
+        return true;
     }
+}
 
-    const auto ambiguous_phylo_kmers = search_results.ambiguous;
-    /// Now let's update the score vectors according to retrieved values
-    for (const auto& ambiguous_result : ambiguous_phylo_kmers)
+encoded_sequence epik::impl::encode_kmers(std::string_view seq, size_t kmer_size, const sampling& sampling,
+                                          const kmer_encoder* encoder)
+{
+    /// The mates of a paired read are encoded one by one
+    const auto separator = seq.find(mate_separator);
+    if (separator != std::string_view::npos)
     {
-        /// hash set of branch ids that are scored by the ambiguous k-mer
-        std::unordered_set<i2l::phylo_kmer::branch_type> l_amb;
-        for (auto exact_result : ambiguous_result)
+        auto result = encode_kmers(seq.substr(0, separator), kmer_size, sampling, encoder);
+        auto second = encode_kmers(seq.substr(separator + 1), kmer_size, sampling, encoder);
+        result.exact.insert(result.exact.end(), second.exact.begin(), second.exact.end());
+        std::move(second.ambiguous.begin(), second.ambiguous.end(), std::back_inserter(result.ambiguous));
+        return result;
+    }
+
+    EPIK_TIME_SCOPE(encode);
+
+    encoded_sequence result;
+    result.exact.reserve(count_kmers(seq, kmer_size));
+
+    /// The number of k-mers per sampled one: the syncmers of s-mer size k - ratio + 1
+    /// or the minimizers of window 2 * ratio - 1
+    const auto ratio = std::max(size_t{1}, static_cast<size_t>(std::lround(1.0 / sampling.density)));
+    const auto smer_size = kmer_size - std::min(ratio, kmer_size) + 1;
+
+    const auto add_exact = [&result, &sampling, smer_size](std::string_view kmer, i2l::phylo_kmer::key_type key) {
+        if (sampling.scheme != sampling_scheme::syncmer || is_open_syncmer(kmer, smer_size))
         {
-            if (exact_result)
+            result.exact.push_back(key);
+        }
+    };
+    const auto add_ambiguous = [&result](const auto& keys) {
+        result.ambiguous.emplace_back(std::begin(keys), std::end(keys));
+    };
+
+    if (!encoder || !encoder->encode(seq, add_exact, add_ambiguous))
+    {
+        for (const auto& [kmer, keys] : i2l::to_kmers<i2l::one_ambiguity_policy>(seq, kmer_size))
+        {
+            if (keys.size() == 1)
             {
-                for (const auto& [postorder_node_id, score] : *exact_result)
-                {
-                    if (thread_counts_amb[postorder_node_id] == 0)
-                    {
-                        l_amb.insert(postorder_node_id);
-                    }
+                add_exact(kmer, keys[0]);
+            }
+            else
+            {
+                add_ambiguous(keys);
+            }
+        }
+    }
 
-                    thread_counts_amb[postorder_node_id] += 1;
-                    thread_scores_amb[postorder_node_id] += static_cast<i2l::phylo_kmer::score_type>(std::pow(10, score));
-                }
+    if (sampling.scheme == sampling_scheme::minimizer)
+    {
+        const auto selected = find_minimizers(result.exact, 2 * ratio - 1);
+        size_t num_selected = 0;
+        for (size_t i = 0; i < result.exact.size(); ++i)
+        {
+            if (selected[i])
+            {
+                result.exact[num_selected++] = result.exact[i];
+            }
+        }
+        result.exact.resize(num_selected);
+    }
+    result.sampled = sampling.scheme != sampling_scheme::none;
+    return result;
+}
 
-                /// Number of keys resolved from the k-mer
-                const size_t w_size = _db.kmer_size();
+namespace
+{
+    /// \brief Searches a key in the database unless the filter rejects it
+    class filtered_search
+    {
+    public:
+        filtered_search(const i2l::phylo_kmer_db& db, const key_filter* filter) noexcept
+            : _db{ db }, _filter{ filter }
+        {}
 
-                /// Calculate average scores
-                for (const auto postorder_node_id: l_amb)
-                {
-                    const auto average_prob = (thread_scores_amb[postorder_node_id] +
-                                               static_cast<float>(w_size - thread_counts_amb[postorder_node_id]) * _threshold)
-                                              / static_cast<float>(w_size);
+        filtered_search(const filtered_search&) = delete;
+        filtered_search& operator=(const filtered_search&) = delete;
 
-                    if (thread_counts[postorder_node_id] == 0)
-                    {
-                        thread_edges.push_back(postorder_node_id);
-                    }
+        /// \brief Reports the keys searched and rejected
+        ~filtered_search() noexcept
+        {
+            EPIK_COUNT(keys_searched, _num_searched);
+            EPIK_COUNT(filter_rejected, _num_rejected);
+            EPIK_COUNT(filter_false_positives, _num_false_positives);
+        }
 
-                    thread_counts[postorder_node_id] += 1;
-                    thread_scores[postorder_node_id] += average_prob;
-                }
+        search_result operator()(i2l::phylo_kmer::key_type key) noexcept
+        {
+            if (_filter && !_filter->may_contain(key))
+            {
+                ++_num_rejected;
+                return {};
+            }
+
+            ++_num_searched;
+            auto key_result = _db.search(key);
+            if (_filter && !key_result)
+            {
+                ++_num_false_positives;
             }
+            return key_result;
         }
 
+    private:
+        const i2l::phylo_kmer_db& _db;
+        const key_filter* _filter;
+        size_t _num_searched = 0;
+        size_t _num_rejected = 0;
+        size_t _num_false_positives = 0;
+    };
+}
+
+kmer_results epik::impl::query_kmers(const encoded_sequence& kmers, const i2l::phylo_kmer_db& db,
+                                     const key_filter* filter)
+{
+    EPIK_TIME_SCOPE(lookup);
+
+    kmer_results result;
+    result.exact.reserve(kmers.exact.size());
+    result.exact_keys.reserve(kmers.exact.size());
+    auto search = filtered_search(db, filter);
+
+    for (const auto key : kmers.exact)
+    {
+        auto key_result = search(key);
+        if (key_result)
+        {
+            result.exact.push_back(key_result);
+            result.exact_keys.push_back(key);
+        }
     }
 
-    /// Score correction
-    for (const auto& edge: thread_edges)
+    for (const auto& keys : kmers.ambiguous)
     {
-        thread_scores[edge] += static_cast<i2l::phylo_kmer::score_type>(num_of_kmers - thread_counts[edge]) * _log_threshold;
-        thread_scores[edge] /= static_cast<i2l::phylo_kmer::score_type>(_db.kmer_size());
+        for (const auto key : keys)
+        {
+            result.ambiguous.emplace_back();
+            result.ambiguous.back().push_back(search(key));
+        }
     }
 
-    std::vector<placement> placements;
-    placements.reserve(thread_edges.size());
+    if (kmers.sampled)
+    {
+        result.num_sampled = kmers.exact.size() + kmers.ambiguous.size();
+    }
+    return result;
+}
+
+std::vector<kmer_results> epik::impl::join_kmers(const std::vector<encoded_sequence>& kmers,
+                                                 const i2l::phylo_kmer_db& db, size_t num_threads,
+                                                 const key_filter* filter)
+{
+    (void)num_threads;
+    EPIK_TIME_SCOPE(lookup);
 
-    for (const auto& edge: thread_edges)
+    /// An exact k-mer of the batch: its key, the sequence and the position among exact keys of the sequence
+    struct kmer_occurrence
     {
-        const auto node = _original_tree.get_by_postorder_id((i2l::phylo_node::id_type)edge);
-        if (!node)
+        i2l::phylo_kmer::key_type key;
+        uint32_t seq;
+        uint32_t position;
+    };
+
+    size_t num_occurrences = 0;
+    for (const auto& seq_kmers : kmers)
+    {
+        num_occurrences += seq_kmers.exact.size();
+    }
+
+    std::vector<kmer_occurrence> occurrences;
+    occurrences.reserve(num_occurrences);
+    std::vector<std::vector<search_result>> found(kmers.size());
+    for (size_t i = 0; i < kmers.size(); ++i)
+    {
+        const auto& exact = kmers[i].exact;
+        for (size_t j = 0; j < exact.size(); ++j)
         {
-            throw std::runtime_error("Could not find node by post-order id: " + std::to_string(edge));
+            occurrences.push_back({ exact[j], static_cast<uint32_t>(i), static_cast<uint32_t>(j) });
         }
+        found[i].resize(exact.size());
+    }
+    std::sort(occurrences.begin(), occurrences.end(),
+              [](const kmer_occurrence& lhs, const kmer_occurrence& rhs) { return lhs.key < rhs.key; });
 
-        const auto distal_length = (*node)->get_branch_length() / 2;
-        placements.push_back({ edge, thread_scores[edge], 0.0,
-                               thread_counts[edge], distal_length, _pendant_lengths[edge] });
+    /// Occurrences of the same key are adjacent now
+    std::vector<size_t> runs;
+    for (size_t i = 0; i < occurrences.size(); ++i)
+    {
+        if (i == 0 || occurrences[i].key != occurrences[i - 1].key)
+        {
+            runs.push_back(i);
+        }
     }
+    runs.push_back(occurrences.size());
+    const auto num_runs = runs.size() - 1;
+
+    /// Every occurrence is written once, so threads never write to the same slot
+#ifdef EPIK_OMP
+    #if __clang__
+    #pragma omp parallel for schedule(dynamic, 1024) num_threads(num_threads) \
+        default(none) shared(db, filter, occurrences, runs, num_runs, found)
+    #elif defined (__GNUC__) && (__GNUC__ < 9)
+#pragma omp parallel for schedule(dynamic, 1024) num_threads(num_threads) default(none) \
+    shared(db, filter, occurrences, runs, found)
+    #else
+#pragma omp parallel for schedule(dynamic, 1024) num_threads(num_threads) \
+    default(none) shared(db, filter, occurrences, runs, num_runs, found)
+    #endif
+#endif
+    for (size_t r = 0; r < num_runs; ++r)
+    {
+        auto search = filtered_search(db, filter);
+        const auto key_result = search(occurrences[runs[r]].key);
+        if (key_result)
+        {
+            for (auto i = runs[r]; i < runs[r + 1]; ++i)
+            {
+                found[occurrences[i].seq][occurrences[i].position] = key_result;
+            }
+        }
+    }
+
+    /// Keep only the exact k-mers found, in the order of the sequence, and search
+    /// the rare ambiguous ones as query_kmers does
+    std::vector<kmer_results> results(kmers.size());
+#ifdef EPIK_OMP
+    #if __clang__
+    #pragma omp parallel for schedule(static) num_threads(num_threads) \
+        default(none) shared(db, filter, kmers, found, results)
+    #elif defined (__GNUC__) && (__GNUC__ < 9)
+#pragma omp parallel for schedule(static) num_threads(num_threads) default(none) \
+    shared(db, filter, kmers, found, results)
+    #else
+#pragma omp parallel for schedule(static) num_threads(num_threads) \
+    default(none) shared(db, filter, kmers, found, results)
+    #endif
+#endif
+    for (size_t i = 0; i < kmers.size(); ++i)
+    {
+        auto search = filtered_search(db, filter);
+        auto& result = results[i];
+        result.exact.reserve(found[i].size());
+        result.exact_keys.reserve(found[i].size());
+        for (size_t j = 0; j < found[i].size(); ++j)
+        {
+            if (found[i][j])
+            {
+                result.exact.push_back(found[i][j]);
+                result.exact_keys.push_back(kmers[i].exact[j]);
+            }
+        }
+
+        for (const auto& keys : kmers[i].ambiguous)
+        {
+            for (const auto key : keys)
+            {
+                result.ambiguous.emplace_back();
+                result.ambiguous.back().push_back(search(key));
+            }
+        }
+
+        if (kmers[i].sampled)
+        {
+            result.num_sampled = kmers[i].exact.size() + kmers[i].ambiguous.size();
+        }
+    }
+    return results;
+}
+
+kmer_results epik::impl::query_kmers(std::string_view seq, const i2l::phylo_kmer_db& db, const key_filter* filter)
+{
+    /// The mates of a paired read are queried one by one
+    const auto separator = seq.find(mate_separator);
+    if (separator != std::string_view::npos)
+    {
+        auto result = query_kmers(seq.substr(0, separator), db, filter);
+        auto second = query_kmers(seq.substr(separator + 1), db, filter);
+        result.exact.insert(result.exact.end(), second.exact.begin(), second.exact.end());
+        result.exact_keys.insert(result.exact_keys.end(), second.exact_keys.begin(), second.exact_keys.end());
+        std::move(second.ambiguous.begin(), second.ambiguous.end(), std::back_inserter(result.ambiguous));
+        return result;
+    }
+
+    EPIK_TIME_SCOPE(lookup);
+
+    kmer_results result;
+    auto search = filtered_search(db, filter);
+
+    result.exact.reserve(count_kmers(seq, db.kmer_size()));
+    result.exact_keys.reserve(count_kmers(seq, db.kmer_size()));
+
+    /// Query every k-mer that has no more than one ambiguous character
+    for (const auto& [kmer, keys] : i2l::to_kmers<i2l::one_ambiguity_policy>(seq, db.kmer_size()))
+    {
+        (void) kmer;
+        if (keys.size() == 1)
+        {
+            const auto key = keys[0];
+            auto key_result = search(key);
+            if (key_result)
+            {
+                result.exact.push_back(key_result);
+                result.exact_keys.push_back(key);
+            }
+        }
+        else
+        {
+            for (const auto& key : keys)
+            {
+                result.ambiguous.emplace_back();
+                result.ambiguous.back().push_back(search(key));
+            }
+        }
+    }
+    return result;
+}
+
+
+/// \brief Places a fasta sequence
+placed_sequence placer::place_seq(std::string_view seq)
+{
+    /// Let's query every k-mer in advance. We'll apply the scores later
+    if (_encoder)
+    {
+        return _place_seq(seq, query_kmers(encode_kmers(seq, _db.kmer_size(), {}, _encoder.get()), _db, _filter.get()),
+                          _current_thread());
+    }
+    return _place_seq(seq, query_kmers(seq, _db, _filter.get()), _current_thread());
+}
+
+placed_sequence placer::place_seq(std::string_view seq, const encoded_sequence& kmers)
+{
+    return _place_seq(seq, query_kmers(kmers, _db, _filter.get()), _current_thread());
+}
+
+placed_sequence placer::place_one(std::string_view seq, size_t thread_id)
+{
+    if (thread_id >= _max_threads)
+    {
+        throw std::runtime_error("Wrong placement thread: " + std::to_string(thread_id));
+    }
+
+    auto placed_seq = _encoder
+        ? _place_seq(seq, query_kmers(encode_kmers(seq, _db.kmer_size(), {}, _encoder.get()), _db, _filter.get()),
+                     thread_id)
+        : _place_seq(seq, query_kmers(seq, _db, _filter.get()), thread_id);
+    _select_and_weight(placed_seq);
+    return placed_seq;
+}
+
+size_t placer::_current_thread() noexcept
+{
+#if defined(EPIK_OMP)
+    return omp_get_thread_num();
+#else
+    return 0;
+#endif
+}
+
+size_t placer::_reset_thread_scores()
+{
+    const auto thread_id = _current_thread();
+    _reset_thread_scores(thread_id);
+    return thread_id;
+}
+
+void placer::_reset_thread_scores(size_t thread_id)
+{
+    _accumulators[thread_id].clear();
+}
+
+template<typename PostingList>
+void placer::_add_ambiguous_kmer(size_t thread_id, const PostingList& postings)
+{
+    auto& accumulator = _accumulators[thread_id];
+
+    /// hash set of branch ids that are scored by the ambiguous k-mer
+    std::unordered_set<i2l::phylo_kmer::branch_type> l_amb;
+    for (const auto& [postorder_node_id, score] : postings)
+    {
+        const auto probability = static_cast<i2l::phylo_kmer::score_type>(std::pow(10, score));
+        if (accumulator.add_ambiguous(postorder_node_id, probability))
+        {
+            l_amb.insert(postorder_node_id);
+        }
+    }
+
+    /// Number of keys resolved from the k-mer
+    const size_t w_size = _db.kmer_size();
+
+    /// Calculate average scores
+    for (const auto postorder_node_id: l_amb)
+    {
+        const auto [score_amb, count_amb] = accumulator.ambiguous(postorder_node_id);
+        const auto average_prob = (score_amb + static_cast<float>(w_size - count_amb) * _threshold)
+                                  / static_cast<float>(w_size);
+
+        accumulator.add(postorder_node_id, average_prob, 1);
+    }
+}
+
+placed_sequence placer::_place_seq(std::string_view seq, const kmer_results& search_results, size_t thread_id)
+{
+    /// No k-mer found (e.g. all rejected by the filter): nothing to score, the placements
+    /// are made by select_best_placements
+    const auto found = [](const auto& results) {
+        return std::any_of(results.begin(), results.end(), [](const auto& result) { return bool(result); });
+    };
+    const auto ambiguous_found = std::any_of(search_results.ambiguous.begin(), search_results.ambiguous.end(), found);
+    if (search_results.exact.empty() && !ambiguous_found)
+    {
+        EPIK_COUNT(kmers_queried, search_results.num_sampled > 0
+                                  ? search_results.num_sampled : count_kmers(seq, _db.kmer_size()));
+        return { seq, {} };
+    }
+
+    if (_fixed && !ambiguous_found && search_results.exact.size() <= _fixed->max_kmers())
+    {
+        return _place_fixed(seq, search_results, thread_id);
+    }
+
+    _reset_thread_scores(thread_id);
+    auto& accumulator = _accumulators[thread_id];
+
+    const auto& exact_phylo_kmers = search_results.exact;
+
+    EPIK_TIME_SCOPE(accumulate);
+    size_t num_postings = 0;
+    placement::weight_ratio_type pruned_weight = 0.0;
+
+    /// Now let's update the score vectors according to retrieved values.
+    /// With clades, only the branches of the candidate clades are scored
+    if (_clades && !ambiguous_found)
+    {
+        std::tie(num_postings, pruned_weight) = _add_by_clades(seq, thread_id, search_results);
+    }
+    else
+    {
+        /// The k-mers of the dense tier are added as rows of scores
+        for (size_t i = 0; i < exact_phylo_kmers.size(); ++i)
+        {
+            const auto& exact_result = exact_phylo_kmers[i];
+            if (exact_result && skips(search_results.exact_keys[i]))
+            {
+                EPIK_COUNT(kmers_skipped, 1);
+            }
+            else if (exact_result)
+            {
+                const auto row = _dense_tier ? _dense_tier->find(search_results.exact_keys[i], *exact_result)
+                                             : std::nullopt;
+                if (!row || !accumulator.add_row(*row))
+                {
+                    accumulator.add_postings(*exact_result);
+                }
+                num_postings += (*exact_result).size();
+            }
+
+        }
+        accumulator.apply_rows();
+    }
+
+    const auto& ambiguous_phylo_kmers = search_results.ambiguous;
+    /// Now let's update the score vectors according to retrieved values
+    for (const auto& ambiguous_result : ambiguous_phylo_kmers)
+    {
+        for (auto exact_result : ambiguous_result)
+        {
+            if (exact_result)
+            {
+                _add_ambiguous_kmer(thread_id, *exact_result);
+            }
+        }
+    }
+
+    EPIK_COUNT(kmers_queried, search_results.num_sampled > 0
+                              ? search_results.num_sampled : count_kmers(seq, _db.kmer_size()));
+    EPIK_COUNT(kmers_hit, exact_phylo_kmers.size());
+    EPIK_COUNT(postings_applied, num_postings);
+    EPIK_COUNT(edges_touched, accumulator.edges().size());
+
+    auto placed_seq = _correct_scores(seq, thread_id, search_results.num_sampled);
+    placed_seq.pruned_weight = pruned_weight;
+    return placed_seq;
+}
+
+std::pair<size_t, placement::weight_ratio_type> placer::_add_by_clades(std::string_view seq, size_t thread_id,
+                                                                       const kmer_results& search_results)
+{
+    auto& accumulator = _accumulators[thread_id];
+    auto& scratch = _clade_scratch[thread_id];
+    auto& bounds = scratch.bounds;
+    auto& states = scratch.states;
+    auto& scored = scratch.scored;
+
+    /// Coarse stage. Every k-mer adds its best score in a clade, or the threshold score if it
+    /// does not score the clade. The bounds are stored without the threshold score of all k-mers,
+    /// which is the same for all clades
+    const auto& exact_results = search_results.exact;
+    for (size_t i = 0; i < exact_results.size(); ++i)
+    {
+        const auto& exact_result = exact_results[i];
+        if (exact_result && skips(search_results.exact_keys[i]))
+        {
+            EPIK_COUNT(kmers_skipped, 1);
+        }
+        else if (exact_result)
+        {
+            const auto [first, last] = _clades->find(search_results.exact_keys[i]);
+            for (auto entry = first; entry != last; ++entry)
+            {
+                if (states[entry->clade] == 0)
+                {
+                    states[entry->clade] = 1;
+                    scored.push_back(entry->clade);
+                }
+                bounds[entry->clade] += entry->score - _log_threshold;
+            }
+        }
+    }
+
+    const auto num_candidates = std::min(_num_candidates, scored.size());
+    std::partial_sort(scored.begin(), scored.begin() + (long)num_candidates, scored.end(),
+                      [&bounds](auto lhs, auto rhs) { return bounds[lhs] > bounds[rhs]; });
+    for (size_t i = 0; i < num_candidates; ++i)
+    {
+        states[scored[i]] = 2;
+    }
+
+    /// Fine stage: the postings of the branches of clades in the given state
+    size_t num_postings = 0;
+    const auto add_postings = [&](uint8_t state) {
+        for (size_t i = 0; i < exact_results.size(); ++i)
+        {
+            const auto& exact_result = exact_results[i];
+            if (exact_result && !skips(search_results.exact_keys[i]))
+            {
+                for (const auto& [branch, score] : *exact_result)
+                {
+                    if (states[_clades->clade_of(branch)] == state)
+                    {
+                        accumulator.add(branch, score, 1);
+                        ++num_postings;
+                    }
+                }
+            }
+        }
+    };
+    add_postings(2);
+
+    /// The coarse stage is ambiguous if a pruned clade may have a branch better than the last placement
+    /// kept: such clades are scored as well. A branch can not score more than the bound of its clade,
+    /// so the placements kept do not change. The scores are compared without the threshold score
+    /// of all k-mers, like the bounds
+    auto& branch_scores = scratch.branch_scores;
+    branch_scores.clear();
+    accumulator.for_each([&](auto, auto score, auto count) {
+        branch_scores.push_back(score - static_cast<i2l::phylo_kmer::score_type>(count) * _log_threshold);
+    });
+
+    auto last_kept = 0.0f;
+    const auto num_kept = std::max(_keep_at_most, size_t{1});
+    if (branch_scores.size() >= num_kept)
+    {
+        std::nth_element(branch_scores.begin(), branch_scores.begin() + (long)(num_kept - 1), branch_scores.end(),
+                         std::greater<>());
+        last_kept = branch_scores[num_kept - 1];
+    }
+
+    size_t num_pruned = 0;
+    bool expanded = false;
+    for (size_t i = num_candidates; i < scored.size(); ++i)
+    {
+        if (bounds[scored[i]] > last_kept)
+        {
+            states[scored[i]] = 3;
+            expanded = true;
+        }
+        else
+        {
+            ++num_pruned;
+        }
+    }
+    if (expanded)
+    {
+        add_postings(3);
+        EPIK_COUNT(clade_expansions, 1);
+    }
+    EPIK_COUNT(clades_pruned, num_pruned);
+
+    /// The branches of the pruned clades are not scored and count at the threshold score in the LWR
+    /// (see sum_scores). They may score up to the bound of their clade, corrected as _correct_scores does:
+    /// this is the weight they may have in addition
+    const auto num_of_kmers = search_results.num_sampled > 0 ? search_results.num_sampled
+                                                             : count_kmers(seq, _db.kmer_size());
+    const auto sampling_scale = search_results.num_sampled > 0
+        ? static_cast<i2l::phylo_kmer::score_type>(count_kmers(seq, _db.kmer_size())) /
+          static_cast<i2l::phylo_kmer::score_type>(search_results.num_sampled)
+        : 1.0f;
+    const auto to_score = [&](i2l::phylo_kmer::score_type bound) {
+        return (bound + static_cast<i2l::phylo_kmer::score_type>(num_of_kmers) * _log_threshold) * sampling_scale
+               / static_cast<i2l::phylo_kmer::score_type>(_db.kmer_size());
+    };
+    const auto threshold_weight = epik::impl::pow(10.0, placement::weight_ratio_type(to_score(0.0f)));
+
+    placement::weight_ratio_type pruned_weight = 0.0;
+    for (const auto clade : scored)
+    {
+        if (states[clade] == 1)
+        {
+            const auto bound_weight = epik::impl::pow(10.0, placement::weight_ratio_type(to_score(bounds[clade])));
+            pruned_weight += _clades->clade_size(clade) * std::max(bound_weight - threshold_weight,
+                                                                   placement::weight_ratio_type(0.0));
+        }
+        bounds[clade] = 0.0f;
+        states[clade] = 0;
+    }
+    scored.clear();
+    return { num_postings, pruned_weight };
+}
+
+placed_sequence placer::_correct_scores(std::string_view seq, size_t thread_id, size_t num_sampled)
+{
+    /// Sampled k-mers are scored as if they were the whole sequence, then the score is scaled
+    /// to all its k-mers: the expected score of the full placement. The scale is the same
+    /// for all branches and does not change their order
+    const auto num_of_kmers = num_sampled > 0 ? num_sampled : count_kmers(seq, _db.kmer_size());
+    const auto sampling_scale = num_sampled > 0
+        ? static_cast<i2l::phylo_kmer::score_type>(count_kmers(seq, _db.kmer_size())) /
+          static_cast<i2l::phylo_kmer::score_type>(num_sampled)
+        : 1.0f;
+    const auto& accumulator = _accumulators[thread_id];
+
+    std::vector<placement> placements;
+    placements.reserve(accumulator.edges().size());
+
+    accumulator.for_each([&](auto edge, auto score, auto count) {
+        /// Score correction
+        score += static_cast<i2l::phylo_kmer::score_type>(num_of_kmers - count) * _log_threshold;
+        if (num_sampled > 0)
+        {
+            score *= sampling_scale;
+        }
+        score /= static_cast<i2l::phylo_kmer::score_type>(_db.kmer_size());
+        placements.push_back(_make_placement(edge, score, count));
+    });
     return { seq, std::move(placements) };
 }
+
+placement placer::_make_placement(i2l::phylo_kmer::branch_type edge, i2l::phylo_kmer::score_type score,
+                                  size_t count) const
+{
+    const auto node = _original_tree.get_by_postorder_id((i2l::phylo_node::id_type)edge);
+    if (!node)
+    {
+        throw std::runtime_error("Could not find node by post-order id: " + std::to_string(edge));
+    }
+
+    const auto distal_length = (*node)->get_branch_length() / 2;
+    return { edge, score, 0.0, count, distal_length, _pendant_lengths[edge] };
+}
+
+placed_sequence placer::_place_fixed(std::string_view seq, const kmer_results& search_results, size_t thread_id)
+{
+    auto& accumulator = _fixed_accumulators[thread_id];
+    accumulator.clear();
+
+    size_t num_postings = 0;
+    {
+        EPIK_TIME_SCOPE(accumulate);
+        for (size_t i = 0; i < search_results.exact.size(); ++i)
+        {
+            const auto& exact_result = search_results.exact[i];
+            if (exact_result && skips(search_results.exact_keys[i]))
+            {
+                EPIK_COUNT(kmers_skipped, 1);
+            }
+            else if (exact_result)
+            {
+                const auto list = _fixed->find(search_results.exact_keys[i]);
+                if (!list)
+                {
+                    throw std::runtime_error("A posting list has no fixed-point scores: "
+                                             "the database changed after build_fixed_point");
+                }
+                accumulator.add(*list);
+                num_postings += list->size;
+            }
+        }
+    }
+
+    const auto& edges = accumulator.edges();
+    EPIK_COUNT(kmers_queried, search_results.num_sampled > 0
+                              ? search_results.num_sampled : count_kmers(seq, _db.kmer_size()));
+    EPIK_COUNT(kmers_hit, search_results.exact.size());
+    EPIK_COUNT(postings_applied, num_postings);
+    EPIK_COUNT(edges_touched, edges.size());
+
+    /// The corrected score of a branch is (to_score(sum) + n * threshold) * sampling_scale / k,
+    /// the same increasing function of the integer sum for all branches (see impl::fixed_postings)
+    const auto num_of_kmers = search_results.num_sampled > 0 ? search_results.num_sampled
+                                                             : count_kmers(seq, _db.kmer_size());
+    const auto sampling_scale = search_results.num_sampled > 0
+        ? (double)count_kmers(seq, _db.kmer_size()) / (double)search_results.num_sampled
+        : 1.0;
+    const auto to_score = [&](fixed_accumulator::sum_type sum) {
+        return static_cast<i2l::phylo_kmer::score_type>(
+            ((double)_fixed->to_score(sum) + (double)num_of_kmers * (double)_log_threshold) * sampling_scale /
+            (double)_db.kmer_size());
+    };
+
+    /// A branch can only be among the best float placements if its sum is at most twice the error bound
+    /// below the num_kept-th largest sum (see impl::fixed_postings). These candidates are put first
+    std::vector<i2l::phylo_kmer::branch_type> ranked(edges.begin(), edges.end());
+    const auto num_kept = std::min(_keep_at_most, ranked.size());
+    size_t num_candidates = 0;
+    if (num_kept > 0)
+    {
+        EPIK_TIME_SCOPE(select);
+        std::nth_element(ranked.begin(), ranked.begin() + (long)(num_kept - 1), ranked.end(),
+                         [&accumulator](auto lhs, auto rhs) { return accumulator.sum(lhs) > accumulator.sum(rhs); });
+        const auto last_kept_sum = (uint64_t)accumulator.sum(ranked[num_kept - 1]);
+        const auto margin = 2 * (uint64_t)_fixed->error_bound(std::max(num_of_kmers, search_results.exact.size()));
+        const auto candidates_end = std::partition(ranked.begin(), ranked.end(), [&](auto branch) {
+            return (uint64_t)accumulator.sum(branch) + margin >= last_kept_sum;
+        });
+        num_candidates = (size_t)(candidates_end - ranked.begin());
+        EPIK_COUNT(fixed_candidates, num_candidates);
+    }
+
+    /// The candidates are scored again with the float scores of the database, added in the order
+    /// of the k-mers and corrected as _correct_scores does: their scores are those of the float path.
+    /// A posting finds the slot of its branch in one lookup
+    std::vector<i2l::phylo_kmer::score_type> candidate_scores(num_candidates, 0.0f);
+    if (num_candidates > 0)
+    {
+        EPIK_TIME_SCOPE(select);
+        for (size_t j = 0; j < num_candidates; ++j)
+        {
+            accumulator.mark(ranked[j], (uint32_t)j);
+        }
+        for (size_t i = 0; i < search_results.exact.size(); ++i)
+        {
+            const auto& exact_result = search_results.exact[i];
+            if (!exact_result || skips(search_results.exact_keys[i]))
+            {
+                continue;
+            }
+            for (const auto& [branch, score] : *exact_result)
+            {
+                const auto slot = accumulator.slot(branch);
+                if (slot != fixed_accumulator::no_slot)
+                {
+                    candidate_scores[slot] += score;
+                }
+            }
+        }
+
+        const auto float_scale = search_results.num_sampled > 0
+            ? static_cast<i2l::phylo_kmer::score_type>(count_kmers(seq, _db.kmer_size())) /
+              static_cast<i2l::phylo_kmer::score_type>(search_results.num_sampled)
+            : 1.0f;
+        for (size_t j = 0; j < num_candidates; ++j)
+        {
+            auto& score = candidate_scores[j];
+            score += static_cast<i2l::phylo_kmer::score_type>(num_of_kmers - accumulator.count(ranked[j])) * _log_threshold;
+            if (search_results.num_sampled > 0)
+            {
+                score *= float_scale;
+            }
+            score /= static_cast<i2l::phylo_kmer::score_type>(_db.kmer_size());
+        }
+
+        /// The best candidates by float score. Ties are broken by the branch id to not depend on the order of the k-mers
+        std::partial_sort(ranked.begin(), ranked.begin() + (long)num_kept, ranked.begin() + (long)num_candidates,
+                          [&](auto lhs, auto rhs) {
+                              const auto lhs_score = candidate_scores[accumulator.slot(lhs)];
+                              const auto rhs_score = candidate_scores[accumulator.slot(rhs)];
+                              return lhs_score > rhs_score || (lhs_score == rhs_score && lhs < rhs);
+                          });
+    }
+
+    /// The sum of 10^score is over all branches, like sum_scores: the branches not scored have
+    /// the threshold score of all k-mers, the candidates their float score. The other branches,
+    /// which weigh less, have their fixed-point score (see impl::fixed_postings for its error)
+    placement::weight_ratio_type score_sum = 0.0;
+    {
+        EPIK_TIME_SCOPE(lwr);
+        const auto num_kmers = static_cast<i2l::phylo_kmer::score_type>(count_kmers(seq, _db.kmer_size()));
+        const auto kmer_size = static_cast<i2l::phylo_kmer::score_type>(_db.kmer_size());
+        const auto num_not_placed = static_cast<placement::weight_ratio_type>(
+            _original_tree.get_node_count() - edges.size());
+        score_sum = num_not_placed * epik::impl::pow(10.0, (num_kmers * _log_threshold / kmer_size));
+        for (const auto score : candidate_scores)
+        {
+            score_sum += epik::impl::pow(10.0, placement::weight_ratio_type(score));
+        }
+        for (size_t j = num_candidates; j < ranked.size(); ++j)
+        {
+            score_sum += epik::impl::pow(10.0, placement::weight_ratio_type(to_score(accumulator.sum(ranked[j]))));
+        }
+    }
+
+    std::vector<placement> placements;
+    placements.reserve(num_kept);
+    for (size_t j = 0; j < num_kept; ++j)
+    {
+        const auto branch = ranked[j];
+        placements.push_back(_make_placement(branch, candidate_scores[accumulator.slot(branch)], accumulator.count(branch)));
+    }
+
+    placed_sequence placed_seq{ seq, std::move(placements) };
+    placed_seq.score_sum = score_sum;
+    return placed_seq;
+}
+
+partial_scores placer::place_partial(const encoded_sequence& kmers,
+                                     i2l::phylo_kmer::key_type first_key, i2l::phylo_kmer::key_type last_key)
+{
+    const auto thread_id = _reset_thread_scores();
+    auto& accumulator = _accumulators[thread_id];
+
+    const auto in_range = [first_key, last_key](i2l::phylo_kmer::key_type key) {
+        return first_key <= key && key <= last_key;
+    };
+
+    partial_scores result;
+    {
+        EPIK_TIME_SCOPE(lookup);
+        for (const auto key : kmers.exact)
+        {
+            if (in_range(key))
+            {
+                if (const auto search_result = _db.search(key))
+                {
+                    accumulator.add_postings(*search_result);
+                    EPIK_COUNT(postings_applied, (*search_result).size());
+                }
+            }
+        }
+
+        /// Every key of an ambiguous k-mer is scored separately, see query_kmers
+        uint32_t key_index = 0;
+        for (const auto& keys : kmers.ambiguous)
+        {
+            for (const auto key : keys)
+            {
+                if (in_range(key))
+                {
+                    if (const auto search_result = _db.search(key))
+                    {
+                        for (const auto& [branch, score] : *search_result)
+                        {
+                            result.ambiguous.push_back({ key_index, branch, score });
+                        }
+                    }
+                }
+                ++key_index;
+            }
+        }
+    }
+
+    _get_partial(thread_id, result);
+    return result;
+}
+
+partial_scores placer::merge_partials(const std::vector<const partial_scores*>& partials)
+{
+    const auto thread_id = _reset_thread_scores();
+
+    partial_scores result;
+    for (const auto* partial : partials)
+    {
+        _add_partial(thread_id, *partial);
+        result.ambiguous.insert(result.ambiguous.end(), partial->ambiguous.begin(), partial->ambiguous.end());
+    }
+    _get_partial(thread_id, result);
+    return result;
+}
+
+void placer::_add_partial(size_t thread_id, const partial_scores& partial)
+{
+    auto& accumulator = _accumulators[thread_id];
+    for (size_t i = 0; i < partial.branches.size(); ++i)
+    {
+        accumulator.add(partial.branches[i], partial.scores[i], partial.counts[i]);
+    }
+}
+
+void placer::_get_partial(size_t thread_id, partial_scores& partial) const
+{
+    const auto& accumulator = _accumulators[thread_id];
+    const auto num_edges = accumulator.edges().size();
+
+    partial.branches.clear();
+    partial.scores.clear();
+    partial.counts.clear();
+    partial.branches.reserve(num_edges);
+    partial.scores.reserve(num_edges);
+    partial.counts.reserve(num_edges);
+    accumulator.for_each([&partial](auto edge, auto score, auto count) {
+        partial.branches.push_back(edge);
+        partial.scores.push_back(score);
+        partial.counts.push_back(static_cast<uint32_t>(count));
+    });
+}
+
+placed_sequence placer::place_merged(std::string_view seq, const std::vector<const partial_scores*>& partials)
+{
+    const auto thread_id = _reset_thread_scores();
+
+    EPIK_TIME_SCOPE(accumulate);
+
+    /// Exact k-mers are additive: sum up the partial scores and counts of every shard
+    for (const auto* partial : partials)
+    {
+        _add_partial(thread_id, *partial);
+    }
+
+    /// Ambiguous k-mers are not: replay them in the order of the sequence. Every key
+    /// is stored in one shard only, so a stable sort keeps the order of its postings
+    std::vector<partial_scores::ambiguous_posting> ambiguous;
+    for (const auto* partial : partials)
+    {
+        ambiguous.insert(ambiguous.end(), partial->ambiguous.begin(), partial->ambiguous.end());
+    }
+    std::stable_sort(ambiguous.begin(), ambiguous.end(),
+                     [](const auto& lhs, const auto& rhs) { return lhs.key_index < rhs.key_index; });
+
+    std::vector<std::pair<i2l::phylo_kmer::branch_type, i2l::phylo_kmer::score_type>> postings;
+    for (size_t i = 0; i < ambiguous.size(); )
+    {
+        postings.clear();
+        const auto key_index = ambiguous[i].key_index;
+        for (; i < ambiguous.size() && ambiguous[i].key_index == key_index; ++i)
+        {
+            postings.emplace_back(ambiguous[i].branch, ambiguous[i].score);
+        }
+        _add_ambiguous_kmer(thread_id, postings);
+    }
+
+    EPIK_COUNT(kmers_queried, count_kmers(seq, _db.kmer_size()));
+    EPIK_COUNT(edges_touched, _accumulators[thread_id].edges().size());
+
+    auto placed_seq = _correct_scores(seq, thread_id);
+    _select_and_weight(placed_seq);
+    return placed_seq;
+}
+
+encoded_batch::encoded_batch(const std::vector<seq_view>& seqs, const std::vector<size_t>& kmer_sizes,
+                             size_t num_threads, const sampling& sampling)
+    : _num_reads{ seqs.size() }
+{
+    (void)num_threads;
+    EPIK_TIME_SCOPE(place);
+
+    _sequence_map = group_by_sequence_content(seqs);
+    _unique_sequences = copy_keys(_sequence_map);
+
+    EPIK_COUNT(reads, seqs.size());
+    EPIK_COUNT(unique_reads, _unique_sequences.size());
+    EPIK_COUNT(duplicates_collapsed, seqs.size() - _unique_sequences.size());
+
+    for (const auto k : kmer_sizes)
+    {
+        if (_kmers.find(k) != _kmers.end())
+        {
+            continue;
+        }
+
+        auto& encoded = _kmers[k];
+        encoded.resize(_unique_sequences.size());
+        const auto& unique_sequences = _unique_sequences;
+        const auto encoder_ptr = kmer_encoder::make(k);
+        const auto* encoder = encoder_ptr.get();
+
+#ifdef EPIK_OMP
+    #if __clang__
+    #pragma omp parallel for schedule(static) num_threads(num_threads) \
+        default(none) shared(unique_sequences, encoded, k, sampling, encoder)
+    #elif defined (__GNUC__) && (__GNUC__ < 9)
+#pragma omp parallel for schedule(static) num_threads(num_threads) default(none) \
+    shared(unique_sequences, encoded, sampling, encoder)
+    #else
+#pragma omp parallel for schedule(static) num_threads(num_threads) \
+    default(none) shared(unique_sequences, encoded, k, sampling, encoder)
+    #endif
+#endif
+        for (size_t i = 0; i < unique_sequences.size(); ++i)
+        {
+            encoded[i] = encode_kmers(unique_sequences[i], k, sampling, encoder);
+        }
+    }
+}
+
+size_t encoded_batch::num_reads() const noexcept
+{
+    return _num_reads;
+}
+
+const sequence_map_t& encoded_batch::sequence_map() const noexcept
+{
+    return _sequence_map;
+}
+
+const std::vector<std::string_view>& encoded_batch::unique_sequences() const noexcept
+{
+    return _unique_sequences;
+}
+
+const std::vector<encoded_sequence>& encoded_batch::kmers(size_t k) const
+{
+    const auto it = _kmers.find(k);
+    if (it == _kmers.end())
+    {
+        throw std::runtime_error("The batch was not encoded for k=" + std::to_string(k));
+    }
+    return it->second;
+}
+
+std::vector<placed_collection> epik::place(const std::vector<placer*>& placers,
+                                          const encoded_batch& batch, size_t num_threads,
+                                          engine search_engine)
+{
+    (void)num_threads;
+    EPIK_TIME_SCOPE(place);
+
+    const auto& unique_sequences = batch.unique_sequences();
+    const auto num_unique = unique_sequences.size();
+
+    std::vector<const std::vector<encoded_sequence>*> placer_kmers;
+    std::vector<placed_collection> results(placers.size());
+    for (size_t p = 0; p < placers.size(); ++p)
+    {
+        placer_kmers.push_back(&batch.kmers(placers[p]->kmer_size()));
+        results[p].sequence_map = batch.sequence_map();
+        results[p].placed_seqs.resize(num_unique);
+    }
+
+    /// The join engine searches the k-mers of the whole batch in advance
+    std::vector<std::vector<kmer_results>> placer_results(placers.size());
+    if (search_engine == engine::join)
+    {
+        for (size_t p = 0; p < placers.size(); ++p)
+        {
+            placer_results[p] = impl::join_kmers(*placer_kmers[p], placers[p]->db(), num_threads,
+                                                 placers[p]->filter());
+        }
+    }
+    const auto joined = search_engine == engine::join;
+
+    /// One flat loop over all pairs (database, sequence) to balance the load
+    /// between threads whatever the number of databases
+    const auto num_tasks = placers.size() * num_unique;
+#ifdef EPIK_OMP
+    #if __clang__
+    #pragma omp parallel for schedule(dynamic) num_threads(num_threads) default(none) \
+        shared(epik::impl::pow, placers, placer_kmers, placer_results, joined, unique_sequences, num_unique, num_tasks, results)
+    #elif defined (__GNUC__) && (__GNUC__ < 9)
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads) default(none) \
+    shared(epik::impl::pow, placers, placer_kmers, placer_results, unique_sequences, results)
+    #else
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads) default(none) \
+    shared(epik::impl::pow, placers, placer_kmers, placer_results, joined, unique_sequences, num_unique, num_tasks, results)
+    #endif
+#endif
+    for (size_t i = 0; i < num_tasks; ++i)
+    {
+        const auto p = i / num_unique;
+        const auto s = i % num_unique;
+        results[p].placed_seqs[s] = joined
+            ? placers[p]->place_searched(unique_sequences[s], placer_results[p][s])
+            : placers[p]->place_encoded(unique_sequences[s], (*placer_kmers[p])[s]);
+    }
+    return results;
+}
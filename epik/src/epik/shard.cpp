@@ -0,0 +1,599 @@
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <sstream>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <boost/filesystem.hpp>
+#include <rapidjson/document.h>
+#include <rapidjson/prettywriter.h>
+#include <rapidjson/stringbuffer.h>
+#include <i2l/phylo_kmer_db.h>
+#include <i2l/phylo_tree.h>
+#include <i2l/serialization.h>
+#include <epik/shard.h>
+#include <epik/metrics.h>
+
+#if defined(EPIK_OMP)
+#include <omp.h>
+#endif
+
+using namespace epik::shard;
+using epik::impl::partial_scores;
+using key_type = i2l::phylo_kmer::key_type;
+namespace fs = boost::filesystem;
+
+namespace
+{
+    /// The message format between the coordinator and the workers. Values are written in the
+    /// native byte order: workers are expected to run on machines of the same architecture.
+    ///
+    /// Request: uint64 number of sequences, then for every sequence uint32 length and the characters.
+    /// Response: for every sequence of the request, the vectors of partial_scores,
+    /// each as uint32 size and the elements.
+
+    template<typename T>
+    void put(std::string& buffer, const T& value)
+    {
+        buffer.append(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    template<typename T>
+    void put_vector(std::string& buffer, const std::vector<T>& values)
+    {
+        put(buffer, static_cast<uint32_t>(values.size()));
+        buffer.append(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(T));
+    }
+
+    void write_all(int fd, const std::string& buffer)
+    {
+        const char* data = buffer.data();
+        size_t size = buffer.size();
+        while (size > 0)
+        {
+            const auto written = ::write(fd, data, size);
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::runtime_error(std::string("Could not write to a shard worker pipe: ") + std::strerror(errno));
+            }
+            data += written;
+            size -= static_cast<size_t>(written);
+        }
+    }
+
+    /// \brief Reads exactly size bytes. Returns false if the input ended before the first byte
+    bool read_all(int fd, char* data, size_t size)
+    {
+        size_t total = 0;
+        while (total < size)
+        {
+            const auto n = ::read(fd, data + total, size - total);
+            if (n < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                throw std::runtime_error(std::string("Could not read from a shard worker pipe: ") + std::strerror(errno));
+            }
+            if (n == 0)
+            {
+                if (total == 0)
+                {
+                    return false;
+                }
+                throw std::runtime_error("Unexpected end of a shard worker message");
+            }
+            total += static_cast<size_t>(n);
+        }
+        return true;
+    }
+
+    template<typename T>
+    T get(int fd)
+    {
+        T value;
+        if (!read_all(fd, reinterpret_cast<char*>(&value), sizeof(T)))
+        {
+            throw std::runtime_error("Unexpected end of a shard worker message");
+        }
+        return value;
+    }
+
+    template<typename T>
+    std::vector<T> get_vector(int fd)
+    {
+        std::vector<T> values(get<uint32_t>(fd));
+        if (!values.empty() && !read_all(fd, reinterpret_cast<char*>(values.data()), values.size() * sizeof(T)))
+        {
+            throw std::runtime_error("Unexpected end of a shard worker message");
+        }
+        return values;
+    }
+
+    /// \brief Creates a database with the parameters and the tree of another one and no phylo-k-mers
+    i2l::phylo_kmer_db make_empty_copy(const i2l::phylo_kmer_db& db)
+    {
+        i2l::phylo_kmer_db copy(db.kmer_size(), db.omega(), std::string(db.sequence_type()), std::string(db.tree()));
+        copy.tree_index() = db.tree_index();
+        return copy;
+    }
+
+    void set_cloexec(int fd)
+    {
+        ::fcntl(fd, F_SETFD, ::fcntl(fd, F_GETFD) | FD_CLOEXEC);
+    }
+}
+
+manifest epik::shard::read_manifest(const std::string& filename)
+{
+    std::ifstream in(filename);
+    if (!in)
+    {
+        throw std::runtime_error("Could not open file " + filename);
+    }
+    std::stringstream content;
+    content << in.rdbuf();
+
+    rapidjson::Document document;
+    document.Parse(content.str().c_str());
+    if (document.HasParseError() || !document.IsObject() ||
+        !document.HasMember("skeleton") || !document.HasMember("shards") || !document["shards"].IsArray())
+    {
+        throw std::runtime_error("Wrong shard manifest: " + filename);
+    }
+
+    /// Shard files are stored next to the manifest
+    const auto directory = fs::path(filename).parent_path();
+
+    manifest result;
+    result.database = document.HasMember("database") ? document["database"].GetString() : "";
+    result.skeleton = (directory / document["skeleton"].GetString()).string();
+
+    /// Manifests made before mu was recorded were split from whole databases
+    result.mu = document.HasMember("mu") ? static_cast<float>(document["mu"].GetDouble()) : 1.0f;
+
+    const auto& shards = document["shards"];
+    for (rapidjson::SizeType i = 0; i < shards.Size(); ++i)
+    {
+        const auto& shard = shards[i];
+        result.shards.push_back({
+            (directory / shard["file"].GetString()).string(),
+            static_cast<key_type>(shard["first_key"].GetUint64()),
+            static_cast<key_type>(shard["last_key"].GetUint64()),
+            static_cast<size_t>(shard["num_entries"].GetUint64())
+        });
+    }
+
+    if (result.shards.empty())
+    {
+        throw std::runtime_error("No shards in the manifest: " + filename);
+    }
+    return result;
+}
+
+size_t epik::shard::max_shard_entries(const manifest& manifest)
+{
+    size_t max_entries = 0;
+    for (const auto& shard : manifest.shards)
+    {
+        max_entries = std::max(max_entries, shard.num_entries);
+    }
+    return max_entries;
+}
+
+std::string epik::shard::make_shards(const i2l::phylo_kmer_db& db, const std::string& db_filename,
+                                     size_t num_shards, const std::string& output_dir, float mu)
+{
+    /// The number of entries of every key, in the order of keys
+    std::vector<std::pair<key_type, size_t>> keys;
+    size_t total_entries = 0;
+    for (const auto& [key, entries] : db)
+    {
+        keys.emplace_back(key, entries.size());
+        total_entries += entries.size();
+    }
+    std::sort(keys.begin(), keys.end());
+
+    if (num_shards == 0 || keys.size() < num_shards)
+    {
+        throw std::runtime_error("Can not split a database of " + std::to_string(keys.size()) +
+                                 " k-mers into " + std::to_string(num_shards) + " shards");
+    }
+
+    /// Split the key space into ranges of about total_entries / num_shards entries.
+    /// The first and the last ranges are open to cover all possible keys
+    const auto name = fs::path(db_filename).stem().string();
+    manifest result;
+    result.database = db_filename;
+    result.mu = mu;
+
+    size_t accumulated = 0;
+    key_type first_key = 0;
+    size_t shard_entries = 0;
+    for (size_t i = 0; i < keys.size(); ++i)
+    {
+        accumulated += keys[i].second;
+        shard_entries += keys[i].second;
+
+        const auto shard_index = result.shards.size();
+        const auto keys_left = keys.size() - i - 1;
+        const auto shards_left = num_shards - shard_index - 1;
+        const bool is_last = shard_index + 1 == num_shards;
+        if (!is_last && (accumulated * num_shards >= total_entries * (shard_index + 1) || keys_left == shards_left))
+        {
+            result.shards.push_back({ name + ".shard" + std::to_string(shard_index) + ".ipk",
+                                      first_key, keys[i].first, shard_entries });
+            first_key = keys[i].first + 1;
+            shard_entries = 0;
+        }
+    }
+    result.shards.push_back({ name + ".shard" + std::to_string(result.shards.size()) + ".ipk",
+                              first_key, std::numeric_limits<key_type>::max(), shard_entries });
+
+    /// One pass over the database per shard to not keep two copies of it in memory
+    for (const auto& shard : result.shards)
+    {
+        auto shard_db = make_empty_copy(db);
+        for (const auto& [key, entries] : db)
+        {
+            if (shard.first_key <= key && key <= shard.last_key)
+            {
+                for (const auto& [branch, score] : entries)
+                {
+                    shard_db.unsafe_insert(key, { branch, score });
+                }
+            }
+        }
+        i2l::save(shard_db, (fs::path(output_dir) / shard.filename).string());
+    }
+
+    result.skeleton = name + ".skeleton.ipk";
+    i2l::save(make_empty_copy(db), (fs::path(output_dir) / result.skeleton).string());
+
+    rapidjson::StringBuffer buffer;
+    rapidjson::PrettyWriter<rapidjson::StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("database");
+    writer.String(result.database.c_str());
+    writer.Key("skeleton");
+    writer.String(result.skeleton.c_str());
+    writer.Key("mu");
+    writer.Double(result.mu);
+    writer.Key("shards");
+    writer.StartArray();
+    for (const auto& shard : result.shards)
+    {
+        writer.StartObject();
+        writer.Key("file");
+        writer.String(shard.filename.c_str());
+        writer.Key("first_key");
+        writer.Uint64(shard.first_key);
+        writer.Key("last_key");
+        writer.Uint64(shard.last_key);
+        writer.Key("num_entries");
+        writer.Uint64(shard.num_entries);
+        writer.EndObject();
+    }
+    writer.EndArray();
+    writer.EndObject();
+
+    const auto manifest_filename = (fs::path(output_dir) / (name + ".shards.json")).string();
+    std::ofstream out(manifest_filename);
+    if (!out)
+    {
+        throw std::runtime_error("Could not create file " + manifest_filename);
+    }
+    out << buffer.GetString() << std::endl;
+    return manifest_filename;
+}
+
+void epik::shard::run_worker(placer& placer, const shard_info& shard, size_t num_threads, int in_fd, int out_fd)
+{
+    (void)num_threads;
+
+    /// The encoder validates itself against i2l when it is made: once for all batches
+    const auto encoder_ptr = impl::kmer_encoder::make(placer.kmer_size());
+    const auto* encoder = encoder_ptr.get();
+
+    uint64_t num_sequences = 0;
+    while (read_all(in_fd, reinterpret_cast<char*>(&num_sequences), sizeof(num_sequences)))
+    {
+        std::vector<std::string> sequences(num_sequences);
+        for (auto& sequence : sequences)
+        {
+            sequence.resize(get<uint32_t>(in_fd));
+            if (!sequence.empty() && !read_all(in_fd, sequence.data(), sequence.size()))
+            {
+                throw std::runtime_error("Unexpected end of a shard worker message");
+            }
+        }
+
+        std::vector<partial_scores> partials(sequences.size());
+        const auto& first_key = shard.first_key;
+        const auto& last_key = shard.last_key;
+
+#ifdef EPIK_OMP
+    #if __clang__
+    #pragma omp parallel for schedule(dynamic) num_threads(num_threads) \
+        default(none) shared(placer, sequences, partials, first_key, last_key, encoder)
+    #elif defined (__GNUC__) && (__GNUC__ < 9)
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads) default(none) \
+    shared(placer, sequences, partials, encoder)
+    #else
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads) \
+    default(none) shared(placer, sequences, partials, first_key, last_key, encoder)
+    #endif
+#endif
+        for (size_t i = 0; i < sequences.size(); ++i)
+        {
+            const auto kmers = impl::encode_kmers(sequences[i], placer.kmer_size(), {}, encoder);
+            partials[i] = placer.place_partial(kmers, first_key, last_key);
+        }
+
+        std::string buffer;
+        for (const auto& partial : partials)
+        {
+            put_vector(buffer, partial.branches);
+            put_vector(buffer, partial.scores);
+            put_vector(buffer, partial.counts);
+            put_vector(buffer, partial.ambiguous);
+        }
+        write_all(out_fd, buffer);
+    }
+}
+
+worker_process::worker_process(const std::vector<std::string>& args)
+    : _pid{ -1 }
+    , _to_worker{ -1 }
+    , _from_worker{ -1 }
+{
+    int to_worker[2];
+    int from_worker[2];
+    if (::pipe(to_worker) != 0 || ::pipe(from_worker) != 0)
+    {
+        throw std::runtime_error(std::string("Could not create a pipe: ") + std::strerror(errno));
+    }
+
+    /// Workers started later must not inherit the pipes of this one,
+    /// otherwise this worker never sees the end of its input
+    for (const auto fd : { to_worker[0], to_worker[1], from_worker[0], from_worker[1] })
+    {
+        set_cloexec(fd);
+    }
+
+    std::vector<char*> argv;
+    for (const auto& arg : args)
+    {
+        argv.push_back(const_cast<char*>(arg.c_str()));
+    }
+    argv.push_back(nullptr);
+
+    _pid = ::fork();
+    if (_pid < 0)
+    {
+        throw std::runtime_error(std::string("Could not start a shard worker: ") + std::strerror(errno));
+    }
+    if (_pid == 0)
+    {
+        ::dup2(to_worker[0], STDIN_FILENO);
+        ::dup2(from_worker[1], STDOUT_FILENO);
+        ::execvp(argv[0], argv.data());
+        ::_exit(127);
+    }
+
+    ::close(to_worker[0]);
+    ::close(from_worker[1]);
+    _to_worker = to_worker[1];
+    _from_worker = from_worker[0];
+}
+
+worker_process::~worker_process() noexcept
+{
+    ::close(_to_worker);
+    ::close(_from_worker);
+    int status = 0;
+    ::waitpid(_pid, &status, 0);
+}
+
+void worker_process::send(const std::vector<std::string_view>& sequences)
+{
+    std::string buffer;
+    put(buffer, static_cast<uint64_t>(sequences.size()));
+    for (const auto sequence : sequences)
+    {
+        put(buffer, static_cast<uint32_t>(sequence.size()));
+        buffer.append(sequence);
+    }
+    write_all(_to_worker, buffer);
+}
+
+std::vector<partial_scores> worker_process::receive(size_t num_sequences)
+{
+    std::vector<partial_scores> partials(num_sequences);
+    for (auto& partial : partials)
+    {
+        partial.branches = get_vector<i2l::phylo_kmer::branch_type>(_from_worker);
+        partial.scores = get_vector<i2l::phylo_kmer::score_type>(_from_worker);
+        partial.counts = get_vector<uint32_t>(_from_worker);
+        partial.ambiguous = get_vector<partial_scores::ambiguous_posting>(_from_worker);
+    }
+    return partials;
+}
+
+coordinator::coordinator(placer& placer, const manifest& manifest, const std::vector<std::string>& worker_args)
+    : _placer{ placer }
+{
+    /// A worker that exits makes writes fail with EPIPE instead of killing the coordinator
+    std::signal(SIGPIPE, SIG_IGN);
+
+    for (size_t i = 0; i < manifest.shards.size(); ++i)
+    {
+        auto args = worker_args;
+        args.push_back(std::to_string(i));
+        _workers.push_back(std::make_unique<worker_process>(args));
+    }
+}
+
+epik::impl::placed_collection coordinator::place(const std::vector<impl::seq_view>& seqs, size_t num_threads)
+{
+    (void)num_threads;
+    EPIK_TIME_SCOPE(place);
+
+    auto sequence_map = impl::group_by_sequence_content(seqs);
+    const auto unique_sequences = impl::copy_keys(sequence_map);
+
+    EPIK_COUNT(reads, seqs.size());
+    EPIK_COUNT(unique_reads, unique_sequences.size());
+    EPIK_COUNT(duplicates_collapsed, seqs.size() - unique_sequences.size());
+
+    /// Workers read the whole request before answering, so all of them
+    /// can work at the same time while their answers are read one by one
+    for (auto& worker : _workers)
+    {
+        worker->send(unique_sequences);
+    }
+
+    std::vector<std::vector<partial_scores>> partials;
+    for (auto& worker : _workers)
+    {
+        partials.push_back(worker->receive(unique_sequences.size()));
+    }
+
+    std::vector<impl::placed_sequence> placed_seqs(unique_sequences.size());
+    auto& placer = _placer;
+
+#ifdef EPIK_OMP
+    #if __clang__
+    #pragma omp parallel for schedule(dynamic) num_threads(num_threads) \
+        default(none) shared(epik::impl::pow, placer, unique_sequences, partials, placed_seqs)
+    #elif defined (__GNUC__) && (__GNUC__ < 9)
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads) default(none) \
+    shared(epik::impl::pow, placer, partials, placed_seqs)
+    #else
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads) \
+    default(none) shared(epik::impl::pow, placer, unique_sequences, partials, placed_seqs)
+    #endif
+#endif
+    for (size_t i = 0; i < unique_sequences.size(); ++i)
+    {
+        std::vector<const partial_scores*> seq_partials;
+        seq_partials.reserve(partials.size());
+        for (const auto& worker_partials : partials)
+        {
+            seq_partials.push_back(&worker_partials[i]);
+        }
+        placed_seqs[i] = placer.place_merged(unique_sequences[i], seq_partials);
+    }
+    return { std::move(sequence_map), std::move(placed_seqs) };
+}
+
+out_of_core_placer::out_of_core_placer(placer& placer, const i2l::phylo_tree& tree, const manifest& manifest,
+                                       float omega, size_t max_entries)
+    : _placer{ placer }
+    , _tree{ tree }
+    , _manifest{ manifest }
+    , _omega{ omega }
+    , _encoder{ impl::kmer_encoder::make(placer.kmer_size()) }
+{
+    /// A shard is never truncated to fit: the placement would silently miss its phylo-k-mers
+    const auto max_shard = max_shard_entries(manifest);
+    if (max_shard > max_entries)
+    {
+        throw std::runtime_error("The largest shard has " + std::to_string(max_shard) + " phylo-k-mers, more than the " +
+                                 std::to_string(max_entries) + " that fit in memory. Split the database into more shards");
+    }
+}
+
+epik::impl::placed_collection out_of_core_placer::place(const std::vector<impl::seq_view>& seqs, size_t num_threads)
+{
+    EPIK_TIME_SCOPE(place);
+
+    auto sequence_map = impl::group_by_sequence_content(seqs);
+    const auto unique_sequences = impl::copy_keys(sequence_map);
+
+    EPIK_COUNT(reads, seqs.size());
+    EPIK_COUNT(unique_reads, unique_sequences.size());
+    EPIK_COUNT(duplicates_collapsed, seqs.size() - unique_sequences.size());
+
+    auto& placer = _placer;
+    const auto kmer_size = placer.kmer_size();
+    std::vector<impl::encoded_sequence> kmers(unique_sequences.size());
+    std::vector<partial_scores> partials(unique_sequences.size());
+    const auto* encoder = _encoder.get();
+
+#ifdef EPIK_OMP
+    #if __clang__
+    #pragma omp parallel for schedule(static) num_threads(num_threads) \
+        default(none) shared(unique_sequences, kmers, kmer_size, encoder)
+    #elif defined (__GNUC__) && (__GNUC__ < 9)
+#pragma omp parallel for schedule(static) num_threads(num_threads) default(none) shared(kmers, encoder)
+    #else
+#pragma omp parallel for schedule(static) num_threads(num_threads) \
+    default(none) shared(unique_sequences, kmers, kmer_size, encoder)
+    #endif
+#endif
+    for (size_t i = 0; i < unique_sequences.size(); ++i)
+    {
+        kmers[i] = impl::encode_kmers(unique_sequences[i], kmer_size, {}, encoder);
+    }
+
+    for (const auto& shard : _manifest.shards)
+    {
+        /// Only one shard is in memory at a time
+        const auto db = [&]() {
+            EPIK_TIME_SCOPE(load);
+            return i2l::load(shard.filename, 1.0f, _omega, std::numeric_limits<size_t>::max());
+        }();
+        auto shard_placer = epik::placer(db, _tree, 1, 0.0, num_threads);
+        const auto& first_key = shard.first_key;
+        const auto& last_key = shard.last_key;
+
+#ifdef EPIK_OMP
+    #if __clang__
+    #pragma omp parallel for schedule(dynamic) num_threads(num_threads) \
+        default(none) shared(placer, shard_placer, kmers, partials, first_key, last_key)
+    #elif defined (__GNUC__) && (__GNUC__ < 9)
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads) default(none) \
+    shared(placer, shard_placer, kmers, partials)
+    #else
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads) \
+    default(none) shared(placer, shard_placer, kmers, partials, first_key, last_key)
+    #endif
+#endif
+        for (size_t i = 0; i < kmers.size(); ++i)
+        {
+            const auto shard_partial = shard_placer.place_partial(kmers[i], first_key, last_key);
+            partials[i] = placer.merge_partials({ &partials[i], &shard_partial });
+        }
+    }
+
+    std::vector<impl::placed_sequence> placed_seqs(unique_sequences.size());
+
+#ifdef EPIK_OMP
+    #if __clang__
+    #pragma omp parallel for schedule(dynamic) num_threads(num_threads) \
+        default(none) shared(epik::impl::pow, placer, unique_sequences, partials, placed_seqs)
+    #elif defined (__GNUC__) && (__GNUC__ < 9)
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads) default(none) \
+    shared(epik::impl::pow, placer, partials, placed_seqs)
+    #else
+#pragma omp parallel for schedule(dynamic) num_threads(num_threads) \
+    default(none) shared(epik::impl::pow, placer, unique_sequences, partials, placed_seqs)
+    #endif
+#endif
+    for (size_t i = 0; i < unique_sequences.size(); ++i)
+    {
+        placed_seqs[i] = placer.place_merged(unique_sequences[i], { &partials[i] });
+    }
+    return { std::move(sequence_map), std::move(placed_seqs) };
+}
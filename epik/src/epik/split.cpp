@@ -0,0 +1,361 @@
+#include <sstream>
+#include <iomanip>
+#include <limits>
+#include <fstream>
+#include <stdexcept>
+#include <boost/filesystem.hpp>
+#include <rapidjson/document.h>
+#include <rapidjson/writer.h>
+#include <rapidjson/stringbuffer.h>
+#include <epik/split.h>
+
+namespace fs = boost::filesystem;
+using namespace epik::split;
+
+namespace
+{
+    /// The size of the buffers used to scan and copy files
+    constexpr size_t buffer_size = 4 * 1024 * 1024;
+
+    /// \brief Finds the first record of a fasta file that starts at position or after it.
+    /// Returns the size of the file if there is none
+    size_t find_record_start(std::ifstream& in, size_t file_size, size_t position)
+    {
+        if (position == 0 || position >= file_size)
+        {
+            return std::min(position, file_size);
+        }
+
+        /// A record starts with '>' after a newline. Read from the character before position
+        /// to check if a record starts exactly at position
+        in.clear();
+        in.seekg(static_cast<std::streamoff>(position - 1));
+        std::vector<char> buffer(buffer_size);
+        size_t offset = position - 1;
+        char previous = 0;
+        while (in)
+        {
+            in.read(buffer.data(), static_cast<std::streamsize>(buffer.size()));
+            const auto size_read = static_cast<size_t>(in.gcount());
+            for (size_t i = 0; i < size_read; ++i)
+            {
+                if (previous == '\n' && buffer[i] == '>' && offset + i >= position)
+                {
+                    return offset + i;
+                }
+                previous = buffer[i];
+            }
+            offset += size_read;
+        }
+        return file_size;
+    }
+
+    /// \brief Finds the first record of a fastq file that starts at position or after it.
+    /// Returns the size of the file if there is none.
+    /// \details A record takes four lines and a line of qualities may start with '@' (or '>'): a record
+    /// is found from position by its line structure, like io::mapped_fasta::at_record_start does.
+    /// It is a line starting with '@' and, two lines later, a line starting with '+'. Two lines after
+    /// a line of qualities comes a sequence
+    size_t find_fastq_record_start(std::ifstream& in, size_t file_size, size_t position)
+    {
+        if (position == 0 || position >= file_size)
+        {
+            return std::min(position, file_size);
+        }
+
+        /// Skip the rest of the line before position, from the character before it
+        in.clear();
+        in.seekg(static_cast<std::streamoff>(position - 1));
+        std::string line;
+        std::getline(in, line);
+        size_t offset = position + line.size();
+
+        /// The starts and the first characters of the last three lines read
+        std::vector<std::pair<size_t, char>> lines;
+        while (std::getline(in, line))
+        {
+            lines.emplace_back(offset, line.empty() ? '\0' : line.front());
+            offset += line.size() + 1;
+            if (lines.size() == 3)
+            {
+                if (lines[0].second == '@' && lines[2].second == '+')
+                {
+                    return lines[0].first;
+                }
+                lines.erase(lines.begin());
+            }
+        }
+        return file_size;
+    }
+
+    /// \brief If a query file is fastq: its first record starts with '@'
+    bool is_fastq(std::ifstream& in)
+    {
+        in.clear();
+        in.seekg(0);
+        return in.peek() == '@';
+    }
+
+    /// \brief Appends the bytes [begin, end) of a file to a stream
+    void copy_range(const std::string& filename, size_t begin, size_t end, std::ofstream& out)
+    {
+        std::ifstream in(filename, std::ios::binary);
+        if (!in)
+        {
+            throw std::runtime_error("Could not open file " + filename);
+        }
+        in.seekg(static_cast<std::streamoff>(begin));
+
+        std::vector<char> buffer(buffer_size);
+        auto left = end - begin;
+        while (left > 0)
+        {
+            const auto size = std::min(left, buffer.size());
+            in.read(buffer.data(), static_cast<std::streamsize>(size));
+            if (static_cast<size_t>(in.gcount()) != size)
+            {
+                throw std::runtime_error("Could not read file " + filename);
+            }
+            out.write(buffer.data(), static_cast<std::streamsize>(size));
+            left -= size;
+        }
+    }
+
+    /// \brief Writes a file to a temporary one renamed to filename, so that filename is complete or absent
+    template<typename Write>
+    void write_atomically(const std::string& filename, const Write& write)
+    {
+        const auto temp_filename = filename + ".tmp";
+        {
+            std::ofstream out(temp_filename, std::ios::binary);
+            if (!out)
+            {
+                throw std::runtime_error("Could not create file " + temp_filename);
+            }
+            write(out);
+            if (!out)
+            {
+                throw std::runtime_error("Could not write file " + temp_filename);
+            }
+        }
+        fs::rename(temp_filename, filename);
+    }
+}
+
+part epik::split::parse_part(const std::string& value)
+{
+    part result{};
+    char separator = 0;
+    std::istringstream in(value);
+    in >> result.index >> separator >> result.count;
+    if (in.fail() || !in.eof() || separator != '/' || result.count == 0 || result.index >= result.count)
+    {
+        throw std::runtime_error("Wrong query part: " + value + ". Expected I/N with 0 <= I < N");
+    }
+    return result;
+}
+
+std::string epik::split::part_filename(const std::string& filename, const part& part)
+{
+    const auto path = fs::path(filename);
+    const auto name = path.stem().string() + ".part" + std::to_string(part.index) + "of" +
+                      std::to_string(part.count) + path.extension().string();
+    return (path.parent_path() / name).string();
+}
+
+byte_range epik::split::find_range(const std::string& filename, const part& part)
+{
+    std::ifstream in(filename, std::ios::binary);
+    if (!in)
+    {
+        throw std::runtime_error("Could not open file " + filename);
+    }
+    const auto file_size = static_cast<size_t>(fs::file_size(filename));
+
+    /// Every process computes the same boundaries, so the parts do not overlap
+    const auto nominal = [file_size, &part](size_t index) {
+        return static_cast<size_t>(static_cast<double>(file_size) * static_cast<double>(index) /
+                                   static_cast<double>(part.count));
+    };
+    const auto find_start = is_fastq(in) ? find_fastq_record_start : find_record_start;
+    const auto begin = part.index == 0 ? 0 : find_start(in, file_size, nominal(part.index));
+    const auto end = part.index + 1 == part.count ? file_size : find_start(in, file_size, nominal(part.index + 1));
+    return { begin, std::max(begin, end) };
+}
+
+void epik::split::save_fragment_index(const fragment& fragment)
+{
+    rapidjson::StringBuffer buffer;
+    rapidjson::Writer<rapidjson::StringBuffer> writer(buffer);
+    writer.StartObject();
+    writer.Key("file");
+    writer.String(fs::path(fragment.filename).filename().string().c_str());
+    writer.Key("placements_begin");
+    writer.Uint64(fragment.placements_begin);
+    writer.Key("placements_end");
+    writer.Uint64(fragment.placements_end);
+    writer.Key("placements");
+    writer.Uint64(fragment.num_placements);
+    writer.EndObject();
+
+    write_atomically(fragment.filename + ".index", [&buffer](std::ofstream& out) {
+        out << buffer.GetString() << std::endl;
+    });
+}
+
+fragment epik::split::load_fragment_index(const std::string& filename)
+{
+    const auto index_filename = filename + ".index";
+    std::ifstream in(index_filename);
+    if (!in)
+    {
+        throw std::runtime_error("Could not open file " + index_filename + ". Was the part placed completely?");
+    }
+    std::stringstream content;
+    content << in.rdbuf();
+
+    rapidjson::Document document;
+    document.Parse(content.str().c_str());
+    if (document.HasParseError() || !document.IsObject() || !document.HasMember("placements_begin") ||
+        !document.HasMember("placements_end") || !document.HasMember("placements"))
+    {
+        throw std::runtime_error("Wrong fragment index: " + index_filename);
+    }
+
+    fragment result;
+    result.filename = filename;
+    result.placements_begin = static_cast<size_t>(document["placements_begin"].GetUint64());
+    result.placements_end = static_cast<size_t>(document["placements_end"].GetUint64());
+    result.num_placements = static_cast<size_t>(document["placements"].GetUint64());
+    if (!fs::exists(filename) || result.placements_begin > result.placements_end ||
+        fs::file_size(filename) < result.placements_end)
+    {
+        throw std::runtime_error("The fragment " + filename + " does not match its index");
+    }
+    return result;
+}
+
+size_t epik::split::merge_jplace(const std::vector<std::string>& fragments, const std::string& output)
+{
+    if (fragments.empty())
+    {
+        throw std::runtime_error("No fragments to merge");
+    }
+
+    std::vector<fragment> indexes;
+    for (const auto& filename : fragments)
+    {
+        indexes.push_back(load_fragment_index(filename));
+    }
+
+    /// The fragments must be placed on the same tree with the same fields: their headers are the same
+    /// from the tree on. The metadata before differ, as they have the invocation of every part
+    const auto read_header = [](const fragment& fragment) {
+        std::ifstream in(fragment.filename, std::ios::binary);
+        std::string header(fragment.placements_begin, '\0');
+        in.read(header.data(), static_cast<std::streamsize>(header.size()));
+        const auto tree_begin = header.find("\"tree\":");
+        if (!in || tree_begin == std::string::npos)
+        {
+            throw std::runtime_error("Could not read the header of " + fragment.filename);
+        }
+        return header.substr(tree_begin);
+    };
+    const auto header = read_header(indexes.front());
+    for (size_t i = 1; i < indexes.size(); ++i)
+    {
+        if (read_header(indexes[i]) != header)
+        {
+            throw std::runtime_error("The fragment " + indexes[i].filename + " was placed on another tree than " +
+                                     indexes.front().filename);
+        }
+    }
+
+    size_t num_placements = 0;
+    write_atomically(output, [&indexes, &num_placements](std::ofstream& out) {
+        const auto& first = indexes.front();
+        copy_range(first.filename, 0, first.placements_begin, out);
+
+        /// The placements of every fragment are a list of objects: they are joined with commas
+        for (const auto& fragment : indexes)
+        {
+            if (fragment.num_placements == 0)
+            {
+                continue;
+            }
+            if (num_placements > 0)
+            {
+                out << ',';
+            }
+            copy_range(fragment.filename, fragment.placements_begin, fragment.placements_end, out);
+            num_placements += fragment.num_placements;
+        }
+
+        copy_range(first.filename, first.placements_end, static_cast<size_t>(fs::file_size(first.filename)), out);
+    });
+    return num_placements;
+}
+
+void epik::split::merge_mass(const std::vector<std::string>& tables, const std::string& output)
+{
+    std::string header;
+    std::vector<double> mass;
+    std::vector<uint64_t> counts;
+    for (const auto& filename : tables)
+    {
+        std::ifstream in(filename);
+        std::string line;
+        if (!in || !std::getline(in, line))
+        {
+            throw std::runtime_error("Could not read file " + filename);
+        }
+        if (header.empty())
+        {
+            header = line;
+        }
+        else if (line != header)
+        {
+            throw std::runtime_error("The mass table " + filename + " has other columns than " + tables.front());
+        }
+        const auto with_counts = header.find("\treads") != std::string::npos;
+
+        while (std::getline(in, line))
+        {
+            std::istringstream fields(line);
+            size_t branch;
+            double branch_mass;
+            uint64_t count = 0;
+            fields >> branch >> branch_mass;
+            if (with_counts)
+            {
+                fields >> count;
+            }
+            if (fields.fail())
+            {
+                throw std::runtime_error("Wrong line of " + filename + ": \"" + line + "\"");
+            }
+            if (branch >= mass.size())
+            {
+                mass.resize(branch + 1, 0.0);
+                counts.resize(branch + 1, 0);
+            }
+            mass[branch] += branch_mass;
+            counts[branch] += count;
+        }
+    }
+
+    const auto with_counts = header.find("\treads") != std::string::npos;
+    write_atomically(output, [&](std::ofstream& out) {
+        out << std::setprecision(std::numeric_limits<double>::max_digits10);
+        out << header << '\n';
+        for (size_t branch = 0; branch < mass.size(); ++branch)
+        {
+            out << branch << '\t' << mass[branch];
+            if (with_counts)
+            {
+                out << '\t' << counts[branch];
+            }
+            out << '\n';
+        }
+    });
+}
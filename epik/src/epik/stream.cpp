@@ -0,0 +1,167 @@
+#include <algorithm>
+#include <stdexcept>
+#include <utility>
+#include <epik/stream.h>
+
+using namespace epik;
+
+stream_placer::stream_placer(placer& placer, size_t num_workers, size_t queue_capacity, callback on_placed,
+                             const std::vector<std::string>& warm_up)
+    : _placer{ placer }
+    , _on_placed{ std::move(on_placed) }
+    , _queue(std::max(queue_capacity, size_t{1}))
+    , _head{ 0 }
+    , _size{ 0 }
+    , _num_busy{ 0 }
+    , _num_rejected{ 0 }
+    , _stopping{ false }
+{
+    if (num_workers == 0 || num_workers > _placer.max_threads())
+    {
+        throw std::runtime_error("A stream placer needs from 1 to " + std::to_string(_placer.max_threads()) +
+                                 " workers: the number of threads of the placer");
+    }
+
+    /// The first reads grow the scratch of a worker and bring the database into memory:
+    /// they are placed before any read is waiting for it
+    for (size_t thread_id = 0; thread_id < num_workers; ++thread_id)
+    {
+        for (const auto& seq : warm_up)
+        {
+            _placer.place_one(seq, thread_id);
+        }
+    }
+
+    _workers.reserve(num_workers);
+    try
+    {
+        for (size_t thread_id = 0; thread_id < num_workers; ++thread_id)
+        {
+            _workers.emplace_back(&stream_placer::_work, this, thread_id);
+        }
+    }
+    catch (...)
+    {
+        /// The destructor is not called if the constructor throws
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            _stopping = true;
+        }
+        _not_empty.notify_all();
+        for (auto& worker : _workers)
+        {
+            worker.join();
+        }
+        throw;
+    }
+}
+
+stream_placer::~stream_placer() noexcept
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        _stopping = true;
+    }
+    _not_empty.notify_all();
+    for (auto& worker : _workers)
+    {
+        worker.join();
+    }
+}
+
+bool stream_placer::try_submit(std::string header, std::string sequence)
+{
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        if (_size == _queue.size())
+        {
+            ++_num_rejected;
+            return false;
+        }
+        _push(std::move(header), std::move(sequence));
+    }
+    _not_empty.notify_one();
+    return true;
+}
+
+void stream_placer::submit(std::string header, std::string sequence)
+{
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _not_full.wait(lock, [this]() { return _size < _queue.size(); });
+        _push(std::move(header), std::move(sequence));
+    }
+    _not_empty.notify_one();
+}
+
+void stream_placer::wait()
+{
+    std::unique_lock<std::mutex> lock(_mutex);
+    _idle.wait(lock, [this]() { return _size == 0 && _num_busy == 0; });
+    if (_error)
+    {
+        std::rethrow_exception(std::exchange(_error, nullptr));
+    }
+}
+
+size_t stream_placer::num_rejected() const
+{
+    std::lock_guard<std::mutex> lock(_mutex);
+    return _num_rejected;
+}
+
+void stream_placer::_push(std::string header, std::string sequence)
+{
+    auto& slot = _queue[(_head + _size) % _queue.size()];
+    slot.header = std::move(header);
+    slot.sequence = std::move(sequence);
+    slot.submitted = clock::now();
+    ++_size;
+}
+
+void stream_placer::_work(size_t thread_id)
+{
+    while (true)
+    {
+        request request;
+        {
+            std::unique_lock<std::mutex> lock(_mutex);
+            _not_empty.wait(lock, [this]() { return _stopping || _size > 0; });
+            if (_size == 0)
+            {
+                return;
+            }
+            request = std::move(_queue[_head]);
+            _head = (_head + 1) % _queue.size();
+            --_size;
+            ++_num_busy;
+        }
+        _not_full.notify_one();
+
+        try
+        {
+            const auto started = clock::now();
+            auto placed = _placer.place_one(request.sequence, thread_id);
+            const auto finished = clock::now();
+            _on_placed({ std::move(request.header), std::move(placed.placements),
+                         finished - request.submitted, started - request.submitted });
+        }
+        catch (...)
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_error)
+            {
+                _error = std::current_exception();
+            }
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            --_num_busy;
+            if (_size == 0 && _num_busy == 0)
+            {
+                _idle.notify_all();
+            }
+        }
+    }
+}
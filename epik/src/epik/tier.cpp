@@ -0,0 +1,105 @@
+#include <cmath>
+#include <algorithm>
+#include <stdexcept>
+#include <i2l/phylo_kmer_db.h>
+#include <epik/tier.h>
+
+using namespace epik::impl;
+
+dense_tier::dense_tier(const i2l::phylo_kmer_db& db, size_t num_branches, double min_fraction, size_t max_bytes)
+    : _num_branches{ num_branches }
+    , _stride{ (num_branches + 63) / 64 * 64 }
+    , _min_postings{ 0 }
+    , _num_postings{ 0 }
+{
+    if (min_fraction <= 0.0 || min_fraction > 1.0)
+    {
+        throw std::runtime_error("The dense tier fraction has to be a value in (0, 1]");
+    }
+    _min_postings = std::max(size_t{1}, static_cast<size_t>(std::ceil(min_fraction * static_cast<double>(num_branches))));
+
+    std::vector<std::pair<size_t, i2l::phylo_kmer::key_type>> lists;
+    for (const auto& [key, entries] : db)
+    {
+        if ((size_t)entries.size() >= _min_postings)
+        {
+            lists.emplace_back(entries.size(), key);
+        }
+    }
+
+    /// The longest lists gain the most from rows: keep as many of them as fit in max_bytes
+    const auto row_bytes = _stride * (sizeof(score_type) + sizeof(uint8_t));
+    const auto tier_bytes = [&](size_t num_rows) {
+        return num_rows * row_bytes + ordinal_index::memory_bytes(num_rows);
+    };
+    if (tier_bytes(lists.size()) > max_bytes)
+    {
+        std::sort(lists.begin(), lists.end(), [](const auto& lhs, const auto& rhs) {
+            return lhs.first > rhs.first || (lhs.first == rhs.first && lhs.second < rhs.second);
+        });
+        size_t num_rows = 0;
+        while (num_rows < lists.size() && tier_bytes(num_rows + 1) <= max_bytes)
+        {
+            ++num_rows;
+        }
+        lists.resize(num_rows);
+
+        /// Shorter lists are not looked up
+        _min_postings = lists.empty() ? std::numeric_limits<size_t>::max() : lists.back().first;
+    }
+
+    std::vector<i2l::phylo_kmer::key_type> keys;
+    keys.reserve(lists.size());
+    for (const auto& [size, key] : lists)
+    {
+        (void)size;
+        keys.push_back(key);
+    }
+
+    _scores.resize(keys.size() * _stride, 0.0f);
+    _hits.resize(keys.size() * _stride, 0);
+
+    for (size_t row = 0; row < keys.size(); ++row)
+    {
+        const auto entries = *db.search(keys[row]);
+
+        auto* scores = _scores.data() + row * _stride;
+        auto* hits = _hits.data() + row * _stride;
+        for (const auto& [branch, score] : entries)
+        {
+            if (branch >= num_branches)
+            {
+                throw std::runtime_error("Wrong branch in the database: " + std::to_string(branch));
+            }
+            scores[branch] += score;
+            ++hits[branch];
+        }
+        _num_postings += entries.size();
+    }
+    _rows = ordinal_index(keys);
+}
+
+size_t dense_tier::num_branches() const noexcept
+{
+    return _num_branches;
+}
+
+size_t dense_tier::num_kmers() const noexcept
+{
+    return _rows.size();
+}
+
+size_t dense_tier::num_postings() const noexcept
+{
+    return _num_postings;
+}
+
+size_t dense_tier::min_postings() const noexcept
+{
+    return _min_postings;
+}
+
+size_t dense_tier::memory_bytes() const noexcept
+{
+    return _scores.size() * sizeof(score_type) + _hits.size() * sizeof(uint8_t) + _rows.memory_bytes();
+}
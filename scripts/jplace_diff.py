@@ -124,7 +124,7 @@ class JplaceParser:
 
             # check if .jplace has at least one placement
             assert "placements" in content,  "Error while parsing " \
-                f'{self.input_file}: input file must have the "placements" section.'
+                f'{self._input_file}: input file must have the "placements" section.'
 
             for placement_dict in content["placements"]:
                 placed_seq = PlacedSeq.from_dict(placement_dict, fields)
@@ -172,26 +172,23 @@ def check_first(result1, result2) -> int:
     return placement1.edge_num == placement2.edge_num
 
 
-@click.command()
-@click.argument('jplace1', type=click.Path(exists=True))
-@click.argument('jplace2', type=click.Path(exists=True))
-@click.option('--only-best', is_flag=True, default=False)
-def jplace_diff(jplace1: str, jplace2: str, only_first: bool) -> None:
-    # parse the input files
-    parser1 = JplaceParser(jplace1)
-    parser1.parse()
-
-    parser2 = JplaceParser(jplace2)
-    parser2.parse()
-
-    num_seqs = len(parser1.placements)
+def compare_placements(parser1: JplaceParser, parser2: JplaceParser,
+                       only_best: bool = False, epsilon: float = EPSILON, verbose: bool = True) -> int:
+    """
+    Compares the placements of two parsed .jplace files. Returns the number
+    of sequences of the first file placed equally in the second one.
+    """
     num_matches = 0
-    for name, result1 in tqdm.tqdm(parser1.placements.items()):
+    placements = parser1.placements.items()
+    for name, result1 in (tqdm.tqdm(placements) if verbose else placements):
 
         # get the placements for the same sequence from the second file
+        if name not in parser2.placements:
+            conditional_print(f'\n{name}: not in the second file', verbose)
+            continue
         result2 = parser2.placements[name]
 
-        if only_first:
+        if only_best:
             num_matches += check_first(result1, result2)
         else:
             records1 = dict((rec.edge_num, rec.likelihood) for rec in result1.placements)
@@ -203,7 +200,7 @@ def jplace_diff(jplace1: str, jplace2: str, only_first: bool) -> None:
             scores1 = set(rec.likelihood for rec in result1.placements)
             scores2 = set(rec.likelihood for rec in result2.placements)
 
-            if set_almost_equals(scores1, scores2):
+            if set_almost_equals(scores1, scores2, epsilon):
                 num_matches += 1
                 continue
 
@@ -211,22 +208,39 @@ def jplace_diff(jplace1: str, jplace2: str, only_first: bool) -> None:
             found_mismatch = False
             for edge in edge_union:
                 if edge not in records1:
-                    conditional_print(f'\n{name}:', not found_mismatch)
+                    conditional_print(f'\n{name}:', verbose and not found_mismatch)
                     found_mismatch = True
-                    print(f"\t{edge} is not in the first file")
+                    conditional_print(f"\t{edge} is not in the first file", verbose)
                 elif edge not in records2:
-                    conditional_print(f'\n{name}:', not found_mismatch)
+                    conditional_print(f'\n{name}:', verbose and not found_mismatch)
                     found_mismatch = True
-                    print(f"\t{edge} is not in the second file")
+                    conditional_print(f"\t{edge} is not in the second file", verbose)
                 # if found in both, check likelihoods
-                elif abs(10**records1[edge] - 10**records2[edge]) > EPSILON:
-                    conditional_print(f'\n{name}:', not found_mismatch)
+                elif abs(10**records1[edge] - 10**records2[edge]) > epsilon:
+                    conditional_print(f'\n{name}:', verbose and not found_mismatch)
                     found_mismatch = True
-                    print(f'\t[{edge}] {records1[edge]} != {records2[edge]}')
+                    conditional_print(f'\t[{edge}] {records1[edge]} != {records2[edge]}', verbose)
 
             if not found_mismatch:
                 num_matches += 1
 
+    return num_matches
+
+
+@click.command()
+@click.argument('jplace1', type=click.Path(exists=True))
+@click.argument('jplace2', type=click.Path(exists=True))
+@click.option('--only-best', is_flag=True, default=False)
+def jplace_diff(jplace1: str, jplace2: str, only_best: bool) -> None:
+    # parse the input files
+    parser1 = JplaceParser(jplace1)
+    parser1.parse()
+
+    parser2 = JplaceParser(jplace2)
+    parser2.parse()
+
+    num_seqs = len(parser1.placements)
+    num_matches = compare_placements(parser1, parser2, only_best)
     print(f"\n{num_matches}/{num_seqs} placements match.")
 
 
@@ -0,0 +1,313 @@
+#!/usr/bin/env python3
+
+# This script is an end-to-end throughput and correctness check of EPIK builds.
+# It generates synthetic datasets with epik-bench and epik-bench-aa, places them
+# with epik-dna and epik-aa at several thread counts and compares the runs to a stored baseline:
+#   - placements must match the reference .jplace files of the baseline (see jplace_diff.py);
+#   - throughput (seq/s) must not drop by more than a given proportion;
+#   - placing the queries in parts with --query-part and merging them with --merge-parts
+#     must give the placements of the unsplit run.
+# Placement speed, database loading time and peak RSS are recorded for every run.
+#
+#   Usage:
+#       python regress.py update --bin-dir BUILD/epik --workdir WORKDIR --baseline BASELINE_DIR
+#       python regress.py check --bin-dir BUILD/epik --workdir WORKDIR --baseline BASELINE_DIR
+#
+# See DEFAULT_DATASETS for the format of a --datasets configuration file.
+
+__license__ = "MIT"
+
+import os
+import sys
+import json
+import time
+import click
+import subprocess
+from pathlib import Path
+from typing import Dict, List
+
+sys.path.append(os.path.dirname(os.path.realpath(__file__)))
+import jplace_diff as jd
+
+
+# Parameters are passed to epik-bench as --name value
+DEFAULT_DATASETS = {
+    "dna-small": {
+        "states": "nucl",
+        "leaves": 500, "k": 10, "kmers": 500000,
+        "posting-dist": "geometric", "posting-mean": 20,
+        "queries": 20000, "read-length": 150, "ambiguity": 0.005, "hit-rate": 0.5,
+    },
+    "dna-large-tree": {
+        "states": "nucl",
+        "leaves": 5000, "k": 10, "kmers": 2000000,
+        "posting-dist": "geometric", "posting-mean": 50,
+        "queries": 20000, "read-length": 150, "ambiguity": 0.005, "hit-rate": 0.5,
+    },
+    "aa-small": {
+        "states": "amino",
+        "leaves": 500, "k": 5, "kmers": 500000,
+        "posting-dist": "geometric", "posting-mean": 20,
+        "queries": 10000, "read-length": 100, "ambiguity": 0.005, "hit-rate": 0.5,
+    },
+    "aa-real-size": {
+        "states": "amino",
+        "leaves": 2000, "k": 6, "kmers": 4000000,
+        "posting-dist": "geometric", "posting-mean": 30,
+        "queries": 50000, "read-length": 300, "ambiguity": 0.02, "hit-rate": 0.3,
+    },
+}
+
+
+def binary(bin_dir: str, states: str, bench: bool = False) -> str:
+    if bench:
+        name = "epik-bench" if states == "nucl" else "epik-bench-aa"
+    else:
+        name = "epik-dna" if states == "nucl" else "epik-aa"
+    return os.path.join(bin_dir, name)
+
+
+def generate(name: str, dataset: Dict, bin_dir: str, workdir: str):
+    """
+    Generates the database and queries of a dataset if not done yet.
+    Datasets are deterministic for the same parameters and seed.
+    """
+    data_dir = os.path.join(workdir, "data")
+    Path(data_dir).mkdir(parents=True, exist_ok=True)
+    db_file = os.path.join(data_dir, f"{name}.ipk")
+    query_file = os.path.join(data_dir, f"{name}.fasta")
+
+    if not (os.path.isfile(db_file) and os.path.isfile(query_file)):
+        command = [binary(bin_dir, dataset["states"], bench=True),
+                   "--write-db", db_file, "--write-queries", query_file]
+        for param, value in dataset.items():
+            if param != "states":
+                command.extend([f"--{param}", str(value)])
+        print(" ".join(command))
+        if subprocess.call(command) != 0:
+            raise Exception(f"Error! Could not generate dataset {name}")
+    return db_file, query_file
+
+
+def run_epik(epik_bin: str, db_file: str, query_file: str, threads: int, output_dir: str) -> Dict:
+    """
+    Places the queries once. Returns the speed, loading time, peak RSS and the output file.
+    """
+    Path(output_dir).mkdir(parents=True, exist_ok=True)
+    metrics_file = os.path.join(output_dir, "metrics.json")
+    command = [epik_bin, "-d", db_file, "-q", query_file, "-j", str(threads),
+               "-o", output_dir, "--metrics", metrics_file]
+
+    with open(os.path.join(output_dir, "epik.log"), "w") as log:
+        begin = time.perf_counter()
+        process = subprocess.Popen(command, stdout=log, stderr=subprocess.STDOUT)
+        _, status, usage = os.wait4(process.pid, 0)
+        wall_time = time.perf_counter() - begin
+
+    if os.waitstatus_to_exitcode(status) != 0:
+        raise Exception(f"Error! {' '.join(command)} failed, see {log.name}")
+
+    with open(metrics_file) as f:
+        metrics = json.load(f)["total"]
+
+    # ru_maxrss is in kilobytes on Linux and in bytes on macOS
+    peak_rss = usage.ru_maxrss * (1 if sys.platform == "darwin" else 1024)
+    reads = metrics["counters"]["reads"]
+    place_time = metrics["stages"]["place"]["seconds"]
+    return {
+        "threads": threads,
+        "reads": reads,
+        "wall_s": wall_time,
+        "load_s": metrics["stages"]["load"]["seconds"],
+        "place_s": place_time,
+        "seq_per_s": reads / place_time if place_time > 0 else 0.0,
+        "peak_rss_mb": peak_rss / 1024 / 1024,
+        "jplace": os.path.join(output_dir, f"placements_{os.path.basename(query_file)}.jplace"),
+    }
+
+
+def run_parts(epik_bin: str, db_file: str, query_file: str, threads: int, parts: int, output_dir: str) -> str:
+    """
+    Places the queries in parts with --query-part I/N one after another and merges them
+    with --merge-parts N. Returns the merged output file.
+    """
+    Path(output_dir).mkdir(parents=True, exist_ok=True)
+    base = [epik_bin, "-d", db_file, "-q", query_file, "-o", output_dir]
+    commands = [base + ["-j", str(threads), "--query-part", f"{i}/{parts}"] for i in range(parts)]
+    commands.append(base + ["--merge-parts", str(parts)])
+
+    with open(os.path.join(output_dir, "epik.log"), "w") as log:
+        for command in commands:
+            if subprocess.call(command, stdout=log, stderr=subprocess.STDOUT) != 0:
+                raise Exception(f"Error! {' '.join(command)} failed, see {log.name}")
+
+    return os.path.join(output_dir, f"placements_{os.path.basename(query_file)}.jplace")
+
+
+def run_dataset(name: str, dataset: Dict, bin_dir: str, workdir: str,
+                threads: List[int], repeats: int) -> List[Dict]:
+    """
+    Runs a dataset at every thread count. The fastest of the repeats is kept.
+    """
+    db_file, query_file = generate(name, dataset, bin_dir, workdir)
+    epik_bin = binary(bin_dir, dataset["states"])
+
+    results = []
+    for num_threads in threads:
+        runs = []
+        for i in range(repeats):
+            output_dir = os.path.join(workdir, "runs", name, f"j{num_threads}", f"r{i}")
+            runs.append(run_epik(epik_bin, db_file, query_file, num_threads, output_dir))
+        best = max(runs, key=lambda run: run["seq_per_s"])
+        best["peak_rss_mb"] = max(run["peak_rss_mb"] for run in runs)
+        print(f"{name} -j{num_threads}: {best['seq_per_s']:.0f} seq/s, load {best['load_s']:.2f} s, "
+              f"peak RSS {best['peak_rss_mb']:.0f} MB")
+        results.append(best)
+    return results
+
+
+def compare_jplace(jplace: str, reference: str, epsilon: float) -> float:
+    """
+    Returns the proportion of sequences placed as in the reference file.
+    """
+    parser = jd.JplaceParser(jplace)
+    parser.parse()
+    reference_parser = jd.JplaceParser(reference)
+    reference_parser.parse()
+
+    num_seqs = len(reference_parser.placements)
+    num_matches = jd.compare_placements(reference_parser, parser, epsilon=epsilon, verbose=False)
+    return num_matches / num_seqs if num_seqs > 0 else 1.0
+
+
+def load_datasets(datasets_file: str) -> Dict:
+    if datasets_file:
+        with open(datasets_file) as f:
+            return json.load(f)
+    return DEFAULT_DATASETS
+
+
+def parse_threads(threads: str) -> List[int]:
+    return [int(t) for t in threads.split(",")]
+
+
+@click.group()
+def regress():
+    """
+    End-to-end throughput regression harness for EPIK.
+    """
+    pass
+
+
+common_options = [
+    click.option('--bin-dir', required=True,
+                 type=click.Path(dir_okay=True, file_okay=False, exists=True),
+                 help="Directory with epik-dna, epik-aa, epik-bench and epik-bench-aa."),
+    click.option('--workdir', required=True,
+                 type=click.Path(dir_okay=True, file_okay=False),
+                 help="Directory for generated datasets and placement runs."),
+    click.option('--baseline', required=True,
+                 type=click.Path(dir_okay=True, file_okay=False),
+                 help="Directory with the baseline: throughput and reference .jplace files."),
+    click.option('--datasets', type=click.Path(dir_okay=False, file_okay=True, exists=True),
+                 default=None, help="JSON file with dataset parameters."),
+    click.option('--threads', type=str, default="1,2,4", show_default=True,
+                 help="Comma-separated thread counts."),
+    click.option('--repeats', type=int, default=3, show_default=True,
+                 help="Runs per thread count, the fastest one is kept."),
+]
+
+
+def add_options(options):
+    def decorator(f):
+        for option in reversed(options):
+            f = option(f)
+        return f
+    return decorator
+
+
+@regress.command()
+@add_options(common_options)
+def update(bin_dir, workdir, baseline, datasets, threads, repeats):
+    """
+    Runs all datasets and stores the results as the new baseline.
+    """
+    Path(baseline).mkdir(parents=True, exist_ok=True)
+    summary = {}
+    for name, dataset in load_datasets(datasets).items():
+        results = run_dataset(name, dataset, bin_dir, workdir, parse_threads(threads), repeats)
+        reference = os.path.join(baseline, f"{name}.jplace")
+        os.replace(results[0]["jplace"], reference)
+        summary[name] = dict((str(r["threads"]), r) for r in results)
+        for r in results:
+            del r["jplace"]
+
+    with open(os.path.join(baseline, "baseline.json"), "w") as f:
+        json.dump(summary, f, indent=4)
+    print(f"Baseline written to {baseline}")
+
+
+@regress.command()
+@add_options(common_options)
+@click.option('--max-slowdown', type=float, default=0.1, show_default=True,
+              help="Maximum allowed throughput drop relative to the baseline.")
+@click.option('--min-match', type=float, default=1.0, show_default=True,
+              help="Minimum proportion of sequences placed as in the baseline.")
+@click.option('--epsilon', type=float, default=jd.EPSILON, show_default=True,
+              help="Tolerance for likelihood comparison.")
+@click.option('--parts', type=int, default=4, show_default=True,
+              help="Place every dataset in this many parts with --query-part, merge them and compare "
+                   "to the unsplit run. 0 disables the check.")
+def check(bin_dir, workdir, baseline, datasets, threads, repeats, max_slowdown, min_match, epsilon, parts):
+    """
+    Runs all datasets and compares them to the baseline. Exits with 1 on regression.
+    """
+    with open(os.path.join(baseline, "baseline.json")) as f:
+        baseline_results = json.load(f)
+
+    failures = []
+    report = {}
+    for name, dataset in load_datasets(datasets).items():
+        if name not in baseline_results:
+            failures.append(f"{name}: no baseline")
+            continue
+
+        results = run_dataset(name, dataset, bin_dir, workdir, parse_threads(threads), repeats)
+        reference = os.path.join(baseline, f"{name}.jplace")
+        for r in results:
+            r["match"] = compare_jplace(r["jplace"], reference, epsilon)
+            if r["match"] < min_match:
+                failures.append(f"{name} -j{r['threads']}: {r['match']:.4%} of placements match the baseline")
+
+            expected = baseline_results[name].get(str(r["threads"]))
+            if expected:
+                r["baseline_seq_per_s"] = expected["seq_per_s"]
+                if r["seq_per_s"] < expected["seq_per_s"] * (1.0 - max_slowdown):
+                    failures.append(f"{name} -j{r['threads']}: {r['seq_per_s']:.0f} seq/s, "
+                                    f"baseline {expected['seq_per_s']:.0f} seq/s")
+
+        # The merged parts must reproduce the unsplit run exactly, whatever the baseline says
+        if parts > 0:
+            db_file, query_file = generate(name, dataset, bin_dir, workdir)
+            output_dir = os.path.join(workdir, "runs", name, f"parts{parts}")
+            merged = run_parts(binary(bin_dir, dataset["states"]), db_file, query_file,
+                               results[0]["threads"], parts, output_dir)
+            match = compare_jplace(merged, results[0]["jplace"], epsilon)
+            print(f"{name} in {parts} parts: {match:.4%} of placements match the unsplit run")
+            if match < 1.0:
+                failures.append(f"{name} in {parts} parts: {match:.4%} of placements match the unsplit run")
+        report[name] = results
+
+    with open(os.path.join(workdir, "results.json"), "w") as f:
+        json.dump(report, f, indent=4)
+
+    if failures:
+        print("\nFAILED:")
+        for failure in failures:
+            print(f"\t{failure}")
+        sys.exit(1)
+    print("\nAll checks passed.")
+
+
+if __name__ == "__main__":
+    regress()